@@ -1,65 +1,67 @@
 /**
  * by Cal Woodruff <cwoodruf@sfu.ca>
  *
- * Defines the arp table for the router using a very simple hash table based on ip.
+ * Defines the arp table for the router.
  *
- * Since we are never going to make a router that will 
- * work with an infinite lan we can use a reasonably sized array
- * to store the lan information.
- *
- * In our case we use an array slightly bigger than the provisioned 
- * number of ip addresses for the subnet we are on. See LAN_SIZE in sr_arp.h.
- *
- * Accessing the array is done via a hash function. Given that the first 3
- * octets of the ip addresses on the lan are all the same this can be simply:
- *
- * ip & LAN_SIZE - 1
- *
- * for a lan of LAN_SIZE
+ * Entries are allocated one at a time and found through the robin hood
+ * hash table in sr_arp_table.c, which grows with the LAN. Entries are not
+ * moved when the table grows so pointers to them stay good until the entry
+ * is deleted.
  */
+#define SR_LOG_MODULE SR_LOG_ARP
+
 #include <assert.h>
 #include <arpa/inet.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include "sr_rt.h"
 #include "sr_router.h"
 #include "sr_protocol.h"
 /*---------------------------------------------------------------------------*/
 /**
- * check if we need to spam the LAN with arp broadcasts
+ * timer callback: an entry has outlived ARP_TTL or a request went unanswered
+ * for ARP_CHECK_EVERY seconds, so spam the LAN with another arp request
  */
-void sr_arp_check_refresh(struct sr_instance* sr) 
+void sr_arp_timeout(struct sr_instance* sr, struct sr_timer* t) 
 {
-        time_t t, age, refreshage;
-        int i;
-        struct sr_arp* entry;
+        struct sr_fwd* fwd = sr_fwd(sr);
+        struct sr_arp* entry = sr_timer_entry(t, struct sr_arp, timer);
+        struct in_addr n;
 
         assert(sr);
+        if (!entry->ip) return;
 
-        refreshage = time(&t) - sr->arp_lastrefresh;
-        /* printf("ARP: running check refresh refresh age: %lds\n", refreshage); */
-
-        if (refreshage >= ARP_CHECK_EVERY) {
-                for (i=0; i<LAN_SIZE; i++) {
-                        entry = &sr->arp_table[i];
-                        if (!entry->ip) continue;
-
-                        age = t - entry->created;
-                        printf("ARP: Entry %i aged %lds (ttl %ds)\n", i, age, ARP_TTL);
-                        if (age <= ARP_TTL) continue;
-
-                        printf("ARP: Updating ");
-                        sr_arp_print_entry(i,*entry);
+        /* a neighbour each ARP_TTL: thousands of them on a big LAN */
+        n.s_addr = entry->ip;
+        sr_log_limit(SR_LOG_ARP, SR_LOG_DEBUG, "ARP: Updating ip %s tries %d age %lums\n", inet_ntoa(n),
+                entry->tries, (unsigned long) (sr_timer_now(&fwd->timers) - entry->created));
 
-                        entry->tries++;
-                        sr_arp_refresh(
-                                sr,
-                                entry->ip,
-                                entry->iface->name
-                        );
+        /* cap tries so a long dead neighbour can't wrap back to 0 */
+        if (entry->tries < ARP_MAX_TRIES) {
+                /* just given up: keep what led up to it */
+                if (++entry->tries == ARP_MAX_TRIES) sr_flight_trigger(&sr->flight, SR_FLIGHT_ARP);
+        }
+        sr_cache_flush(&fwd->cache);
+        /* given up on the neighbour: waiting packets become unreachables */
+        if (entry->tries >= ARP_MAX_TRIES) {
+                sr_router_flush(sr, entry);
+                /* at ARP_MAX_TRIES and ARP_TTL seconds or more since it was last
+                   answered (or, never answered, first asked about): forget it */
+                if (sr_timer_now(&fwd->timers) - entry->created >= ARP_TTL * 1000) {
+                        sr_arp_delete(sr, entry);
+                        return;
                 }
-                sr->arp_lastrefresh = t;
         }
+        sr_arp_refresh(
+                sr,
+                entry->ip,
+                entry->iface->name
+        );
+        /* keep asking until we get an answer */
+        sr_timer_add(&fwd->timers, &entry->timer, sr_arp_timeout,
+                sr_timer_now(&fwd->timers) + ARP_CHECK_EVERY * 1000);
 }
 /*---------------------------------------------------------------------------*/
 /** 
@@ -70,6 +72,7 @@ void sr_arp_check_refresh(struct sr_instance* sr)
 */
 struct sr_arp* sr_arp_set(struct sr_instance* sr, uint32_t ip, unsigned char* mac, struct sr_if* iface) 
 {
+        struct sr_fwd* fwd = sr_fwd(sr);
         struct sr_arp* entry = sr_arp_get(sr, ip);
         struct in_addr n;
 
@@ -77,8 +80,9 @@ struct sr_arp* sr_arp_set(struct sr_instance* sr, uint32_t ip, unsigned char* ma
         assert(ip);
         assert(mac);
         assert(iface);
+        if (!entry) return NULL;
 
-        memset(entry, 0, sizeof(struct sr_arp));
+        /* keep any packets queued on the entry: the caller flushes them */
         entry->ip = ip;
 	if (mac) {
 		memcpy(
@@ -89,43 +93,142 @@ struct sr_arp* sr_arp_set(struct sr_instance* sr, uint32_t ip, unsigned char* ma
 	}
         entry->iface = iface;
         entry->tries = 0;
-        time(&entry->created);
+        entry->created = sr_timer_now(&fwd->timers);
+        sr_timer_add(&fwd->timers, &entry->timer, sr_arp_timeout, entry->created + ARP_TTL * 1000);
+        sr_arp_set_template(entry);
+        sr_cache_flush(&fwd->cache);
 
+        /* the whole table is printed by "arp" on the control fifo */
         n.s_addr = entry->ip;
-        printf("ARP: Created entry %s\n",inet_ntoa(n));
-        sr_arp_print_table(sr);
+        Debug("ARP: Created entry %s\n",inet_ntoa(n));
 
         return entry;
 }
 /*---------------------------------------------------------------------------*/
+/**
+    build the ethernet header used for every ip packet forwarded to this 
+    neighbour so sr_router_send can rewrite the header in one copy
+*/
+void sr_arp_set_template(struct sr_arp* entry) 
+{
+        struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)entry->eth;
+
+        assert(entry);
+        assert(entry->iface);
+
+        memcpy(e_hdr->ether_dhost, entry->mac, ETHER_ADDR_LEN);
+        memcpy(e_hdr->ether_shost, entry->iface->addr, ETHER_ADDR_LEN);
+        e_hdr->ether_type = htons(ETHERTYPE_IP);
+}
+/*---------------------------------------------------------------------------*/
+/**
+    rebuild the ethernet templates of resolved entries 
+    needed when the mac address of one of our interfaces changes
+*/
+void sr_arp_update_templates(struct sr_instance* sr) 
+{
+        struct sr_fwd* fwd = sr_fwd(sr);
+        struct sr_arp* entry;
+        uint32_t i;
+
+        assert(sr);
+        for (i=0; i<=fwd->arp_table.mask; i++) {
+                if (!fwd->arp_table.slots[i].dist) continue;
+                entry = fwd->arp_table.slots[i].entry;
+                if (entry->ip && entry->iface) sr_arp_set_template(entry);
+        }
+}
+/*---------------------------------------------------------------------------*/
+/**
+    set up an empty arp table
+*/
+void sr_arp_init(struct sr_instance* sr) 
+{
+        struct timespec ts;
+
+        assert(sr);
+        /* a per run seed keeps outsiders from picking colliding addresses */
+        clock_gettime(CLOCK_REALTIME, &ts);
+        if (!sr_arp_table_init(&sr_fwd(sr)->arp_table, ts.tv_nsec ^ (getpid() << 16))) {
+                fprintf(stderr, "ARP: out of memory for arp table\n");
+                exit(1);
+        }
+}
+/*---------------------------------------------------------------------------*/
+/**
+    arp lookup without side effects
+    @return the arp entry for ip or NULL if we have never heard of it
+*/
+struct sr_arp* sr_arp_find(struct sr_instance* sr, uint32_t ip) 
+{
+        assert(sr);
+        return sr_arp_table_find(&sr_fwd(sr)->arp_table, ip);
+}
+/*---------------------------------------------------------------------------*/
 /**
     arp getter
 
-    use a hash to index into the arp table based on ip address
-    if there is a collision just go to the next available space 
-    most likely this will never happen with the test setup
+    find the entry for ip in the hash table 
+    if there isn't one make a blank entry (ip 0) for the caller to fill in
 
-    @return the arp entry
+    @return the arp entry or NULL if we are out of memory
 */
 struct sr_arp* sr_arp_get(struct sr_instance* sr, uint32_t ip) 
 {
-        int index,i;
         struct sr_arp* entry;
 
         assert(sr);
         assert(ip);
 
-        index = ARP_MASK & ntohl(ip);
-        entry = &sr->arp_table[index];
-        if (entry->ip == ip || entry->ip == 0) return entry;
+        entry = sr_arp_table_find(&sr_fwd(sr)->arp_table, ip);
+        if (entry) return entry;
+
+        entry = calloc(1, sizeof(struct sr_arp));
+        if (!entry) return NULL;
+        if (!sr_arp_table_insert(&sr_fwd(sr)->arp_table, ip, entry)) {
+                free(entry);
+                return NULL;
+        }
+        return entry;
+}
+/*---------------------------------------------------------------------------*/
+/**
+    take an entry out of the table and free it
+    any packets still queued on it must have been flushed already
+*/
+void sr_arp_delete(struct sr_instance* sr, struct sr_arp* entry) 
+{
+        struct sr_fwd* fwd = sr_fwd(sr);
+        struct in_addr n;
+
+        assert(sr);
+        assert(entry);
+        assert(!entry->pending);
+
+        n.s_addr = entry->ip;
+        Debug("ARP: Deleting entry %s\n", inet_ntoa(n));
+        sr_timer_cancel(&fwd->timers, &entry->timer);
+        sr_arp_table_delete(&fwd->arp_table, entry->ip);
+        sr_cache_flush(&fwd->cache);
+        free(entry);
+}
+/*---------------------------------------------------------------------------*/
+/**
+    free every entry and the table itself
+*/
+void sr_arp_clear(struct sr_instance* sr) 
+{
+        struct sr_fwd* fwd = sr_fwd(sr);
+        uint32_t i;
 
-        /* scan the whole table for an empty entry our the entry for this ip */
-        for (i=index+1; i != index; i++) {
-                if (i >= LAN_SIZE) i = 0;
-                entry = &sr->arp_table[i];
-                if (entry->ip == ip || entry->ip == 0) return entry;
+        assert(sr);
+        for (i=0; i<=fwd->arp_table.mask; i++) {
+                if (!fwd->arp_table.slots[i].dist) continue;
+                sr_timer_cancel(&fwd->timers, &fwd->arp_table.slots[i].entry->timer);
+                free(fwd->arp_table.slots[i].entry);
         }
-        return NULL;
+        sr_arp_table_free(&fwd->arp_table);
+        sr_cache_flush(&fwd->cache);
 }
 /*---------------------------------------------------------------------------*/
 /**
@@ -133,6 +236,7 @@ struct sr_arp* sr_arp_get(struct sr_instance* sr, uint32_t ip)
 */
 void sr_arp_refresh(struct sr_instance* sr, uint32_t ip, char* interface) 
 {
+        struct sr_fwd* fwd = sr_fwd(sr);
         int i;
 	struct in_addr s_ip;
 	struct sr_arp *entry;
@@ -151,7 +255,7 @@ void sr_arp_refresh(struct sr_instance* sr, uint32_t ip, char* interface)
         assert(ip);
         assert(interface);
         if (!iface) {
-                printf("ARP: sr_arp_refresh: interface %s not found: aborting\n", interface); 
+                sr_log(SR_LOG_ARP, SR_LOG_WARN, "ARP: sr_arp_refresh: interface %s not found: aborting\n", interface);
                 return;
         }
 
@@ -171,7 +275,7 @@ void sr_arp_refresh(struct sr_instance* sr, uint32_t ip, char* interface)
         a_hdr->ar_op = htons(ARP_REQUEST);
         memcpy(a_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
         a_hdr->ar_sip = iface->ip;
-        memcpy(a_hdr->ar_tha, sr_arp_get(sr,ip), ETHER_ADDR_LEN);
+        /* target hardware address is left zeroed: that's what we're asking for */
         a_hdr->ar_tip = ip;
 
 	/* make an arp entry to avoid sending loads of requests */
@@ -180,7 +284,12 @@ void sr_arp_refresh(struct sr_instance* sr, uint32_t ip, char* interface)
 		s_ip.s_addr = ip;
 		Debug("ARP: creating dummy entry for %s\n", inet_ntoa(s_ip));
 		entry->ip = ip;
+		entry->iface = iface;
 		entry->tries++;
+		entry->created = sr_timer_now(&fwd->timers);
+		sr_timer_add(&fwd->timers, &entry->timer, sr_arp_timeout, 
+			entry->created + ARP_CHECK_EVERY * 1000);
+		sr_cache_flush(&fwd->cache);
 	}
 
         /* send the packet and cross our fingers! */
@@ -210,7 +319,7 @@ void sr_arp_request_response(
 
         /* check to see if the packet is for us */
         if (iface->ip != a_hdr->ar_tip) {
-                printf("ARP: Arp request is not for us - aborting!");
+                Trace("ARP: Arp request is not for us - aborting!\n");
                 return;
         }
 
@@ -258,14 +367,19 @@ void sr_arp_scan(struct sr_instance* sr)
 } 
 /*---------------------------------------------------------------------------*/
 /** 
- * scan the arp array and print any entries you find
+ * scan the arp hash table and print any entries you find
  */
 void sr_arp_print_table(struct sr_instance* sr) 
 {
-        int i;
-        printf("ARP: Current arp entries out of a total of %d:\n",LAN_SIZE);
-        for (i=0; i<LAN_SIZE; i++) {
-                if (sr->arp_table[i].ip) sr_arp_print_entry(i,sr->arp_table[i]);
+        struct sr_fwd* fwd = sr_fwd(sr);
+        uint32_t i;
+        printf("ARP: Current arp entries: %u in %u slots (grown %lu times):\n",
+                fwd->arp_table.count, fwd->arp_table.mask + 1, fwd->arp_table.grows);
+        for (i=0; i<=fwd->arp_table.mask; i++) {
+                if (!fwd->arp_table.slots[i].dist) continue;
+                if (!fwd->arp_table.slots[i].entry->ip) continue;
+                printf("ARP: slot %u ", i);
+                sr_arp_print_entry(sr, fwd->arp_table.slots[i].entry);
         }
         printf("ARP: End of arp table.\n");
 }
@@ -273,16 +387,14 @@ void sr_arp_print_table(struct sr_instance* sr)
 /**
  * format and print an arp entry
  */
-void sr_arp_print_entry(int i, struct sr_arp entry) 
+void sr_arp_print_entry(struct sr_instance* sr, struct sr_arp* entry) 
 {
-        time_t t, age;
         struct in_addr pr_ip;
 
-        pr_ip.s_addr = entry.ip;
-        age = time(&t) - entry.created;
+        pr_ip.s_addr = entry->ip;
 
-        printf("ARP: table entry %d ip %s mac ", i, inet_ntoa(pr_ip));
-        DebugMAC(entry.mac);
-        printf(" tries %d age %lds created %s ", entry.tries, age, ctime(&entry.created));
+        printf("ip %s mac %02x:%02x:%02x:%02x:%02x:%02x", inet_ntoa(pr_ip), entry->mac[0], entry->mac[1],
+                entry->mac[2], entry->mac[3], entry->mac[4], entry->mac[5]);
+        printf(" tries %d age %lums\n", entry->tries, 
+                (unsigned long) (sr_timer_now(&sr_fwd(sr)->timers) - entry->created));
 }
-
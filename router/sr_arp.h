@@ -8,6 +8,10 @@
 #include <stdint.h>
 #include "sr_protocol.h"
 #include "sr_if.h"
+#include "sr_timer.h"
+#include "sr_arp_table.h"
+
+struct sr_buffer_item;
 
 /** data structure for an arp entry */
 struct sr_arp {
@@ -15,18 +19,24 @@ struct sr_arp {
         unsigned char mac[ETHER_ADDR_LEN];
         struct sr_if* iface;
         uint8_t tries;
-        time_t created;
+        uint64_t created; /** ms on the monotonic clock: see sr_timer.h */
+        struct sr_timer timer; /** next refresh or retry of this entry */
+        /** packets buffered until this neighbour answers: see sr_buffer.c */
+        struct sr_buffer_item* pending;
+        struct sr_buffer_item* pending_end;
+        /** ready made ethernet header (dhost, shost, type) for forwarding to this neighbour */
+        uint8_t eth[16] __attribute__ ((aligned (16)));
 };
 
-/** mask for arp table hash function */
+/** mask for the interface lookup tables in sr_if.c */
 #define ARP_MASK 0xFF
 
-/** instead of having clunky linked lists use an array that is probably large enough for most LANs */
+/** size of the interface lookup tables: the arp table itself grows as needed (sr_arp_table.h) */
 #define LAN_SIZE (ARP_MASK+1)
 
 /** seconds arp entry is allowed to be valid: normally this is 10 min to 4 hours depending on system */
 #define ARP_TTL 600
-/** seconds to wait between arp checks */
+/** seconds to wait between arp retries */
 #define ARP_CHECK_EVERY 10
 /** maximum number of tries to make before treating link as dead */
 #define ARP_MAX_TRIES 5
@@ -0,0 +1,134 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * robin hood hash table for the arp cache: see sr_arp_table.h
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sr_arp_table.h"
+
+/** put ip into a table known to have a free slot and not to hold ip already */
+static void sr_arp_table_place(struct sr_arp_table* t, uint32_t ip, struct sr_arp* entry)
+{
+        struct sr_arp_slot cur, tmp;
+        uint32_t i;
+
+        cur.ip = ip;
+        cur.dist = 1;
+        cur.entry = entry;
+        i = sr_arp_hash(t, ip) & t->mask;
+        for (;;) {
+                if (t->slots[i].dist == 0) {
+                        t->slots[i] = cur;
+                        t->count++;
+                        return;
+                }
+                /* take from the rich: whoever is nearer home moves on */
+                if (t->slots[i].dist < cur.dist) {
+                        tmp = t->slots[i];
+                        t->slots[i] = cur;
+                        cur = tmp;
+                }
+                cur.dist++;
+                i = (i + 1) & t->mask;
+        }
+}
+
+/** move everything into a table of nslots slots */
+static int sr_arp_table_resize(struct sr_arp_table* t, uint32_t nslots)
+{
+        struct sr_arp_slot* old = t->slots;
+        uint32_t i, oldslots = t->mask + 1;
+
+        t->slots = calloc(nslots, sizeof(struct sr_arp_slot));
+        if (!t->slots) {
+                t->slots = old;
+                return 0;
+        }
+        t->mask = nslots - 1;
+        t->count = 0;
+        for (i = 0; i < oldslots; i++) {
+                if (old[i].dist) sr_arp_table_place(t, old[i].ip, old[i].entry);
+        }
+        free(old);
+        t->grows++;
+        return 1;
+}
+
+/**
+ * start with an empty table of SR_ARP_MIN_SLOTS
+ * @return 1 on success, 0 if out of memory
+ */
+int sr_arp_table_init(struct sr_arp_table* t, uint32_t seed)
+{
+        assert(t);
+        memset(t, 0, sizeof(struct sr_arp_table));
+        t->slots = calloc(SR_ARP_MIN_SLOTS, sizeof(struct sr_arp_slot));
+        if (!t->slots) return 0;
+        t->mask = SR_ARP_MIN_SLOTS - 1;
+        t->seed = seed;
+        return 1;
+}
+
+/** release the slots: the entries belong to the caller */
+void sr_arp_table_free(struct sr_arp_table* t)
+{
+        assert(t);
+        free(t->slots);
+        t->slots = 0;
+        t->mask = 0;
+        t->count = 0;
+}
+
+/**
+ * add an entry for ip, which must not be in the table yet
+ * @return 1 on success, 0 if the table needed to grow and could not
+ */
+int sr_arp_table_insert(struct sr_arp_table* t, uint32_t ip, struct sr_arp* entry)
+{
+        assert(t);
+        assert(entry);
+        assert(!sr_arp_table_find(t, ip));
+
+        if ((uint64_t)(t->count + 1) * SR_ARP_LOAD_DEN > (uint64_t)(t->mask + 1) * SR_ARP_LOAD_NUM) {
+                if (!sr_arp_table_resize(t, (t->mask + 1) * 2)) {
+                        /* go on while there is room: probes always need an empty slot to stop at */
+                        if (t->count + 1 >= t->mask + 1) return 0;
+                }
+        }
+        sr_arp_table_place(t, ip, entry);
+        return 1;
+}
+
+/**
+ * take ip out of the table, shifting the rest of its probe run back a slot
+ * @return the entry that was stored for ip or 0 if there was none
+ */
+struct sr_arp* sr_arp_table_delete(struct sr_arp_table* t, uint32_t ip)
+{
+        struct sr_arp* entry;
+        uint32_t i, next, dist;
+
+        assert(t);
+        i = sr_arp_hash(t, ip) & t->mask;
+        for (dist = 1; ; dist++) {
+                if (t->slots[i].dist < dist) return 0;
+                if (t->slots[i].ip == ip) break;
+                i = (i + 1) & t->mask;
+        }
+        entry = t->slots[i].entry;
+
+        /* backward shift until an empty slot or one already at home */
+        next = (i + 1) & t->mask;
+        while (t->slots[next].dist > 1) {
+                t->slots[i] = t->slots[next];
+                t->slots[i].dist--;
+                i = next;
+                next = (next + 1) & t->mask;
+        }
+        memset(&t->slots[i], 0, sizeof(struct sr_arp_slot));
+        t->count--;
+        return entry;
+}
@@ -0,0 +1,80 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * hash table behind the arp cache: ip address -> struct sr_arp
+ *
+ * open addressing with robin hood probing: an entry that has been pushed
+ * further from its home slot than the one sitting in a slot takes the slot
+ * over. probe lengths stay short even when the table is nearly full and a
+ * lookup can stop as soon as it passes a slot holding an entry that is
+ * closer to home than the key would be. deletion shifts the following
+ * entries back one slot so there are no tombstones to clean up.
+ *
+ * the table doubles once it is SR_ARP_LOAD_NUM / SR_ARP_LOAD_DEN full.
+ * only pointers live in the table: the arp entries themselves never move
+ * so the destination cache and buffered packets can hold on to them.
+ */
+#ifndef SR_ARP_TABLE_H
+#define SR_ARP_TABLE_H
+
+#include <stdint.h>
+
+/** smallest table: must be a power of 2 */
+#define SR_ARP_MIN_SLOTS 64
+/** grow when more than 7/8 of the slots are in use */
+#define SR_ARP_LOAD_NUM 7
+#define SR_ARP_LOAD_DEN 8
+
+struct sr_arp;
+
+struct sr_arp_slot
+{
+        uint32_t ip;            /** copy of entry->ip so probes stay in the table */
+        uint32_t dist;          /** 1 + distance from the home slot, 0 if empty */
+        struct sr_arp* entry;
+};
+
+struct sr_arp_table
+{
+        struct sr_arp_slot* slots;
+        uint32_t mask;          /** number of slots - 1 */
+        uint32_t count;         /** slots in use */
+        uint32_t seed;          /** mixed into the hash so slots can't be chosen from outside */
+        unsigned long grows;
+};
+
+/** murmur3 finaliser: every bit of the address affects the home slot */
+static inline uint32_t sr_arp_hash(const struct sr_arp_table* t, uint32_t ip)
+{
+        uint32_t h = ip ^ t->seed;
+
+        h ^= h >> 16;
+        h *= 0x85EBCA6B;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35;
+        h ^= h >> 16;
+        return h;
+}
+
+/** @return the entry stored for ip (network byte order) or 0 */
+static inline struct sr_arp* sr_arp_table_find(const struct sr_arp_table* t, uint32_t ip)
+{
+        uint32_t i, dist;
+        const struct sr_arp_slot* s;
+
+        i = sr_arp_hash(t, ip) & t->mask;
+        for (dist = 1; ; dist++) {
+                s = &t->slots[i];
+                /* an empty slot or one closer to home ends the probe */
+                if (s->dist < dist) return 0;
+                if (s->ip == ip) return s->entry;
+                i = (i + 1) & t->mask;
+        }
+}
+
+int sr_arp_table_init(struct sr_arp_table* t, uint32_t seed);
+void sr_arp_table_free(struct sr_arp_table* t);
+int sr_arp_table_insert(struct sr_arp_table* t, uint32_t ip, struct sr_arp* entry);
+struct sr_arp* sr_arp_table_delete(struct sr_arp_table* t, uint32_t ip);
+
+#endif
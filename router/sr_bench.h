@@ -0,0 +1,19 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * what the sr_bench_*.c programs have in common
+ */
+#ifndef SR_BENCH_H
+#define SR_BENCH_H
+
+#include <time.h>
+
+/** seconds on the monotonic clock */
+static inline double bench_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif
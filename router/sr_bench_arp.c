@@ -0,0 +1,181 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * benchmark for the arp hash table in sr_arp_table.c
+ *
+ * fills tables with 256, 4k and 64k neighbours, both as one contiguous
+ * block of addresses (a /24, /20 or /16 LAN) and as random addresses, and
+ * times inserts (including growth), lookups of present and absent
+ * addresses and deletes. every lookup is checked and half the table is
+ * deleted and checked again so a wrong answer aborts the run. the old
+ * 256 entry array indexed by the last octet is timed for comparison where
+ * it can hold the neighbours at all.
+ *
+ * usage: sr_bench_arp [neighbours ...]  (default 256 4096 65536)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_arp_table.h"
+#include "sr_bench.h"
+
+/** lookups timed per table */
+#define BENCH_LOOKUPS 4000000
+
+static uint64_t bench_seed = 0xD1B54A32D192ED03ULL;
+
+static uint32_t bench_rand(void)
+{
+        bench_seed ^= bench_seed << 13;
+        bench_seed ^= bench_seed >> 7;
+        bench_seed ^= bench_seed << 17;
+        return (uint32_t)(bench_seed >> 16);
+}
+
+static void bench_fail(const char* what, uint32_t ip)
+{
+        struct in_addr a;
+
+        a.s_addr = ip;
+        fprintf(stderr, "BENCH: %s for %s\n", what, inet_ntoa(a));
+        exit(1);
+}
+
+/** the old table: last octet then a scan for the ip or a free slot */
+static struct sr_arp* bench_old_get(struct sr_arp* table, uint32_t ip)
+{
+        int index, i;
+
+        index = ARP_MASK & ntohl(ip);
+        if (table[index].ip == ip || table[index].ip == 0) return &table[index];
+        for (i = index + 1; i != index; i++) {
+                if (i >= LAN_SIZE) i = 0;
+                if (table[i].ip == ip || table[i].ip == 0) return &table[i];
+        }
+        return NULL;
+}
+
+static void bench_old(uint32_t* ips, int n)
+{
+        static struct sr_arp table[LAN_SIZE];
+        volatile uintptr_t sink = 0;
+        double t0, insert, lookup;
+        struct sr_arp* e;
+        long i;
+
+        memset(table, 0, sizeof(table));
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                e = bench_old_get(table, ips[i]);
+                if (!e) bench_fail("old table full", ips[i]);
+                e->ip = ips[i];
+        }
+        insert = (bench_now() - t0) / n;
+        t0 = bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; i++) sink += (uintptr_t) bench_old_get(table, ips[i % n]);
+        lookup = (bench_now() - t0) / BENCH_LOOKUPS;
+        printf("  %-8s insert %7.1f ns  hit %6.1f ns\n", "old", insert * 1e9, lookup * 1e9);
+}
+
+static void bench_hash(uint32_t* ips, uint32_t* absent, int n)
+{
+        struct sr_arp_table t;
+        struct sr_arp* entries = calloc(n, sizeof(struct sr_arp));
+        volatile uintptr_t sink = 0;
+        double t0, insert, hit, miss, del;
+        unsigned long probes = 0, maxprobe = 0;
+        uint32_t j;
+        long i;
+
+        if (!entries || !sr_arp_table_init(&t, bench_rand())) bench_fail("out of memory", 0);
+
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                entries[i].ip = ips[i];
+                if (!sr_arp_table_insert(&t, ips[i], &entries[i])) bench_fail("insert failed", ips[i]);
+        }
+        insert = (bench_now() - t0) / n;
+
+        for (i = 0; i < n; i++) {
+                if (sr_arp_table_find(&t, ips[i]) != &entries[i]) bench_fail("lookup missed", ips[i]);
+                if (sr_arp_table_find(&t, absent[i])) bench_fail("lookup found absent address", absent[i]);
+        }
+        for (j = 0; j <= t.mask; j++) {
+                if (!t.slots[j].dist) continue;
+                probes += t.slots[j].dist;
+                if (t.slots[j].dist > maxprobe) maxprobe = t.slots[j].dist;
+        }
+
+        t0 = bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; i++) sink += (uintptr_t) sr_arp_table_find(&t, ips[i % n]);
+        hit = (bench_now() - t0) / BENCH_LOOKUPS;
+        t0 = bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; i++) sink += (uintptr_t) sr_arp_table_find(&t, absent[i % n]);
+        miss = (bench_now() - t0) / BENCH_LOOKUPS;
+
+        /* delete every other neighbour and make sure the rest are still there */
+        t0 = bench_now();
+        for (i = 0; i < n; i += 2) {
+                if (sr_arp_table_delete(&t, ips[i]) != &entries[i]) bench_fail("delete missed", ips[i]);
+        }
+        del = (bench_now() - t0) / ((n + 1) / 2);
+        for (i = 0; i < n; i++) {
+                if (sr_arp_table_find(&t, ips[i]) != (i & 1 ? &entries[i] : NULL)) {
+                        bench_fail("lookup wrong after delete", ips[i]);
+                }
+        }
+        if (t.count != n / 2) bench_fail("count wrong after delete", 0);
+
+        printf("  %-8s insert %7.1f ns  hit %6.1f ns  miss %6.1f ns  delete %6.1f ns"
+               "  (%u slots, mean probe %.2f, max %lu)\n",
+                "hash", insert * 1e9, hit * 1e9, miss * 1e9, del * 1e9,
+                t.mask + 1, (double) probes / n, maxprobe);
+
+        sr_arp_table_free(&t);
+        free(entries);
+}
+
+/** 2n distinct addresses: a contiguous block from 10.0.0.1 or scattered over 10/8 */
+static void bench_addrs(uint32_t* ips, uint32_t* absent, int n, int random)
+{
+        uint32_t start = bench_rand();
+        long i;
+
+        for (i = 0; i < 2 * n; i++) {
+                /* an odd multiplier is a permutation of the low 24 bits: no repeats */
+                ips[i] = htonl(random ? 0x0A000000 | ((start + i * 0x9E3779U) & 0x00FFFFFF)
+                                      : 0x0A000001 + i);
+        }
+        /* the second half are neighbours we never heard from */
+        for (i = 0; i < n; i++) absent[i] = ips[n + i];
+}
+
+int main(int argc, char** argv)
+{
+        int defaults[] = { 256, 4096, 65536 };
+        int nsizes = argc > 1 ? argc - 1 : 3;
+        int k, n, random;
+        uint32_t* ips,* absent;
+
+        for (k = 0; k < nsizes; k++) {
+                n = argc > 1 ? atoi(argv[k + 1]) : defaults[k];
+                ips = malloc(2 * n * sizeof(uint32_t));
+                absent = malloc(n * sizeof(uint32_t));
+                if (!ips || !absent) bench_fail("out of memory", 0);
+                for (random = 0; random < 2; random++) {
+                        printf("%d neighbours, %s addresses:\n", n, random ? "random" : "contiguous");
+                        bench_addrs(ips, absent, n, random);
+                        if (n <= LAN_SIZE) bench_old(ips, n);
+                        else printf("  %-8s cannot hold %d neighbours\n", "old", n);
+                        bench_hash(ips, absent, n);
+                }
+                free(ips);
+                free(absent);
+        }
+        printf("all lookups and deletes checked\n");
+        return 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * checks and times the ip checksum code in sr_ip.c
+ *
+ * random ip headers (with and without options) are forwarded through
+ * sr_ip_passthru and the incrementally adjusted checksum is compared with
+ * a full recompute of the header. every kernel in sr_cksum.c is then
+ * compared with a byte at a time reference on random buffers of every
+ * length and alignment up to 9 KB and timed on 64 B to 9 KB buffers.
+ * any difference aborts the run.
+ *
+ * usage: sr_bench_cksum [headers]  (default 10000000)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_cksum.h"
+#include "sr_bench.h"
+
+/** largest buffer summed: a jumbo frame */
+#define BENCH_MAXLEN 9216
+
+static uint64_t bench_seed = 0x2545F4914F6CDD1DULL;
+
+static uint32_t bench_rand(void)
+{
+        bench_seed ^= bench_seed << 13;
+        bench_seed ^= bench_seed >> 7;
+        bench_seed ^= bench_seed << 17;
+        return (uint32_t)(bench_seed >> 16);
+}
+
+/** fill pkt with a random but valid ip header of hl 32 bit words */
+static void bench_header(struct sr_ip_packet* pkt, int hl)
+{
+        uint8_t* b = (uint8_t*)&pkt->ip;
+        int i;
+
+        for (i = 0; i < hl * 4; i++) b[i] = bench_rand();
+        pkt->ip.ip_v = 4;
+        pkt->ip.ip_hl = hl;
+        pkt->ip.ip_ttl = 2 + bench_rand() % 254;
+        pkt->ip.ip_sum = 0;
+        pkt->ip.ip_sum = sr_ip_checksum((uint16_t*) b, hl * 4);
+}
+
+/** the old forwarding path: decrement then sum the whole header again */
+static void bench_full(struct sr_ip_packet* pkt)
+{
+        uint8_t* b = (uint8_t*)&pkt->ip;
+
+        pkt->ip.ip_ttl--;
+        pkt->ip.ip_sum = 0;
+        pkt->ip.ip_sum = sr_ip_checksum((uint16_t*) b, pkt->ip.ip_hl * 4);
+}
+
+static void bench_check(long n)
+{
+        static struct sr_ip_packet pkt, ref;
+        uint8_t* b = (uint8_t*)&pkt.ip;
+        struct sr_ip_handle h;
+        long i;
+
+        memset(&h, 0, sizeof(h));
+        h.pkt = &pkt;
+        for (i = 0; i < n; i++) {
+                bench_header(&pkt, 5 + bench_rand() % 11);
+                memcpy(&ref, &pkt, sizeof(struct sr_ethernet_hdr) + 60);
+                sr_ip_passthru(&h);
+                bench_full(&ref);
+                if (pkt.ip.ip_sum != ref.ip.ip_sum ||
+                    sr_ip_checksum((uint16_t*) b, pkt.ip.ip_hl * 4) != 0) {
+                        fprintf(stderr, "BENCH: header %ld (hl %d ttl %d): adjusted %04X full %04X\n",
+                                i, pkt.ip.ip_hl, pkt.ip.ip_ttl,
+                                ntohs(pkt.ip.ip_sum), ntohs(ref.ip.ip_sum));
+                        exit(1);
+                }
+        }
+        printf("checked %ld random headers (hl 5-15): adjusted checksum matches full recompute\n", n);
+}
+
+static void bench_time(int hl, long n)
+{
+        static struct sr_ip_packet pkt;
+        struct sr_ip_handle h;
+        double t0, full, adjust;
+        long i;
+
+        memset(&h, 0, sizeof(h));
+        h.pkt = &pkt;
+
+        bench_header(&pkt, hl);
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                bench_full(&pkt);
+                pkt.ip.ip_ttl += 2;
+        }
+        full = (bench_now() - t0) / n;
+
+        bench_header(&pkt, hl);
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                sr_ip_passthru(&h);
+                pkt.ip.ip_ttl += 2;
+        }
+        adjust = (bench_now() - t0) / n;
+
+        printf("hl %2d: full recompute %6.2f ns, incremental %6.2f ns per packet\n",
+                hl, full * 1e9, adjust * 1e9);
+}
+
+/** RFC 1071 the slow way: big endian words, then back to memory order */
+static uint16_t bench_reference(const uint8_t* p, size_t len)
+{
+        uint32_t sum = 0;
+        size_t i;
+
+        for (i = 0; i + 1 < len; i += 2) sum += (p[i] << 8) | p[i+1];
+        if (len & 1) sum += p[len-1] << 8;
+        while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+        return htons((uint16_t) sum);
+}
+
+static void bench_kernels_check(void)
+{
+        static uint8_t buf[BENCH_MAXLEN + 64];
+        const struct sr_cksum_impl* k;
+        size_t len, off, i;
+        uint16_t want;
+
+        for (k = sr_cksum_impls(); k->name; k++) {
+                if (!k->supported()) {
+                        printf("%-8s not supported by this cpu\n", k->name);
+                        continue;
+                }
+                for (len = 0; len <= BENCH_MAXLEN; len += (len < 512 ? 1 : 61)) {
+                        off = bench_rand() % 64;
+                        for (i = 0; i < len; i++) buf[off+i] = bench_rand();
+                        /* all ones data pushes the carries as far as they go */
+                        if (len % 7 == 0) memset(buf + off, 0xFF, len);
+                        want = bench_reference(buf + off, len);
+                        if (k->sum(buf + off, len) != want) {
+                                fprintf(stderr, "BENCH: %s: length %zu offset %zu: got %04X want %04X\n",
+                                        k->name, len, off, k->sum(buf + off, len), want);
+                                exit(1);
+                        }
+                }
+                printf("%-8s matches the reference for lengths 0-%d at random alignments\n",
+                        k->name, BENCH_MAXLEN);
+        }
+}
+
+static void bench_kernels_time(void)
+{
+        static uint8_t buf[BENCH_MAXLEN];
+        size_t sizes[] = { 64, 128, 256, 576, 1500, 4096, 9000 };
+        const struct sr_cksum_impl* k;
+        volatile uint16_t sink = 0;
+        double t0, t;
+        long i, n;
+        int j;
+
+        for (i = 0; i < BENCH_MAXLEN; i++) buf[i] = bench_rand();
+
+        printf("%-8s", "bytes");
+        for (j = 0; j < sizeof(sizes)/sizeof(sizes[0]); j++) printf(" %9zu", sizes[j]);
+        printf("   (ns per buffer)\n");
+        for (k = sr_cksum_impls(); k->name; k++) {
+                if (!k->supported()) continue;
+                printf("%-8s", k->name);
+                for (j = 0; j < sizeof(sizes)/sizeof(sizes[0]); j++) {
+                        n = 200000000 / sizes[j];
+                        t0 = bench_now();
+                        for (i = 0; i < n; i++) sink += k->sum(buf + (i & 1), sizes[j]);
+                        t = (bench_now() - t0) / n;
+                        printf(" %9.1f", t * 1e9);
+                }
+                printf("\n");
+        }
+        /* make sure dispatch has run so the name is meaningful */
+        sink = sr_cksum_sum(buf, 64);
+        printf("sr_cksum_sum dispatches to %s on this cpu\n", sr_cksum_name());
+}
+
+int main(int argc, char** argv)
+{
+        long n = argc > 1 ? atol(argv[1]) : 10000000;
+
+        bench_check(n);
+        bench_time(5, n);
+        bench_time(15, n);
+        bench_kernels_check();
+        bench_kernels_time();
+        return 0;
+}
@@ -0,0 +1,212 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * checks and times the flight recorder in sr_flight.c
+ *
+ * frames of random sizes, some longer than the snap length, go into a
+ * small ring and it is dumped now and then, so the ring has gone round
+ * more or less and records end at every sort of place. each dump is read
+ * back: it has to be the newest frames in order, ending with the last one
+ * logged, cut at the snap length, and as many as the ring said it held.
+ * the file can never be bigger than the ring and its header.
+ *
+ * the same again spread over BENCH_RINGS rings as the pipe backend's
+ * threads use them, one far quieter than the rest: a dump merges them and
+ * still has to be an unbroken run of frames ending with the last one.
+ *
+ * then minimum size frames are recorded into a full ring, taking the time
+ * once per BENCH_BATCH frames as the event loop does, which is what the
+ * recorder costs the router per packet, and the ring is dumped once.
+ *
+ * usage: sr_bench_flight [packets] [prefix]  (default 10000000, /tmp/sr_bench)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include "sr_dumper.h"
+#include "sr_flight.h"
+#include "sr_bench.h"
+
+/** frames in the checked stream */
+#define BENCH_CHECKED 200000
+#define BENCH_RING "256k"
+#define BENCH_SNAPLEN 1024      /** as PACKET_DUMP_SIZE */
+#define BENCH_FRAME 60
+#define BENCH_MAXFRAME 1514
+/** frames handled per event loop wakeup in the timed run */
+#define BENCH_BATCH 32
+/** rings in the merged check: the last one gets few frames */
+#define BENCH_RINGS 4
+
+static uint32_t bench_next(uint64_t* seed)
+{
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        return (uint32_t) *seed;
+}
+
+/** frame i: its number up front so a record can be matched to it */
+static int bench_frame(uint8_t* f, uint32_t i)
+{
+        uint64_t seed = 88172645463325252ull ^ i;
+        int len, j;
+
+        bench_next(&seed);
+        len = BENCH_FRAME + bench_next(&seed) % (BENCH_MAXFRAME - BENCH_FRAME + 1);
+        memcpy(f, &i, sizeof(i));
+        for (j = sizeof(i); j < len; j++) f[j] = (uint8_t) (i * 31 + j);
+        return len;
+}
+
+/** the dump of a ring that frames 0..last went through */
+static void bench_read(struct sr_flight* fl, const char* fn, uint32_t last)
+{
+        static uint8_t f[BENCH_MAXFRAME], r[BENCH_MAXFRAME];
+        struct pcap_file_header fh;
+        struct pcap_sf_pkthdr h;
+        unsigned long records = 0;
+        uint32_t want = 0;
+        struct stat st;
+        FILE* fp;
+        int len;
+
+        if (!(fp = fopen(fn, "r")) || fread(&fh, sizeof(fh), 1, fp) != 1 ||
+            fh.magic != TCPDUMP_MAGIC || fh.snaplen != BENCH_SNAPLEN) {
+                fprintf(stderr, "FAIL: %s: bad file header\n", fn);
+                exit(1);
+        }
+        while (fread(&h, sizeof(h), 1, fp) == 1) {
+                if (h.caplen > BENCH_SNAPLEN || h.caplen < sizeof(want) || fread(r, h.caplen, 1, fp) != 1) {
+                        fprintf(stderr, "FAIL: %s: record %lu is cut short\n", fn, records);
+                        exit(1);
+                }
+                if (records && memcmp(&want, r, sizeof(want))) {
+                        fprintf(stderr, "FAIL: %s: record %lu is not frame %u\n", fn, records, want);
+                        exit(1);
+                }
+                memcpy(&want, r, sizeof(want));
+                len = bench_frame(f, want);
+                if (h.len != (uint32_t) len || h.caplen != (uint32_t) (len < BENCH_SNAPLEN ? len : BENCH_SNAPLEN) ||
+                    memcmp(f, r, h.caplen)) {
+                        fprintf(stderr, "FAIL: %s: frame %u recorded wrong\n", fn, want);
+                        exit(1);
+                }
+                want++;
+                records++;
+        }
+        fstat(fileno(fp), &st);
+        fclose(fp);
+        /* several rings: what a busy one has lost is left out of the others too */
+        if (want != last + 1 || (fl->nrings == 1 && records != fl->rings[0].count) ||
+            (size_t) st.st_size > sizeof(fh) + fl->size) {
+                fprintf(stderr, "FAIL: %s: %lu records ending at %u for %lu held ending at %u, %ld bytes\n",
+                        fn, records, want - 1, fl->rings[0].count, last, (long) st.st_size);
+                exit(1);
+        }
+        unlink(fn);
+}
+
+static void bench_check(const char* prefix)
+{
+        static struct sr_flight fl;
+        static uint8_t f[BENCH_MAXFRAME];
+        char spec[128], fn[160];
+        uint64_t seed = 2463534242ull;
+        unsigned long dumps = 0;
+        uint32_t i;
+        int len;
+
+        snprintf(spec, sizeof(spec), "%s,0,%s", BENCH_RING, prefix);
+        if (sr_flight_open(&fl, spec, BENCH_SNAPLEN, 1)) exit(1);
+        for (i = 0; i < BENCH_CHECKED; i++) {
+                len = bench_frame(f, i);
+                sr_flight_log(&fl, 0, f, len, 0);
+                if (i < 8 || bench_next(&seed) % 8000 == 0) {
+                        if (sr_flight_dump(&fl, SR_FLIGHT_CONTROL)) exit(1);
+                        snprintf(fn, sizeof(fn), "%s.%lu.control.pcap", prefix, fl.dumps);
+                        bench_read(&fl, fn, i);
+                        dumps++;
+                }
+        }
+        printf("checked %lu dumps, %lu of %d frames overwritten\n", dumps, fl.rings[0].overwritten, BENCH_CHECKED);
+        sr_flight_close(&fl);
+}
+
+static void bench_rings(const char* prefix)
+{
+        static struct sr_flight fl;
+        static uint8_t f[BENCH_MAXFRAME];
+        char spec[128], fn[160];
+        uint64_t seed = 2463534242ull;
+        unsigned long dumps = 0;
+        struct timeval ts;
+        uint32_t i, r;
+        int len;
+
+        snprintf(spec, sizeof(spec), "%s,0,%s", BENCH_RING, prefix);
+        if (sr_flight_open(&fl, spec, BENCH_SNAPLEN, BENCH_RINGS)) exit(1);
+        for (i = 0; i < BENCH_CHECKED; i++) {
+                len = bench_frame(f, i);
+                r = bench_next(&seed);
+                /* a microsecond apart so the merged order is the logged order */
+                ts.tv_sec = 1000000000 + i / 1000000;
+                ts.tv_usec = i % 1000000;
+                sr_flight_log(&fl, r % 64 ? r % (BENCH_RINGS - 1) : BENCH_RINGS - 1, f, len, &ts);
+                if (i < 8 || bench_next(&seed) % 8000 == 0) {
+                        if (sr_flight_dump(&fl, SR_FLIGHT_CONTROL)) exit(1);
+                        snprintf(fn, sizeof(fn), "%s.%lu.control.pcap", prefix, fl.dumps);
+                        bench_read(&fl, fn, i);
+                        dumps++;
+                }
+        }
+        printf("checked %lu dumps of %d rings\n", dumps, BENCH_RINGS);
+        sr_flight_close(&fl);
+}
+
+static void bench_time(const char* prefix, int n)
+{
+        static struct sr_flight fl;
+        struct timeval now;
+        uint8_t f[BENCH_FRAME];
+        char spec[128], fn[160];
+        double t0, t_log, t_dump;
+        int i;
+
+        memset(f, 0xab, sizeof(f));
+        snprintf(spec, sizeof(spec), "64M,0,%s", prefix);
+        if (sr_flight_open(&fl, spec, BENCH_SNAPLEN, 1)) exit(1);
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                /* the event loop reads the clock once per wakeup */
+                if (i % BENCH_BATCH == 0) gettimeofday(&now, 0);
+                sr_flight_log(&fl, 0, f, BENCH_FRAME, &now);
+        }
+        t_log = bench_now() - t0;
+        t0 = bench_now();
+        sr_flight_dump(&fl, SR_FLIGHT_CONTROL);
+        t_dump = bench_now() - t0;
+        snprintf(fn, sizeof(fn), "%s.%lu.control.pcap", prefix, fl.dumps);
+        unlink(fn);
+
+        printf("record: %8.1f ns/packet\n", t_log * 1e9 / n);
+        printf("dump:   %8.1f ms for %lu packets\n", t_dump * 1e3, fl.rings[0].count);
+        sr_flight_print_stats(&fl);
+        sr_flight_close(&fl);
+}
+
+int main(int argc, char** argv)
+{
+        int n = argc > 1 ? atoi(argv[1]) : 10000000;
+        const char* prefix = argc > 2 ? argv[2] : "/tmp/sr_bench";
+
+        bench_check(prefix);
+        bench_rings(prefix);
+        bench_time(prefix, n);
+        return 0;
+}
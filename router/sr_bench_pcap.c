@@ -0,0 +1,272 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * checks and times packet capture through the writer thread in sr_pcap.c
+ *
+ * frames of random sizes, some longer than the snap length, are logged
+ * and the file is read back once the writer is done: every record has to
+ * be one of the frames in the order they were logged, cut at the snap
+ * length, and records plus drops have to add up to what was logged.
+ * the same again with BENCH_THREADS threads logging to queues of their
+ * own at once, as the pipe backend's do: each thread's frames have to
+ * come out in the order it logged them.
+ *
+ * then minimum size frames are logged the old way (sr_dump and fflush for
+ * each one) and through the ring, taking the time once per BENCH_BATCH
+ * frames as the event loop does, to compare the time spent per packet,
+ * which is what comes off the forwarding rate. nothing else is going on
+ * in that loop, so left to itself it would fill the ring faster than the
+ * writer empties it and drop most of it, which is cheaper than logging.
+ * so between batches it waits, off the clock, whenever the writer is more
+ * than half a ring behind, as the router gives the cpu up when it waits
+ * for packets, and the run fails if anything was dropped: both ways log
+ * every packet. the time per packet is given without the waits and with
+ * them, which on one cpu is what the writer costs as well.
+ *
+ * usage: sr_bench_pcap [packets] [file]  (default 1000000, /tmp/sr_bench.pcap)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "sr_dumper.h"
+#include "sr_pcap.h"
+#include "sr_bench.h"
+
+/** frames in the checked stream */
+#define BENCH_CHECKED 200000
+#define BENCH_SNAPLEN 1024      /** as PACKET_DUMP_SIZE */
+#define BENCH_FRAME 60
+#define BENCH_MAXFRAME 1514
+/** frames handled per event loop wakeup in the timed run */
+#define BENCH_BATCH 32
+/** threads logging at once in the merged check */
+#define BENCH_THREADS 4
+
+static uint32_t bench_next(uint64_t* seed)
+{
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        return (uint32_t) *seed;
+}
+
+/** fill frame i: its number up front so a record can be matched to it */
+static int bench_frame(uint8_t* f, uint64_t* seed, uint32_t i)
+{
+        int len = BENCH_FRAME + bench_next(seed) % (BENCH_MAXFRAME - BENCH_FRAME + 1);
+        int j;
+
+        memcpy(f, &i, sizeof(i));
+        for (j = sizeof(i); j < len; j++) f[j] = (uint8_t) (i * 31 + j);
+        return len;
+}
+
+static void bench_check(const char* fn)
+{
+        static struct sr_pcap p;
+        static uint8_t f[BENCH_MAXFRAME], r[BENCH_MAXFRAME];
+        struct pcap_file_header fh;
+        struct pcap_sf_pkthdr h;
+        uint64_t seed = 88172645463325252ull, rseed;
+        unsigned long records = 0;
+        uint32_t i, next = 0, want;
+        FILE* fp;
+        int len;
+
+        if (sr_pcap_open(&p, fn, BENCH_SNAPLEN, 1)) exit(1);
+        for (i = 0; i < BENCH_CHECKED; i++) {
+                len = bench_frame(f, &seed, i);
+                sr_pcap_log(&p, 0, f, len, 0);
+                /* let the writer run now and then or most of it would be dropped */
+                if (i % 1000 == 999) usleep(100);
+        }
+        sr_pcap_close(&p);
+
+        if (!(fp = fopen(fn, "r")) || fread(&fh, sizeof(fh), 1, fp) != 1 ||
+            fh.magic != TCPDUMP_MAGIC || fh.snaplen != BENCH_SNAPLEN) {
+                fprintf(stderr, "FAIL: bad file header\n");
+                exit(1);
+        }
+        rseed = 88172645463325252ull;
+        while (fread(&h, sizeof(h), 1, fp) == 1) {
+                if (h.caplen > BENCH_SNAPLEN || fread(r, h.caplen, 1, fp) != 1 || h.caplen < sizeof(want)) {
+                        fprintf(stderr, "FAIL: record %lu is cut short\n", records);
+                        exit(1);
+                }
+                memcpy(&want, r, sizeof(want));
+                /* dropped frames are skipped over, but never reordered */
+                do {
+                        if (next >= BENCH_CHECKED || next > want) {
+                                fprintf(stderr, "FAIL: record %lu is frame %u, expected %u or later\n",
+                                        records, want, next);
+                                exit(1);
+                        }
+                        len = bench_frame(f, &rseed, next);
+                } while (next++ != want);
+                if (h.len != (uint32_t) len || h.caplen != (uint32_t) (len < BENCH_SNAPLEN ? len : BENCH_SNAPLEN) ||
+                    memcmp(f, r, h.caplen)) {
+                        fprintf(stderr, "FAIL: frame %u logged wrong\n", want);
+                        exit(1);
+                }
+                records++;
+        }
+        fclose(fp);
+        if (records + p.out.drops != BENCH_CHECKED) {
+                fprintf(stderr, "FAIL: %lu records and %lu drops for %d frames\n",
+                        records, p.out.drops, BENCH_CHECKED);
+                exit(1);
+        }
+        printf("checked %lu records, %lu dropped, %lu writes\n", records, p.out.drops, p.writes);
+}
+
+struct bench_logger
+{
+        struct sr_pcap* p;
+        int queue;
+};
+
+/** a thread's frames: the queue number in the top byte of the frame number */
+static void* bench_log(void* arg)
+{
+        struct bench_logger* l = arg;
+        uint64_t seed = 2463534242ull + l->queue;
+        uint8_t f[BENCH_MAXFRAME];
+        uint32_t i;
+        int len;
+
+        for (i = 0; i < BENCH_CHECKED / BENCH_THREADS; i++) {
+                len = bench_frame(f, &seed, (uint32_t) l->queue << 24 | i);
+                sr_pcap_log(l->p, l->queue, f, len, 0);
+                if (i % 1000 == 999) usleep(100);
+        }
+        return 0;
+}
+
+static void bench_merged(const char* fn)
+{
+        static struct sr_pcap p;
+        static uint8_t r[BENCH_MAXFRAME];
+        struct bench_logger l[BENCH_THREADS];
+        pthread_t t[BENCH_THREADS];
+        struct pcap_file_header fh;
+        struct pcap_sf_pkthdr h;
+        uint32_t next[BENCH_THREADS] = { 0 }, id, q;
+        unsigned long records = 0;
+        FILE* fp;
+        int i;
+
+        if (sr_pcap_open(&p, fn, BENCH_SNAPLEN, BENCH_THREADS)) exit(1);
+        for (i = 0; i < BENCH_THREADS; i++) {
+                l[i].p = &p;
+                l[i].queue = i;
+                pthread_create(&t[i], 0, bench_log, &l[i]);
+        }
+        for (i = 0; i < BENCH_THREADS; i++) pthread_join(t[i], 0);
+        sr_pcap_close(&p);
+
+        if (!(fp = fopen(fn, "r")) || fread(&fh, sizeof(fh), 1, fp) != 1 || fh.magic != TCPDUMP_MAGIC) {
+                fprintf(stderr, "FAIL: merged: bad file header\n");
+                exit(1);
+        }
+        while (fread(&h, sizeof(h), 1, fp) == 1) {
+                if (h.caplen > BENCH_SNAPLEN || h.caplen < sizeof(id) || fread(r, h.caplen, 1, fp) != 1) {
+                        fprintf(stderr, "FAIL: merged: record %lu is cut short\n", records);
+                        exit(1);
+                }
+                memcpy(&id, r, sizeof(id));
+                q = id >> 24;
+                if (q >= BENCH_THREADS || (id & 0xffffff) < next[q]) {
+                        fprintf(stderr, "FAIL: merged: record %lu is frame %u of thread %u, expected %u or later\n",
+                                records, id & 0xffffff, q, next[q]);
+                        exit(1);
+                }
+                next[q] = (id & 0xffffff) + 1;
+                records++;
+        }
+        fclose(fp);
+        if (records + p.out.drops != BENCH_CHECKED / BENCH_THREADS * BENCH_THREADS) {
+                fprintf(stderr, "FAIL: merged: %lu records and %lu drops for %d frames\n",
+                        records, p.out.drops, BENCH_CHECKED / BENCH_THREADS * BENCH_THREADS);
+                exit(1);
+        }
+        printf("checked %lu records from %d threads, %lu dropped, %lu merged\n",
+               records, BENCH_THREADS, p.out.drops, p.merged);
+}
+
+/** bytes the writer has yet to take out of q */
+static uint64_t bench_backlog(struct sr_pcap_queue* q)
+{
+        return q->head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+static void bench_time(const char* fn, int n)
+{
+        static struct sr_pcap p;
+        struct pcap_pkthdr h;
+        struct timeval now;
+        uint8_t f[BENCH_FRAME];
+        FILE* fp;
+        double t0, t1, t_old, t_new, t_wait = 0;
+        unsigned long waits = 0;
+        int i;
+
+        memset(f, 0xab, sizeof(f));
+        if (!(fp = sr_dump_open(fn, 0, BENCH_SNAPLEN))) exit(1);
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                gettimeofday(&h.ts, 0);
+                h.caplen = h.len = BENCH_FRAME;
+                sr_dump(fp, &h, f);
+                fflush(fp);
+        }
+        t_old = bench_now() - t0;
+        sr_dump_close(fp);
+
+        if (sr_pcap_open(&p, fn, BENCH_SNAPLEN, 1)) exit(1);
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                if (i % BENCH_BATCH == 0) {
+                        if (bench_backlog(&p.out) > p.out.size / 2) {
+                                t1 = bench_now();
+                                while (bench_backlog(&p.out) > p.out.size / 4) usleep(100);
+                                t_wait += bench_now() - t1;
+                                waits++;
+                        }
+                        /* the event loop reads the clock once per wakeup */
+                        gettimeofday(&now, 0);
+                }
+                sr_pcap_log(&p, 0, f, BENCH_FRAME, &now);
+        }
+        t_new = bench_now() - t0 - t_wait;
+        sr_pcap_close(&p);
+
+        if (p.out.drops) {
+                fprintf(stderr, "FAIL: timed run dropped %lu of %d packets\n", p.out.drops, n);
+                exit(1);
+        }
+        printf("fwrite+fflush: %8.1f ns/packet\n", t_old * 1e9 / n);
+        printf("ring+writer:   %8.1f ns/packet (%.1fx), none dropped, %lu writes, "
+               "%lu waits for the writer\n",
+               t_new * 1e9 / n, t_old / t_new, p.writes, waits);
+        /* on one cpu the writer's time comes off forwarding too */
+        printf("  with waits:  %8.1f ns/packet (%.1fx)\n",
+               (t_new + t_wait) * 1e9 / n, t_old / (t_new + t_wait));
+        sr_pcap_print_stats(&p);
+}
+
+int main(int argc, char** argv)
+{
+        int n = argc > 1 ? atoi(argv[1]) : 1000000;
+        const char* fn = argc > 2 ? argv[2] : "/tmp/sr_bench.pcap";
+
+        bench_check(fn);
+        bench_merged(fn);
+        bench_time(fn, n);
+        unlink(fn);
+        return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * benchmark for the routing table lookups in sr_rt.c
+ *
+ * builds random routing tables of increasing size through sr_add_rt_entry
+ * and times the original list walk against the compiled trie and the
+ * DIR-24-8 table. every list result is checked against the other engines
+ * so a wrong answer aborts the run.
+ *
+ * usage: sr_bench_rt [routes ...]  (default 10 1000 100000 1000000)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_bench.h"
+
+/** number of addresses looked up through the trie per table size */
+#define BENCH_LOOKUPS 1000000
+/** upper bound on route comparisons spent on the list walk per table size */
+#define BENCH_LIST_WORK 200000000.0
+
+static uint64_t bench_seed = 0x9E3779B97F4A7C15ULL;
+
+/** xorshift so every run builds the same tables */
+static uint32_t bench_rand(void)
+{
+        bench_seed ^= bench_seed << 13;
+        bench_seed ^= bench_seed >> 7;
+        bench_seed ^= bench_seed << 17;
+        return (uint32_t)(bench_seed >> 16);
+}
+
+/** prefix lengths roughly shaped like a real table: mostly /24s */
+static uint8_t bench_masklen(void)
+{
+        uint32_t r = bench_rand() % 100;
+
+        if (r < 70) return 24;
+        if (r < 90) return 16 + bench_rand() % 8;
+        if (r < 95) return 8 + bench_rand() % 8;
+        return 25 + bench_rand() % 8;
+}
+
+static void bench_table(struct sr_instance* sr, int routes, uint32_t* addrs)
+{
+        struct in_addr dest, gw, mask;
+        char iface[8];
+        uint32_t m;
+        uint8_t len;
+        int i;
+
+        /* default route first as in a normal rtable */
+        dest.s_addr = mask.s_addr = 0;
+        gw.s_addr = htonl(0x0A000001);
+        sr_add_rt_entry(sr, dest, gw, mask, "eth0");
+
+        for (i = 1; i < routes; i++) {
+                len = bench_masklen();
+                m = len ? 0xFFFFFFFF << (32 - len) : 0;
+                dest.s_addr = htonl(bench_rand() & m);
+                mask.s_addr = htonl(m);
+                gw.s_addr = htonl(0x0A000000 | (bench_rand() & 0xFFFF));
+                snprintf(iface, sizeof(iface), "eth%d", i % 4);
+                sr_add_rt_entry(sr, dest, gw, mask, iface);
+        }
+
+        /* half the lookups land inside known prefixes, the rest anywhere */
+        for (i = 0; i < BENCH_LOOKUPS; i++) {
+                addrs[i] = bench_rand();
+                if (i & 1) {
+                        struct sr_rt* r = sr->routing_table;
+                        int skip = bench_rand() % (routes < 64 ? routes : 64);
+                        while (skip-- && r->next) r = r->next;
+                        addrs[i] = (ntohl(r->dest.s_addr) & ntohl(r->mask.s_addr)) |
+                                (addrs[i] & ~ntohl(r->mask.s_addr));
+                }
+                addrs[i] = htonl(addrs[i] ? addrs[i] : 1);
+        }
+}
+
+static void bench_run(struct sr_instance* sr, int routes, uint32_t* addrs)
+{
+        double t0, build, list, trie, dir;
+        int i, nlist;
+        volatile uintptr_t sink = 0;
+
+        t0 = bench_now();
+        bench_table(sr, routes, addrs);
+        build = bench_now() - t0;
+
+        nlist = (int)(BENCH_LIST_WORK / routes);
+        if (nlist > BENCH_LOOKUPS) nlist = BENCH_LOOKUPS;
+        if (nlist < 100) nlist = 100;
+
+        t0 = bench_now();
+        for (i = 0; i < nlist; i++) {
+                sink += (uintptr_t)sr_rt_list_find(sr, addrs[i]);
+        }
+        list = (bench_now() - t0) / nlist;
+
+        t0 = bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; i++) {
+                sink += (uintptr_t)sr_rt_find(sr, addrs[i]);
+        }
+        trie = (bench_now() - t0) / BENCH_LOOKUPS;
+
+        sr->rt_engine = SR_RT_DIR;
+        sr->rt_dir = sr_rt_dir_build(sr->routing_table);
+        t0 = bench_now();
+        for (i = 0; i < BENCH_LOOKUPS; i++) {
+                sink += (uintptr_t)sr_rt_find(sr, addrs[i]);
+        }
+        dir = (bench_now() - t0) / BENCH_LOOKUPS;
+
+        for (i = 0; i < nlist; i++) {
+                struct sr_rt* r = sr_rt_list_find(sr, addrs[i]);
+                if (r != sr_rt_trie_lookup(sr->rt_trie, ntohl(addrs[i])) ||
+                    r != sr_rt_dir_lookup(sr->rt_dir, ntohl(addrs[i]))) {
+                        struct in_addr a;
+                        a.s_addr = addrs[i];
+                        fprintf(stderr, "BENCH: lookup engines disagree on %s\n", inet_ntoa(a));
+                        exit(1);
+                }
+        }
+
+        printf("%10d %12.1f %14.1f %14.1f %14.1f %12.1f %10.1f\n",
+                routes, build * 1e3, list * 1e9, trie * 1e9, dir * 1e9, 
+                sr->rt_dir->build_ms, sr->rt_dir->bytes / (1024.0 * 1024.0));
+        sr->rt_engine = SR_RT_TRIE;
+        sr_rt_clear(sr);
+}
+
+int main(int argc, char** argv)
+{
+        int sizes[] = { 10, 1000, 100000, 1000000 };
+        struct sr_instance* sr;
+        uint32_t* addrs;
+        int i;
+
+        sr = (struct sr_instance*)calloc(1, sizeof(struct sr_instance));
+        addrs = (uint32_t*)malloc(BENCH_LOOKUPS * sizeof(uint32_t));
+        assert(sr && addrs);
+        sr_epoch_init(&sr->rt_epoch);
+
+        printf("%10s %12s %14s %14s %14s %12s %10s\n", "routes", "trie build ms",
+                "list ns/find", "trie ns/find", "dir ns/find", "dir build ms", "dir MB");
+        if (argc > 1) {
+                for (i = 1; i < argc; i++) bench_run(sr, atoi(argv[i]), addrs);
+        } else {
+                for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) bench_run(sr, sizes[i], addrs);
+        }
+
+        free(addrs);
+        free(sr);
+        return 0;
+}
@@ -0,0 +1,310 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * checks and times live routing table changes (live updates in sr_rt.c)
+ *
+ * reader threads look routes up as pipe workers do, in an epoch for each
+ * batch, while the main thread adds and deletes routes at a steady rate
+ * and now and then replaces the whole table from a file. a table of
+ * BENCH_STABLE /24s is always there, as is a default route; the routes
+ * that come and go are in another /8. every answer a reader gets has to
+ * match the address it asked about and carry the gateway its prefix was
+ * given, so a route freed while a reader could still see it shows up,
+ * and an address in one of the /24s always has to find that /24.
+ *
+ * lookups per second are taken with the routes left alone and then while
+ * they change. once the churn stops the trie and a DIR-24-8 table built
+ * from the list have to give the answer the list does.
+ *
+ * usage: sr_bench_rtlive [updates/s] [seconds] [readers]  (default 10000, 3, 2)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_bench.h"
+
+/** routes that stay: 100.0.0.0/24 up */
+#define BENCH_STABLE 10000
+#define BENCH_STABLE_NET 0x64000000
+/** routes that come and go are in 200.0.0.0/8 */
+#define BENCH_CHURN_NET 0xC8000000
+/** churn routes kept at once: the oldest is deleted past this */
+#define BENCH_LIVE 1024
+/** lookups per epoch, as a pipe worker's batch */
+#define BENCH_BATCH 32
+#define BENCH_READERS 16
+#define BENCH_CHECKS 2000
+
+struct bench_reader
+{
+        struct sr_instance* sr;
+        struct sr_epoch_reader* epoch;
+        pthread_t thread;
+        uint64_t seed;
+        unsigned long lookups __attribute__ ((aligned (64)));
+        unsigned long errors;
+};
+
+static volatile int bench_stop;
+
+static uint32_t bench_next(uint64_t* seed)
+{
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        return (uint32_t) *seed;
+}
+
+/** the gateway a prefix is given: a reader checks its answers against it */
+static uint32_t bench_gw(uint32_t dest, uint32_t mask)
+{
+        return 0x0A000000 | (((dest ^ (mask * 2654435761U)) * 2246822519U) >> 8);
+}
+
+static uint32_t bench_mask(uint8_t len)
+{
+        return len ? 0xFFFFFFFF << (32 - len) : 0;
+}
+
+/** dest, mask and gw in host order */
+static void bench_route(uint32_t* dest, uint32_t* mask, uint32_t* gw, int stable, uint64_t* seed)
+{
+        uint8_t len;
+
+        if (stable >= 0) {
+                *mask = bench_mask(24);
+                *dest = BENCH_STABLE_NET + ((uint32_t) stable << 8);
+        } else {
+                len = 16 + bench_next(seed) % 17;
+                *mask = bench_mask(len);
+                *dest = (BENCH_CHURN_NET | (bench_next(seed) & 0xFFFFFF)) & *mask;
+        }
+        *gw = bench_gw(*dest, *mask);
+}
+
+/** @return 0 if rt is a right answer for ip (host order) */
+static int bench_check(struct sr_rt* rt, uint32_t ip)
+{
+        uint32_t dest, mask;
+
+        if (!rt) return -1;
+        dest = ntohl(rt->dest.s_addr);
+        mask = ntohl(rt->mask.s_addr);
+        if ((ip & mask) != dest || ntohl(rt->gw.s_addr) != bench_gw(dest, mask)) return -1;
+        if (strcmp(rt->interface, "eth0")) return -1;
+        /* one of the /24s that are always there */
+        if ((ip >> 24) == (BENCH_STABLE_NET >> 24) && ((ip - BENCH_STABLE_NET) >> 8) < BENCH_STABLE &&
+            mask != bench_mask(24)) return -1;
+        return 0;
+}
+
+static void* bench_read(void* arg)
+{
+        struct bench_reader* r = arg;
+        uint32_t ip;
+        int i;
+
+        while (!bench_stop) {
+                sr_epoch_enter(&r->sr->rt_epoch, r->epoch);
+                for (i = 0; i < BENCH_BATCH; i++) {
+                        ip = bench_next(&r->seed);
+                        /* mostly where the routes are, some anywhere */
+                        if (i & 1) ip = BENCH_CHURN_NET | (ip & 0xFFFFFF);
+                        else if (i & 2) ip = BENCH_STABLE_NET + (ip % (BENCH_STABLE << 8));
+                        if (!ip) ip = 1;
+                        if (bench_check(sr_rt_find(r->sr, htonl(ip)), ip)) r->errors++;
+                }
+                sr_epoch_leave(r->epoch);
+                __atomic_store_n(&r->lookups, r->lookups + BENCH_BATCH, __ATOMIC_RELAXED);
+        }
+        return 0;
+}
+
+static unsigned long bench_lookups(struct bench_reader* r, int readers)
+{
+        unsigned long n = 0;
+        int i;
+
+        for (i = 0; i < readers; i++) n += __atomic_load_n(&r[i].lookups, __ATOMIC_RELAXED);
+        return n;
+}
+
+/** the stable routes and the default route as an rtable file */
+static void bench_rtable(const char* path)
+{
+        uint32_t dest, mask, gw;
+        struct in_addr a;
+        FILE* fp;
+        int i;
+
+        if (!(fp = fopen(path, "w"))) {
+                perror(path);
+                exit(1);
+        }
+        fprintf(fp, "0.0.0.0 10.%d.%d.%d 0.0.0.0 eth0\n",
+                (bench_gw(0, 0) >> 16) & 0xFF, (bench_gw(0, 0) >> 8) & 0xFF, bench_gw(0, 0) & 0xFF);
+        for (i = 0; i < BENCH_STABLE; i++) {
+                bench_route(&dest, &mask, &gw, i, 0);
+                a.s_addr = htonl(dest);
+                fprintf(fp, "%s ", inet_ntoa(a));
+                a.s_addr = htonl(gw);
+                fprintf(fp, "%s ", inet_ntoa(a));
+                a.s_addr = htonl(mask);
+                fprintf(fp, "%s eth0\n", inet_ntoa(a));
+        }
+        fclose(fp);
+}
+
+/** the trie and a DIR-24-8 table agree with the list on ip */
+static void bench_agree_on(struct sr_instance* sr, struct sr_rt_dir* dir, uint32_t ip)
+{
+        struct sr_rt* want = sr_rt_list_find(sr, htonl(ip));
+
+        if (sr_rt_trie_lookup(sr->rt_trie, ip) != want || sr_rt_dir_lookup(dir, ip) != want) {
+                fprintf(stderr, "FAILED: lookups of %08x disagree after the churn\n", ip);
+                exit(1);
+        }
+}
+
+/** at both ends of every route left from the churn and some anywhere */
+static void bench_agree(struct sr_instance* sr)
+{
+        struct sr_rt_dir* dir = sr_rt_dir_build(sr->routing_table);
+        struct sr_rt* rt;
+        uint64_t seed = 2463534242ull;
+        uint32_t ip;
+        int i;
+
+        for (rt = sr->routing_table; rt; rt = rt->next) {
+                ip = ntohl(rt->dest.s_addr);
+                if ((ip >> 24) != (BENCH_CHURN_NET >> 24)) continue;
+                bench_agree_on(sr, dir, ip);
+                bench_agree_on(sr, dir, ip | ~ntohl(rt->mask.s_addr));
+        }
+        for (i = 0; i < BENCH_CHECKS; i++) {
+                ip = bench_next(&seed);
+                if (i & 1) ip = BENCH_CHURN_NET | (ip & 0xFFFFFF);
+                bench_agree_on(sr, dir, ip ? ip : 1);
+        }
+        sr_rt_dir_free(dir);
+}
+
+int main(int argc, char** argv)
+{
+        struct bench_reader reader[BENCH_READERS];
+        struct sr_instance* sr;
+        struct in_addr dest, gw, mask;
+        uint32_t live[BENCH_LIVE][2];
+        unsigned long updates = 0, reloads = 0, errors = 0, quiet, before, after;
+        char path[] = "/tmp/sr_bench_rtlive.XXXXXX";
+        double rate = 10000, seconds = 3, start, t, next_reload;
+        int readers = 2, head = 0, count = 0, fd, i;
+        uint64_t seed = 88172645463325252ull;
+
+        if (argc > 1) rate = atof(argv[1]);
+        if (argc > 2) seconds = atof(argv[2]);
+        if (argc > 3) readers = atoi(argv[3]);
+        if (readers < 1 || readers > BENCH_READERS) readers = 2;
+
+        if ((fd = mkstemp(path)) == -1) {
+                perror("mkstemp");
+                exit(1);
+        }
+        close(fd);
+        bench_rtable(path);
+
+        sr = (struct sr_instance*)calloc(1, sizeof(struct sr_instance));
+        assert(sr);
+        sr->rt_engine = SR_RT_TRIE;
+        sr_timer_init(&sr->fwd.timers);
+        sr_epoch_init(&sr->rt_epoch);
+        if (sr_load_rt(sr, path)) exit(1);
+
+        memset(reader, 0, sizeof(reader));
+        for (i = 0; i < readers; i++) {
+                reader[i].sr = sr;
+                reader[i].seed = 0x9E3779B97F4A7C15ull * (i + 1);
+                reader[i].epoch = sr_epoch_register(&sr->rt_epoch);
+                if (pthread_create(&reader[i].thread, 0, bench_read, &reader[i])) {
+                        perror("pthread_create");
+                        exit(1);
+                }
+        }
+
+        /* the routes left alone */
+        before = bench_lookups(reader, readers);
+        start = bench_now();
+        usleep(1000000);
+        quiet = (bench_lookups(reader, readers) - before) / (bench_now() - start);
+
+        /* adds and deletes at rate a second, a reload each second */
+        before = bench_lookups(reader, readers);
+        start = bench_now();
+        next_reload = start + 1;
+        while ((t = bench_now()) - start < seconds) {
+                if (t >= next_reload) {
+                        if (sr_rt_reload(sr, path)) exit(1);
+                        head = count = 0;
+                        reloads++;
+                        next_reload += 1;
+                }
+                /* ahead: a late wakeup is made up for by a burst after it */
+                if (updates >= (t - start) * rate) {
+                        usleep(100);
+                        continue;
+                }
+                if (count == BENCH_LIVE) {
+                        dest.s_addr = htonl(live[head][0]);
+                        mask.s_addr = htonl(live[head][1]);
+                        head = (head + 1) % BENCH_LIVE;
+                        count--;
+                        if (sr_rt_del(sr, dest, mask)) {
+                                fprintf(stderr, "FAILED: a route added wasn't there to delete\n");
+                                exit(1);
+                        }
+                } else {
+                        bench_route(&live[(head + count) % BENCH_LIVE][0], &live[(head + count) % BENCH_LIVE][1],
+                                &gw.s_addr, -1, &seed);
+                        dest.s_addr = htonl(live[(head + count) % BENCH_LIVE][0]);
+                        mask.s_addr = htonl(live[(head + count) % BENCH_LIVE][1]);
+                        gw.s_addr = htonl(gw.s_addr);
+                        count++;
+                        if (sr_rt_add(sr, dest, gw, mask, "eth0")) exit(1);
+                }
+                updates++;
+        }
+        after = bench_lookups(reader, readers);
+        t = bench_now() - start;
+
+        bench_stop = 1;
+        for (i = 0; i < readers; i++) {
+                pthread_join(reader[i].thread, 0);
+                sr_epoch_unregister(reader[i].epoch);
+                errors += reader[i].errors;
+        }
+        unlink(path);
+
+        printf("%d readers: %.2f Mlookups/s quiet, %.2f Mlookups/s with %.0f updates/s and %lu reloads\n",
+                readers, quiet / 1e6, (after - before) / t / 1e6, updates / t, reloads);
+        sr_rt_print_stats(sr);
+        if (errors) {
+                fprintf(stderr, "FAILED: %lu lookups gave a wrong or freed route\n", errors);
+                exit(1);
+        }
+        bench_agree(sr);
+        sr_rt_clear(sr);
+        if (sr->rt_epoch.pending) {
+                fprintf(stderr, "FAILED: %lu retired and never freed\n", sr->rt_epoch.pending);
+                exit(1);
+        }
+        free(sr);
+        return 0;
+}
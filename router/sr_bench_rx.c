@@ -0,0 +1,245 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * checks and times the batched VNS receive buffer in sr_rx.c
+ *
+ * a child process writes a stream of VNSPACKET commands of random sizes
+ * into a socket pair, cut up in different ways: a byte at a time, in
+ * random pieces that split commands anywhere, and in big writes holding
+ * many commands. the parent reads the stream with sr_rx_fill / sr_rx_next
+ * and compares every command with what was sent, so a lost, reordered or
+ * damaged command aborts the run. a bad length must be reported as one.
+ *
+ * then a stream of minimum size packets is read both with sr_rx and the
+ * way sr_read_from_server used to (recv the length then read the body) to
+ * compare syscalls and time per packet.
+ *
+ * usage: sr_bench_rx [packets]  (default 1000000)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "sr_rx.h"
+#include "sr_bench.h"
+
+/** commands in each of the checked streams */
+#define BENCH_CHECKED 20000
+/** frame size of the timed stream: a minimum ethernet frame */
+#define BENCH_FRAME 60
+
+static uint32_t bench_next(uint64_t* seed)
+{
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        return (uint32_t)(*seed >> 16);
+}
+
+/**
+ * build command number i of a stream into cmd
+ * @return its length
+ */
+static int bench_command(uint8_t* cmd, uint64_t* seed, int i, int frame)
+{
+        c_packet_header* hdr = (c_packet_header*) cmd;
+        int len, j;
+
+        if (!frame) frame = 14 + bench_next(seed) % (1514 - 14 + 1);
+        len = sizeof(c_packet_header) + frame;
+        hdr->mLen = htonl(len);
+        hdr->mType = htonl(VNSPACKET);
+        memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+        snprintf(hdr->mInterfaceName, sizeof(hdr->mInterfaceName), "eth%d", i % 4);
+        memcpy(cmd + sizeof(c_packet_header), &i, sizeof(i));
+        for (j = sizeof(c_packet_header) + sizeof(i); j < len; j++) cmd[j] = (uint8_t)(i * 31 + j);
+        return len;
+}
+
+/** child: write n commands to fd in pieces of piece bytes (0: random, -1: as big as possible) */
+static void bench_writer(int fd, int n, int piece, int frame)
+{
+        static uint8_t out[1 << 20];
+        uint64_t seed = 0x853C49E6748FEA9BULL, cut = 0xDA3E39CB94B95BDBULL;
+        size_t used = 0, off, chunk;
+        ssize_t ret;
+        int i;
+
+        for (i = 0; i <= n; i++) {
+                if (i < n) used += bench_command(out + used, &seed, i, frame);
+                /* flush when nearly full and at the end */
+                if (i < n && used < sizeof(out) - VNSCMDSIZE) continue;
+                for (off = 0; off < used; off += ret) {
+                        chunk = used - off;
+                        if (piece > 0 && chunk > piece) chunk = piece;
+                        if (piece == 0) {
+                                size_t r = 1 + bench_next(&cut) % 3000;
+                                if (chunk > r) chunk = r;
+                        }
+                        ret = write(fd, out + off, chunk);
+                        if (ret <= 0) _exit(1);
+                }
+                used = 0;
+        }
+        close(fd);
+        _exit(0);
+}
+
+static pid_t bench_spawn(int* fd, int n, int piece, int frame)
+{
+        int sv[2];
+        pid_t pid;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+                perror("socketpair");
+                exit(1);
+        }
+        if ((pid = fork()) == 0) {
+                close(sv[0]);
+                bench_writer(sv[1], n, piece, frame);
+        }
+        close(sv[1]);
+        *fd = sv[0];
+        return pid;
+}
+
+static void bench_check(const char* name, int piece, int n)
+{
+        static struct sr_rx rx;
+        static uint8_t want[VNSCMDSIZE];
+        uint64_t seed = 0x853C49E6748FEA9BULL;
+        uint8_t* cmd;
+        int fd, len, wlen, i = 0, status;
+        uint32_t type;
+        pid_t pid = bench_spawn(&fd, n, piece, 0);
+
+        sr_rx_init(&rx);
+        while (i < n) {
+                if (sr_rx_fill(&rx, fd) <= 0) {
+                        fprintf(stderr, "BENCH: %s: stream ended after %d commands\n", name, i);
+                        exit(1);
+                }
+                while ((cmd = sr_rx_next(&rx, &len))) {
+                        wlen = bench_command(want, &seed, i, 0);
+                        /* sr_rx_next hands the type back in host order */
+                        type = VNSPACKET;
+                        memcpy(want + sizeof(uint32_t), &type, sizeof(type));
+                        if (len != wlen || memcmp(cmd, want, len) != 0) {
+                                fprintf(stderr, "BENCH: %s: command %d differs (length %d want %d)\n",
+                                        name, i, len, wlen);
+                                exit(1);
+                        }
+                        i++;
+                }
+                if (len < 0) {
+                        fprintf(stderr, "BENCH: %s: bad length at command %d\n", name, i);
+                        exit(1);
+                }
+        }
+        if (sr_rx_fill(&rx, fd) != 0 || sr_rx_pending(&rx)) {
+                fprintf(stderr, "BENCH: %s: data left over after the last command\n", name);
+                exit(1);
+        }
+        close(fd);
+        waitpid(pid, &status, 0);
+        printf("%-12s %d commands in %6lu reads, %lu partial commands moved: all match\n",
+                name, n, rx.reads, rx.moves);
+}
+
+/** a length bigger than any command must be caught, not waited for */
+static void bench_check_bad(void)
+{
+        static struct sr_rx rx;
+        uint32_t bad[2] = { htonl(VNSCMDSIZE + 1), htonl(VNSPACKET) };
+        int sv[2], len;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) exit(1);
+        if (write(sv[1], bad, sizeof(bad)) != sizeof(bad)) exit(1);
+        sr_rx_init(&rx);
+        sr_rx_fill(&rx, sv[0]);
+        if (sr_rx_next(&rx, &len) || len != -1) {
+                fprintf(stderr, "BENCH: bad length was not reported\n");
+                exit(1);
+        }
+        close(sv[0]);
+        close(sv[1]);
+        printf("%-12s reported as an error\n", "bad length");
+}
+
+/** the old way: recv the 4 byte length then read the body */
+static int bench_old_read(int fd, uint8_t* buf, unsigned long* calls)
+{
+        uint32_t len;
+        int got = 0, ret;
+
+        while (got < 4) {
+                ret = recv(fd, (uint8_t*)&len + got, 4 - got, 0);
+                (*calls)++;
+                if (ret <= 0) return ret;
+                got += ret;
+        }
+        len = ntohl(len);
+        memcpy(buf, &len, 4);
+        for (got = 0; got < len - 4; got += ret) {
+                ret = read(fd, buf + 4 + got, len - 4 - got);
+                (*calls)++;
+                if (ret <= 0) return -1;
+        }
+        return len;
+}
+
+static void bench_time(int n)
+{
+        static struct sr_rx rx;
+        static uint8_t buf[VNSCMDSIZE + MPADDING];
+        unsigned long calls = 0;
+        double t0, told, tnew;
+        int fd, len, i, status;
+        pid_t pid;
+
+        pid = bench_spawn(&fd, n, -1, BENCH_FRAME);
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                if (bench_old_read(fd, buf, &calls) <= 0) exit(1);
+        }
+        told = bench_now() - t0;
+        close(fd);
+        waitpid(pid, &status, 0);
+        printf("old reader   %d packets of %d bytes: %.3f syscalls and %6.1f ns per packet\n",
+                n, BENCH_FRAME, (double) calls / n, told / n * 1e9);
+
+        pid = bench_spawn(&fd, n, -1, BENCH_FRAME);
+        sr_rx_init(&rx);
+        t0 = bench_now();
+        for (i = 0; i < n; ) {
+                if (sr_rx_fill(&rx, fd) <= 0) exit(1);
+                while (sr_rx_next(&rx, &len)) i++;
+        }
+        tnew = bench_now() - t0;
+        close(fd);
+        waitpid(pid, &status, 0);
+        printf("sr_rx        %d packets of %d bytes: %.3f syscalls and %6.1f ns per packet (%.0fx fewer syscalls)\n",
+                n, BENCH_FRAME, (double) rx.reads / n, tnew / n * 1e9,
+                (double) calls / rx.reads);
+}
+
+int main(int argc, char** argv)
+{
+        int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+        signal(SIGPIPE, SIG_IGN);
+        /* a syscall per byte: keep this one short */
+        bench_check("fragmented", 1, BENCH_CHECKED / 20);
+        bench_check("random cuts", 0, BENCH_CHECKED);
+        bench_check("coalesced", -1, BENCH_CHECKED);
+        bench_check_bad();
+        bench_time(n);
+        return 0;
+}
@@ -0,0 +1,241 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * checks and times the writev transmit queue in sr_tx.c
+ *
+ * frames of random sizes, some pointed at and some copied, are queued and
+ * flushed into a non blocking socket pair with a small send buffer so that
+ * most writev calls come up short or would block. a child process reads
+ * the stream back in random sized pieces and compares every command with
+ * what was queued, so a lost or damaged byte aborts the run. flushes don't
+ * wait, as in the router, and leave what doesn't fit in the backlog while
+ * there is room behind it for another queue; then the run waits for it.
+ *
+ * then minimum size frames are sent the old way (copy behind a header,
+ * one write per packet) and through the queue to compare syscalls and
+ * time per packet.
+ *
+ * usage: sr_bench_tx [packets]  (default 1000000)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "sr_tx.h"
+#include "sr_bench.h"
+
+/** frames in the checked stream */
+#define BENCH_CHECKED 100000
+/** frame size of the timed stream: a minimum ethernet frame */
+#define BENCH_FRAME 60
+/** largest frame checked */
+#define BENCH_MAXFRAME 1514
+
+static uint32_t bench_next(uint64_t* seed)
+{
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        return (uint32_t)(*seed >> 16);
+}
+
+/** frame number i of the checked stream: @return its length */
+static int bench_frame(uint8_t* f, uint64_t* seed, int i)
+{
+        int len = 14 + bench_next(seed) % (BENCH_MAXFRAME - 14 + 1), j;
+
+        for (j = 0; j < len; j++) f[j] = (uint8_t)(i * 7 + j * 13);
+        memcpy(f, &i, sizeof(i));
+        return len;
+}
+
+static void bench_readall(int fd, uint8_t* p, size_t n, uint64_t* cut)
+{
+        size_t got = 0, want;
+        ssize_t r;
+
+        while (got < n) {
+                want = 1 + bench_next(cut) % 2000;
+                if (want > n - got) want = n - got;
+                r = read(fd, p + got, want);
+                if (r <= 0) {
+                        fprintf(stderr, "BENCH: reader: stream ended early\n");
+                        _exit(1);
+                }
+                got += r;
+        }
+}
+
+/** child: read the stream back and compare it with what should have been sent */
+static void bench_reader(int fd, int n)
+{
+        static uint8_t want[BENCH_MAXFRAME], got[VNSCMDSIZE];
+        uint64_t seed = 0x6A09E667F3BCC909ULL, cut = 0xBB67AE8584CAA73BULL;
+        c_packet_header* hdr = (c_packet_header*) got;
+        char name[16];
+        int i, len;
+
+        for (i = 0; i < n; i++) {
+                len = bench_frame(want, &seed, i);
+                bench_readall(fd, got, sizeof(c_packet_header), &cut);
+                memset(name, 0, sizeof(name));
+                snprintf(name, sizeof(name), "eth%d", i % 3);
+                if (ntohl(hdr->mLen) != len + sizeof(c_packet_header) ||
+                    ntohl(hdr->mType) != VNSPACKET ||
+                    memcmp(hdr->mInterfaceName, name, sizeof(name)) != 0) {
+                        fprintf(stderr, "BENCH: reader: bad header on frame %d\n", i);
+                        _exit(1);
+                }
+                bench_readall(fd, got, len, &cut);
+                if (memcmp(got, want, len) != 0) {
+                        fprintf(stderr, "BENCH: reader: frame %d differs\n", i);
+                        _exit(1);
+                }
+        }
+        if (read(fd, got, 1) != 0) {
+                fprintf(stderr, "BENCH: reader: data after the last frame\n");
+                _exit(1);
+        }
+        _exit(0);
+}
+
+static pid_t bench_spawn(int* fd, void (*reader)(int, int), int n)
+{
+        int sv[2], size = 4096;
+        pid_t pid;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+                perror("socketpair");
+                exit(1);
+        }
+        if ((pid = fork()) == 0) {
+                close(sv[0]);
+                reader(sv[1], n);
+        }
+        close(sv[1]);
+        *fd = sv[0];
+        /* a small non blocking send buffer: short writes and EAGAIN all the time */
+        setsockopt(*fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) | O_NONBLOCK);
+        return pid;
+}
+
+static void bench_check(void)
+{
+        static struct sr_tx tx;
+        /* frames that are pointed at must stay put until the flush */
+        static uint8_t frames[SR_TX_FRAMES][BENCH_MAXFRAME];
+        uint8_t scratch[BENCH_MAXFRAME];
+        uint64_t seed = 0x6A09E667F3BCC909ULL;
+        char name[16];
+        int fd, i, len, copy, slot = 0, status;
+        pid_t pid = bench_spawn(&fd, bench_reader, BENCH_CHECKED);
+
+        sr_tx_init(&tx);
+        for (i = 0; i < BENCH_CHECKED; i++) {
+                copy = i % 3 == 0;
+                len = bench_frame(scratch, &seed, i);
+                if (sr_tx_full(&tx, len, copy)) {
+                        /* a full queue behind the backlog has to fit or some of it is dropped */
+                        if (sr_tx_backlog(&tx) + SR_TX_FRAMES * (sizeof(c_packet_header) + BENCH_MAXFRAME) >
+                            SR_TX_BACKLOG) {
+                                if (sr_tx_drain(&tx, fd) == -1) exit(1);
+                        } else if (sr_tx_flush(&tx, fd) == -1) exit(1);
+                        slot = 0;
+                }
+                memset(name, 0, sizeof(name));
+                snprintf(name, sizeof(name), "eth%d", i % 3);
+                if (copy) {
+                        sr_tx_queue(&tx, scratch, len, name, 1);
+                        /* the staged copy must not see this */
+                        memset(scratch, 0xAA, sizeof(scratch));
+                } else {
+                        memcpy(frames[slot], scratch, len);
+                        sr_tx_queue(&tx, frames[slot++], len, name, 0);
+                }
+        }
+        if (sr_tx_drain(&tx, fd) == -1) exit(1);
+        close(fd);
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || tx.dropped) {
+                fprintf(stderr, "BENCH: stream check failed\n");
+                exit(1);
+        }
+        printf("%d frames in %lu writes (%lu short or blocked, %lu flushes left a backlog) read back intact\n",
+                BENCH_CHECKED, tx.writes, tx.partial, tx.held);
+        sr_tx_close(&tx);
+}
+
+/** child for the timed runs: just drain */
+static void bench_drain(int fd, int n)
+{
+        static uint8_t buf[1 << 16];
+
+        while (read(fd, buf, sizeof(buf)) > 0);
+        _exit(0);
+}
+
+static void bench_time(int n)
+{
+        static struct sr_tx tx;
+        c_packet_header pkt[VNSCMDSIZE / sizeof(c_packet_header) + 1];
+        uint8_t frame[BENCH_FRAME];
+        unsigned long calls = 0;
+        unsigned int total = BENCH_FRAME + sizeof(c_packet_header);
+        double t0, told, tnew;
+        int fd, i, status, size = 1 << 20;
+        pid_t pid;
+
+        memset(frame, 0x5A, sizeof(frame));
+
+        pid = bench_spawn(&fd, bench_drain, n);
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                pkt->mLen = htonl(total);
+                pkt->mType = htonl(VNSPACKET);
+                strncpy(pkt->mInterfaceName, "eth0", 16);
+                memcpy((uint8_t*) pkt + sizeof(c_packet_header), frame, BENCH_FRAME);
+                if (write(fd, pkt, total) < total) exit(1);
+                calls++;
+        }
+        told = bench_now() - t0;
+        close(fd);
+        waitpid(pid, &status, 0);
+        printf("write per packet  %d packets of %d bytes: %.3f syscalls and %6.1f ns per packet\n",
+                n, BENCH_FRAME, (double) calls / n, told / n * 1e9);
+
+        pid = bench_spawn(&fd, bench_drain, n);
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        sr_tx_init(&tx);
+        t0 = bench_now();
+        for (i = 0; i < n; i++) {
+                if (sr_tx_full(&tx, BENCH_FRAME, 0) && sr_tx_flush(&tx, fd) == -1) exit(1);
+                sr_tx_queue(&tx, frame, BENCH_FRAME, "eth0", 0);
+        }
+        if (sr_tx_flush(&tx, fd) == -1) exit(1);
+        tnew = bench_now() - t0;
+        close(fd);
+        waitpid(pid, &status, 0);
+        printf("sr_tx writev      %d packets of %d bytes: %.3f syscalls and %6.1f ns per packet\n",
+                n, BENCH_FRAME, (double) tx.writes / n, tnew / n * 1e9);
+}
+
+int main(int argc, char** argv)
+{
+        int n = argc > 1 ? atoi(argv[1]) : 1000000;
+
+        signal(SIGPIPE, SIG_IGN);
+        bench_check();
+        bench_time(n);
+        return 0;
+}
@@ -0,0 +1,183 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * udp load generator and sink for timing the router on real interfaces
+ *
+ * the sender blasts numbered datagrams at a host on the far side of the
+ * router with sendmmsg for a fixed time. the receiver counts what arrives
+ * with recvmmsg and uses the numbers to work out how many were lost or
+ * came out of order. sr_netns.sh runs one of each in network namespaces
+ * either side of sr.
+ *
+ * udp checksums are turned off on the sender: veth leaves them for the
+ * nic to fill in and there is no nic, so a frame the router copies out
+ * of its ring would otherwise arrive with a bad checksum.
+ *
+ * usage: sr_bench_udp send <ip address> [seconds] [payload bytes]
+ *        sr_bench_udp recv [seconds]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_bench.h"
+
+#define BENCH_PORT 9000
+/** datagrams per sendmmsg or recvmmsg */
+#define BENCH_BATCH 32
+#define BENCH_MAXPAYLOAD 1472
+
+#ifndef SO_NO_CHECK
+#define SO_NO_CHECK 11
+#endif
+
+static int bench_send(const char* ip, double seconds, int size)
+{
+        static uint8_t payload[BENCH_BATCH][BENCH_MAXPAYLOAD];
+        struct mmsghdr msg[BENCH_BATCH];
+        struct iovec iov[BENCH_BATCH];
+        struct sockaddr_in to;
+        unsigned long sent = 0, failed = 0;
+        uint64_t seq = 0;
+        double t0, t;
+        int fd, i, n, one = 1;
+
+        memset(&to, 0, sizeof(to));
+        to.sin_family = AF_INET;
+        to.sin_port = htons(BENCH_PORT);
+        if (!inet_aton(ip, &to.sin_addr)) {
+                fprintf(stderr, "BENCH: bad address %s\n", ip);
+                return 1;
+        }
+        if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+                perror("socket");
+                return 1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_NO_CHECK, &one, sizeof(one));
+        if (connect(fd, (struct sockaddr*) &to, sizeof(to)) == -1) {
+                perror("connect");
+                return 1;
+        }
+
+        memset(msg, 0, sizeof(msg));
+        for (i = 0; i < BENCH_BATCH; i++) {
+                iov[i].iov_base = payload[i];
+                iov[i].iov_len = size;
+                msg[i].msg_hdr.msg_iov = &iov[i];
+                msg[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        t0 = t = bench_now();
+        while (t - t0 < seconds) {
+                for (i = 0; i < BENCH_BATCH; i++) memcpy(payload[i], &(uint64_t){ seq + i }, sizeof(seq));
+                n = sendmmsg(fd, msg, BENCH_BATCH, 0);
+                if (n == -1) {
+                        /* the far side may not be resolved yet or the queue is full */
+                        if (errno != ENOBUFS && errno != ECONNREFUSED && errno != EHOSTUNREACH) {
+                                perror("sendmmsg");
+                                return 1;
+                        }
+                        failed++;
+                        n = 0;
+                }
+                seq += n;
+                sent += n;
+                t = bench_now();
+        }
+        printf("sent %lu datagrams of %d bytes in %.2f s: %.0f per second (%lu batches refused)\n",
+                sent, size, t - t0, sent / (t - t0), failed);
+        close(fd);
+        return 0;
+}
+
+static int bench_recv(double seconds)
+{
+        static uint8_t payload[BENCH_BATCH][BENCH_MAXPAYLOAD];
+        struct mmsghdr msg[BENCH_BATCH];
+        struct iovec iov[BENCH_BATCH];
+        struct sockaddr_in me;
+        struct timeval tv = { 0, 100000 };
+        unsigned long got = 0, bytes = 0, late = 0;
+        uint64_t seq, next = 0;
+        double t0 = 0, tlast = 0, tend;
+        int fd, i, n, size = 1 << 22;
+
+        if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+                perror("socket");
+                return 1;
+        }
+        memset(&me, 0, sizeof(me));
+        me.sin_family = AF_INET;
+        me.sin_port = htons(BENCH_PORT);
+        if (bind(fd, (struct sockaddr*) &me, sizeof(me)) == -1) {
+                perror("bind");
+                return 1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        memset(msg, 0, sizeof(msg));
+        for (i = 0; i < BENCH_BATCH; i++) {
+                iov[i].iov_base = payload[i];
+                iov[i].iov_len = BENCH_MAXPAYLOAD;
+                msg[i].msg_hdr.msg_iov = &iov[i];
+                msg[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        /* the clock starts with the first datagram */
+        tend = bench_now() + seconds;
+        while (bench_now() < tend) {
+                n = recvmmsg(fd, msg, BENCH_BATCH, 0, 0);
+                if (n == -1) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                        perror("recvmmsg");
+                        return 1;
+                }
+                if (!got) t0 = bench_now();
+                tlast = bench_now();
+                for (i = 0; i < n; i++) {
+                        if (msg[i].msg_len < sizeof(seq)) continue;
+                        memcpy(&seq, payload[i], sizeof(seq));
+                        if (seq < next) late++;
+                        else next = seq + 1;
+                        got++;
+                        bytes += msg[i].msg_len;
+                }
+        }
+        if (!got || tlast <= t0) {
+                printf("received %lu datagrams\n", got);
+                close(fd);
+                return got ? 0 : 1;
+        }
+        printf("received %lu datagrams in %.2f s: %.0f per second, %.1f Mbit/s of payload, "
+                "%lu lost, %lu out of order\n",
+                got, tlast - t0, got / (tlast - t0), bytes * 8 / (tlast - t0) / 1e6,
+                next > got ? (unsigned long)(next - got) : 0, late);
+        close(fd);
+        return 0;
+}
+
+int main(int argc, char** argv)
+{
+        int size;
+
+        if (argc > 2 && strcmp(argv[1], "send") == 0) {
+                size = argc > 4 ? atoi(argv[4]) : 18;
+                if (size < (int) sizeof(uint64_t)) size = sizeof(uint64_t);
+                if (size > BENCH_MAXPAYLOAD) size = BENCH_MAXPAYLOAD;
+                return bench_send(argv[2], argc > 3 ? atof(argv[3]) : 5, size);
+        }
+        if (argc > 1 && strcmp(argv[1], "recv") == 0)
+                return bench_recv(argc > 2 ? atof(argv[2]) : 5);
+
+        fprintf(stderr, "usage: %s send <ip address> [seconds] [payload bytes]\n"
+                        "       %s recv [seconds]\n", argv[0], argv[0]);
+        return 1;
+}
@@ -0,0 +1,367 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * checks and times the three ways sr can drive its VNS connection
+ *
+ *   blocking  recv into sr_rx then writev the replies (sr_read_from_server)
+ *   epoll     non blocking recvs on an epoll wakeup until EAGAIN, writev
+ *             after each, waiting on EPOLLOUT when the socket is full
+ *             (sr_vns_event)
+ *   io_uring  a multishot recv into provided buffers and linked sendmsgs,
+ *             one io_uring_enter per round (sr_uring.h)
+ *
+ * a child process plays the server: it writes a stream of VNSPACKET
+ * commands into a socket pair as fast as it can, and a second child reads
+ * back what the "router" in the parent sends, which is every packet echoed
+ * out of the interface it came in on. the reader compares each echo with
+ * what was sent so a lost, reordered or damaged packet fails the run.
+ * first a stream of random sized packets is checked through each path,
+ * then minimum size packets are timed and syscalls counted.
+ *
+ * usage: sr_bench_vns [packets]  (default 1000000)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "sr_rx.h"
+#include "sr_tx.h"
+#include "sr_uring.h"
+#include "sr_bench.h"
+
+/** packets in each checked stream */
+#define BENCH_CHECKED 50000
+/** frame size of the timed stream: a minimum ethernet frame */
+#define BENCH_FRAME 60
+/** recvs or chunks per wakeup, as SR_EVENT_BURST */
+#define BENCH_BURST 8
+
+struct bench_router
+{
+        struct sr_rx rx;
+        struct sr_tx tx;
+        struct sr_uring u;
+        unsigned long packets;
+        unsigned long calls;    /** syscalls */
+};
+
+static uint32_t bench_next(uint64_t* seed)
+{
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 7;
+        *seed ^= *seed << 17;
+        return (uint32_t)(*seed >> 16);
+}
+
+/**
+ * build packet i of a stream into cmd
+ * @param frame frame size or 0 for random sizes
+ * @return the command's length
+ */
+static int bench_command(uint8_t* cmd, uint64_t* seed, int i, int frame)
+{
+        c_packet_header* hdr = (c_packet_header*) cmd;
+        int len, j;
+
+        if (!frame) frame = 14 + bench_next(seed) % (1514 - 14 + 1);
+        len = sizeof(c_packet_header) + frame;
+        hdr->mLen = htonl(len);
+        hdr->mType = htonl(VNSPACKET);
+        memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+        snprintf(hdr->mInterfaceName, sizeof(hdr->mInterfaceName), "eth%d", i % 4);
+        memcpy(cmd + sizeof(c_packet_header), &i, sizeof(i));
+        for (j = sizeof(c_packet_header) + sizeof(i); j < len; j++) cmd[j] = (uint8_t)(i * 31 + j);
+        return len;
+}
+
+/** child: write n packets to fd in big writes then stop sending */
+static void bench_writer(int fd, int n, int frame)
+{
+        static uint8_t out[1 << 20];
+        uint64_t seed = 0x853C49E6748FEA9BULL;
+        size_t used = 0, off;
+        ssize_t ret;
+        int i;
+
+        for (i = 0; i <= n; i++) {
+                if (i < n) used += bench_command(out + used, &seed, i, frame);
+                if (i < n && used < sizeof(out) - VNSCMDSIZE) continue;
+                for (off = 0; off < used; off += ret) {
+                        if ((ret = write(fd, out + off, used - off)) <= 0) _exit(1);
+                }
+                used = 0;
+        }
+        shutdown(fd, SHUT_WR);
+        _exit(0);
+}
+
+/** child: read the echoes and check each against what was written */
+static void bench_reader(int fd, int n, int frame)
+{
+        static struct sr_rx rx;
+        static uint8_t want[VNSCMDSIZE];
+        uint64_t seed = 0x853C49E6748FEA9BULL;
+        uint32_t type = VNSPACKET;
+        uint8_t* cmd;
+        int len, wlen, i = 0;
+
+        sr_rx_init(&rx);
+        while (i < n) {
+                if (sr_rx_fill(&rx, fd) <= 0) break;
+                while ((cmd = sr_rx_next(&rx, &len))) {
+                        wlen = bench_command(want, &seed, i, frame);
+                        memcpy(want + sizeof(uint32_t), &type, sizeof(type));
+                        if (len != wlen || memcmp(cmd, want, len) != 0) {
+                                fprintf(stderr, "BENCH: echo %d differs (length %d want %d)\n", i, len, wlen);
+                                _exit(1);
+                        }
+                        i++;
+                }
+                if (len < 0) _exit(1);
+        }
+        if (i < n) {
+                fprintf(stderr, "BENCH: only %d of %d packets came back\n", i, n);
+                _exit(1);
+        }
+        _exit(0);
+}
+
+/** start the server side: @return the router's end of the connection */
+static int bench_spawn(pid_t* pids, int n, int frame)
+{
+        int sv[2], size = 1 << 20;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+                perror("socketpair");
+                exit(1);
+        }
+        setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        if ((pids[0] = fork()) == 0) {
+                close(sv[0]);
+                bench_writer(sv[1], n, frame);
+        }
+        if ((pids[1] = fork()) == 0) {
+                close(sv[0]);
+                bench_reader(sv[1], n, frame);
+        }
+        close(sv[1]);
+        return sv[0];
+}
+
+/** echo a packet: it is sent from where it is unless copy is set */
+static int bench_echo(struct bench_router* r, uint8_t* cmd, int len, int copy, int fd)
+{
+        c_packet_header* hdr = (c_packet_header*) cmd;
+        unsigned int flen = len - sizeof(c_packet_header);
+
+        /* fd is -1 for io_uring, whose syscalls are counted by the ring */
+        if (sr_tx_full(&r->tx, flen, copy)) {
+                if (fd == -1) {
+                        if (sr_uring_flush(&r->u, &r->tx) == -1) return -1;
+                } else {
+                        r->calls++;
+                        if (sr_tx_flush(&r->tx, fd) == -1) return -1;
+                }
+        }
+        sr_tx_queue(&r->tx, cmd + sizeof(c_packet_header), flen, hdr->mInterfaceName, copy);
+        r->packets++;
+        return 0;
+}
+
+/** @return -1 if the router failed */
+static int bench_blocking(struct bench_router* r, int fd)
+{
+        uint8_t* cmd;
+        int len, ret;
+
+        for (;;) {
+                ret = sr_rx_fill(&r->rx, fd);
+                r->calls++;
+                if (ret == 0) return 0;
+                if (ret < 0) return -1;
+                while ((cmd = sr_rx_next(&r->rx, &len))) {
+                        if (bench_echo(r, cmd, len, 0, fd) == -1) return -1;
+                }
+                if (len < 0) return -1;
+                if (r->tx.frames) {
+                        r->calls++;
+                        if (sr_tx_flush(&r->tx, fd) == -1) return -1;
+                }
+        }
+}
+
+static int bench_epoll(struct bench_router* r, int fd)
+{
+        struct epoll_event e;
+        uint8_t* cmd;
+        int ep, len, ret, burst;
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ep = epoll_create1(0);
+        e.events = EPOLLIN;
+        e.data.fd = fd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, fd, &e);
+        for (;;) {
+                r->calls++;
+                if (epoll_wait(ep, &e, 1, -1) == -1 && errno != EINTR) return -1;
+                /* room for the backlog: read again once it has gone */
+                if (e.events & EPOLLOUT) {
+                        r->calls++;
+                        if (sr_tx_flush(&r->tx, fd) == -1) return -1;
+                        if (sr_tx_backlog(&r->tx)) continue;
+                        e.events = EPOLLIN;
+                        epoll_ctl(ep, EPOLL_CTL_MOD, fd, &e);
+                        continue;
+                }
+                for (burst = 0; burst < BENCH_BURST; burst++) {
+                        ret = sr_rx_fill(&r->rx, fd);
+                        r->calls++;
+                        if (ret == -1 && errno == EAGAIN) break;
+                        if (ret == 0) {
+                                close(ep);
+                                return 0;
+                        }
+                        if (ret < 0) return -1;
+                        while ((cmd = sr_rx_next(&r->rx, &len))) {
+                                if (bench_echo(r, cmd, len, 0, fd) == -1) return -1;
+                        }
+                        if (len < 0) return -1;
+                        if (r->tx.frames) {
+                                r->calls++;
+                                if (sr_tx_flush(&r->tx, fd) == -1) return -1;
+                        }
+                        if (sr_tx_backlog(&r->tx)) {
+                                e.events = EPOLLOUT;
+                                epoll_ctl(ep, EPOLL_CTL_MOD, fd, &e);
+                                break;
+                        }
+                }
+        }
+}
+
+/** handle up to a burst of chunks: @return 1 when the server hung up */
+static int bench_uring_handle(struct bench_router* r)
+{
+        uint8_t* cmd, * data;
+        size_t left;
+        int len, ret, burst;
+
+        for (burst = 0; burst < BENCH_BURST; burst++) {
+                if ((ret = sr_uring_recv(&r->u, &data, &left)) == 0) return 0;
+                if (ret < 0) return errno ? -1 : 1;
+                while ((cmd = sr_rx_next_from(&r->rx, &data, &left, &len))) {
+                        if (bench_echo(r, cmd, len, !sr_uring_owns(&r->u, cmd, len), -1) == -1) return -1;
+                }
+                sr_uring_done(&r->u);
+                if (len < 0) return -1;
+        }
+        return 0;
+}
+
+static int bench_uring(struct bench_router* r, int fd)
+{
+        struct epoll_event e;
+        unsigned long enters;
+        int ep, ret, round;
+
+        if (sr_uring_init(&r->u, fd) == -1) {
+                perror("io_uring");
+                return -1;
+        }
+        ep = epoll_create1(0);
+        e.events = EPOLLIN;
+        e.data.fd = r->u.fd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, r->u.fd, &e);
+        for (ret = 0; ret == 0; ) {
+                r->calls++;
+                if (epoll_wait(ep, &e, 1, -1) == -1 && errno != EINTR) return -1;
+                /* as sr_uring_event then sr_uring_flush_packets */
+                ret = bench_uring_handle(r);
+                for (round = 0; ret == 0 && round < BENCH_BURST; round++) {
+                        if (sr_uring_flush(&r->u, &r->tx) == -1) return -1;
+                        if (!sr_uring_ready(&r->u)) break;
+                        ret = bench_uring_handle(r);
+                }
+                if (ret == 0 && round == BENCH_BURST) sr_uring_wake(&r->u);
+        }
+        if (ret == 1 && sr_uring_flush(&r->u, &r->tx) == -1) ret = -1;
+        enters = r->u.enters;
+        sr_uring_close(&r->u);
+        close(ep);
+        r->calls += enters;
+        return ret == 1 ? 0 : -1;
+}
+
+/**
+ * push n packets through one of the paths
+ * @return seconds taken
+ */
+static double bench_run(const char* name, int (*router)(struct bench_router*, int), int n, int frame)
+{
+        static struct bench_router r;
+        pid_t pids[2];
+        int fd, status, ok = 1, i;
+        double t0, t;
+
+        memset(&r, 0, sizeof(r));
+        sr_rx_init(&r.rx);
+        sr_tx_init(&r.tx);
+        fd = bench_spawn(pids, n, frame);
+        t0 = bench_now();
+        if (router(&r, fd) == -1) {
+                fprintf(stderr, "BENCH: %s: router failed after %lu packets\n", name, r.packets);
+                ok = 0;
+        }
+        close(fd);
+        sr_tx_close(&r.tx);
+        t = bench_now() - t0;
+        for (i = 0; i < 2; i++) {
+                waitpid(pids[i], &status, 0);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = 0;
+        }
+        if (!ok || r.packets != n) {
+                fprintf(stderr, "BENCH: %s: %lu of %d packets echoed correctly\n", name, r.packets, n);
+                exit(1);
+        }
+        if (frame) {
+                printf("%-9s %d packets of %d bytes: %.3f syscalls and %6.1f ns per packet (%.0f packets/s)\n",
+                        name, n, frame, (double) r.calls / n, t / n * 1e9, n / t);
+        } else {
+                printf("%-9s %d packets of random sizes: all echoed intact, %lu copied\n",
+                        name, n, r.tx.copied);
+        }
+        return t;
+}
+
+int main(int argc, char** argv)
+{
+        int n = argc > 1 ? atoi(argv[1]) : 1000000;
+        struct sr_uring probe;
+        int sv[2], uring;
+
+        signal(SIGPIPE, SIG_IGN);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        if ((uring = sr_uring_init(&probe, sv[0]) == 0)) sr_uring_close(&probe);
+        else printf("io_uring is not available (%s): only timing blocking and epoll\n", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+
+        bench_run("blocking", bench_blocking, BENCH_CHECKED, 0);
+        bench_run("epoll", bench_epoll, BENCH_CHECKED, 0);
+        if (uring) bench_run("io_uring", bench_uring, BENCH_CHECKED, 0);
+
+        bench_run("blocking", bench_blocking, n, BENCH_FRAME);
+        bench_run("epoll", bench_epoll, n, BENCH_FRAME);
+        if (uring) bench_run("io_uring", bench_uring, n, BENCH_FRAME);
+        return 0;
+}
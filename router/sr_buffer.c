@@ -2,48 +2,64 @@
  * @author Cal Woodruff <cwoodruf@sfu.ca>
  * shared packet buffer for router
  */
+#define SR_LOG_MODULE SR_LOG_BUFFER
+
 #include <assert.h>
 #include <stdlib.h>
-#include <time.h>
 #include <string.h>
+#include <stdio.h>
 #include "sr_router.h"
 #include "sr_buffer.h"
 /**
  * our versions of malloc and free that 
  * use a fixed array to avoid memory corruption problems
+ *
+ * unused slots are kept on a stack so both are O(1)
+ * @return a slot or NULL if every slot is in use
  */
 struct sr_buffer_item* sr_buffer_malloc(struct sr_instance* sr) 
 {
+        struct sr_buffer* buf;
         struct sr_buffer_item* b;
-        int i;
+        int i, inuse;
 
         assert(sr);
+        buf = &sr_fwd(sr)->buffer;
 
-        for (i=0; i<BUFFSIZE; i++) {
-                b = &sr->buffer.items[i];
-                if (b->h.buffered == 0) {
-                        b->h.raw = sr->buffer.packets[i];
-                        b->h.buffered = 1;
-                        b->pos = i;
-                        return b;
-                }
+        if (buf->nfree == 0) return NULL;
+        /* a router that never waits on arp never needs the pool */
+        if (!buf->packets && !(buf->packets = malloc(BUFFSIZE * sizeof(buf->packets[0])))) {
+                perror("malloc(..):sr_buffer.c::sr_buffer_malloc");
+                return NULL;
         }
-        return NULL;
+
+        i = buf->freelist[ --buf->nfree ];
+        b = &buf->items[i];
+        b->h.raw = buf->packets[i];
+        b->h.buffered = 1;
+        b->pos = i;
+
+        inuse = BUFFSIZE - buf->nfree;
+        if (inuse > buf->highwater) buf->highwater = inuse;
+        return b;
 }
 
+/**
+ * put a slot back on the stack: the packet bytes are left as they are 
+ * since the next user copies a whole packet over them anyway
+ */
 void sr_buffer_free(struct sr_instance* sr, struct sr_buffer_item* item) 
 {
+        struct sr_fwd* fwd = sr_fwd(sr);
         assert(sr);
-/*
-        if (!item->h.buffered) return;
-        if (item->pos < 0 || item->pos >= BUFFSIZE) return;
-*/
+        assert(item->h.buffered);
+        assert(item->pos >= 0 && item->pos < BUFFSIZE);
 
-        memset(
-		&sr->buffer.packets[item->pos],
-        	0,
-		VNSCMDSIZE+MPADDING
-	);
+        fwd->buffer.freelist[ fwd->buffer.nfree++ ] = item->pos;
+        if (item->held) {
+                sr->io->release(sr, item->h.raw);
+                item->held = 0;
+        }
 
         item->h.buffered = 0;
 	item->h.pkt = 0;
@@ -52,23 +68,100 @@ void sr_buffer_free(struct sr_instance* sr, struct sr_buffer_item* item)
 	item->next = 0;
 	item->prev = 0;
 }
+/**
+ * append an item to the queue of packets waiting on an arp entry
+ */
+static void sr_buffer_enqueue(struct sr_buffer_item* item, struct sr_arp* arp) 
+{
+        assert(item);
+        assert(arp);
+        assert(!item->arp);
+
+        item->arp = arp;
+        item->qnext = 0;
+        item->qprev = arp->pending_end;
+        if (arp->pending_end) arp->pending_end->qnext = item;
+        else arp->pending = item;
+        arp->pending_end = item;
+}
+/**
+ * take an item off its arp entry's queue
+ */
+static void sr_buffer_dequeue(struct sr_buffer_item* item) 
+{
+        struct sr_arp* arp = item->arp;
+
+        if (!arp) return;
+        if (item->qprev) item->qprev->qnext = item->qnext;
+        else arp->pending = item->qnext;
+        if (item->qnext) item->qnext->qprev = item->qprev;
+        else arp->pending_end = item->qprev;
+        item->arp = 0;
+        item->qprev = item->qnext = 0;
+}
+/**
+ * detach every packet waiting on an arp entry 
+ * @return the first item, the rest follow on qnext
+ */
+struct sr_buffer_item* sr_buffer_take(struct sr_arp* arp) 
+{
+        struct sr_buffer_item* item,* first;
+
+        assert(arp);
+        first = arp->pending;
+        for (item = first; item; item = item->qnext) item->arp = 0;
+        arp->pending = arp->pending_end = 0;
+        return first;
+}
+/**
+ * timer callback: the packet has waited PACKET_TOO_OLD seconds for arp
+ */
+void sr_buffer_timeout(struct sr_instance* sr, struct sr_timer* t) 
+{
+        struct sr_buffer_item* item = sr_timer_entry(t, struct sr_buffer_item, timer);
+
+        Trace("BUFFER: packet too old - deleting\n");
+        sr_buffer_remove(sr, item);
+}
 /**
  * initialize the buffer for the interface
+ * the packet pool is given back until a packet needs it again
  */
 void sr_buffer_clear(struct sr_instance* sr) 
 {
+        struct sr_fwd* fwd = sr_fwd(sr);
 	int i;
         assert(sr);
-        memset(&sr->buffer,0,sizeof(struct sr_buffer));
-        sr->buffer.start = sr->buffer.end = 0;
+        free(fwd->buffer.packets);
+        fwd->buffer.packets = 0;
+        memset(fwd->buffer.items,0,sizeof(fwd->buffer.items));
+        fwd->buffer.start = fwd->buffer.end = 0;
 	for (i=0; i<BUFFSIZE; i++) {
-		sr->buffer.items[i].pos = -1;
+		fwd->buffer.items[i].pos = -1;
+		/* hand out the low slots first */
+		fwd->buffer.freelist[i] = BUFFSIZE - 1 - i;
 	}
+	fwd->buffer.nfree = BUFFSIZE;
+	fwd->buffer.highwater = 0;
+	fwd->buffer.dropped = 0;
+}
+/**
+ * print how full the buffer has been
+ */
+void sr_buffer_print_stats(struct sr_instance* sr) 
+{
+        struct sr_fwd* fwd = sr_fwd(sr);
+        assert(sr);
+        printf("BUFFER: %d of %d slots in use, high water mark %d, %lu packets dropped\n",
+                BUFFSIZE - fwd->buffer.nfree, BUFFSIZE, 
+                fwd->buffer.highwater, fwd->buffer.dropped);
 }
 /** 
- * save a packet to the buffer 
+ * save a packet to the buffer until arp has an answer for its next hop
+ * a packet that is already buffered just goes back on the arp entry's queue
+ * @return 1 if the packet is buffered, 0 if there was no room for it
  */
-void sr_buffer_add(struct sr_ip_handle* h) 
+int sr_buffer_add(struct sr_ip_handle* h, struct sr_arp* arp) 
 {
         struct sr_instance* sr;
         struct sr_buffer* b;
@@ -77,33 +170,47 @@ void sr_buffer_add(struct sr_ip_handle* h)
         struct ip* ip;
 
         assert(h);
+        assert(arp);
         if (h->buffered) {
-                Debug("BUFFER: packet already buffered\n");
-                return;
+                Trace("BUFFER: packet already buffered\n");
+                /* h is the first member of its buffer item */
+                i = (struct sr_buffer_item*)h;
+                if (!i->arp) sr_buffer_enqueue(i, arp);
+                return 1;
         }
 
         sr = h->sr;
         assert(sr);
-        b = &sr->buffer;
+        b = &sr_fwd(sr)->buffer;
 
         i = sr_buffer_malloc(sr);
-	raw = i->h.raw;
         if (!i) {
-                Debug("BUFFER: out of memory for buffer item - aborting!\n");
-                return;
+                b->dropped++;
+                sr_flight_trigger(&sr->flight, SR_FLIGHT_BUFFER);
+                sr_log_limit(SR_LOG_BUFFER, SR_LOG_DEBUG, "BUFFER: all %d slots in use - dropping packet\n", BUFFSIZE);
+                return 0;
         }
+	raw = i->h.raw;
         h->buffered = 1;
         i->h = *h;
-	i->h.raw = raw;
-        memcpy(i->h.raw, h->raw, h->raw_len);
+        /* frames the backend can keep where they are are not copied */
+        if (sr->io->hold && sr->io->hold(sr, h->raw)) {
+                i->held = 1;
+        } else {
+	        i->h.raw = raw;
+                i->h.raw_size = sizeof(b->packets[0]);
+                memcpy(i->h.raw, h->raw, h->raw_len);
+        }
         i->h.pkt = (struct sr_ip_packet*)i->h.raw;
-        time(&i->created);
+        i->created = sr_timer_now(&sr_fwd(sr)->timers);
         i->next = 0;
+        sr_buffer_enqueue(i, arp);
+        sr_timer_add(&sr_fwd(sr)->timers, &i->timer, sr_buffer_timeout, i->created + PACKET_TOO_OLD * 1000);
 
         ip = &i->h.pkt->ip;
-        Debug("BUFFER: saving packet (proto %d", ip->ip_p);
-        Debug(" src %s, ", inet_ntoa(ip->ip_src));
-        Debug("dst %s)\n", inet_ntoa(ip->ip_dst));
+        Trace("BUFFER: saving packet (proto %d", ip->ip_p);
+        Trace(" src %s, ", inet_ntoa(ip->ip_src));
+        Trace("dst %s)\n", inet_ntoa(ip->ip_dst));
         /* we are only item in list */
         if (!b->start)  {
                 b->start = i;
@@ -116,6 +223,7 @@ void sr_buffer_add(struct sr_ip_handle* h)
         }
         /* increment end of list */
         b->end = i;
+        return 1;
 }
 
 /** 
@@ -127,7 +235,7 @@ void sr_buffer_remove(struct sr_instance* sr, struct sr_buffer_item* item)
         struct sr_buffer* b;
 
         assert(sr);
-        b = &sr->buffer;
+        b = &sr_fwd(sr)->buffer;
 
         if (item) {
                 delitem = item;
@@ -144,6 +252,8 @@ void sr_buffer_remove(struct sr_instance* sr, struct sr_buffer_item* item)
                 } else {
                         b->end = b->start = 0;
                 }
+                sr_buffer_dequeue(delitem);
+                sr_timer_cancel(&sr_fwd(sr)->timers, &delitem->timer);
                 sr_buffer_free(sr,delitem);
         }
 }
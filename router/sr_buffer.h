@@ -7,6 +7,9 @@
 #define SR_BUFFER_H
 
 #include "vnscommand.h"
+#include "sr_timer.h"
+
+struct sr_arp;
 
 /** hold packets for this many seconds if they are buffered */
 #define PACKET_TOO_OLD 6
@@ -20,27 +23,42 @@ struct sr_ip_handle {
     struct sr_instance*         sr;
     uint8_t*                    raw;
     unsigned int                raw_len;
+    unsigned int                raw_size; /** bytes at raw that may be written */
     struct sr_ip_packet*        pkt;
     unsigned int                len;
     struct sr_if*               iface;
     uint8_t                     buffered;
 };
 
+/**
+ * buffered packets sit on two lists: the buffer's list in order of arrival
+ * (used to age them out) and the queue of the arp entry they are waiting on
+ */
 struct sr_buffer_item 
 {
-        struct sr_ip_handle h;
-        time_t created;
+        struct sr_ip_handle h; /** must be first: see sr_buffer_add */
+        uint64_t created; /** ms on the monotonic clock: see sr_timer.h */
+        struct sr_timer timer; /** drops the packet PACKET_TOO_OLD after created */
         struct sr_buffer_item* prev;
         struct sr_buffer_item* next;
+        struct sr_arp* arp; /** arp entry whose queue we are on, if any */
+        struct sr_buffer_item* qprev;
+        struct sr_buffer_item* qnext;
         int    pos;
+        uint8_t held; /** h.raw is a frame the backend kept for us, not packets[pos]: see sr_io.h */
 };
 
 struct sr_buffer 
 {
         struct sr_buffer_item items[BUFFSIZE];
-        uint8_t packets[BUFFSIZE][VNSCMDSIZE+MPADDING];
+        /** BUFFSIZE packets, most of a router's memory: allocated when first needed */
+        uint8_t (*packets)[VNSCMDSIZE+MPADDING];
         struct sr_buffer_item* start;
         struct sr_buffer_item* end;
+        uint16_t freelist[BUFFSIZE]; /** stack of unused slots in items and packets */
+        int nfree; /** number of slots on the freelist */
+        int highwater; /** most slots ever in use at once */
+        unsigned long dropped; /** packets lost because every slot was in use */
 };
 
 #endif
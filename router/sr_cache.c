@@ -0,0 +1,54 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * destination cache: see sr_cache.h
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "sr_arp.h"
+#include "sr_cache.h"
+
+/**
+ * empty the cache and reset its counters
+ */
+void sr_cache_clear(struct sr_cache* c)
+{
+        assert(c);
+        memset(c, 0, sizeof(struct sr_cache));
+        c->gen = 1;
+}
+/**
+ * remember the route and resolved arp entry used for dst
+ */
+void sr_cache_put(struct sr_cache* c, uint32_t dst, struct sr_rt* route, const struct sr_arp* arp)
+{
+        struct sr_cache_entry* e;
+
+        assert(c);
+        assert(route);
+        assert(arp);
+
+        e = sr_cache_slot(c, dst);
+        e->dst = dst;
+        e->gen = c->gen;
+        e->route = route;
+        memcpy(e->eth, arp->eth, sizeof(e->eth));
+}
+/**
+ * print hit and miss counts so the cache can be sized
+ */
+void sr_cache_print_stats(struct sr_cache* c)
+{
+        uint64_t total;
+
+        assert(c);
+        total = c->hits + c->misses;
+        printf("CACHE: %d slots, %llu hits, %llu misses (%.1f%% hit rate), %llu flushes\n",
+                SR_CACHE_SIZE,
+                (unsigned long long) c->hits,
+                (unsigned long long) c->misses,
+                total ? 100.0 * c->hits / total : 0.0,
+                (unsigned long long) c->flushes);
+}
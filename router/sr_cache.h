@@ -0,0 +1,75 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * destination cache that sits in front of sr_rt_find and sr_arp_get
+ *
+ * most traffic goes to a handful of destinations so we remember which
+ * route and which resolved arp entry each destination ip used last time.
+ * the cache is direct mapped and is flushed as a whole by bumping a
+ * generation number whenever the routing or arp tables change.
+ */
+#ifndef SR_CACHE_H
+#define SR_CACHE_H
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+/** number of cache slots: must be a power of 2 */
+#ifndef SR_CACHE_SIZE
+#define SR_CACHE_SIZE 1024
+#endif
+
+struct sr_rt;
+struct sr_arp;
+
+struct sr_cache_entry
+{
+        uint32_t dst;           /** destination ip (network byte order) */
+        uint32_t gen;           /** cache generation this entry belongs to */
+        struct sr_rt* route;    /** egress interface and gateway */
+        /** the gateway's arp template, copied so a hit reads nothing else */
+        uint8_t eth[16] __attribute__ ((aligned (16)));
+};
+
+struct sr_cache
+{
+        struct sr_cache_entry entries[SR_CACHE_SIZE];
+        uint32_t gen;           /** entries from other generations are stale */
+        uint32_t routes;        /** the routing table's rt_gen when last flushed */
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t flushes;
+};
+
+/** multiplicative hash so neighbouring addresses spread over the slots */
+static inline struct sr_cache_entry* sr_cache_slot(struct sr_cache* c, uint32_t dst)
+{
+        return &c->entries[ (ntohl(dst) * 2654435761U) >> 16 & (SR_CACHE_SIZE - 1) ];
+}
+
+/** @return the cached entry for dst or 0 on a miss */
+static inline struct sr_cache_entry* sr_cache_find(struct sr_cache* c, uint32_t dst)
+{
+        struct sr_cache_entry* e = sr_cache_slot(c, dst);
+
+        if (e->dst == dst && e->gen == c->gen) {
+                c->hits++;
+                return e;
+        }
+        c->misses++;
+        return 0;
+}
+
+/** forget everything: call whenever routes or arp entries change */
+static inline void sr_cache_flush(struct sr_cache* c)
+{
+        c->flushes++;
+        /* generation 0 marks never used slots so skip it on wrap around */
+        if (++c->gen == 0) c->gen = 1;
+}
+
+void sr_cache_clear(struct sr_cache* c);
+void sr_cache_put(struct sr_cache* c, uint32_t dst, struct sr_rt* route, const struct sr_arp* arp);
+void sr_cache_print_stats(struct sr_cache* c);
+
+#endif
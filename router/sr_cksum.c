@@ -0,0 +1,241 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * internet checksum kernels and runtime dispatch: see sr_cksum.h
+ *
+ * the sums are done in whatever byte order the machine uses (RFC 1071
+ * section 2B) with loads done through memcpy so buffers of any alignment
+ * and length are fine and nothing past the end of the buffer is read.
+ */
+#include <string.h>
+#include "sr_cksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_CKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+/** the vector kernels empty their 32 bit lanes at least this often */
+#define SR_CKSUM_CHUNK 65536
+
+static uint16_t sr_cksum_probe(const void* data, size_t len);
+uint16_t (*sr_cksum_sum)(const void* data, size_t len) = sr_cksum_probe;
+static const char* sr_cksum_selected = "none";
+
+/** squash a 64 bit running sum back into 16 bits with end around carry */
+static inline uint16_t sr_cksum_fold(uint64_t sum)
+{
+        sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+        sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        return (uint16_t) sum;
+}
+
+/** add bytes to sum 32 bits at a time: 2^16 = 1 mod 0xFFFF so this is fine */
+static inline uint64_t sr_cksum_add(const uint8_t* p, size_t len, uint64_t sum)
+{
+        uint32_t w0, w1, w2, w3;
+        uint16_t h;
+
+        while (len >= 16) {
+                memcpy(&w0, p, 4);
+                memcpy(&w1, p + 4, 4);
+                memcpy(&w2, p + 8, 4);
+                memcpy(&w3, p + 12, 4);
+                sum += (uint64_t) w0 + w1 + w2 + w3;
+                p += 16;
+                len -= 16;
+        }
+        while (len >= 4) {
+                memcpy(&w0, p, 4);
+                sum += w0;
+                p += 4;
+                len -= 4;
+        }
+        if (len >= 2) {
+                memcpy(&h, p, 2);
+                sum += h;
+                p += 2;
+                len -= 2;
+        }
+        if (len) {
+                /* pad the last byte with a zero byte in memory order */
+                h = 0;
+                memcpy(&h, p, 1);
+                sum += h;
+        }
+        return sum;
+}
+
+/**
+ * the original algorithm: add up each 16 bit word
+ */
+uint16_t sr_cksum_scalar(const void* data, size_t len)
+{
+        const uint8_t* p = data;
+        uint64_t sum = 0;
+        uint16_t h;
+
+        while (len >= 2) {
+                memcpy(&h, p, 2);
+                sum += h;
+                p += 2;
+                len -= 2;
+        }
+        if (len) {
+                h = 0;
+                memcpy(&h, p, 1);
+                sum += h;
+        }
+        return sr_cksum_fold(sum);
+}
+
+/**
+ * portable version: 32 bit words into a 64 bit accumulator
+ */
+uint16_t sr_cksum_generic(const void* data, size_t len)
+{
+        return sr_cksum_fold(sr_cksum_add(data, len, 0));
+}
+
+static int sr_cksum_always(void) { return 1; }
+
+#ifdef SR_CKSUM_X86
+/**
+ * SSE2: widen each 16 bit word to a 32 bit lane and add 64 bytes a turn
+ */
+__attribute__ ((target ("sse2")))
+static uint16_t sr_cksum_sse2(const void* data, size_t len)
+{
+        const uint8_t* p = data;
+        const __m128i zero = _mm_setzero_si128();
+        uint32_t lanes[4];
+        uint64_t sum = 0;
+        size_t chunk;
+        __m128i acc, v0, v1, v2, v3;
+
+        while (len >= 64) {
+                chunk = len < SR_CKSUM_CHUNK ? len & ~(size_t) 63 : SR_CKSUM_CHUNK;
+                len -= chunk;
+                acc = zero;
+                for (; chunk; chunk -= 64, p += 64) {
+                        v0 = _mm_loadu_si128((const __m128i*) p);
+                        v1 = _mm_loadu_si128((const __m128i*) (p + 16));
+                        v2 = _mm_loadu_si128((const __m128i*) (p + 32));
+                        v3 = _mm_loadu_si128((const __m128i*) (p + 48));
+                        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v0, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v0, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v1, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v1, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v2, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v2, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v3, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v3, zero));
+                }
+                _mm_storeu_si128((__m128i*) lanes, acc);
+                sum += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+        return sr_cksum_fold(sr_cksum_add(p, len, sum));
+}
+static int sr_cksum_has_sse2(void) { return __builtin_cpu_supports("sse2"); }
+
+/**
+ * AVX2: as for SSE2 but 32 bytes per load and 128 bytes a turn
+ */
+__attribute__ ((target ("avx2")))
+static uint16_t sr_cksum_avx2(const void* data, size_t len)
+{
+        const uint8_t* p = data;
+        const __m256i zero = _mm256_setzero_si256();
+        uint32_t lanes[8];
+        uint64_t sum = 0;
+        size_t chunk;
+        int i;
+        __m256i acc, v0, v1, v2, v3;
+
+        while (len >= 128) {
+                chunk = len < SR_CKSUM_CHUNK ? len & ~(size_t) 127 : SR_CKSUM_CHUNK;
+                len -= chunk;
+                acc = zero;
+                for (; chunk; chunk -= 128, p += 128) {
+                        v0 = _mm256_loadu_si256((const __m256i*) p);
+                        v1 = _mm256_loadu_si256((const __m256i*) (p + 32));
+                        v2 = _mm256_loadu_si256((const __m256i*) (p + 64));
+                        v3 = _mm256_loadu_si256((const __m256i*) (p + 96));
+                        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v0, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v0, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v1, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v1, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v2, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v2, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v3, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v3, zero));
+                }
+                _mm256_storeu_si256((__m256i*) lanes, acc);
+                for (i = 0; i < 8; i++) sum += lanes[i];
+        }
+        return sr_cksum_fold(sr_cksum_add(p, len, sum));
+}
+static int sr_cksum_has_avx2(void) { return __builtin_cpu_supports("avx2"); }
+#endif /* SR_CKSUM_X86 */
+
+/** best first: sr_cksum_probe takes the first one the cpu supports */
+static const struct sr_cksum_impl sr_cksum_table[] = {
+#ifdef SR_CKSUM_X86
+        { "avx2", sr_cksum_avx2, sr_cksum_has_avx2 },
+        { "sse2", sr_cksum_sse2, sr_cksum_has_sse2 },
+#endif
+        { "generic", sr_cksum_generic, sr_cksum_always },
+        { "scalar", sr_cksum_scalar, sr_cksum_always },
+        { 0, 0, 0 }
+};
+
+/**
+ * list of implementations built into this binary, ending with a null name
+ */
+const struct sr_cksum_impl* sr_cksum_impls(void)
+{
+        return sr_cksum_table;
+}
+
+/**
+ * switch sr_cksum_sum to a named implementation
+ * @return 1 on success, 0 if it is unknown or the cpu lacks support
+ */
+int sr_cksum_select(const char* name)
+{
+        const struct sr_cksum_impl* i;
+
+        for (i = sr_cksum_table; i->name; i++) {
+                if (strcmp(i->name, name) == 0 && i->supported()) {
+                        sr_cksum_sum = i->sum;
+                        sr_cksum_selected = i->name;
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+const char* sr_cksum_name(void)
+{
+        return sr_cksum_selected;
+}
+
+/** first call: pick the best kernel then hand this sum over to it */
+static uint16_t sr_cksum_probe(const void* data, size_t len)
+{
+        const struct sr_cksum_impl* i;
+
+#ifdef SR_CKSUM_X86
+        __builtin_cpu_init();
+#endif
+        for (i = sr_cksum_table; i->name; i++) {
+                if (i->supported()) {
+                        sr_cksum_sum = i->sum;
+                        sr_cksum_selected = i->name;
+                        break;
+                }
+        }
+        return sr_cksum_sum(data, len);
+}
@@ -0,0 +1,39 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * internet checksum engine (RFC 1071 one's complement sum)
+ *
+ * there are several implementations of the sum: the original 16 bit word
+ * loop, a portable loop accumulating 32 bit words in 64 bits and on x86
+ * SSE2 and AVX2 versions. the best one the cpu supports is picked the
+ * first time sr_cksum_sum is called.
+ *
+ * all of them sum the data as it sits in memory so the result can be
+ * stored straight into a packet without byte swapping. an odd final byte
+ * is padded with a zero byte as the RFC requires.
+ */
+#ifndef SR_CKSUM_H
+#define SR_CKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** one implementation of the 16 bit one's complement sum (not inverted) */
+struct sr_cksum_impl
+{
+        const char* name;
+        uint16_t (*sum)(const void* data, size_t len);
+        int (*supported)(void);
+};
+
+/** the implementation in use: starts out pointing at the cpu probe */
+extern uint16_t (*sr_cksum_sum)(const void* data, size_t len);
+
+uint16_t sr_cksum_scalar(const void* data, size_t len);
+uint16_t sr_cksum_generic(const void* data, size_t len);
+
+const struct sr_cksum_impl* sr_cksum_impls(void);
+int sr_cksum_select(const char* name);
+const char* sr_cksum_name(void);
+
+#endif
@@ -0,0 +1,206 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * commands read from a fifo while the router runs: see sr_control.h
+ */
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "sr_router.h"
+#include "sr_event.h"
+#include "sr_io.h"
+#include "sr_rt.h"
+#include "sr_control.h"
+
+struct sr_control_cmd
+{
+        const char* name;
+        void (*fn)(struct sr_instance* sr, char* args);
+        const char* help;
+};
+
+static void sr_control_help(struct sr_instance* sr, char* args);
+
+static void sr_control_dump(struct sr_instance* sr, char* args)
+{
+        if (!sr->flight.rings) {
+                printf("CONTROL: no flight recorder: start sr with -F\n");
+                return;
+        }
+        sr_flight_trigger(&sr->flight, SR_FLIGHT_CONTROL);
+}
+
+static void sr_control_stats(struct sr_instance* sr, char* args)
+{
+        if (sr->pcap.fd >= 0) sr_pcap_print_stats(&sr->pcap);
+        if (sr->flight.rings) sr_flight_print_stats(&sr->flight);
+        sr->io->print_stats(sr);
+        sr_event_print_stats(sr);
+        sr_cache_print_stats(&sr_fwd(sr)->cache);
+        sr_buffer_print_stats(sr);
+        sr_rt_print_stats(sr);
+        printf("CONTROL: %lu commands, %lu unknown\n", sr->control.commands, sr->control.unknown);
+}
+
+/**
+ * route add dest gw mask iface | route del dest mask | route load file
+ * change the routes while packets are being forwarded: with no args
+ * print them
+ */
+static void sr_control_route(struct sr_instance* sr, char* args)
+{
+        char op[8], a[32], b[32], c[32], iface[32];
+        struct in_addr dest, gw, mask;
+        int n = sscanf(args, "%7s %31s %31s %31s %31s", op, a, b, c, iface);
+
+        if (n <= 0) {
+                sr_print_routing_table(sr);
+        } else if (strcmp(op, "add") == 0 && n == 5 &&
+                   inet_aton(a, &dest) && inet_aton(b, &gw) && inet_aton(c, &mask)) {
+                if (sr_rt_add(sr, dest, gw, mask, iface) == 0) printf("CONTROL: route to %s/%s added\n", a, c);
+        } else if (strcmp(op, "del") == 0 && n == 3 && inet_aton(a, &dest) && inet_aton(b, &mask)) {
+                if (sr_rt_del(sr, dest, mask) == 0) printf("CONTROL: route to %s/%s deleted\n", a, b);
+                else printf("CONTROL: there is no route to %s/%s\n", a, b);
+        } else if (strcmp(op, "load") == 0 && n == 2) {
+                if (sr_rt_reload(sr, a) == 0) printf("CONTROL: routes replaced from %s\n", a);
+                else printf("CONTROL: routes from %s not loaded\n", a);
+        } else {
+                printf("CONTROL: route add dest gw mask iface | del dest mask | load file\n");
+        }
+}
+
+/** log levels: set them as for -g, with no args print them */
+static void sr_control_log(struct sr_instance* sr, char* args)
+{
+        if (*args && sr_log_set(args) == -1) return;
+        sr_log_print_levels();
+}
+
+static void sr_control_arp(struct sr_instance* sr, char* args)
+{
+        /* the workers' tables are theirs to change while we'd read them */
+        if (sr->pipe.workers) {
+                printf("CONTROL: each pipe worker has an arp table of its own\n");
+                return;
+        }
+        sr_arp_print_table(sr);
+}
+
+static const struct sr_control_cmd sr_control_cmds[] = {
+        { "dump", sr_control_dump, "write the flight recorder out to a pcap file" },
+        { "stats", sr_control_stats, "print the counters printed at exit" },
+        { "route", sr_control_route, "add, del or load routes: print them with no args" },
+        { "log", sr_control_log, "set log levels as for -g: print them with no args" },
+        { "arp", sr_control_arp, "print the arp table" },
+        { "help", sr_control_help, "list commands" },
+        { 0, 0, 0 }
+};
+
+static void sr_control_help(struct sr_instance* sr, char* args)
+{
+        const struct sr_control_cmd* c;
+
+        for (c = sr_control_cmds; c->name; c++) printf("CONTROL: %-8s %s\n", c->name, c->help);
+}
+
+/** run one line: the command name, then anything after it is its args */
+static void sr_control_run(struct sr_instance* sr, char* line)
+{
+        const struct sr_control_cmd* c;
+        char* args;
+        size_t n;
+
+        line += strspn(line, " \t\r");
+        if (!*line) return;
+        n = strcspn(line, " \t\r");
+        args = line + n + strspn(line + n, " \t\r");
+        line[n] = '\0';
+        for (c = sr_control_cmds; c->name; c++) {
+                if (strcmp(c->name, line) == 0) {
+                        sr->control.commands++;
+                        c->fn(sr, args);
+                        return;
+                }
+        }
+        sr->control.unknown++;
+        printf("CONTROL: unknown command \"%s\": try help\n", line);
+}
+
+/** the fifo is readable: run every complete line */
+static void sr_control_read(struct sr_instance* sr, int fd, uint32_t events, void* arg)
+{
+        struct sr_control* c = &sr->control;
+        char buf[SR_CONTROL_LINE];
+        ssize_t n;
+        int i, burst;
+
+        for (burst = 0; burst < SR_EVENT_BURST; burst++) {
+                if ((n = read(fd, buf, sizeof(buf))) <= 0) break;
+                for (i = 0; i < n; i++) {
+                        if (buf[i] != '\n') {
+                                /* too long: the rest of it is dropped */
+                                if (c->len < SR_CONTROL_LINE - 1) c->line[c->len++] = buf[i];
+                                continue;
+                        }
+                        c->line[c->len] = '\0';
+                        c->len = 0;
+                        sr_control_run(sr, c->line);
+                }
+        }
+        fflush(stdout);
+}
+
+/**
+ * make the fifo if it isn't there and start reading commands from it
+ * @return 0 or -1 if path is something other than a fifo or can't be opened
+ */
+int sr_control_open(struct sr_instance* sr, const char* path)
+{
+        struct sr_control* c;
+        struct stat st;
+
+        assert(sr);
+        assert(path);
+        c = &sr->control;
+        memset(c, 0, sizeof(*c));
+        c->fd = -1;
+        if (strlen(path) >= sizeof(c->path)) {
+                fprintf(stderr, "CONTROL: fifo name %s is too long\n", path);
+                return -1;
+        }
+        if (mkfifo(path, 0600) == -1 && errno != EEXIST) {
+                perror("mkfifo(..):sr_control.c::sr_control_open");
+                return -1;
+        }
+        if (stat(path, &st) == -1 || !S_ISFIFO(st.st_mode)) {
+                fprintf(stderr, "CONTROL: %s is not a fifo\n", path);
+                return -1;
+        }
+        if ((c->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1) {
+                perror("open(..):sr_control.c::sr_control_open");
+                return -1;
+        }
+        strcpy(c->path, path);
+        if (sr_event_add(sr, c->fd, EPOLLIN, sr_control_read, 0) == -1) {
+                sr_control_close(sr);
+                return -1;
+        }
+        return 0;
+}
+
+void sr_control_close(struct sr_instance* sr)
+{
+        struct sr_control* c = &sr->control;
+
+        assert(sr);
+        if (c->fd < 0) return;
+        sr_event_del(sr, c->fd);
+        close(c->fd);
+        c->fd = -1;
+        unlink(c->path);
+}
@@ -0,0 +1,36 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * control fifo (-C path)
+ *
+ * a named pipe the router reads one line commands from while it runs, eg
+ *
+ *   echo dump > sr.ctl
+ *
+ * it is opened read/write so the router is always one of its writers and
+ * never sees end of file when a client goes away. commands are read in the
+ * event loop like any other fd and looked up in the table in sr_control.c;
+ * "help" lists them. the fifo is removed when the router exits.
+ */
+#ifndef SR_CONTROL_H
+#define SR_CONTROL_H
+
+/** longest command line: longer ones are thrown away */
+#define SR_CONTROL_LINE 256
+
+struct sr_instance;
+
+struct sr_control
+{
+        int fd;                 /** -1 if there is no control fifo */
+        char path[108];
+        char line[SR_CONTROL_LINE]; /** a command that has not all arrived */
+        int len;
+        unsigned long commands;
+        unsigned long unknown;  /** lines that weren't a command we know */
+};
+
+int sr_control_open(struct sr_instance* sr, const char* path);
+void sr_control_close(struct sr_instance* sr);
+
+#endif
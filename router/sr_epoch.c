@@ -0,0 +1,115 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * epoch based reclamation: see sr_epoch.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "sr_epoch.h"
+
+void sr_epoch_init(struct sr_epoch* e)
+{
+        assert(e);
+        memset(e, 0, sizeof(*e));
+        e->now = 1;
+        e->tail = &e->retired;
+}
+
+/** @return a reader slot of its own for a thread or 0 if they are all taken */
+struct sr_epoch_reader* sr_epoch_register(struct sr_epoch* e)
+{
+        int i;
+
+        assert(e);
+        for (i = 0; i < SR_EPOCH_READERS; i++) {
+                if (e->reader[i].used) continue;
+                e->reader[i].used = 1;
+                e->reader[i].seen = 0;
+                if (i >= e->readers) __atomic_store_n(&e->readers, i + 1, __ATOMIC_RELEASE);
+                return &e->reader[i];
+        }
+        return 0;
+}
+
+void sr_epoch_unregister(struct sr_epoch_reader* r)
+{
+        if (!r) return;
+        sr_epoch_leave(r);
+        r->used = 0;
+}
+
+/**
+ * writer: ptr is no longer reachable by readers that enter from now on.
+ * free_fn(ptr) is called once the readers that might still have it leave
+ * @return 0 or -1 if there was no memory to remember it: it is then
+ * leaked rather than freed early
+ */
+int sr_epoch_retire(struct sr_epoch* e, void* ptr, void (*free_fn)(void*))
+{
+        struct sr_epoch_retired* r;
+
+        assert(e);
+        if (!ptr) return 0;
+        if (!(r = malloc(sizeof(*r)))) {
+                perror("malloc(..):sr_epoch.c::sr_epoch_retire");
+                return -1;
+        }
+        r->ptr = ptr;
+        r->free = free_fn;
+        r->next = 0;
+        /* the unlinking store that made ptr unreachable comes before this */
+        r->epoch = __atomic_add_fetch(&e->now, 1, __ATOMIC_SEQ_CST);
+        *e->tail = r;
+        e->tail = &r->next;
+        if (++e->pending > e->high) e->high = e->pending;
+        return 0;
+}
+
+/**
+ * writer: free everything no reader can still be using
+ * @return the number of things freed
+ */
+int sr_epoch_reclaim(struct sr_epoch* e)
+{
+        struct sr_epoch_retired* r;
+        uint64_t oldest = UINT64_MAX, seen;
+        int i, n, freed = 0;
+
+        assert(e);
+        if (!e->retired) return 0;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        n = __atomic_load_n(&e->readers, __ATOMIC_ACQUIRE);
+        for (i = 0; i < n; i++) {
+                seen = __atomic_load_n(&e->reader[i].seen, __ATOMIC_ACQUIRE);
+                if (seen && seen < oldest) oldest = seen;
+        }
+        while ((r = e->retired) && r->epoch <= oldest) {
+                e->retired = r->next;
+                if (r->free) r->free(r->ptr);
+                free(r);
+                freed++;
+        }
+        if (!e->retired) e->tail = &e->retired;
+        e->pending -= freed;
+        e->freed += freed;
+        if (freed) e->reclaims++;
+        return freed;
+}
+
+/** free everything retired: the readers must all be gone */
+void sr_epoch_close(struct sr_epoch* e)
+{
+        int i;
+
+        assert(e);
+        for (i = 0; i < e->readers; i++) sr_epoch_leave(&e->reader[i]);
+        sr_epoch_reclaim(e);
+}
+
+void sr_epoch_print_stats(struct sr_epoch* e)
+{
+        printf("EPOCH: epoch %llu, %lu freed in %lu reclaims, %lu waiting (at most %lu)\n",
+                (unsigned long long) e->now, e->freed, e->reclaims, e->pending, e->high);
+}
@@ -0,0 +1,83 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * epoch based reclamation for things readers use without locking
+ *
+ * the routing table (sr_rt.h) is changed while pipe workers (sr_pipe.h)
+ * are looking routes up in it. the writer never changes anything a reader
+ * might be looking at: it builds what is new off to the side, publishes it
+ * with one pointer store and retires what it replaced. something retired
+ * is only freed once every reader that could have seen it has moved on.
+ *
+ * readers say when they start and stop looking, once per batch of packets
+ * rather than per lookup: sr_epoch_enter notes the epoch it started in
+ * and sr_epoch_leave marks the reader as not looking at anything. every
+ * retire moves the epoch on and is stamped with the new one, so a reader
+ * that entered at that epoch or later came after the change and can't
+ * hold what was retired. sr_epoch_reclaim frees whatever is older than
+ * the oldest epoch a reader is in. readers that are out, asleep between
+ * batches say, hold nothing up.
+ *
+ * there is one writer at a time (the main thread). a reader that never
+ * leaves keeps everything retired after it entered: memory, not safety.
+ */
+#ifndef SR_EPOCH_H
+#define SR_EPOCH_H
+
+#include <stdint.h>
+
+/** readers that can be registered: a pipe's workers and then some */
+#define SR_EPOCH_READERS 64
+
+struct sr_epoch_reader
+{
+        uint64_t seen __attribute__ ((aligned (64))); /** epoch it entered in, 0 when out */
+        int used;
+};
+
+/** something retired but not freed yet */
+struct sr_epoch_retired
+{
+        void* ptr;
+        void (*free)(void*);
+        uint64_t epoch;         /** readers at or past this can't have it */
+        struct sr_epoch_retired* next;
+};
+
+struct sr_epoch
+{
+        uint64_t now __attribute__ ((aligned (64))); /** the current epoch, from 1 */
+        struct sr_epoch_reader reader[SR_EPOCH_READERS];
+        int readers;            /** reader[] used so far */
+        /* writer side: retired in epoch order, oldest first */
+        struct sr_epoch_retired* retired;
+        struct sr_epoch_retired** tail;
+        unsigned long pending;  /** retired and not freed yet */
+        unsigned long high;     /** most pending at once */
+        unsigned long freed;
+        unsigned long reclaims; /** sr_epoch_reclaim calls that freed something */
+};
+
+/** reader: about to look at shared things */
+static inline void sr_epoch_enter(struct sr_epoch* e, struct sr_epoch_reader* r)
+{
+        __atomic_store_n(&r->seen, __atomic_load_n(&e->now, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        /* the writer sees the epoch before we read anything it publishes */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/** reader: holding on to nothing shared any more */
+static inline void sr_epoch_leave(struct sr_epoch_reader* r)
+{
+        __atomic_store_n(&r->seen, 0, __ATOMIC_RELEASE);
+}
+
+void sr_epoch_init(struct sr_epoch* e);
+struct sr_epoch_reader* sr_epoch_register(struct sr_epoch* e);
+void sr_epoch_unregister(struct sr_epoch_reader* r);
+int sr_epoch_retire(struct sr_epoch* e, void* ptr, void (*free_fn)(void*));
+int sr_epoch_reclaim(struct sr_epoch* e);
+void sr_epoch_close(struct sr_epoch* e);
+void sr_epoch_print_stats(struct sr_epoch* e);
+
+#endif
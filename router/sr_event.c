@@ -0,0 +1,219 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * epoll event loop with a timerfd driving the timer wheel: see sr_event.h
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "sr_router.h"
+#include "sr_event.h"
+
+static struct sr_event_source* sr_event_find(struct sr_event_loop* ev, int fd)
+{
+        int i;
+
+        for (i = 0; i < SR_EVENT_MAX; i++) {
+                if (ev->sources[i].fd == fd) return &ev->sources[i];
+        }
+        return 0;
+}
+
+/** the timerfd went off: catch the timer wheel up */
+static void sr_event_tick(struct sr_instance* sr, int fd, uint32_t events, void* arg)
+{
+        uint64_t expirations;
+
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+        sr->events.ticks++;
+        if (expirations > 1) sr->events.missed += expirations - 1;
+        sr_timer_run(sr);
+}
+
+/**
+ * create the epoll instance and start the tick timer
+ * @return 0 on success, -1 on error
+ */
+int sr_event_init(struct sr_instance* sr)
+{
+        struct sr_event_loop* ev;
+        struct itimerspec its;
+        struct epoll_event e;
+        int i;
+
+        assert(sr);
+        ev = &sr->events;
+        memset(ev, 0, sizeof(struct sr_event_loop));
+        for (i = 0; i < SR_EVENT_MAX; i++) ev->sources[i].fd = -1;
+        ev->tfd = -1;
+
+        if ((ev->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+                perror("epoll_create1(..):sr_event.c::sr_event_init");
+                return -1;
+        }
+        if ((ev->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+                perror("timerfd_create(..):sr_event.c::sr_event_init");
+                sr_event_close(sr);
+                return -1;
+        }
+        memset(&its, 0, sizeof(its));
+        its.it_interval.tv_nsec = SR_TIMER_TICK_MS * 1000000L;
+        its.it_value = its.it_interval;
+        timerfd_settime(ev->tfd, 0, &its, 0);
+
+        ev->tick.fd = ev->tfd;
+        ev->tick.fn = sr_event_tick;
+        e.events = EPOLLIN;
+        e.data.ptr = &ev->tick;
+        if (epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->tfd, &e) == -1) {
+                perror("epoll_ctl(..):sr_event.c::sr_event_init");
+                sr_event_close(sr);
+                return -1;
+        }
+        return 0;
+}
+
+/**
+ * call fn whenever fd has any of events (EPOLLIN etc)
+ * @return 0 on success, -1 if the fd could not be added
+ */
+int sr_event_add(struct sr_instance* sr, int fd, uint32_t events, sr_event_fn fn, void* arg)
+{
+        struct sr_event_source* s;
+        struct epoll_event e;
+
+        assert(sr);
+        assert(fn);
+        assert(fd >= 0);
+
+        if (sr_event_find(&sr->events, fd)) {
+                fprintf(stderr, "EVENT: fd %d is already registered\n", fd);
+                return -1;
+        }
+        if (!(s = sr_event_find(&sr->events, -1))) {
+                fprintf(stderr, "EVENT: all %d event slots in use\n", SR_EVENT_MAX);
+                return -1;
+        }
+        e.events = events;
+        e.data.ptr = s;
+        if (epoll_ctl(sr->events.epfd, EPOLL_CTL_ADD, fd, &e) == -1) {
+                perror("epoll_ctl(..):sr_event.c::sr_event_add");
+                return -1;
+        }
+        s->fd = fd;
+        s->fn = fn;
+        s->arg = arg;
+        return 0;
+}
+
+/** change the events a registered fd is watched for (eg add EPOLLOUT) */
+int sr_event_mod(struct sr_instance* sr, int fd, uint32_t events)
+{
+        struct sr_event_source* s;
+        struct epoll_event e;
+
+        assert(sr);
+        if (!(s = sr_event_find(&sr->events, fd))) return -1;
+        e.events = events;
+        e.data.ptr = s;
+        return epoll_ctl(sr->events.epfd, EPOLL_CTL_MOD, fd, &e);
+}
+
+/** stop watching fd: closing it is up to the caller */
+int sr_event_del(struct sr_instance* sr, int fd)
+{
+        struct sr_event_source* s;
+
+        assert(sr);
+        if (!(s = sr_event_find(&sr->events, fd))) return -1;
+        epoll_ctl(sr->events.epfd, EPOLL_CTL_DEL, fd, 0);
+        /* events for it may still be in the batch being dispatched */
+        s->fd = -1;
+        s->fn = 0;
+        return 0;
+}
+
+/**
+ * one pass of the loop: wait up to timeout ms (-1 for as long as it
+ * takes) and dispatch whatever came in. sr_multi.c runs many routers'
+ * loops this way, a pass each when their epoll fd is readable
+ * @return 0, or -1 if epoll failed: the loop is stopped either way when
+ * a callback or the flush gave up
+ */
+int sr_event_poll(struct sr_instance* sr, int timeout)
+{
+        struct sr_event_loop* ev;
+        struct epoll_event e[SR_EVENT_BATCH];
+        struct sr_event_source* s;
+        int n, i;
+
+        assert(sr);
+        ev = &sr->events;
+        /* dumps asked for by signals, triggers or the last batch */
+        if (__atomic_load_n(&sr->flight.pending, __ATOMIC_RELAXED)) sr_flight_check(&sr->flight);
+        n = epoll_wait(ev->epfd, e, SR_EVENT_BATCH, timeout);
+        if (n == -1) {
+                if (errno == EINTR) return 0;
+                perror("epoll_wait(..):sr_event.c::sr_event_poll");
+                ev->running = 0;
+                return -1;
+        }
+        if (n == 0) return 0;
+        ev->wakeups++;
+        /* the batch's log messages go out in one write at the end */
+        sr_log_hold();
+        if (sr->pcap.fd >= 0 || sr->flight.rings) {
+                gettimeofday(&ev->now, 0);
+                ev->stamped = 1;
+        }
+        for (i = 0; i < n && ev->running; i++) {
+                s = e[i].data.ptr;
+                if (!s->fn) continue;
+                ev->events++;
+                s->fn(sr, s->fd, e[i].events, s->arg);
+        }
+        /* anything the callbacks or timers queued goes out now */
+        if (sr_flush_packets(sr) == -1) ev->running = 0;
+        ev->stamped = 0;
+        sr_log_flush();
+        return 0;
+}
+
+/**
+ * dispatch events until sr_event_stop is called
+ * @return 0 when stopped, -1 if epoll failed
+ */
+int sr_event_run(struct sr_instance* sr)
+{
+        assert(sr);
+        sr->events.running = 1;
+        while (sr->events.running) {
+                if (sr_event_poll(sr, -1) == -1) return -1;
+        }
+        return 0;
+}
+
+/** make sr_event_run return: safe to call from a signal handler */
+void sr_event_stop(struct sr_instance* sr)
+{
+        sr->events.running = 0;
+}
+
+void sr_event_close(struct sr_instance* sr)
+{
+        assert(sr);
+        if (sr->events.tfd != -1) close(sr->events.tfd);
+        if (sr->events.epfd != -1) close(sr->events.epfd);
+        sr->events.tfd = sr->events.epfd = -1;
+}
+
+void sr_event_print_stats(struct sr_instance* sr)
+{
+        struct sr_event_loop* ev = &sr->events;
+
+        printf("EVENT: %lu wakeups, %lu callbacks, %lu ticks (%lu missed)\n",
+                ev->wakeups, ev->events, ev->ticks, ev->missed);
+}
@@ -0,0 +1,70 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * epoll event loop
+ *
+ * the router used to block in recv on the VNS socket so timers only ran
+ * when a packet happened to arrive. now every file descriptor the router
+ * cares about is registered here with a callback and the loop sleeps in
+ * epoll_wait. a timerfd wakes it every SR_TIMER_TICK_MS to run the timer
+ * wheel (see sr_timer.h) whether or not anything else is happening.
+ *
+ * callbacks are expected to be non blocking and to drain their fd in
+ * bursts of at most SR_EVENT_BURST reads so one busy source can't starve
+ * the others or the timers.
+ *
+ * when packets are being logged (-l or -F) the clock is read once per
+ * wakeup into now and every packet of the batch is stamped with it.
+ */
+#ifndef SR_EVENT_H
+#define SR_EVENT_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/epoll.h>
+
+/** file descriptors that can be registered, not counting the timerfd */
+#define SR_EVENT_MAX 16
+/** events taken from the kernel per epoll_wait */
+#define SR_EVENT_BATCH 16
+/** reads a callback should do per wakeup before giving others a turn */
+#define SR_EVENT_BURST 8
+
+struct sr_instance;
+
+typedef void (*sr_event_fn)(struct sr_instance* sr, int fd, uint32_t events, void* arg);
+
+struct sr_event_source
+{
+        int fd;                 /** -1 if the slot is free */
+        sr_event_fn fn;
+        void* arg;
+};
+
+struct sr_event_loop
+{
+        int epfd;
+        int tfd;                /** timerfd for the timer wheel */
+        volatile sig_atomic_t running;
+        struct sr_event_source sources[SR_EVENT_MAX];
+        struct sr_event_source tick;
+        unsigned long wakeups;  /** returns from epoll_wait */
+        unsigned long events;   /** callbacks run */
+        unsigned long ticks;    /** timerfd expirations */
+        unsigned long missed;   /** expirations that piled up while busy */
+        struct timeval now;     /** time of the current batch if stamped */
+        int stamped;            /** now is set: packets logged in the batch use it */
+};
+
+int sr_event_init(struct sr_instance* sr);
+int sr_event_add(struct sr_instance* sr, int fd, uint32_t events, sr_event_fn fn, void* arg);
+int sr_event_mod(struct sr_instance* sr, int fd, uint32_t events);
+int sr_event_del(struct sr_instance* sr, int fd);
+int sr_event_poll(struct sr_instance* sr, int timeout);
+int sr_event_run(struct sr_instance* sr);
+void sr_event_stop(struct sr_instance* sr);
+void sr_event_close(struct sr_instance* sr);
+void sr_event_print_stats(struct sr_instance* sr);
+
+#endif
@@ -0,0 +1,355 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * flight recorder: an overwriting capture ring dumped on demand, see sr_flight.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include "sr_dumper.h"
+#include "sr_flight.h"
+
+static const char* sr_flight_reasons[SR_FLIGHT_REASONS] = {
+        "none", "signal", "control", "arp", "buffer"
+};
+
+/** bytes taken by the record at off */
+static inline size_t sr_flight_reclen(struct sr_flight_ring* r, size_t off)
+{
+        struct pcap_sf_pkthdr h;
+
+        memcpy(&h, r->data + off, sizeof(h));
+        return sizeof(h) + h.caplen;
+}
+
+/** throw away the oldest record */
+static inline void sr_flight_drop(struct sr_flight_ring* r)
+{
+        r->tail += sr_flight_reclen(r, r->tail);
+        r->count--;
+        r->overwritten++;
+        if (r->wrapped && r->tail == r->wrap) {
+                r->tail = 0;
+                r->wrapped = 0;
+        }
+}
+
+/** sizes like 65536, 512k, 64M or 1G */
+static size_t sr_flight_size(const char* s, char** end)
+{
+        unsigned long long n = strtoull(s, end, 10);
+
+        switch (**end) {
+        case 'g': case 'G': n <<= 10; /* fall through */
+        case 'm': case 'M': n <<= 10; /* fall through */
+        case 'k': case 'K': n <<= 10; (*end)++;
+        }
+        return n;
+}
+
+/**
+ * allocate the rings
+ * @param spec size[,seconds[,prefix]] eg 64M,30,/tmp/sr
+ * @param rings threads that will record: each is given a ring number below this
+ * @return 0 or -1 if spec is no good or there is no memory
+ */
+int sr_flight_open(struct sr_flight* f, const char* spec, int snaplen, int rings)
+{
+        char* end;
+        int i;
+
+        assert(f);
+        assert(spec);
+        memset(f, 0, sizeof(*f));
+        f->snaplen = snaplen;
+        f->size = sr_flight_size(spec, &end);
+        if (*end == ',') f->age = strtol(end + 1, &end, 10);
+        if (*end == ',') snprintf(f->prefix, sizeof(f->prefix), "%s", end + 1);
+        else if (*end) f->size = 0;
+        if (!f->prefix[0]) snprintf(f->prefix, sizeof(f->prefix), "%s", SR_FLIGHT_PREFIX);
+        if (rings < 1 || rings > SR_FLIGHT_RINGS || f->size / rings < SR_FLIGHT_MIN || f->age < 0) {
+                fprintf(stderr, "FLIGHT: bad recorder spec \"%s\": want size[,seconds[,prefix]] "
+                        "with size at least %d for each of the %d threads recording\n", spec, SR_FLIGHT_MIN, rings);
+                return -1;
+        }
+        if (posix_memalign((void**) &f->rings, 64, rings * sizeof(struct sr_flight_ring))) {
+                f->rings = 0;
+                perror("posix_memalign(..):sr_flight.c::sr_flight_open");
+                return -1;
+        }
+        memset(f->rings, 0, rings * sizeof(struct sr_flight_ring));
+        f->nrings = rings;
+        for (i = 0; i < rings; i++) {
+                f->rings[i].size = f->size / rings;
+                if (!(f->rings[i].data = malloc(f->rings[i].size))) {
+                        perror("malloc(..):sr_flight.c::sr_flight_open");
+                        sr_flight_close(f);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/**
+ * record a frame, making room by throwing away the oldest ones
+ * @param ring the calling thread's: only it ever records to that ring
+ * @param ts time of the batch or 0 to read the clock
+ */
+void sr_flight_log(struct sr_flight* f, int ring, const uint8_t* buf, int len, const struct timeval* ts)
+{
+        struct sr_flight_ring* r = &f->rings[ring];
+        struct pcap_sf_pkthdr h;
+        struct timeval tv;
+        size_t caplen = len < f->snaplen ? len : f->snaplen;
+        size_t need = sizeof(h) + caplen;
+
+        /* one ring is only ever dumped by the thread recording to it */
+        if (f->nrings > 1 && __atomic_exchange_n(&r->busy, 1, __ATOMIC_ACQUIRE)) {
+                r->skipped++;
+                return;
+        }
+        for (;;) {
+                if (!r->wrapped) {
+                        if (r->head + need <= r->size) break;
+                        if (!r->count) {
+                                r->head = r->tail = 0;
+                                break;
+                        }
+                        /* start again at the front: the run at tail ends here */
+                        r->wrap = r->head;
+                        r->head = 0;
+                        r->wrapped = 1;
+                }
+                if (r->head + need <= r->tail) break;
+                sr_flight_drop(r);
+        }
+
+        if (!ts) {
+                gettimeofday(&tv, 0);
+                ts = &tv;
+        }
+        h.ts.tv_sec = ts->tv_sec;
+        h.ts.tv_usec = ts->tv_usec;
+        h.caplen = caplen;
+        h.len = len;
+        memcpy(r->data + r->head, &h, sizeof(h));
+        memcpy(r->data + r->head + sizeof(h), buf, caplen);
+        r->head += need;
+        r->count++;
+        r->packets++;
+        if (f->nrings > 1) __atomic_store_n(&r->busy, 0, __ATOMIC_RELEASE);
+}
+
+static int sr_flight_write(int fd, const uint8_t* p, size_t n)
+{
+        ssize_t w;
+
+        while (n) {
+                if ((w = write(fd, p, n)) < 0) {
+                        if (errno == EINTR) continue;
+                        return -1;
+                }
+                p += w;
+                n -= w;
+        }
+        return 0;
+}
+
+/** where a dump has got to in a ring */
+struct sr_flight_cursor
+{
+        size_t pos;             /** the next record */
+        int upper;              /** pos is in the run that ends at wrap */
+        unsigned long n;        /** records left */
+        struct pcap_sf_pkthdr h; /** the header at pos */
+};
+
+/** step c on to the next record in r */
+static void sr_flight_next(struct sr_flight_ring* r, struct sr_flight_cursor* c)
+{
+        if (c->n && c->upper && c->pos == r->wrap) {
+                c->pos = 0;
+                c->upper = 0;
+        }
+        if (c->n) memcpy(&c->h, r->data + c->pos, sizeof(c->h));
+}
+
+static void sr_flight_pass(struct sr_flight_ring* r, struct sr_flight_cursor* c)
+{
+        c->pos += sizeof(c->h) + c->h.caplen;
+        c->n--;
+        sr_flight_next(r, c);
+}
+
+static inline int sr_flight_before(const struct pcap_sf_pkthdr* a, const struct pcap_sf_pkthdr* b)
+{
+        return a->ts.tv_sec < b->ts.tv_sec || (a->ts.tv_sec == b->ts.tv_sec && a->ts.tv_usec < b->ts.tv_usec);
+}
+
+/**
+ * write the rest of the records at c straight out of r: one or two writes
+ * @return bytes written or -1
+ */
+static ssize_t sr_flight_rest(int fd, struct sr_flight_ring* r, struct sr_flight_cursor* c)
+{
+        size_t end1 = c->upper ? r->wrap : r->head, end2 = c->upper ? r->head : 0;
+
+        if (!c->n) return 0;
+        if (sr_flight_write(fd, r->data + c->pos, end1 - c->pos) ||
+            (end2 && sr_flight_write(fd, r->data, end2))) return -1;
+        c->n = 0;
+        return (end1 - c->pos) + end2;
+}
+
+/**
+ * write the records of every ring at the cursors to fd, oldest first:
+ * gathered in stage until only one ring has any left, then straight out
+ * @return bytes written or -1
+ */
+static ssize_t sr_flight_merge(struct sr_flight* f, struct sr_flight_cursor* c, int fd)
+{
+        static uint8_t stage[SR_FLIGHT_STAGE];
+        struct sr_flight_ring* r;
+        size_t used = 0, rec;
+        ssize_t rest, out = 0;
+        int i, best, left;
+
+        for (;;) {
+                best = -1;
+                left = 0;
+                for (i = 0; i < f->nrings; i++) {
+                        if (!c[i].n) continue;
+                        left++;
+                        if (best < 0 || sr_flight_before(&c[i].h, &c[best].h)) best = i;
+                }
+                if (left <= 1) break;
+                r = &f->rings[best];
+                rec = sizeof(c[best].h) + c[best].h.caplen;
+                if (used + rec > sizeof(stage)) {
+                        if (sr_flight_write(fd, stage, used)) return -1;
+                        out += used;
+                        used = 0;
+                }
+                memcpy(stage + used, r->data + c[best].pos, rec);
+                used += rec;
+                sr_flight_pass(r, &c[best]);
+        }
+        if (used && sr_flight_write(fd, stage, used)) return -1;
+        out += used;
+        if (best >= 0) {
+                if ((rest = sr_flight_rest(fd, &f->rings[best], &c[best])) < 0) return -1;
+                out += rest;
+        }
+        return out;
+}
+
+/**
+ * write what is in the rings to a new pcap file, oldest first. the rings
+ * are left as they are so the next dump overlaps this one.
+ * @param reason an enum sr_flight_reason: triggers in the holdoff are ignored
+ * @return 0 if dumped or ignored, -1 if the file could not be written
+ */
+int sr_flight_dump(struct sr_flight* f, int reason)
+{
+        struct sr_flight_cursor c[SR_FLIGHT_RINGS];
+        struct pcap_file_header hdr;
+        struct pcap_sf_pkthdr from;
+        struct sr_flight_ring* r;
+        char fname[128];
+        time_t now = time(0);
+        unsigned long n = 0;
+        ssize_t bytes;
+        int i, fd, err;
+
+        assert(f);
+        __atomic_store_n(&f->pending, SR_FLIGHT_NONE, __ATOMIC_RELAXED);
+        if (!f->rings) return 0;
+        if (reason >= SR_FLIGHT_ARP && f->dumps && now - f->last < SR_FLIGHT_HOLDOFF) {
+                f->suppressed++;
+                return 0;
+        }
+
+        snprintf(fname, sizeof(fname), "%s.%lu.%s.pcap", f->prefix, f->dumps + 1, sr_flight_reasons[reason]);
+        if ((fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+                fprintf(stderr, "FLIGHT: can't open %s: %s\n", fname, strerror(errno));
+                return -1;
+        }
+
+        /* the recording threads leave their frames out until we are done */
+        memset(&from, 0, sizeof(from));
+        from.ts.tv_sec = f->age ? now - f->age : 0;
+        for (i = 0; i < f->nrings; i++) {
+                r = &f->rings[i];
+                while (f->nrings > 1 && __atomic_exchange_n(&r->busy, 1, __ATOMIC_ACQUIRE)) sched_yield();
+                c[i].pos = r->tail;
+                c[i].upper = r->wrapped;
+                c[i].n = r->count;
+                sr_flight_next(r, &c[i]);
+                /* nothing from before the first record a busy ring has kept */
+                if (r->overwritten && c[i].n && sr_flight_before(&from, &c[i].h)) from = c[i].h;
+        }
+        /* step over records older than the age limit and that */
+        for (i = 0; i < f->nrings; i++) {
+                while (c[i].n && sr_flight_before(&c[i].h, &from)) sr_flight_pass(&f->rings[i], &c[i]);
+                n += c[i].n;
+        }
+
+        /* as sf_write_header in sr_dumper.c */
+        hdr.magic = TCPDUMP_MAGIC;
+        hdr.version_major = PCAP_VERSION_MAJOR;
+        hdr.version_minor = PCAP_VERSION_MINOR;
+        hdr.thiszone = 0;
+        hdr.sigfigs = 0;
+        hdr.snaplen = f->snaplen;
+        hdr.linktype = LINKTYPE_ETHERNET;
+        err = sr_flight_write(fd, (uint8_t*) &hdr, sizeof(hdr)) ||
+                (bytes = sr_flight_merge(f, c, fd)) < 0;
+        if (err) perror("write(..):sr_flight.c::sr_flight_dump");
+        close(fd);
+        for (i = 0; f->nrings > 1 && i < f->nrings; i++) __atomic_store_n(&f->rings[i].busy, 0, __ATOMIC_RELEASE);
+
+        f->dumps++;
+        f->last = now;
+        if (!err) f->dumped += bytes;
+        printf("FLIGHT: %s: dumped %lu packets to %s\n", sr_flight_reasons[reason], n, fname);
+        return err ? -1 : 0;
+}
+
+void sr_flight_close(struct sr_flight* f)
+{
+        int i;
+
+        assert(f);
+        for (i = 0; i < f->nrings && f->rings; i++) free(f->rings[i].data);
+        free(f->rings);
+        f->rings = 0;
+}
+
+void sr_flight_print_stats(struct sr_flight* f)
+{
+        struct sr_flight_ring* r;
+        unsigned long packets = 0, count = 0, overwritten = 0, skipped = 0;
+        int i;
+
+        assert(f);
+        for (i = 0; i < f->nrings && f->rings; i++) {
+                r = &f->rings[i];
+                packets += r->packets;
+                count += r->count;
+                overwritten += r->overwritten;
+                skipped += r->skipped;
+        }
+        printf("FLIGHT: %lu packets recorded, %lu in %d ring%s (%zu bytes), %lu overwritten, "
+               "%lu skipped during dumps, %lu dumps (%llu bytes), asked for by",
+               packets, count, f->nrings, f->nrings == 1 ? "" : "s", f->size, overwritten, skipped,
+               f->dumps, f->dumped);
+        for (i = SR_FLIGHT_SIGNAL; i < SR_FLIGHT_REASONS; i++)
+                printf(" %s %lu,", sr_flight_reasons[i], f->triggers[i]);
+        printf(" %lu ignored after a dump\n", f->suppressed);
+}
@@ -0,0 +1,139 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * flight recorder (-F): the last few MB of traffic kept in memory
+ *
+ * -l writes every packet to disk, which is rarely what we want. with -F
+ * every frame sr_log_packet sees is copied into a ring of a fixed size as
+ * a pcap record (header as in sr_dumper.c, cut at the snap length) and the
+ * oldest records are thrown away to make room, so memory use never goes
+ * past what was asked for. nothing is written until something asks for a
+ * dump, then the ring goes out oldest first as an ordinary pcap file:
+ *
+ *   - SIGUSR1
+ *   - "dump" on the control fifo (-C, see sr_control.h)
+ *   - a neighbour reaching ARP_MAX_TRIES (sr_arp.c)
+ *   - the arp buffer filling up and dropping packets (sr_buffer.c)
+ *
+ * records are never split at the end of the ring: one that doesn't fit
+ * starts again at the front and the end of the data is remembered in wrap.
+ * so the ring is at most two runs of whole records and a dump is the file
+ * header and one or two writes. recording is a memcpy and, once the ring
+ * is full, stepping the tail past a record or two.
+ *
+ * when several threads record (the pipe backend's, see sr_pipe.h) the
+ * memory is shared out evenly into a ring for each, so none of them waits
+ * on another. a dump merges the rings oldest record first. each ring has
+ * a busy flag that its thread takes while it records: uncontended, on a
+ * cache line of its own. a dump takes every ring's flag for as long as it
+ * writes and a thread that finds its ring taken leaves the frame out
+ * (counted in skipped) rather than wait for the disk. a busy thread's
+ * ring covers less time than a quiet one's, so a dump leaves out records
+ * older than the oldest one left in any ring that has had to throw some
+ * away: the file has no gaps.
+ *
+ * triggers and signals only set pending: the dump happens at the end of
+ * the event loop batch (sr_flight_check) so nothing is written from a
+ * signal handler or from inside the arp code. pipe workers trigger on the
+ * router's one recorder so the counts and pending are changed atomically:
+ * the first reason in wins and the main thread takes it. triggers can
+ * come in storms (every packet dropped by a full buffer is one) so after
+ * a dump they are ignored for SR_FLIGHT_HOLDOFF seconds. asking for a dump
+ * always works. the dump is written in the router's main thread, so
+ * without the pipe forwarding stops for as long as it takes: about 3ms per
+ * MB of ring into the page cache. with it only recording stops.
+ *
+ * an optional age limit leaves out records older than that many seconds
+ * when dumping, so "the last 30 seconds or 64MB, whichever is less" is
+ * -F 64M,30.
+ */
+#ifndef SR_FLIGHT_H
+#define SR_FLIGHT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+/** seconds after a dump that triggers are ignored */
+#define SR_FLIGHT_HOLDOFF 10
+/** smallest ring we'll take: has to hold a record of snap length */
+#define SR_FLIGHT_MIN (64 << 10)
+/** default dump file prefix: files are <prefix>.<n>.<reason>.pcap */
+#define SR_FLIGHT_PREFIX "sr.flight"
+
+/** why a dump was asked for */
+enum sr_flight_reason
+{
+        SR_FLIGHT_NONE = 0,
+        SR_FLIGHT_SIGNAL,
+        SR_FLIGHT_CONTROL,
+        SR_FLIGHT_ARP,
+        SR_FLIGHT_BUFFER,
+        SR_FLIGHT_REASONS
+};
+
+/** most threads that can record */
+#define SR_FLIGHT_RINGS 32
+/** bytes gathered before a write when a dump merges rings */
+#define SR_FLIGHT_STAGE (256 << 10)
+
+/** one recording thread's records */
+struct sr_flight_ring
+{
+        uint8_t* data;
+        size_t size;            /** bytes in data */
+        size_t head;            /** where the next record goes */
+        size_t tail;            /** the oldest record */
+        size_t wrap;            /** end of the run at tail when head has gone round */
+        int wrapped;            /** data is tail..wrap then 0..head */
+        unsigned long count;    /** records in the ring */
+        int busy;               /** taken by the thread recording or by a dump: atomic */
+        /* stats */
+        unsigned long packets;
+        unsigned long overwritten; /** records thrown away to make room */
+        unsigned long skipped;  /** frames left out while a dump had the ring */
+} __attribute__ ((aligned (64)));
+
+struct sr_flight
+{
+        struct sr_flight_ring* rings; /** 0 when not recording */
+        int nrings;
+        size_t size;            /** bytes in all the rings */
+        int snaplen;
+        int age;                /** seconds of traffic to dump, 0 for all of it */
+        char prefix[64];
+        int pending;            /** enum sr_flight_reason of the dump to do: atomic */
+        time_t last;            /** time of the last dump */
+        /* stats */
+        unsigned long dumps;
+        unsigned long suppressed; /** triggers ignored in the holdoff */
+        unsigned long triggers[SR_FLIGHT_REASONS];
+        unsigned long long dumped; /** bytes written out */
+};
+
+int sr_flight_open(struct sr_flight* f, const char* spec, int snaplen, int rings);
+void sr_flight_log(struct sr_flight* f, int ring, const uint8_t* buf, int len, const struct timeval* ts);
+int sr_flight_dump(struct sr_flight* f, int reason);
+void sr_flight_close(struct sr_flight* f);
+void sr_flight_print_stats(struct sr_flight* f);
+
+/** ask for a dump at the end of the batch: safe from a signal handler */
+static inline void sr_flight_trigger(struct sr_flight* f, int reason)
+{
+        int none = SR_FLIGHT_NONE;
+
+        if (!f->rings) return;
+        __atomic_fetch_add(&f->triggers[reason], 1, __ATOMIC_RELAXED);
+        __atomic_compare_exchange_n(&f->pending, &none, reason, 0,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/** do the dump asked for, if any: called by the event loop */
+static inline void sr_flight_check(struct sr_flight* f)
+{
+        int reason = __atomic_exchange_n(&f->pending, SR_FLIGHT_NONE, __ATOMIC_RELAXED);
+
+        if (reason) sr_flight_dump(f, reason);
+}
+
+#endif
@@ -9,8 +9,11 @@
  *
  *---------------------------------------------------------------------------*/
 
+#define SR_LOG_MODULE SR_LOG_IF
+
 #include <stdio.h>
 #include <assert.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -37,6 +40,23 @@ uint8_t sr_if_name2idx(const char* name)
 
         return (uint8_t) idx;
 }
+
+/**
+ * check a name from outside (a kernel interface, an rtable line, a
+ * control command) before it goes anywhere near sr_if_name2idx
+ * @return the index the name would have or -1 if it doesn't fit
+ */
+int sr_if_name_check(const char* name)
+{
+        char* end;
+        long idx;
+
+        if (strlen(name) <= 3 || strlen(name) >= sr_IFACE_NAMELEN || !isdigit((unsigned char) name[3]))
+                return -1;
+        idx = strtol(name + 3, &end, 10);
+        if (*end || idx >= LAN_SIZE) return -1;
+        return (int) idx;
+}
 /**
  * unfortunately the vns server itself sends these "eth" strings for the interfaces
  * when we process a packet so we have to do this look up every packet
@@ -66,18 +86,15 @@ struct sr_if* sr_if_ip2iface(struct sr_instance* sr, uint32_t ip)
  * clear all iface related variables
  */
 void sr_if_clear(struct sr_instance* sr) {
-        int i;
+        struct sr_if *i, *next;
         assert(sr);
-        for (i=0; i<=LAN_SIZE; i++) {
-                if (sr->interfaces[i]) {
-                        free(sr->interfaces[i]);
-                        sr->interfaces[i] = 0;
-                }
-                if (sr->ip2iface[i]) {
-                        free(sr->ip2iface[i]);
-                        sr->ip2iface[i] = 0;
-                }
+        /* both arrays point into if_list so free each interface just once */
+        for (i=sr->if_list; i; i=next) {
+                next = i->next;
+                free(i);
         }
+        memset(sr->interfaces, 0, sizeof(sr->interfaces));
+        memset(sr->ip2iface, 0, sizeof(sr->ip2iface));
         sr->if_list = 0;
 }
 /*--------------------------------------------------------------------- 
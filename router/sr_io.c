@@ -0,0 +1,145 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * packet i/o backend selection and helpers shared by backends: see sr_io.h
+ */
+#include <assert.h>
+#include <ifaddrs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include "sr_router.h"
+#include "sr_io.h"
+
+static const struct sr_io* sr_io_backends[] = {
+        &sr_vns_io,
+        &sr_uring_io,
+        &sr_packet_io,
+        &sr_tap_io,
+        &sr_xdp_io,
+        &sr_pipe_io,
+        0
+};
+
+/** @return the backend called name or 0 if there isn't one */
+const struct sr_io* sr_io_find(const char* name)
+{
+        int i;
+
+        assert(name);
+        for (i = 0; sr_io_backends[i]; i++) {
+                if (strcmp(sr_io_backends[i]->name, name) == 0) return sr_io_backends[i];
+        }
+        return 0;
+}
+
+/**
+ * add an interface found in the kernel to the router
+ * the name has to fit sr_if_name2idx (see readme.txt) so eth0 is fine but lo or veth0 are not
+ * @return 0 if it was added, -1 if it was skipped
+ */
+int sr_io_add_interface(struct sr_instance* sr, const char* name,
+        const unsigned char* addr, uint32_t ip)
+{
+        int idx;
+
+        assert(sr);
+        assert(name);
+        assert(addr);
+
+        if ((idx = sr_if_name_check(name)) == -1) {
+                fprintf(stderr, "IO: skipping %s: interface names must look like eth0 .. eth%d\n",
+                        name, LAN_SIZE - 1);
+                return -1;
+        }
+        if (sr->interfaces[idx]) {
+                fprintf(stderr, "IO: skipping %s: it would replace %s\n",
+                        name, sr->interfaces[idx]->name);
+                return -1;
+        }
+        if (!ip) {
+                fprintf(stderr, "IO: skipping %s: it has no ipv4 address\n", name);
+                return -1;
+        }
+        sr_add_interface(sr, name);
+        sr_set_ether_addr(sr, addr);
+        sr_set_ether_ip(sr, ip);
+        return 0;
+}
+
+/** @return 1 if name is in the comma separated list (0 means every interface) */
+static int sr_io_wanted(const char* name, const char* ifnames)
+{
+        size_t len = strlen(name);
+        const char* p;
+
+        if (!ifnames) return 1;
+        for (p = ifnames; (p = strstr(p, name)); p += len) {
+                if ((p == ifnames || p[-1] == ',') && (p[len] == ',' || p[len] == '\0')) return 1;
+        }
+        return 0;
+}
+
+/** @return the ipv4 address of the interface called name or 0 */
+static uint32_t sr_io_ip(struct ifaddrs* all, const char* name)
+{
+        struct ifaddrs* a;
+
+        for (a = all; a; a = a->ifa_next) {
+                if (a->ifa_addr && a->ifa_addr->sa_family == AF_INET && strcmp(a->ifa_name, name) == 0)
+                        return ((struct sockaddr_in*) a->ifa_addr)->sin_addr.s_addr;
+        }
+        return 0;
+}
+
+/**
+ * add the kernel's ethernet interfaces that are up (or just those in the
+ * comma separated list ifnames) to the router with their hardware and ip
+ * addresses, calling found for each so the backend can open it
+ * @return the number of interfaces added, -1 if none were or found failed
+ */
+int sr_io_discover(struct sr_instance* sr, const char* ifnames, int max, sr_io_found_fn found)
+{
+        struct ifaddrs *all, *a;
+        struct sockaddr_ll* hw;
+        int n = 0;
+
+        assert(sr);
+        assert(found);
+        if (getifaddrs(&all) == -1) {
+                perror("getifaddrs(..):sr_io.c::sr_io_discover");
+                return -1;
+        }
+        for (a = all; a; a = a->ifa_next) {
+                if (!a->ifa_addr || a->ifa_addr->sa_family != AF_PACKET) continue;
+                if (!(a->ifa_flags & IFF_UP) || (a->ifa_flags & IFF_LOOPBACK)) continue;
+                if (!sr_io_wanted(a->ifa_name, ifnames)) continue;
+                if (n == max) {
+                        fprintf(stderr, "IO: skipping %s: only %d interfaces are supported\n",
+                                a->ifa_name, max);
+                        continue;
+                }
+                hw = (struct sockaddr_ll*) a->ifa_addr;
+                if (hw->sll_halen != ETHER_ADDR_LEN) continue;
+                if (sr_io_add_interface(sr, a->ifa_name, hw->sll_addr, sr_io_ip(all, a->ifa_name)) == -1)
+                        continue;
+                n++;
+                if (found(sr, a->ifa_name, hw->sll_ifindex) == -1) {
+                        freeifaddrs(all);
+                        return -1;
+                }
+        }
+        freeifaddrs(all);
+
+        if (n == 0) {
+                fprintf(stderr, "IO: no usable interfaces found\n");
+                return -1;
+        }
+        sr_arp_update_templates(sr);
+        printf("IO: Router interfaces:\n");
+        sr_print_if_list(sr);
+        return n;
+}
@@ -0,0 +1,70 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * packet i/o backends
+ *
+ * the router was written to get its frames from the VNS server. the rest
+ * of the code only ever needs three things from whatever carries the
+ * frames: hand received frames to sr_handlepacket, take frames from
+ * sr_send_packet and push out what has been queued at the end of a batch.
+ * a backend is a table of functions doing just that, picked with -B.
+ *
+ *   vns     the original: frames tunnelled over tcp to the VNS server
+ *           (sr_vns_comm.c, sr_rx.h, sr_tx.h)
+ *   uring   the same VNS connection read and written through io_uring,
+ *           falling back to vns if it is unavailable (sr_uring.h)
+ *   packet  AF_PACKET sockets on real (or veth) interfaces with mmap'd
+ *           TPACKET_V3 rings (sr_packet.c)
+ *   tap     a TAP device per interface so the kernel plays the hosts
+ *           (sr_tap.c)
+ *   xdp     AF_XDP sockets sharing one UMEM so forwarded frames are never
+ *           copied (sr_xdp.c)
+ *   pipe    the VNS connection with reading, routing and writing on
+ *           threads of their own (sr_pipe.h)
+ *
+ * backends that talk to the kernel find the router's interfaces, their
+ * hardware and ip addresses themselves in open instead of waiting for a
+ * HWINFO message.
+ */
+#ifndef SR_IO_H
+#define SR_IO_H
+
+#include <stdint.h>
+
+struct sr_instance;
+
+/** sr_io_discover found a usable interface: set it up, -1 gives up */
+typedef int (*sr_io_found_fn)(struct sr_instance* sr, const char* name, int ifindex);
+
+struct sr_io
+{
+        const char* name;
+        /** find interfaces (a comma separated list or all if 0): 0 if the backend gets them elsewhere */
+        int (*open)(struct sr_instance* sr, const char* ifnames);
+        /** register file descriptors with the event loop and handle anything pending */
+        int (*start)(struct sr_instance* sr);
+        /** queue a frame that has passed the checks in sr_send_packet */
+        int (*send)(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface);
+        /** push out everything queued: -1 means the backend is unusable */
+        int (*flush)(struct sr_instance* sr);
+        void (*close)(struct sr_instance* sr);
+        void (*print_stats)(struct sr_instance* sr);
+        /** optional: keep a received frame for sr_buffer rather than have it copied, 1 if kept */
+        int (*hold)(struct sr_instance* sr, uint8_t* frame);
+        /** the buffer is done with a frame it was allowed to keep */
+        void (*release)(struct sr_instance* sr, uint8_t* frame);
+};
+
+extern const struct sr_io sr_vns_io;
+extern const struct sr_io sr_uring_io;
+extern const struct sr_io sr_packet_io;
+extern const struct sr_io sr_tap_io;
+extern const struct sr_io sr_xdp_io;
+extern const struct sr_io sr_pipe_io;
+
+const struct sr_io* sr_io_find(const char* name);
+int sr_io_add_interface(struct sr_instance* sr, const char* name,
+        const unsigned char* addr, uint32_t ip);
+int sr_io_discover(struct sr_instance* sr, const char* ifnames, int max, sr_io_found_fn found);
+
+#endif
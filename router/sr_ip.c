@@ -3,10 +3,13 @@
  *
  * implementation of ip specific routines esp checksums
  */
+#define SR_LOG_MODULE SR_LOG_IP
+
 #include <assert.h>
 #include <string.h>
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_cksum.h"
 
 /**
  * does the job of swapping around the ethernet address and ip 
@@ -45,7 +48,7 @@ void sr_ip_reverse(struct sr_ip_packet* p, uint16_t len)
 
         /* now that we have everything in the ip header recompute the checksum */
         p->ip.ip_sum = sr_ip_checksum((uint16_t*) &p->ip, (p->ip.ip_hl*4));
-        Debug(
+        Trace(
                 "IP: calculated ip checksum %X, recalculated %X (should be 0)\n", 
                 ntohs(p->ip.ip_sum), 
                 sr_ip_checksum((uint16_t*) &p->ip, sizeof(struct ip))
@@ -56,6 +59,25 @@ void sr_ip_reverse(struct sr_ip_packet* p, uint16_t len)
  * fairly simple send a time exceeded icmp packet back where this came from
  * @return 1 if packet should be sent
  */
+/**
+ * make sure size bytes can be written to the packet
+ * packets straight from the receive buffer own only their own bytes so if
+ * the reply is going to be bigger the packet is moved to the spill frame
+ */
+static void sr_ip_make_room(struct sr_ip_handle* h, unsigned int size) 
+{
+        struct sr_fwd* fwd = sr_fwd(h->sr);
+        uint8_t* spill = fwd->spill;
+
+        assert(size <= sizeof(fwd->spill));
+        if (h->raw_size >= size) return;
+
+        memcpy(spill, h->raw, h->raw_len < size ? h->raw_len : size);
+        if (h->raw_len < size) memset(spill + h->raw_len, 0, size - h->raw_len);
+        h->raw = spill;
+        h->raw_size = sizeof(fwd->spill);
+        h->pkt = (struct sr_ip_packet*) spill;
+}
 int sr_icmp_unreachable(struct sr_ip_handle* h) 
 {
         uint8_t data[ICMP_TIMEOUT_SIZE];
@@ -66,6 +88,7 @@ int sr_icmp_unreachable(struct sr_ip_handle* h)
 	uint32_t dst;
 
         assert(h);
+	sr_ip_make_room(h, sizeof(struct sr_ethernet_hdr) + 20 + 8 + ICMP_TIMEOUT_SIZE);
         p = h->pkt;
 	sr = h->sr;
 	dst = p->ip.ip_dst.s_addr;
@@ -77,7 +100,8 @@ int sr_icmp_unreachable(struct sr_ip_handle* h)
 	iface = sr_if_ip2iface(sr, dst);
 	if (!iface) {
 		receiver = sr_rt_find(h->sr, dst);
-		p->ip.ip_dst.s_addr = h->sr->interfaces[ receiver->ifidx ]->ip;
+		p->ip.ip_dst.s_addr = receiver ? 
+			h->sr->interfaces[ receiver->ifidx ]->ip : h->iface->ip;
 	}
 
         /* then reverse ip information so we can send the packet back */
@@ -128,12 +152,12 @@ int sr_icmp_handler(struct sr_ip_handle* h)
 
         switch(type) {
         case ICMP_ECHO_REQUEST: 
-                Debug("IP: icmp: got an echo request\n"); 
+                Trace("IP: icmp: got an echo request\n"); 
                 sr_ip_reverse(p,ntohs(ip->ip_len));
                 p->d.icmp.type = 0;
                 p->d.icmp.code = 0;
                 p->d.icmp.checksum = 0;
-		Debug("IP: icmp id %X, seq %X\n", 
+		Trace("IP: icmp id %X, seq %X\n", 
 			ntohs(p->d.icmp.fields.ping.id), 
 			ntohs(p->d.icmp.fields.ping.sequence)
 		);
@@ -142,11 +166,14 @@ int sr_icmp_handler(struct sr_ip_handle* h)
                 return 1;
 
         case ICMP_TRACEROUTE:
-                Debug("IP: icmp: got traceroute request");
+                Trace("IP: icmp: got traceroute request");
+                sr_ip_make_room(h, sizeof(struct sr_ethernet_hdr) + 20 + 20);
+                p = h->pkt;
+                ip = &p->ip;
                 sr_ip_reverse(p,ntohs(ip->ip_len));
                 p->d.traceroute.checksum = 0;
                 hops = ntohs(p->d.traceroute.in_hops) + 1;
-                Debug("IP: icmp: in_hops now %d\n",hops);
+                Trace("IP: icmp: in_hops now %d\n",hops);
                 p->d.traceroute.in_hops = htons(hops);
                 p->d.traceroute.mtu = htonl(1500); /**  we know this because its ethernet */
                 iface = sr_if_ip2iface(h->sr,ip->ip_src.s_addr);
@@ -156,12 +183,12 @@ int sr_icmp_handler(struct sr_ip_handle* h)
                 return 1;
 
         case ICMP_UNREACHABLE:
-                Debug("IP: icmp: destination unreachable received.");
+                Trace("IP: icmp: destination unreachable received.");
         default: 
-                Debug("IP: icmp: id %d\n", type);
+                Trace("IP: icmp: id %d\n", type);
                 /* if the icmp packet is going to an interface abort */
                 if (sr_if_ip2iface(h->sr, ip->ip_dst.s_addr)) return 0;
-                Debug("IP: icmp: forwarding packet\n");
+                Trace("IP: icmp: forwarding packet\n");
                 return sr_ip_passthru(h);
         }
         return 0;
@@ -177,31 +204,48 @@ int sr_ip_handler(struct sr_ip_handle* h)
                 case IPPROTO_UDP:
                         return sr_ip_passthru(h);
                 default: 
-                        Debug("IP: don't know protocol - aborting\n");
+                        sr_log_limit(SR_LOG_IP, SR_LOG_DEBUG, "IP: don't know protocol - aborting\n");
         }
         return 0;
 }
 /**
  * packet is only passing through so decrement ttl and send it along
+ *
+ * sr_handlepacket has already verified the header checksum so rather than
+ * summing the header again we patch the checksum for the one 16 bit word
+ * (ttl and protocol) that changed
  */
 int sr_ip_passthru(struct sr_ip_handle* h) {
         struct ip* ip;
+        uint16_t before, after;
 
         assert(h);
 
         ip = &h->pkt->ip;
+        memcpy(&before, &ip->ip_ttl, sizeof(uint16_t));
         ip->ip_ttl -= 0x01;
-        ip->ip_sum = 0;
-        ip->ip_sum = sr_ip_checksum((uint16_t*) ip, (ip->ip_hl*4));
-        Debug(
-                "IP: ttl is %d, recalculated ip checksum %X (checked value %X should be 0)\n", 
-                ip->ip_ttl,
-                ntohs(h->pkt->ip.ip_sum), 
-                sr_ip_checksum((uint16_t*) ip, (ip->ip_hl*4))
-        );
+        memcpy(&after, &ip->ip_ttl, sizeof(uint16_t));
+        ip->ip_sum = sr_ip_checksum_adjust(ip->ip_sum, before, after);
+        Trace("IP: ttl is %d, adjusted ip checksum %X\n", ip->ip_ttl, ntohs(ip->ip_sum));
 
         return 1;
 }
+/**
+ * incremental checksum update from RFC 1624 (eqn. 3):
+ *
+ * HC' = ~(~HC + ~m + m')
+ *
+ * where HC is the old checksum and m and m' are the old and new values of
+ * the 16 bit word that changed. all values are as they appear in the packet.
+ */
+uint16_t sr_ip_checksum_adjust(uint16_t sum, uint16_t before, uint16_t after) 
+{
+        uint32_t s = (uint16_t) ~sum + (uint16_t) ~before + after;
+
+        s = (s & 0xFFFF) + (s >> 16);
+        s = (s & 0xFFFF) + (s >> 16);
+        return (uint16_t) ~s;
+}
 /**
  * do a basic checksum calculation
  *
@@ -212,11 +256,11 @@ int sr_ip_passthru(struct sr_ip_handle* h) {
  * see also http://www.faqs.org/rfcs/rfc1071.html 
  * for examples of how to compute these checksums
  * 
- * we assume there are an even number of bytes
- * which means we need to pad anything that is 
- * odd before sending it to this function
+ * the summing itself is done by the fastest kernel in sr_cksum.c 
+ * for this cpu: odd lengths are padded with a zero byte as RFC 1071 
+ * requires without reading past the end of the data
  *
- * when checking an incoming packet this should return 0xFFFF 
+ * when checking an incoming packet this should return 0
  * if the checksum is correct
  * 
  * when making the checksum for a header with an embedded checksum 
@@ -225,21 +269,8 @@ int sr_ip_passthru(struct sr_ip_handle* h) {
  */ 
 uint16_t sr_ip_checksum(uint16_t const data[], uint16_t len_in_bytes) 
 {
-        uint32_t sum = 0;
-        uint16_t words = len_in_bytes/2;
-        
-        /* add up each 16 bit word */
-        while(words-- > 0) {
-                sum += *(data++);
-        }
-        if (len_in_bytes % 2) {
-                Debug("IP: checksum: odd number of bytes %d, data %d after %d\n", len_in_bytes, *data, (*data << 8));
-                sum += (*data << 8);
-        }
-
-        /* squash sum back into 16 bits: compute 1s compliment with carries */
-        while (sum >> 16) { sum = (sum >> 16) + (sum & 0xFFFF); }
+        /* ip headers are too short to gain from the vector kernels */
+        if (len_in_bytes <= 60) return (uint16_t) ~sr_cksum_generic(data, len_in_bytes);
 
-        /* invert the answer */
-        return ((uint16_t) ~sum);
+        return (uint16_t) ~sr_cksum_sum(data, len_in_bytes);
 }
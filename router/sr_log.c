@@ -0,0 +1,201 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * logging: see sr_log.h
+ */
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "sr_log.h"
+
+#ifdef _DEBUG_
+#define SR_LOG_DEFAULT SR_LOG_DEBUG
+#else
+#define SR_LOG_DEFAULT SR_LOG_INFO
+#endif
+
+uint8_t sr_log_levels[SR_LOG_MODULES] = { [0 ... SR_LOG_MODULES - 1] = SR_LOG_DEFAULT };
+
+static const char* sr_log_modules[SR_LOG_MODULES] = {
+        "main", "vns", "router", "ip", "arp", "buffer", "if"
+};
+static const char* sr_log_names[] = { "error", "warn", "info", "debug", "trace" };
+
+struct sr_log_buffer
+{
+        char data[SR_LOG_BYTES];
+        int len;
+        int hold;               /** in a batch: wait for sr_log_flush */
+};
+
+static __thread struct sr_log_buffer sr_log_buf;
+static int sr_log_fd = 1;
+static struct sr_log_stats sr_log_stats;
+
+/**
+ * where the messages go: stdout, but a terminal or pipe through a
+ * descriptor of our own that doesn't block, so stdout's own is left alone
+ */
+void sr_log_init(void)
+{
+        struct stat st;
+        int fd;
+
+        if (fstat(1, &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode)) &&
+            (fd = open("/proc/self/fd/1", O_WRONLY | O_NONBLOCK | O_CLOEXEC)) != -1) {
+                sr_log_fd = fd;
+        }
+        atexit(sr_log_flush);
+}
+
+static int sr_log_level(const char* name)
+{
+        int i;
+
+        for (i = 0; i <= SR_LOG_TRACE; i++) {
+                if (strcmp(name, sr_log_names[i]) == 0) return i;
+        }
+        return -1;
+}
+
+static int sr_log_module(const char* name)
+{
+        int i;
+
+        for (i = 0; i < SR_LOG_MODULES; i++) {
+                if (strcmp(name, sr_log_modules[i]) == 0) return i;
+        }
+        return -1;
+}
+
+/**
+ * spec: level or module=level, comma separated, applied in order
+ * @return 0 or -1 if something in it is unknown: nothing is changed
+ */
+int sr_log_set(const char* spec)
+{
+        uint8_t levels[SR_LOG_MODULES];
+        char buf[256], *tok, *save, *eq;
+        int m, l;
+
+        memcpy(levels, sr_log_levels, sizeof(levels));
+        snprintf(buf, sizeof(buf), "%s", spec);
+        for (tok = strtok_r(buf, ", \t\r\n", &save); tok; tok = strtok_r(0, ", \t\r\n", &save)) {
+                if ((eq = strchr(tok, '='))) *eq++ = '\0';
+                l = sr_log_level(eq ? eq : tok);
+                m = eq ? sr_log_module(tok) : -1;
+                if (l == -1 || (eq && m == -1)) {
+                        fprintf(stderr, "LOG: don't know \"%s\": levels are error, warn, info, debug and trace, "
+                                "modules main, vns, router, ip, arp, buffer and if\n", tok);
+                        return -1;
+                }
+                if (l > SR_LOG_LEVEL) {
+                        fprintf(stderr, "LOG: %s is compiled out of this build\n", sr_log_names[l]);
+                }
+                if (eq) levels[m] = l;
+                else memset(levels, l, sizeof(levels));
+        }
+        memcpy(sr_log_levels, levels, sizeof(levels));
+        return 0;
+}
+
+void sr_log_print_levels(void)
+{
+        int i;
+
+        printf("LOG:");
+        for (i = 0; i < SR_LOG_MODULES; i++) {
+                printf(" %s=%s", sr_log_modules[i], sr_log_names[sr_log_levels[i]]);
+        }
+        printf(" (up to %s compiled in)\n", sr_log_names[SR_LOG_LEVEL]);
+}
+
+/** write out what is in b in one go */
+static void sr_log_out(struct sr_log_buffer* b)
+{
+        unsigned long lost = 0;
+        ssize_t n;
+        char* p;
+
+        if (!b->len) return;
+        n = write(sr_log_fd, b->data, b->len);
+        __atomic_add_fetch(&sr_log_stats.writes, 1, __ATOMIC_RELAXED);
+        if (n < b->len) {
+                /* no room in the pipe or terminal: drop the rest */
+                for (p = b->data + (n > 0 ? n : 0); p < b->data + b->len; p++) {
+                        if (*p == '\n') lost++;
+                }
+                __atomic_add_fetch(&sr_log_stats.lost, lost, __ATOMIC_RELAXED);
+        }
+        b->len = 0;
+}
+
+/** format a message into the thread's buffer: written out now unless held */
+void sr_log_write(const char* fmt, ...)
+{
+        struct sr_log_buffer* b = &sr_log_buf;
+        va_list ap;
+        int n;
+
+        /* printed since the last message: it goes out between them */
+        if (__fpending(stdout)) {
+                sr_log_out(b);
+                fflush(stdout);
+        }
+        if (b->len > SR_LOG_BYTES - SR_LOG_LINE) sr_log_out(b);
+        va_start(ap, fmt);
+        n = vsnprintf(b->data + b->len, SR_LOG_BYTES - b->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if (n >= SR_LOG_BYTES - b->len) n = SR_LOG_BYTES - b->len - 1;
+        b->len += n;
+        __atomic_add_fetch(&sr_log_stats.messages, 1, __ATOMIC_RELAXED);
+        if (!b->hold) sr_log_flush();
+}
+
+/** @return 1 if a sr_log_limit site can log this second */
+int sr_log_allow(struct sr_log_site* s)
+{
+        time_t now = time(0);
+        unsigned long held;
+
+        if (now != s->second) {
+                held = s->held;
+                s->second = now;
+                s->count = 0;
+                s->held = 0;
+                if (held) sr_log_write("LOG: %s:%d held back %lu messages\n", s->file, s->line, held);
+        }
+        if (s->count < SR_LOG_BURST) {
+                s->count++;
+                return 1;
+        }
+        s->held++;
+        __atomic_add_fetch(&sr_log_stats.held, 1, __ATOMIC_RELAXED);
+        return 0;
+}
+
+/** this thread is starting a batch: keep its messages until sr_log_flush */
+void sr_log_hold(void)
+{
+        sr_log_buf.hold = 1;
+}
+
+/** write out this thread's messages and stop holding them */
+void sr_log_flush(void)
+{
+        sr_log_buf.hold = 0;
+        sr_log_out(&sr_log_buf);
+}
+
+void sr_log_print_stats(void)
+{
+        sr_log_flush();
+        printf("LOG: %lu messages in %lu writes, %lu held back by rate limits, %lu lost to a full output\n",
+                sr_log_stats.messages, sr_log_stats.writes, sr_log_stats.held, sr_log_stats.lost);
+}
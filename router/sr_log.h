@@ -0,0 +1,109 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * logging: sr -g levels, "log levels" on the control fifo
+ *
+ * a message comes from a module, the part of the router that logs it,
+ * and has a level. levels past SR_LOG_LEVEL are compiled out, arguments
+ * and all: with _DEBUG_ that is nothing, without it (make release) it is
+ * debug and trace, so no packet is ever formatted for a log. what is left
+ * is filtered by a level for each module, set with a comma separated list
+ * like "info,arp=debug,router=trace": a bare level is for every module.
+ * Debug logs at debug for the module a file defines SR_LOG_MODULE as and
+ * Trace, a line per packet, at trace.
+ *
+ * messages go into a buffer of the thread's own. the event loop and the
+ * pipe workers hold them for a batch (sr_log_hold) and write them all out
+ * when it is done (sr_log_flush); outside a batch a message is written
+ * out there and then. writes to a terminal or pipe never block: whatever
+ * doesn't fit is lost and counted rather than holding up packets.
+ *
+ * sr_log_limit is for messages that could come once per packet, such as
+ * a drop: a site lets SR_LOG_BURST through a second and says how many it
+ * held back the next time it lets one through. the counts are per site,
+ * not per thread, and only about right when threads share a site.
+ */
+#ifndef SR_LOG_H
+#define SR_LOG_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define SR_LOG_ERROR 0
+#define SR_LOG_WARN 1
+#define SR_LOG_INFO 2
+#define SR_LOG_DEBUG 3
+#define SR_LOG_TRACE 4
+
+/** the most verbose level compiled in */
+#ifndef SR_LOG_LEVEL
+#ifdef _DEBUG_
+#define SR_LOG_LEVEL SR_LOG_TRACE
+#else
+#define SR_LOG_LEVEL SR_LOG_INFO
+#endif
+#endif
+
+/** modules: sr_log_set knows them by the names in sr_log.c */
+#define SR_LOG_MAIN 0
+#define SR_LOG_VNS 1
+#define SR_LOG_ROUTER 2
+#define SR_LOG_IP 3
+#define SR_LOG_ARP 4
+#define SR_LOG_BUFFER 5
+#define SR_LOG_IF 6
+#define SR_LOG_MODULES 7
+
+/** what Debug and Trace log as: define it before the includes */
+#ifndef SR_LOG_MODULE
+#define SR_LOG_MODULE SR_LOG_MAIN
+#endif
+
+/** a thread's messages waiting to be written */
+#define SR_LOG_BYTES 8192
+/** room kept for a message: longer ones are cut short */
+#define SR_LOG_LINE 512
+/** messages a sr_log_limit site lets through a second */
+#define SR_LOG_BURST 10
+
+struct sr_log_site
+{
+        const char* file;
+        int line;
+        time_t second;          /** of the last message let through */
+        unsigned int count;     /** let through in that second */
+        unsigned long held;     /** held back since */
+};
+
+struct sr_log_stats
+{
+        unsigned long messages;
+        unsigned long held;     /** by sr_log_limit sites */
+        unsigned long lost;     /** messages the output had no room for */
+        unsigned long writes;
+};
+
+/** the level each module logs at, changed at any time by sr_log_set */
+extern uint8_t sr_log_levels[SR_LOG_MODULES];
+
+#define sr_log_on(mod, lvl) ((lvl) <= SR_LOG_LEVEL && (lvl) <= sr_log_levels[mod])
+
+#define sr_log(mod, lvl, fmt, args...) \
+        do { if (sr_log_on(mod, lvl)) sr_log_write(fmt, ## args); } while (0)
+
+#define sr_log_limit(mod, lvl, fmt, args...) \
+        do { \
+                static struct sr_log_site sr_log_site_ = { __FILE__, __LINE__ }; \
+                if (sr_log_on(mod, lvl) && sr_log_allow(&sr_log_site_)) sr_log_write(fmt, ## args); \
+        } while (0)
+
+void sr_log_init(void);
+int sr_log_set(const char* spec);
+void sr_log_print_levels(void);
+void sr_log_write(const char* fmt, ...) __attribute__ ((format (printf, 1, 2)));
+int sr_log_allow(struct sr_log_site* site);
+void sr_log_hold(void);
+void sr_log_flush(void);
+void sr_log_print_stats(void);
+
+#endif
@@ -34,6 +34,7 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_multi.h"
 
 extern char* optarg;
 
@@ -57,9 +58,13 @@ static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static int sr_main_multi(struct sr_instance* config, char* routers, int loops,
+                         char* server, unsigned int port);
 
 struct sr_instance sr;
+static struct sr_multi multi; /* -m: the routers hosted here */
 void sr_main_abort(int sig);
+void sr_main_dump(int sig);
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -76,18 +81,29 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    char *flight = 0;
+    char *control = 0;
+    int workers = 0;
+    int loggers;
+    char *routers = 0;
+    int loops = 1;
 
     uint32_t mask = DEFAULT_MASK; 
     char *subnetstr = DEFAULT_SUBNET;
     struct in_addr subnetaddr;
     uint32_t subnet;
+    int rt_engine = SR_RT_TRIE;
+    const struct sr_io* io = &sr_vns_io;
+    char *ifnames = 0;
 
     (void) signal(SIGINT, sr_main_abort);
+    (void) signal(SIGUSR1, sr_main_dump);
 
     printf("Using %s\n", VERSION_INFO);
+    sr_log_init();
     
 
-    while ((c = getopt(argc, argv, "ha:s:v:p:u:t:r:l:T:S:M:")) != EOF)
+    while ((c = getopt(argc, argv, "ha:s:v:p:u:t:r:l:T:S:M:L:B:i:F:C:W:m:E:g:")) != EOF)
     {
         switch (c)
         {
@@ -128,6 +144,45 @@ int main(int argc, char **argv)
             case 'M':
                 mask = (uint32_t) strtoull((char *) optarg,NULL,16);
                 break;
+            case 'L':
+                if (strcmp(optarg, "dir") == 0) rt_engine = SR_RT_DIR;
+                else if (strcmp(optarg, "list") == 0) rt_engine = SR_RT_LIST;
+                else if (strcmp(optarg, "trie") == 0) rt_engine = SR_RT_TRIE;
+                else {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'B':
+                if (!(io = sr_io_find(optarg))) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'i':
+                ifnames = optarg;
+                break;
+            case 'F':
+                flight = optarg;
+                break;
+            case 'C':
+                control = optarg;
+                break;
+            case 'W':
+                workers = atoi((char *) optarg);
+                break;
+            case 'm':
+                routers = optarg;
+                break;
+            case 'E':
+                loops = atoi((char *) optarg);
+                break;
+            case 'g':
+                if (sr_log_set(optarg) == -1) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
         } /* switch */
     } /* -- while -- */
 
@@ -146,16 +201,11 @@ int main(int argc, char **argv)
     sr.subnet = subnet;
     strncpy(sr.subnetstr,subnetstr,16);
     sr.mask = htonl(mask);
+    sr.rt_engine = rt_engine;
+    sr.io = io;
+    sr.pipe.want = workers;
 
 
-    /* -- set up routing table from file -- */
-    if(template == NULL) {
-        sr.template[0] = '\0';
-        sr_load_rt_wrap(&sr, rtable);
-    }
-    else
-        strncpy(sr.template, template, 30);
-
     sr.topo_id = topo;
     strncpy(sr.host,host,32);
     strncpy(sr.auth_key_fn,auth_key_file,64);
@@ -165,11 +215,36 @@ int main(int argc, char **argv)
     else
     { strncpy(sr.user, user, 32); }
 
+    /* -- many routers: sr is what they have in common -- */
+    if(routers != 0)
+    {
+        if(template || logfile || flight || control || sr.io->open || sr.io == &sr_pipe_io)
+        {
+            fprintf(stderr,"-m hosts routers on the vns or uring backend, "
+                    "without -T, -l, -F or -C\n");
+            return 1;
+        }
+        c = sr_main_multi(&sr, routers, loops, server, port);
+        sr_log_print_stats();
+        return c == 0 ? 0 : 1;
+    }
+
+    /* -- set up routing table from file -- */
+    if(template == NULL) {
+        sr.template[0] = '\0';
+        sr_load_rt_wrap(&sr, rtable);
+    }
+    else
+        strncpy(sr.template, template, 30);
+
+    /* -- pipelined, every thread logs packets to a queue or ring of its own -- */
+    loggers = sr.io == &sr_pipe_io || (sr.io == &sr_tap_io && workers) ?
+        sr_pipe_loggers(workers) : 1;
+
     /* -- set up file pointer for logging of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        if(sr_pcap_open(&sr.pcap,logfile,PACKET_DUMP_SIZE,loggers) != 0)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
@@ -177,33 +252,56 @@ int main(int argc, char **argv)
         }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else {
-        Debug("Requesting topology %d\n", topo);
-    }
+    /* -- recent packets kept in memory and dumped when asked for -- */
+    if(flight != 0 && sr_flight_open(&sr.flight,flight,PACKET_DUMP_SIZE,loggers) != 0)
+    { exit(1); }
 
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    if(sr.io->open)
     {
-        return 1;
+        /* -- interfaces come from the kernel rather than the server -- */
+        Debug("Using %s backend\n", sr.io->name);
+        if(sr.io->open(&sr, ifnames) == -1 || sr_verify_routing_table(&sr) != 0)
+        {
+            fprintf(stderr,"Could not set up interfaces for the %s backend\n", sr.io->name);
+            sr_destroy_instance(&sr);
+            return 1;
+        }
     }
+    else
+    {
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else {
+            Debug("Requesting topology %d\n", topo);
+        }
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(&sr,port,server) == -1)
+        {
+            return 1;
+        }
 
-    if(template != NULL) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
+        if(template != NULL) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", template);
+            sr_load_rt_wrap(&sr, "rtable.vrhost");
+        }
     }
 
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
-    /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1) { 
-        sr_arp_check_refresh(&sr); 
+    /* -- whizbang main loop ;-) timers run on time whether or not packets arrive */
+    if(sr_event_init(&sr) == -1 || sr.io->start(&sr) == -1 ||
+       (control != 0 && sr_control_open(&sr, control) == -1))
+    {
+        sr_destroy_instance(&sr);
+        return 1;
     }
+    sr_event_run(&sr);
 
     sr_destroy_instance(&sr);
+    sr_log_print_stats();
 
     return 0;
 }/* -- main -- */
@@ -220,6 +318,15 @@ static void usage(char* argv0)
     printf("           [-T template_name] [-u username] [-a auth_key_filename]\n");
     printf("           [-t topo id] [-r routing table] \n");
     printf("           [-l log file] [-S subnet addr (dotted decimal)] [-M subnet mask (hex)]\n");
+    printf("           [-L route lookup: trie (default), dir (DIR-24-8) or list]\n");
+    printf("           [-B backend: vns (default), uring, packet, tap, xdp or pipe]\n");
+    printf("           [-W workers routing packets for -B pipe (default %d), or tap queues for -B tap]\n", SR_PIPE_WORKERS);
+    printf("           [-i interfaces: eth0,eth1,.. or for tap eth0=10.0.1.1,eth1=..]\n");
+    printf("           [-F flight recorder: size[,seconds[,file prefix]] eg 64M,30]\n");
+    printf("           [-C control fifo: echo help > fifo]\n");
+    printf("           [-m routers file: a line of topo id, rtable [and host] per router]\n");
+    printf("           [-E event loop threads serving -m routers (default 1)]\n");
+    printf("           [-g log levels: eg info,arp=debug,router=trace]\n");
     printf("   defaults server=%s port=%d host=%s topo=%d user=%s subnet=%s mask=0x%lX\n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST, DEFAULT_TOPO, DEFAULT_USER, DEFAULT_SUBNET, (unsigned long int) DEFAULT_MASK);
 } /* -- usage -- */
@@ -261,24 +368,56 @@ void sr_set_user(struct sr_instance* sr)
  *
  *----------------------------------------------------------------------------*/
 void sr_main_abort(int signal) {
+        /* let the event loop finish what it is doing and clean up in main */
+        if (multi.running) {
+                sr_multi_stop(&multi);
+                return;
+        }
+        if (sr.events.running) {
+                sr_event_stop(&sr);
+                return;
+        }
         Debug("MAIN: doing sr_destroy_instance\n");
         sr_destroy_instance(&sr);
         Debug("MAIN: sr_destroy_instance finished - exiting\n");
         exit(0);
 }
 
+/** SIGUSR1: write the flight recorder out at the end of the batch */
+void sr_main_dump(int signal) {
+        sr_flight_trigger(&sr.flight, SR_FLIGHT_SIGNAL);
+}
+
 static void sr_destroy_instance(struct sr_instance* sr)
 {
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    /* -- the pipe's threads log and send: stop them before anything they use goes -- */
+    sr_pipe_close(sr);
+
+    if(sr->pcap.fd >= 0)
+    {
+        sr_pcap_close(&sr->pcap);
+        sr_pcap_print_stats(&sr->pcap);
+    }
+    if(sr->flight.rings)
     {
-        sr_dump_close(sr->logfile);
+        sr_flight_print_stats(&sr->flight);
+        sr_flight_close(&sr->flight);
     }
+    sr_control_close(sr);
+    sr->io->print_stats(sr);
+    sr_event_print_stats(sr);
+    sr_event_close(sr);
+    sr->io->close(sr);
+    sr_cache_print_stats(&sr_fwd(sr)->cache);
+    sr_buffer_print_stats(sr);
+    sr_rt_print_stats(sr);
     sr_rt_clear(sr);
     sr_if_clear(sr);
     sr_buffer_clear(sr);
+    sr_arp_clear(sr);
     
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
@@ -298,19 +437,32 @@ static void sr_init_instance(struct sr_instance* sr)
     assert(sr);
 
     sr->sockfd = -1;
+    sr->io = &sr_vns_io;
+    sr_rx_init(&sr->rx);
+    sr_tx_init(&sr->tx);
+    sr->events.epfd = sr->events.tfd = -1;
     sr->user[0] = 0;
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
     sr->routing_table = 0;
-    sr->logfile = 0;
-
-    Debug("MAIN: sr_init: zero out arp table and reset refresh timer\n");
-    memset(sr->arp_table,0,sizeof(struct sr_arp) * LAN_SIZE);
-    time(&sr->arp_lastrefresh);
+    sr->rt_last = 0;
+    sr->rt_trie = 0;
+    sr->rt_dir = 0;
+    sr->rt_engine = SR_RT_TRIE;
+    sr->rt_gen = 0;
+    sr_epoch_init(&sr->rt_epoch);
+    sr->pcap.fd = -1;
+    sr->control.fd = -1;
+
+    Debug("MAIN: sr_init: start the timer wheel and an empty arp table\n");
+    sr_timer_init(&sr_fwd(sr)->timers);
+    sr_arp_init(sr);
     Debug("MAIN: sr_init: zero out ip2iface and interfaces tables\n");
     memset(sr->ip2iface,0,sizeof(struct sr_if*) * LAN_SIZE);
     memset(sr->interfaces,0,sizeof(struct sr_if*) * LAN_SIZE);
+    Debug("MAIN: clearing destination cache\n");
+    sr_cache_clear(&sr_fwd(sr)->cache);
     Debug("MAIN: clearing buffer\n");
     sr_buffer_clear(sr);
     sr->subnet = 0;
@@ -382,3 +534,122 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     sr_print_routing_table(sr);
     printf("---------------------------------------------\n");
 }
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_main_router(..)
+ * Scope: local
+ *
+ * One of the routers hosted with -m: set up as sr is from the options in
+ * config, with its own topology, rtable and host, connected and ready to
+ * be served by sr_multi_run.
+ *
+ *----------------------------------------------------------------------------*/
+
+static struct sr_instance* sr_main_router(struct sr_instance* config, unsigned int topo,
+        const char* rtable, const char* host, char* server, unsigned int port)
+{
+    struct sr_instance* sr;
+
+    if((sr = (struct sr_instance*)calloc(1, sizeof(struct sr_instance))) == 0)
+    {
+        perror("calloc(..):sr_main.c::sr_main_router");
+        return 0;
+    }
+    sr_init_instance(sr);
+    sr->subnet = config->subnet;
+    strncpy(sr->subnetstr, config->subnetstr, sizeof(sr->subnetstr));
+    sr->mask = config->mask;
+    sr->rt_engine = config->rt_engine;
+    sr->io = config->io;
+    sr->template[0] = '\0';
+    sr->topo_id = topo;
+    strncpy(sr->host, host, 32);
+    strncpy(sr->auth_key_fn, config->auth_key_fn, 64);
+    strncpy(sr->user, config->user, 32);
+
+    if(sr_load_rt(sr, rtable) != 0)
+    {
+        fprintf(stderr,"Error setting up routing table from file %s\n", rtable);
+        /* -- the routes read before the bad line are linked in -- */
+        sr_destroy_instance(sr);
+        free(sr);
+        return 0;
+    }
+    Debug("MAIN: router for topology %u connecting to %s:%u\n", topo, server, port);
+    if(sr_connect_to_server(sr, port, server) == -1)
+    {
+        sr_destroy_instance(sr);
+        free(sr);
+        return 0;
+    }
+    sr_init(sr);
+    if(sr_event_init(sr) == -1 || sr->io->start(sr) == -1)
+    {
+        sr_destroy_instance(sr);
+        free(sr);
+        return 0;
+    }
+    return sr;
+} /* -- sr_main_router -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_main_multi(..)
+ * Scope: local
+ *
+ * -m: start a router for every line of the routers file and serve them
+ * all until they have gone or sr is stopped. See sr_multi.h.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int sr_main_multi(struct sr_instance* config, char* routers, int loops,
+                         char* server, unsigned int port)
+{
+    struct sr_instance* sr;
+    char line[BUFSIZ];
+    char rtable[256];
+    char host[32];
+    unsigned int topo;
+    FILE* fp;
+    int i, n, ret = 0;
+
+    if((fp = fopen(routers, "r")) == 0)
+    {
+        perror("fopen(..):sr_main.c::sr_main_multi");
+        return -1;
+    }
+    sr_multi_init(&multi);
+    while(ret == 0 && fgets(line, BUFSIZ, fp) != 0)
+    {
+        if(line[0] == '#') continue;
+        strncpy(host, config->host, sizeof(host));
+        if((n = sscanf(line, "%u %255s %31s", &topo, rtable, host)) < 2) continue;
+        if((sr = sr_main_router(config, topo, rtable, host, server, port)) == 0)
+        { ret = -1; }
+        else if(sr_multi_add(&multi, sr) == -1)
+        {
+            /* -- not one of multi's: nothing else will let it go -- */
+            sr_destroy_instance(sr);
+            free(sr);
+            ret = -1;
+        }
+    }
+    fclose(fp);
+
+    if(ret == 0 && multi.routers == 0)
+    {
+        fprintf(stderr,"No routers in %s\n", routers);
+        ret = -1;
+    }
+    if(ret == 0)
+    {
+        printf("MAIN: serving %d routers\n", multi.routers);
+        ret = sr_multi_run(&multi, loops);
+        sr_multi_print_stats(&multi);
+    }
+    for(i = 0; i < multi.routers; i++)
+    {
+        sr_destroy_instance(multi.router[i]);
+        free(multi.router[i]);
+    }
+    return ret;
+} /* -- sr_main_multi -- */
@@ -0,0 +1,212 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * many routers in one process: see sr_multi.h
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "sr_router.h"
+#include "sr_multi.h"
+
+static double sr_multi_now(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** @return KB resident now or 0 if /proc can't tell us */
+static long sr_multi_rss(void)
+{
+        long pages, resident = 0;
+        FILE* fp;
+
+        if (!(fp = fopen("/proc/self/statm", "r"))) return 0;
+        if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(fp);
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void sr_multi_init(struct sr_multi* m)
+{
+        assert(m);
+        memset(m, 0, sizeof(*m));
+        m->rss = sr_multi_rss();
+}
+
+/** @return 0 or -1 if there are SR_MULTI_ROUTERS already */
+int sr_multi_add(struct sr_multi* m, struct sr_instance* sr)
+{
+        assert(m);
+        assert(sr);
+        if (m->routers == SR_MULTI_ROUTERS) {
+                fprintf(stderr, "MULTI: at most %d routers\n", SR_MULTI_ROUTERS);
+                return -1;
+        }
+        m->router[m->routers++] = sr;
+        return 0;
+}
+
+/** run a pass of each router's loop that has something to do, until they have all gone */
+static void* sr_multi_serve(void* arg)
+{
+        struct sr_multi_loop* l = arg;
+        struct epoll_event e[SR_EVENT_BATCH];
+        struct sr_instance* sr;
+        int n, i;
+
+        while (l->m->running && l->routers) {
+                if ((n = epoll_wait(l->epfd, e, SR_EVENT_BATCH, -1)) == -1) {
+                        if (errno == EINTR) continue;
+                        perror("epoll_wait(..):sr_multi.c::sr_multi_serve");
+                        break;
+                }
+                l->wakeups++;
+                for (i = 0; i < n; i++) {
+                        /* the wake eventfd has no router */
+                        if (!(sr = e[i].data.ptr)) continue;
+                        l->passes++;
+                        if (sr_event_poll(sr, 0) == 0 && sr->events.running) continue;
+                        /* its server hung up: the others carry on */
+                        epoll_ctl(l->epfd, EPOLL_CTL_DEL, sr->events.epfd, 0);
+                        l->routers--;
+                        printf("MULTI: the router for topology %d has stopped\n", sr->topo_id);
+                }
+        }
+        return 0;
+}
+
+/** a loop's epoll fd watching its share of the routers */
+static int sr_multi_loop_init(struct sr_multi* m, struct sr_multi_loop* l, int id)
+{
+        struct epoll_event e;
+        int i;
+
+        l->m = m;
+        l->id = id;
+        l->wake = -1;
+        if ((l->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+                perror("epoll_create1(..):sr_multi.c::sr_multi_loop_init");
+                return -1;
+        }
+        if ((l->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+                perror("eventfd(..):sr_multi.c::sr_multi_loop_init");
+                return -1;
+        }
+        e.events = EPOLLIN;
+        e.data.ptr = 0;
+        if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->wake, &e) == -1) {
+                perror("epoll_ctl(..):sr_multi.c::sr_multi_loop_init");
+                return -1;
+        }
+        for (i = id; i < m->routers; i += m->loops) {
+                e.data.ptr = m->router[i];
+                if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, m->router[i]->events.epfd, &e) == -1) {
+                        perror("epoll_ctl(..):sr_multi.c::sr_multi_loop_init");
+                        return -1;
+                }
+                m->router[i]->events.running = 1;
+                l->routers++;
+        }
+        return 0;
+}
+
+/**
+ * serve every router added, each on one of loops threads, the first of
+ * them being this one, until they have all stopped or sr_multi_stop
+ * @return 0 or -1 if the loops couldn't be set up
+ */
+int sr_multi_run(struct sr_multi* m, int loops)
+{
+        sigset_t all, old;
+        double start;
+        int i, err = 0;
+
+        assert(m);
+        if (loops < 1) loops = 1;
+        if (loops > SR_MULTI_LOOPS) loops = SR_MULTI_LOOPS;
+        if (loops > m->routers) loops = m->routers;
+        m->loops = loops;
+        for (i = 0; i < loops; i++) {
+                if (sr_multi_loop_init(m, &m->loop[i], i) == -1) {
+                        m->loops = i + 1;
+                        err = -1;
+                        goto out;
+                }
+        }
+        m->running = 1;
+        start = sr_multi_now();
+
+        /* signals are for the main thread, which runs the first loop */
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &old);
+        for (i = 1; i < loops && !err; i++) {
+                err = pthread_create(&m->loop[i].thread, 0, sr_multi_serve, &m->loop[i]);
+        }
+        pthread_sigmask(SIG_SETMASK, &old, 0);
+        if (err) {
+                errno = err;
+                perror("pthread_create(..):sr_multi.c::sr_multi_run");
+                sr_multi_stop(m);
+                i--;
+        } else {
+                sr_multi_serve(&m->loop[0]);
+        }
+        while (--i > 0) pthread_join(m->loop[i].thread, 0);
+        m->running = 0;
+        m->seconds = sr_multi_now() - start;
+out:
+        /* the loop that failed to set up is closed here too */
+        for (i = 0; i < m->loops; i++) {
+                if (m->loop[i].epfd != -1) close(m->loop[i].epfd);
+                if (m->loop[i].wake != -1) close(m->loop[i].wake);
+                m->loop[i].epfd = m->loop[i].wake = -1;
+        }
+        return err ? -1 : 0;
+}
+
+/** make sr_multi_run return: safe to call from a signal handler */
+void sr_multi_stop(struct sr_multi* m)
+{
+        uint64_t one = 1;
+        int i;
+
+        m->running = 0;
+        for (i = 0; i < m->loops; i++) {
+                if (m->loop[i].wake != -1 && write(m->loop[i].wake, &one, sizeof(one))) continue;
+        }
+}
+
+void sr_multi_print_stats(struct sr_multi* m)
+{
+        struct sr_instance* sr;
+        unsigned long commands = 0, sent = 0;
+        int i, pools = 0;
+        double t;
+
+        for (i = 0; i < m->routers; i++) {
+                sr = m->router[i];
+                commands += sr->rx.commands;
+                sent += sr->tx.sent;
+                if (sr->fwd.buffer.packets) pools++;
+        }
+        t = m->seconds > 0 ? m->seconds : 1;
+        printf("MULTI: %d routers on %d loops for %.1f s: %lu commands in (%.0f a second), "
+               "%lu frames out (%.0f a second)\n", m->routers, m->loops, m->seconds,
+               commands, commands / t, sent, sent / t);
+        for (i = 0; i < m->loops; i++) {
+                printf("MULTI: loop %d: %lu wakeups, %lu router passes\n",
+                       i, m->loop[i].wakeups, m->loop[i].passes);
+        }
+        printf("MULTI: %lu KB per sr_instance, %d of %d packet pools allocated (%lu KB each), "
+               "%ld KB resident per router\n",
+               (unsigned long) sizeof(struct sr_instance) / 1024, pools, m->routers,
+               (unsigned long) (BUFFSIZE * sizeof(m->router[0]->fwd.buffer.packets[0])) / 1024,
+               m->routers ? (sr_multi_rss() - m->rss) / m->routers : 0);
+}
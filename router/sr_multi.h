@@ -0,0 +1,67 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * many routers in one process: sr -m routers [-E loops]
+ *
+ * each router is a sr_instance of its own with its own VNS connection,
+ * routing table, arp table, timers and event loop (sr_event.h), and
+ * nothing is shared between them. what used to take a process per
+ * topology takes an epoll fd each instead: -E threads (one by default)
+ * each watch the epoll fds of a share of the routers, an epoll fd being
+ * readable whenever something registered with it is, and run a pass of a
+ * router's own loop (sr_event_poll) when it has something to do. a router
+ * whose server hangs up drops out and the rest carry on until the last
+ * one goes or sr is stopped.
+ *
+ * the routers file has a line per router: a topology id, the rtable for
+ * it and optionally the virtual host (-v otherwise). the server, user,
+ * key, lookup engine and backend are those given to sr for all of them.
+ *
+ * a router costs what its sr_instance does. the arp buffer's packet pool
+ * (sr_buffer.h), most of that, is only allocated once a packet has to
+ * wait for arp, the TAP and AF_XDP backends' state only by their open,
+ * and the rest is calloc'd, so pages a router never uses are never
+ * resident.
+ */
+#ifndef SR_MULTI_H
+#define SR_MULTI_H
+
+#include <signal.h>
+#include <pthread.h>
+
+#define SR_MULTI_ROUTERS 256
+#define SR_MULTI_LOOPS 16
+
+struct sr_instance;
+struct sr_multi;
+
+struct sr_multi_loop
+{
+        struct sr_multi* m;
+        int id;
+        int epfd;               /** the epoll fds of its routers */
+        int wake;               /** eventfd written by sr_multi_stop */
+        pthread_t thread;
+        int routers;            /** still connected */
+        unsigned long wakeups;
+        unsigned long passes;   /** router loop passes run */
+};
+
+struct sr_multi
+{
+        struct sr_instance* router[SR_MULTI_ROUTERS];
+        int routers;
+        int loops;
+        struct sr_multi_loop loop[SR_MULTI_LOOPS];
+        volatile sig_atomic_t running;
+        long rss;               /** resident KB before the first router */
+        double seconds;         /** sr_multi_run took */
+};
+
+void sr_multi_init(struct sr_multi* m);
+int sr_multi_add(struct sr_multi* m, struct sr_instance* sr);
+int sr_multi_run(struct sr_multi* m, int loops);
+void sr_multi_stop(struct sr_multi* m);
+void sr_multi_print_stats(struct sr_multi* m);
+
+#endif
@@ -0,0 +1,163 @@
+#!/bin/bash
+# run sr on one machine without a VNS server: two hosts in their own
+# network namespaces with the router in a third namespace between them
+#
+#   h1 10.0.1.2 ---- eth0 10.0.1.1 [ r ] eth1 10.0.2.1 ---- 10.0.2.2 h2
+#
+# with the packet backend (-B packet, the default here) the links are veth
+# pairs and sr reads the router end of each with AF_PACKET. the kernel in
+# r has its ip stack switched off for these addresses so that only sr
+# answers arp and ping and forwards packets.
+#
+# with the tap backend (-B tap) sr creates TAP devices eth0 and eth1 in r
+# and this script moves the kernel end of each into h1 and h2.
+#
+# the xdp backend (-B xdp) uses the same veth pairs as packet.
+#
+# usage: sr_netns.sh [-B packet|tap|xdp] up | down | run | test | bench [seconds] [payload bytes]
+#   up     create the namespaces
+#   down   remove them
+#   run    run sr in the foreground in r (ctrl-c to stop)
+#   test   ping and tracepath through sr
+#   bench  udp from h1 to h2 through sr (see sr_bench_udp.c)
+# must be run as root. sr_netns.sh test and bench bring everything up and
+# down themselves.
+
+cd `dirname $0`
+rtable=rtable.netns
+srlog=sr.netns.txt
+backend=packet
+
+if [ "$1" = "-B" ]
+then
+	backend=$2
+	shift 2
+fi
+
+host() {
+	# host() namespace device address gateway
+	ip -n $1 addr add $3/24 dev $2
+	ip -n $1 link set $2 up
+	ip -n $1 route add default via $4
+}
+
+up() {
+	down 2> /dev/null
+	for ns in h1 r h2
+	do
+		ip netns add $ns
+		ip -n $ns link set lo up
+	done
+	cat > $rtable <<EOF
+10.0.1.2           10.0.1.2           255.255.255.255    eth0
+10.0.2.2           10.0.2.2           255.255.255.255    eth1
+EOF
+	[ $backend = tap ] && return
+
+	ip link add veth1 netns h1 type veth peer name eth0 netns r
+	ip link add veth2 netns h2 type veth peer name eth1 netns r
+	host h1 veth1 10.0.1.2 10.0.1.1
+	host h2 veth2 10.0.2.2 10.0.2.1
+
+	# sr finds its addresses on the interfaces but the kernel must not use them
+	ip netns exec r sysctl -qw net.ipv4.ip_forward=0
+	ip netns exec r sysctl -qw net.ipv4.icmp_echo_ignore_all=1
+	ip netns exec r sysctl -qw net.ipv6.conf.all.disable_ipv6=1
+	for i in eth0 eth1
+	do
+		ip netns exec r sysctl -qw net.ipv4.conf.$i.arp_ignore=8
+	done
+	ip -n r addr add 10.0.1.1/24 dev eth0
+	ip -n r addr add 10.0.2.1/24 dev eth1
+	ip -n r link set eth0 up
+	ip -n r link set eth1 up
+}
+
+# tap only: once sr has created its devices hand the kernel ends to the hosts
+plug() {
+	for try in 1 2 3 4 5 6 7 8 9 10
+	do
+		ip -n r link show eth1 > /dev/null 2>&1 && break
+		sleep 0.2
+	done
+	ip -n r link set eth0 netns h1
+	ip -n r link set eth1 netns h2
+	ip -n h1 link set eth0 name veth1
+	ip -n h2 link set eth1 name veth2
+	host h1 veth1 10.0.1.2 10.0.1.1
+	host h2 veth2 10.0.2.2 10.0.2.1
+}
+
+down() {
+	for ns in h1 r h2
+	do
+		ip netns del $ns
+	done
+	rm -f $rtable
+}
+
+# tap only: sr's first arp requests go out before the hosts are plugged in
+# so give it time to ask again (ARP_CHECK_EVERY in sr_arp.h)
+settle() {
+	sleep 3
+	[ $backend = tap ] && sleep 9
+}
+
+start() {
+	if [ $backend = tap ]
+	then
+		plug &
+		exec ip netns exec r ./sr -B tap -i eth0=10.0.1.1,eth1=10.0.2.1 -r $rtable -S 10.0.0.0 -M FFFF0000 "$@"
+	fi
+	exec ip netns exec r ./sr -B $backend -i eth0,eth1 -r $rtable -S 10.0.0.0 -M FFFF0000 "$@"
+}
+
+case "$1" in
+up)
+	up
+	;;
+down)
+	down
+	;;
+run)
+	shift
+	start "$@"
+	;;
+test)
+	make sr || exit 1
+	up
+	start > $srlog 2>&1 &
+	settle
+	ip netns exec h1 ping -c 3 10.0.1.1 && \
+	ip netns exec h1 ping -c 3 10.0.2.2 && \
+	ip netns exec h2 ping -c 3 10.0.1.2
+	ok=$?
+	ip netns exec h1 tracepath -n 10.0.2.2
+	kill -INT $!
+	wait
+	grep -E '^(PACKET|TAP|XDP|EVENT):' $srlog
+	down
+	exit $ok
+	;;
+bench)
+	seconds=${2:-5}
+	size=${3:-18}
+	make sr sr_bench_udp || exit 1
+	up
+	start > /dev/null 2> $srlog &
+	settle
+	# prime arp on both sides before timing anything
+	ip netns exec h1 ping -c 1 -W 1 10.0.2.2 > /dev/null
+	ip netns exec h2 ./sr_bench_udp recv $((seconds + 2)) &
+	sleep 0.5
+	ip netns exec h1 ./sr_bench_udp send 10.0.2.2 $seconds $size
+	wait %2
+	kill -INT %1
+	wait
+	down
+	;;
+*)
+	echo "usage: $0 [-B packet|tap|xdp] up | down | run | test | bench [seconds] [payload bytes]"
+	exit 1
+	;;
+esac
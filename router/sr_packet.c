@@ -0,0 +1,282 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * AF_PACKET backend with TPACKET_V3 rings: see sr_packet.h
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include "sr_router.h"
+#include "sr_io.h"
+#include "sr_packet.h"
+
+/** where frame data starts in a tx slot when PACKET_TX_HAS_OFF is not set */
+#define SR_PACKET_TX_DATA TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+#define SR_PACKET_RX_LEN ((size_t) SR_PACKET_BLOCK * SR_PACKET_RX_BLOCKS)
+#define SR_PACKET_TX_LEN ((size_t) SR_PACKET_FRAME * SR_PACKET_TX_FRAMES)
+
+static inline struct tpacket_block_desc* sr_packet_block(struct sr_packet_if* pi, unsigned int i)
+{
+        return (struct tpacket_block_desc*)(pi->map + (size_t) i * SR_PACKET_BLOCK);
+}
+
+static inline struct tpacket3_hdr* sr_packet_slot(struct sr_packet_if* pi, unsigned int i)
+{
+        return (struct tpacket3_hdr*)(pi->map + SR_PACKET_RX_LEN + (size_t) i * SR_PACKET_FRAME);
+}
+
+static struct sr_packet_if* sr_packet_find(struct sr_instance* sr, const char* name)
+{
+        int i;
+
+        for (i = 0; i < sr->packet.nifs; i++) {
+                if (strcmp(sr->packet.ifs[i].name, name) == 0) return &sr->packet.ifs[i];
+        }
+        return 0;
+}
+
+/** set up the socket and both rings for one interface */
+static int sr_packet_ring(struct sr_packet_if* pi)
+{
+        struct tpacket_req3 req;
+        struct sockaddr_ll ll;
+        int v;
+
+        /* protocol 0 so nothing lands in the ring until it is bound to pi's interface */
+        if ((pi->fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+                perror("socket(..):sr_packet.c::sr_packet_ring");
+                return -1;
+        }
+        v = TPACKET_V3;
+        if (setsockopt(pi->fd, SOL_PACKET, PACKET_VERSION, &v, sizeof(v)) == -1) {
+                perror("setsockopt(PACKET_VERSION):sr_packet.c::sr_packet_ring");
+                return -1;
+        }
+        /* a malformed frame in the tx ring is skipped rather than blocking it */
+        v = 1;
+        setsockopt(pi->fd, SOL_PACKET, PACKET_LOSS, &v, sizeof(v));
+#ifdef PACKET_IGNORE_OUTGOING
+        setsockopt(pi->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &v, sizeof(v));
+#endif
+
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = SR_PACKET_BLOCK;
+        req.tp_block_nr = SR_PACKET_RX_BLOCKS;
+        req.tp_frame_size = SR_PACKET_FRAME;
+        req.tp_frame_nr = SR_PACKET_RX_LEN / SR_PACKET_FRAME;
+        req.tp_retire_blk_tov = SR_PACKET_RX_TOV;
+        if (setsockopt(pi->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+                perror("setsockopt(PACKET_RX_RING):sr_packet.c::sr_packet_ring");
+                return -1;
+        }
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = SR_PACKET_BLOCK;
+        req.tp_block_nr = SR_PACKET_TX_LEN / SR_PACKET_BLOCK;
+        req.tp_frame_size = SR_PACKET_FRAME;
+        req.tp_frame_nr = SR_PACKET_TX_FRAMES;
+        if (setsockopt(pi->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1) {
+                perror("setsockopt(PACKET_TX_RING):sr_packet.c::sr_packet_ring");
+                return -1;
+        }
+
+        pi->maplen = SR_PACKET_RX_LEN + SR_PACKET_TX_LEN;
+        pi->map = mmap(0, pi->maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pi->fd, 0);
+        if (pi->map == MAP_FAILED) {
+                perror("mmap(..):sr_packet.c::sr_packet_ring");
+                pi->map = 0;
+                return -1;
+        }
+
+        memset(&ll, 0, sizeof(ll));
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = htons(ETH_P_ALL);
+        ll.sll_ifindex = pi->ifindex;
+        if (bind(pi->fd, (struct sockaddr*) &ll, sizeof(ll)) == -1) {
+                perror("bind(..):sr_packet.c::sr_packet_ring");
+                return -1;
+        }
+        return 0;
+}
+
+/** sr_io_discover found an interface: open a ring on it */
+static int sr_packet_found(struct sr_instance* sr, const char* name, int ifindex)
+{
+        struct sr_packet_if* pi = &sr->packet.ifs[sr->packet.nifs++];
+
+        strncpy(pi->name, name, sr_IFACE_NAMELEN - 1);
+        pi->ifindex = ifindex;
+        return sr_packet_ring(pi);
+}
+
+/**
+ * find the interfaces to route between and open a ring on each
+ * @param ifnames comma separated interface names or 0 for every interface that is up
+ */
+static int sr_packet_open(struct sr_instance* sr, const char* ifnames)
+{
+        assert(sr);
+        return sr_io_discover(sr, ifnames, SR_PACKET_MAXIF, sr_packet_found) == -1 ? -1 : 0;
+}
+
+/** event loop callback: handle every frame in the blocks the kernel has finished with */
+static void sr_packet_event(struct sr_instance* sr, int fd, uint32_t events, void* arg)
+{
+        struct sr_packet_if* pi = arg;
+        struct tpacket_block_desc* b;
+        struct tpacket3_hdr* h;
+        struct sockaddr_ll* ll;
+        uint8_t* frame;
+        uint32_t i, n;
+        int burst;
+
+        sr_timer_clock(&sr_fwd(sr)->timers);
+        for (burst = 0; burst < SR_EVENT_BURST; burst++) {
+                b = sr_packet_block(pi, pi->rx_block);
+                if (!(__atomic_load_n(&b->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+                        break;
+
+                n = b->hdr.bh1.num_pkts;
+                h = (struct tpacket3_hdr*)((uint8_t*) b + b->hdr.bh1.offset_to_first_pkt);
+                for (i = 0; i < n; i++) {
+                        ll = (struct sockaddr_ll*)((uint8_t*) h + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+                        frame = (uint8_t*) h + h->tp_mac;
+                        if (h->tp_snaplen != h->tp_len || h->tp_snaplen < sizeof(struct sr_ethernet_hdr) ||
+                            ll->sll_pkttype == PACKET_OUTGOING) {
+                                pi->rx_skipped++;
+                        } else {
+                                pi->rx_frames++;
+                                sr_log_packet(sr, frame, h->tp_snaplen);
+                                sr_handlepacket(sr, frame, h->tp_snaplen, pi->name);
+                        }
+                        h = (struct tpacket3_hdr*)((uint8_t*) h + h->tp_next_offset);
+                }
+
+                /* replies were copied to a tx slot so nothing points into the block now */
+                __atomic_store_n(&b->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+                pi->rx_block = (pi->rx_block + 1) % SR_PACKET_RX_BLOCKS;
+                pi->rx_blocks++;
+        }
+}
+
+/** tell the kernel to send every ready tx slot on pi */
+static int sr_packet_kick(struct sr_packet_if* pi)
+{
+        pi->tx_kicks++;
+        pi->tx_ready = 0;
+        if (sendto(pi->fd, 0, 0, MSG_DONTWAIT, 0, 0) == -1 &&
+            errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS && errno != EINTR) {
+                perror("sendto(..):sr_packet.c::sr_packet_kick");
+                return -1;
+        }
+        return 0;
+}
+
+/**
+ * copy a frame into the next tx slot for iface
+ * if the kernel still has the slot the frame is dropped, as a nic would with a full queue
+ */
+static int sr_packet_send(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface)
+{
+        struct sr_packet_if* pi = sr_packet_find(sr, iface);
+        struct tpacket3_hdr* h;
+
+        if (!pi) {
+                fprintf(stderr, "PACKET: no ring for interface %s\n", iface);
+                return -1;
+        }
+        if (len > SR_PACKET_FRAME - SR_PACKET_TX_DATA) {
+                fprintf(stderr, "PACKET: frame is too long (%u bytes)\n", len);
+                return -1;
+        }
+
+        h = sr_packet_slot(pi, pi->tx_frame);
+        if (__atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+                sr_packet_kick(pi);
+                if (__atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+                        pi->tx_dropped++;
+                        return 0;
+                }
+        }
+        memcpy((uint8_t*) h + SR_PACKET_TX_DATA, frame, len);
+        h->tp_len = len;
+        h->tp_snaplen = len;
+        h->tp_next_offset = 0;
+        __atomic_store_n(&h->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+        pi->tx_frame = (pi->tx_frame + 1) % SR_PACKET_TX_FRAMES;
+        pi->tx_ready++;
+        pi->tx_frames++;
+        return 0;
+}
+
+static int sr_packet_flush(struct sr_instance* sr)
+{
+        int i;
+
+        for (i = 0; i < sr->packet.nifs; i++) {
+                if (sr->packet.ifs[i].tx_ready) sr_packet_kick(&sr->packet.ifs[i]);
+        }
+        return 0;
+}
+
+/** hand the sockets to the event loop and find our neighbours */
+static int sr_packet_start(struct sr_instance* sr)
+{
+        int i;
+
+        for (i = 0; i < sr->packet.nifs; i++) {
+                if (sr_event_add(sr, sr->packet.ifs[i].fd, EPOLLIN, sr_packet_event, &sr->packet.ifs[i]) == -1)
+                        return -1;
+        }
+        printf("PACKET: Sending arp broadcasts on each interface\n");
+        sr_arp_scan(sr);
+        return sr_packet_flush(sr);
+}
+
+static void sr_packet_close(struct sr_instance* sr)
+{
+        struct sr_packet_if* pi;
+        int i;
+
+        for (i = 0; i < sr->packet.nifs; i++) {
+                pi = &sr->packet.ifs[i];
+                if (pi->map) munmap(pi->map, pi->maplen);
+                if (pi->fd != -1) close(pi->fd);
+                pi->map = 0;
+                pi->fd = -1;
+        }
+        sr->packet.nifs = 0;
+}
+
+static void sr_packet_print_stats(struct sr_instance* sr)
+{
+        struct sr_packet_if* pi;
+        int i;
+
+        for (i = 0; i < sr->packet.nifs; i++) {
+                pi = &sr->packet.ifs[i];
+                printf("PACKET: %s rx %lu frames in %lu blocks (%.1f per block), %lu skipped; "
+                        "tx %lu frames in %lu kicks, %lu dropped\n",
+                        pi->name, pi->rx_frames, pi->rx_blocks,
+                        pi->rx_blocks ? (double) pi->rx_frames / pi->rx_blocks : 0.0,
+                        pi->rx_skipped, pi->tx_frames, pi->tx_kicks, pi->tx_dropped);
+        }
+}
+
+const struct sr_io sr_packet_io = {
+        "packet",
+        sr_packet_open,
+        sr_packet_start,
+        sr_packet_send,
+        sr_packet_flush,
+        sr_packet_close,
+        sr_packet_print_stats
+};
@@ -0,0 +1,65 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * AF_PACKET backend (see sr_io.h)
+ *
+ * each router interface gets a packet socket bound to the kernel interface
+ * of the same name with a TPACKET_V3 receive ring and a transmit ring
+ * mapped into our address space.
+ *
+ * the kernel fills receive blocks with as many frames as arrive within
+ * SR_PACKET_RX_TOV ms and then hands the whole block over. frames are
+ * passed to sr_handlepacket where they sit in the ring (no copy) and the
+ * block goes back to the kernel once every frame in it has been handled.
+ * anything queued from a block is copied into the transmit ring before
+ * then, so nothing can point into a block after it is returned.
+ *
+ * sending copies the frame into the next free transmit slot and marks it
+ * ready. one sendto per interface at the end of a batch tells the kernel
+ * to send every ready slot.
+ */
+#ifndef SR_PACKET_H
+#define SR_PACKET_H
+
+#include <stdint.h>
+#include <linux/if_packet.h>
+#include "sr_if.h"
+
+/** interfaces the backend will drive */
+#define SR_PACKET_MAXIF 8
+
+/** receive ring: SR_PACKET_RX_BLOCKS blocks of SR_PACKET_BLOCK bytes */
+#define SR_PACKET_BLOCK (1 << 18)
+#define SR_PACKET_RX_BLOCKS 16
+/** ms the kernel waits for a block to fill before handing it over anyway */
+#define SR_PACKET_RX_TOV 1
+
+/** transmit ring: fixed size slots each holding one frame */
+#define SR_PACKET_FRAME 2048
+#define SR_PACKET_TX_FRAMES 512
+
+struct sr_packet_if
+{
+        char name[sr_IFACE_NAMELEN];
+        int fd;
+        int ifindex;
+        uint8_t* map;           /** rx ring followed by the tx ring */
+        size_t maplen;
+        unsigned int rx_block;  /** next block to look at */
+        unsigned int tx_frame;  /** next slot to fill */
+        unsigned int tx_ready;  /** slots filled since the last sendto */
+        unsigned long rx_frames;
+        unsigned long rx_blocks;
+        unsigned long rx_skipped;       /** truncated, or our own frames looped back */
+        unsigned long tx_frames;
+        unsigned long tx_kicks;         /** sendto calls */
+        unsigned long tx_dropped;       /** the tx ring was full */
+};
+
+struct sr_packet
+{
+        struct sr_packet_if ifs[SR_PACKET_MAXIF];
+        int nifs;
+};
+
+#endif
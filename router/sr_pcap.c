@@ -0,0 +1,363 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * packet capture through a ring drained by a writer thread: see sr_pcap.h
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "sr_dumper.h"
+#include "sr_pcap.h"
+
+static void sr_pcap_wait(struct sr_pcap* p)
+{
+        struct timespec nap = { 0, SR_PCAP_NAPMS * 1000000L };
+        syscall(SYS_futex, &p->sleeping, FUTEX_WAIT_PRIVATE, 1, &nap, 0, 0);
+}
+
+static void sr_pcap_wake(struct sr_pcap* p)
+{
+        syscall(SYS_futex, &p->sleeping, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+}
+
+/** go back to ordinary writes: for the last partial block or if O_DIRECT is refused */
+static void sr_pcap_buffered(struct sr_pcap* p)
+{
+        fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) & ~O_DIRECT);
+        p->direct = 0;
+}
+
+/** copy n bytes into q's ring at stream position pos, wrapping if need be */
+static inline void sr_pcap_put(struct sr_pcap_queue* q, uint64_t pos, const void* data, size_t n)
+{
+        size_t off = pos & (q->size - 1);
+        size_t first = n < q->size - off ? n : q->size - off;
+
+        memcpy(q->ring + off, data, first);
+        if (first < n) memcpy(q->ring, (const uint8_t*) data + first, n - first);
+}
+
+/** copy n bytes out of q's ring at stream position pos */
+static inline void sr_pcap_get(struct sr_pcap_queue* q, uint64_t pos, void* data, size_t n)
+{
+        size_t off = pos & (q->size - 1);
+        size_t first = n < q->size - off ? n : q->size - off;
+
+        memcpy(data, q->ring + off, first);
+        if (first < n) memcpy((uint8_t*) data + first, q->ring, n - first);
+}
+
+/** copy n bytes from one ring to another: the data can wrap in either */
+static void sr_pcap_move(struct sr_pcap_queue* to, uint64_t tpos, struct sr_pcap_queue* from, uint64_t fpos, size_t n)
+{
+        size_t off, len;
+
+        while (n) {
+                off = fpos & (from->size - 1);
+                len = n < from->size - off ? n : from->size - off;
+                sr_pcap_put(to, tpos, from->ring + off, len);
+                tpos += len;
+                fpos += len;
+                n -= len;
+        }
+}
+
+/**
+ * the writer, with several logging threads: move whole records from their
+ * queues to out, the oldest of the records at the front of each first,
+ * until the queues are empty or out is full
+ * @return records moved
+ */
+static unsigned long sr_pcap_merge(struct sr_pcap* p)
+{
+        struct pcap_sf_pkthdr next[SR_PCAP_QUEUES];
+        uint64_t heads[SR_PCAP_QUEUES];
+        struct sr_pcap_queue* q;
+        unsigned long moved = 0;
+        size_t need;
+        int i, best;
+
+        for (i = 0; i < p->nqueues; i++) {
+                q = &p->queues[i];
+                heads[i] = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+                if (q->tail != heads[i]) sr_pcap_get(q, q->tail, &next[i], sizeof(next[i]));
+        }
+        for (;;) {
+                best = -1;
+                for (i = 0; i < p->nqueues; i++) {
+                        if (p->queues[i].tail == heads[i]) continue;
+                        if (best < 0 || next[i].ts.tv_sec < next[best].ts.tv_sec ||
+                            (next[i].ts.tv_sec == next[best].ts.tv_sec && next[i].ts.tv_usec < next[best].ts.tv_usec))
+                                best = i;
+                }
+                if (best < 0) break;
+                q = &p->queues[best];
+                need = sizeof(next[best]) + next[best].caplen;
+                if (p->out.head + need - __atomic_load_n(&p->out.tail, __ATOMIC_ACQUIRE) > p->out.size) break;
+                sr_pcap_move(&p->out, p->out.head, q, q->tail, need);
+                __atomic_store_n(&p->out.head, p->out.head + need, __ATOMIC_RELEASE);
+                __atomic_store_n(&q->tail, q->tail + need, __ATOMIC_RELEASE);
+                if (q->tail != heads[best]) sr_pcap_get(q, q->tail, &next[best], sizeof(next[best]));
+                moved++;
+        }
+        p->merged += moved;
+        return moved;
+}
+
+/**
+ * the writer: everything between tail and head of out goes out in one
+ * writev, two pieces when it wraps round the end of the ring. with
+ * O_DIRECT only whole blocks are taken until we are told to stop.
+ */
+static void* sr_pcap_writer(void* arg)
+{
+        struct sr_pcap* p = arg;
+        struct sr_pcap_queue* o = &p->out;
+        struct iovec iov[2];
+        uint64_t head, tail;
+        size_t off, len;
+        ssize_t n;
+        int stop, moved = 0;
+
+        for (;;) {
+                stop = __atomic_load_n(&p->stop, __ATOMIC_ACQUIRE);
+                if (p->nqueues > 1) moved = sr_pcap_merge(p) != 0;
+                head = __atomic_load_n(&o->head, __ATOMIC_ACQUIRE);
+                tail = o->tail;
+                len = head - tail;
+                if (p->direct) {
+                        if (stop) sr_pcap_buffered(p);
+                        else len &= ~(size_t) (SR_PCAP_BLOCK - 1);
+                }
+                if (!len) {
+                        if (moved) continue;
+                        if (stop) break;
+                        __atomic_store_n(&p->sleeping, 1, __ATOMIC_SEQ_CST);
+                        /* a wake that comes before we wait is lost, but the nap is short */
+                        if (__atomic_load_n(&o->head, __ATOMIC_SEQ_CST) - tail < o->size / 2)
+                                sr_pcap_wait(p);
+                        __atomic_store_n(&p->sleeping, 0, __ATOMIC_RELAXED);
+                        continue;
+                }
+
+                off = tail & (o->size - 1);
+                iov[0].iov_base = o->ring + off;
+                iov[0].iov_len = len < o->size - off ? len : o->size - off;
+                iov[1].iov_base = o->ring;
+                iov[1].iov_len = len - iov[0].iov_len;
+                n = writev(p->fd, iov, iov[1].iov_len ? 2 : 1);
+                if (n < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno == EINVAL && p->direct) {
+                                sr_pcap_buffered(p);
+                                continue;
+                        }
+                        if (!p->errors++) perror("writev(..):sr_pcap.c::sr_pcap_writer");
+                        n = len; /* throw it away rather than fill up and drop everything after */
+                }
+                else {
+                        p->writes++;
+                        p->bytes += n;
+                }
+                __atomic_store_n(&o->tail, tail + n, __ATOMIC_RELEASE);
+        }
+        return 0;
+}
+
+/** the logging threads' counts: out's own if it is the only queue */
+static void sr_pcap_totals(struct sr_pcap* p, struct sr_pcap_queue* t)
+{
+        struct sr_pcap_queue* q;
+        int i;
+
+        *t = p->out;
+        if (!p->queues || p->queues == &p->out) return;
+        t->packets = t->drops = t->wakes = t->high = 0;
+        t->size = p->queues[0].size;
+        for (i = 0; i < p->nqueues; i++) {
+                q = &p->queues[i];
+                t->packets += q->packets;
+                t->drops += q->drops;
+                t->wakes += q->wakes;
+                if (q->high > t->high) t->high = q->high;
+        }
+}
+
+/** free the rings, keeping the counts in out: the writer has to be gone */
+static void sr_pcap_free(struct sr_pcap* p)
+{
+        struct sr_pcap_queue t;
+        int i;
+
+        if (p->queues && p->queues != &p->out) {
+                sr_pcap_totals(p, &t);
+                for (i = 0; i < p->nqueues; i++) free(p->queues[i].ring);
+                free(p->queues);
+                p->out.packets = t.packets;
+                p->out.drops = t.drops;
+                p->out.wakes = t.wakes;
+                p->out.high = t.high;
+                p->out.size = t.size;
+        }
+        p->queues = 0;
+        p->nqueues = 0;
+        free(p->out.ring);
+        p->out.ring = 0;
+}
+
+/**
+ * open the file, put the file header in the ring and start the writer
+ * @param fname file name or "-" for stdout
+ * @param queues threads that will log: each is given a queue number below this
+ * @return 0 or -1 if the file could not be opened
+ */
+int sr_pcap_open(struct sr_pcap* p, const char* fname, int snaplen, int queues)
+{
+        struct pcap_file_header hdr;
+        int i, err;
+
+        assert(p);
+        memset(p, 0, sizeof(*p));
+        p->fd = -1;
+        p->snaplen = snaplen;
+        if (queues < 1 || queues > SR_PCAP_QUEUES) {
+                fprintf(stderr, "PCAP: %d threads logging: there can be 1 to %d\n", queues, SR_PCAP_QUEUES);
+                return -1;
+        }
+        if (fname[0] == '-' && fname[1] == '\0') {
+                p->fd = dup(1);
+        }
+        else {
+                p->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+                p->direct = p->fd >= 0;
+                /* tmpfs and some others won't do O_DIRECT */
+                if (p->fd < 0 && errno == EINVAL) p->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (p->fd < 0) {
+                fprintf(stderr, "sr_pcap_open: can't open %s: %s\n", fname, strerror(errno));
+                return -1;
+        }
+
+        p->out.size = SR_PCAP_RING;
+        if (!(p->out.ring = aligned_alloc(SR_PCAP_BLOCK, SR_PCAP_RING))) goto nomem;
+        if (queues == 1) {
+                p->queues = &p->out;
+        }
+        else if ((p->queues = aligned_alloc(64, queues * sizeof(struct sr_pcap_queue)))) {
+                memset(p->queues, 0, queues * sizeof(struct sr_pcap_queue));
+                for (i = 0; i < queues; i++) {
+                        p->queues[i].size = SR_PCAP_QUEUE;
+                        if (!(p->queues[i].ring = malloc(SR_PCAP_QUEUE))) break;
+                }
+                if (i < queues) {
+                        p->nqueues = queues;
+                        goto nomem;
+                }
+        }
+        else goto nomem;
+        p->nqueues = queues;
+
+        /* as sf_write_header in sr_dumper.c */
+        hdr.magic = TCPDUMP_MAGIC;
+        hdr.version_major = PCAP_VERSION_MAJOR;
+        hdr.version_minor = PCAP_VERSION_MINOR;
+        hdr.thiszone = 0;
+        hdr.sigfigs = 0;
+        hdr.snaplen = snaplen;
+        hdr.linktype = LINKTYPE_ETHERNET;
+        sr_pcap_put(&p->out, 0, &hdr, sizeof(hdr));
+        p->out.head = sizeof(hdr);
+
+        if ((err = pthread_create(&p->writer, 0, sr_pcap_writer, p))) {
+                fprintf(stderr, "PCAP: can't start the writer: %s\n", strerror(err));
+                sr_pcap_free(p);
+                close(p->fd);
+                p->fd = -1;
+                return -1;
+        }
+        return 0;
+
+nomem:
+        perror("aligned_alloc(..):sr_pcap.c::sr_pcap_open");
+        sr_pcap_free(p);
+        close(p->fd);
+        p->fd = -1;
+        return -1;
+}
+
+/**
+ * queue a frame for the capture file, or count it as dropped if there is no room
+ * @param queue the calling thread's: only it ever logs to that queue
+ * @param ts time of the batch or 0 to read the clock
+ */
+void sr_pcap_log(struct sr_pcap* p, int queue, const uint8_t* buf, int len, const struct timeval* ts)
+{
+        struct sr_pcap_queue* q = &p->queues[queue];
+        struct pcap_sf_pkthdr h;
+        struct timeval tv;
+        uint64_t head = q->head, used;
+        size_t caplen = len < p->snaplen ? len : p->snaplen;
+        size_t need = sizeof(h) + caplen;
+
+        used = head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (used + need > q->size) {
+                q->drops++;
+        }
+        else {
+                if (!ts) {
+                        gettimeofday(&tv, 0);
+                        ts = &tv;
+                }
+                h.ts.tv_sec = ts->tv_sec;
+                h.ts.tv_usec = ts->tv_usec;
+                h.caplen = caplen;
+                h.len = len;
+                sr_pcap_put(q, head, &h, sizeof(h));
+                sr_pcap_put(q, head + sizeof(h), buf, caplen);
+                __atomic_store_n(&q->head, head + need, __ATOMIC_RELEASE);
+                q->packets++;
+                used += need;
+                if (used > q->high) q->high = used;
+        }
+        /* taking the flag means one wake per sleep however long the writer takes to run */
+        if (used > q->size / 2 && __atomic_exchange_n(&p->sleeping, 0, __ATOMIC_SEQ_CST)) {
+                sr_pcap_wake(p);
+                q->wakes++;
+        }
+}
+
+/** let the writer finish what is in the rings and close the file */
+void sr_pcap_close(struct sr_pcap* p)
+{
+        assert(p);
+        if (p->fd < 0) return;
+        __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+        sr_pcap_wake(p);
+        pthread_join(p->writer, 0);
+        close(p->fd);
+        p->fd = -1;
+        sr_pcap_free(p);
+}
+
+void sr_pcap_print_stats(struct sr_pcap* p)
+{
+        struct sr_pcap_queue t;
+
+        assert(p);
+        sr_pcap_totals(p, &t);
+        printf("PCAP: %lu packets logged, %lu dropped, %llu bytes in %lu writes (%.1f packets per write), "
+               "%lu early wakeups, ring high water %llu of %llu bytes\n",
+               t.packets, t.drops, p->bytes, p->writes, p->writes ? (double) t.packets / p->writes : 0.0,
+               t.wakes, (unsigned long long) t.high, (unsigned long long) t.size);
+        if (p->merged) printf("PCAP: %lu records merged from the logging threads' queues\n", p->merged);
+}
@@ -0,0 +1,106 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * packet capture (-l) written by a thread of its own
+ *
+ * logging used to cost a gettimeofday, two fwrites and an fflush (so a
+ * write syscall) for every packet received and sent. now sr_pcap_log only
+ * copies the pcap record header and the frame into a ring and moves the
+ * head along: the ring holds the pcap stream exactly as it goes into the
+ * file, so a writer thread can write out everything between tail and head
+ * with one writev however many packets it holds.
+ *
+ * there is one producer (the router loop) and one consumer (the writer):
+ * each only ever stores its own index, with release ordering so the other
+ * side sees the bytes before it sees the index move. nothing is locked. a
+ * packet that doesn't fit is counted in drops and left out: forwarding
+ * never waits on the disk.
+ *
+ * when several threads log (the pipe backend's, see sr_pipe.h) each has a
+ * queue of its own, a ring of SR_PCAP_QUEUE bytes of records in the same
+ * form with itself as the one producer, so they never wait on each other
+ * either. the writer is the consumer of all of them: it moves whole
+ * records into the file ring, oldest first by their time stamps, and
+ * writes that out as before. records are only in order among those the
+ * writer could see at the time, so a thread that falls behind can leave a
+ * record a little after a later one from another.
+ *
+ * reading the clock is most of what is left (gettimeofday is ~90ns in a
+ * vm, twice per forwarded packet), so the event loop takes the time once
+ * per wakeup (see sr_event.h) and every packet handled in that batch is
+ * logged with it. outside the loop ts is 0 and each packet reads the clock.
+ *
+ * the writer sleeps on a futex between passes for at most
+ * SR_PCAP_NAPMS ms. the router only makes the syscall to wake it early
+ * when its ring is more than half full and the writer is asleep, which
+ * at normal rates is never.
+ *
+ * on one cpu the writer's time comes straight off forwarding, and most of
+ * it went on the kernel copying the stream into the page cache. so the
+ * file is opened O_DIRECT where the filesystem allows it: the file header
+ * goes through the ring too, the ring is page aligned and only whole
+ * SR_PCAP_BLOCKs are written, so every write starts and ends on a block
+ * boundary and the disk reads it straight out of the ring. the partial
+ * block at the end goes out the ordinary way when the file is closed.
+ */
+#ifndef SR_PCAP_H
+#define SR_PCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/** bytes in the ring: a power of 2 */
+#ifndef SR_PCAP_RING
+#define SR_PCAP_RING (4 << 20)
+#endif
+/** bytes in each logging thread's queue when there are several: a power of 2 */
+#define SR_PCAP_QUEUE (1 << 20)
+/** most threads that can log */
+#define SR_PCAP_QUEUES 32
+/** O_DIRECT writes are whole blocks of this many bytes */
+#define SR_PCAP_BLOCK 4096
+/** longest the writer sleeps with data waiting */
+#define SR_PCAP_NAPMS 10
+
+/** pcap records with one producer and one consumer */
+struct sr_pcap_queue
+{
+        uint8_t* ring;
+        uint64_t size;          /** bytes in ring */
+        /* producer side */
+        uint64_t head;          /** bytes ever put in the ring */
+        unsigned long packets;
+        unsigned long drops;    /** packets left out because the ring was full */
+        unsigned long wakes;    /** times the writer had to be woken early */
+        uint64_t high;          /** most bytes ever waiting */
+        /* consumer side, on its own cache line */
+        uint64_t tail __attribute__ ((aligned (64))); /** bytes ever taken out */
+} __attribute__ ((aligned (64)));
+
+struct sr_pcap
+{
+        int fd;                 /** the capture file, -1 when not logging */
+        int direct;             /** fd is O_DIRECT: write whole blocks */
+        int snaplen;
+        struct sr_pcap_queue out; /** the file: the one logging thread's queue, or filled by the writer */
+        struct sr_pcap_queue* queues; /** a queue for each logging thread: just &out if there is one */
+        int nqueues;
+        /* writer */
+        unsigned long writes;
+        unsigned long long bytes;
+        unsigned long merged;   /** records moved from the queues to out */
+        int errors;
+        /* shared */
+        int sleeping __attribute__ ((aligned (64))); /** futex word: the writer is waiting on it */
+        int stop;
+        pthread_t writer;
+};
+
+int sr_pcap_open(struct sr_pcap* p, const char* fname, int snaplen, int queues);
+void sr_pcap_log(struct sr_pcap* p, int queue, const uint8_t* buf, int len, const struct timeval* ts);
+void sr_pcap_close(struct sr_pcap* p);
+void sr_pcap_print_stats(struct sr_pcap* p);
+
+#endif
@@ -0,0 +1,560 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * pipelined forwarding: see sr_pipe.h
+ *
+ * the VNS side of it, reading and framing commands, is in sr_vns_comm.c
+ * (sr_pipe_io) as it is for the other VNS backends.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_pipe.h"
+
+/* sr_pipe_self is in sr_timer.c */
+__thread int sr_pipe_logger;
+
+/** @return 1 for an arp reply, -1 for any other arp and 0 for the rest */
+static int sr_pipe_arp(const uint8_t* frame, unsigned int len)
+{
+        const struct sr_ethernet_hdr* eth = (const struct sr_ethernet_hdr*) frame;
+        const struct sr_arphdr* arp;
+
+        if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arphdr) ||
+            eth->ether_type != htons(ETHERTYPE_ARP)) {
+                return 0;
+        }
+        arp = (const struct sr_arphdr*) (frame + sizeof(struct sr_ethernet_hdr));
+        return arp->ar_op == htons(ARP_REPLY) ? 1 : -1;
+}
+
+/**
+ * @return the worker a received frame goes to, picked by its flow as
+ * described in sr_pipe.h, or 0 for an arp reply: that goes to all of them
+ */
+static struct sr_worker* sr_pipe_pick(struct sr_pipe* p, const uint8_t* frame, unsigned int len)
+{
+        const struct sr_ip_packet* pkt = (const struct sr_ip_packet*) frame;
+        unsigned int hl;
+        uint32_t h, ports;
+        int arp;
+
+        if ((arp = sr_pipe_arp(frame, len))) return arp == 1 ? 0 : &p->worker[0];
+        /* anything else odd goes to the first */
+        if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct ip) ||
+            pkt->eth.ether_type != htons(ETHERTYPE_IP)) {
+                return &p->worker[0];
+        }
+        h = ntohl(pkt->ip.ip_src.s_addr) * 2654435761U ^ ntohl(pkt->ip.ip_dst.s_addr);
+        h = (h ^ pkt->ip.ip_p) * 2654435761U;
+        hl = pkt->ip.ip_hl * 4;
+        if ((pkt->ip.ip_p == IPPROTO_TCP || pkt->ip.ip_p == IPPROTO_UDP) &&
+            !(pkt->ip.ip_off & htons(IP_MF | IP_OFFMASK)) &&
+            len >= sizeof(struct sr_ethernet_hdr) + hl + sizeof(ports)) {
+                memcpy(&ports, frame + sizeof(struct sr_ethernet_hdr) + hl, sizeof(ports));
+                h = (h ^ ntohl(ports)) * 2654435761U;
+        }
+        return &p->worker[((uint64_t) h * p->workers) >> 32];
+}
+
+/** copy a frame into a worker's ring, waiting if the worker is behind */
+static int sr_pipe_put(struct sr_pipe* p, struct sr_worker* w, uint8_t* frame, unsigned int len, const char* iface)
+{
+        struct sr_ring_slot* s;
+
+        while (!(s = sr_ring_claim(&w->in))) {
+                sr_ring_publish(&w->in);
+                if (p->stop) return -1;
+                sched_yield();
+        }
+        memcpy(s->frame, frame, len);
+        s->len = len;
+        strncpy(s->iface, iface, sizeof(s->iface) - 1);
+        s->iface[sizeof(s->iface) - 1] = '\0';
+        sr_ring_push(&w->in);
+        if (sr_ring_unpublished(&w->in) >= SR_PIPE_BATCH) sr_ring_publish(&w->in);
+        return 0;
+}
+
+/**
+ * rx thread: hand a received frame to its worker. published every
+ * SR_PIPE_BATCH frames and by sr_pipe_publish at the end of each read
+ * @return 0 or -1 if the pipe is stopping
+ */
+int sr_pipe_deliver(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface)
+{
+        struct sr_pipe* p = &sr->pipe;
+        struct sr_worker* w;
+        int i;
+
+        if (len > SR_RING_FRAME) {
+                p->toolong++;
+                return 0;
+        }
+        if ((w = sr_pipe_pick(p, frame, len))) return sr_pipe_put(p, w, frame, len, iface);
+        for (i = 0; i < p->workers; i++) {
+                if (sr_pipe_put(p, &p->worker[i], frame, len, iface) == -1) return -1;
+        }
+        return 0;
+}
+
+/**
+ * a worker with a queue of its own read a frame from it: if it is an arp
+ * reply the other workers may be waiting on it too, so each gets a copy
+ * in its in ring. one with no room goes without and asks again
+ */
+void sr_pipe_share(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface)
+{
+        struct sr_pipe* p = &sr->pipe;
+        struct sr_ring_slot* s;
+        struct sr_worker* w;
+        int i;
+
+        if (p->workers < 2 || len > SR_RING_FRAME || sr_pipe_arp(frame, len) != 1) return;
+        /* the rings have one producer at a time */
+        pthread_mutex_lock(&p->share);
+        for (i = 0; i < p->workers; i++) {
+                w = &p->worker[i];
+                if (w == sr_pipe_self) continue;
+                if (!(s = sr_ring_claim(&w->in))) {
+                        p->unshared++;
+                        continue;
+                }
+                memcpy(s->frame, frame, len);
+                s->len = len;
+                strncpy(s->iface, iface, sizeof(s->iface) - 1);
+                s->iface[sizeof(s->iface) - 1] = '\0';
+                sr_ring_push(&w->in);
+                sr_ring_publish(&w->in);
+        }
+        pthread_mutex_unlock(&p->share);
+}
+
+/** rx thread: hand the workers everything delivered so far */
+void sr_pipe_publish(struct sr_instance* sr)
+{
+        int i;
+
+        for (i = 0; i < sr->pipe.workers; i++) sr_ring_publish(&sr->pipe.worker[i].in);
+}
+
+/**
+ * queue a frame for the tx thread on this thread's ring: a worker's own
+ * or, for the main thread's timers, the shared one
+ * @return 0 or -1 if the tx thread has gone
+ */
+int sr_pipe_send(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface)
+{
+        struct sr_pipe* p = &sr->pipe;
+        struct sr_ring* r = sr_pipe_self ? &sr_pipe_self->out : &p->out;
+        struct sr_ring_slot* s;
+
+        if (len > SR_RING_FRAME) {
+                fprintf(stderr, "** Error: packet is too long (%u bytes)\n", len);
+                return -1;
+        }
+        while (!(s = sr_ring_claim(r))) {
+                sr_ring_publish(r);
+                if (p->tx_stop) return -1;
+                sched_yield();
+        }
+        memcpy(s->frame, frame, len);
+        s->len = len;
+        strncpy(s->iface, iface, sizeof(s->iface) - 1);
+        s->iface[sizeof(s->iface) - 1] = '\0';
+        sr_ring_push(r);
+        if (sr_ring_unpublished(r) >= SR_PIPE_BATCH) sr_ring_publish(r);
+        return 0;
+}
+
+/** end of a batch on this thread: let the tx thread have it */
+int sr_pipe_flush(struct sr_instance* sr)
+{
+        if (!sr->pipe.running) return 0;
+        sr_ring_publish(sr_pipe_self ? &sr_pipe_self->out : &sr->pipe.out);
+        return 0;
+}
+
+static int sr_pipe_work_more(void* arg)
+{
+        struct sr_worker* w = arg;
+
+        return sr_ring_ready(&w->in) || w->sr->pipe.stop;
+}
+
+/**
+ * a worker with a queue of its own: handle what comes in on it, and the
+ * arp replies the others copy to us, until told to stop
+ */
+static void sr_pipe_serve(struct sr_worker* w)
+{
+        struct sr_instance* sr = w->sr;
+        struct sr_pipe* p = &sr->pipe;
+        struct sr_ring_slot* s;
+        int n, shared;
+
+        for (;;) {
+                sr_epoch_enter(&sr->rt_epoch, w->epoch);
+                sr_log_hold();
+                for (shared = 0; (s = sr_ring_peek(&w->in)); shared++) {
+                        sr_handlepacket(sr, s->frame, s->len, s->iface);
+                        sr_ring_pop(&w->in);
+                }
+                sr_ring_release(&w->in);
+                n = p->poll(sr);
+                sr_timer_run(sr);
+                sr_epoch_leave(w->epoch);
+                sr->io->flush(sr);
+                sr_log_flush();
+                if (n) {
+                        w->packets += n;
+                        w->batches++;
+                        continue;
+                }
+                if (p->stop) break;
+                /* not for long: a copied arp reply doesn't wake us */
+                if (!shared) p->wait(sr, SR_RING_NAPMS);
+        }
+}
+
+/** route whatever rx gives us until told to stop */
+static void sr_pipe_take(struct sr_worker* w)
+{
+        struct sr_instance* sr = w->sr;
+        struct sr_ring_slot* s;
+        int n;
+
+        for (;;) {
+                /* routes we look up in the batch stay put until we leave */
+                sr_epoch_enter(&sr->rt_epoch, w->epoch);
+                sr_log_hold();
+                for (n = 0; n < SR_PIPE_BATCH && (s = sr_ring_peek(&w->in)); n++) {
+                        sr_handlepacket(sr, s->frame, s->len, s->iface);
+                        sr_ring_pop(&w->in);
+                }
+                /* our arp retries and buffer expiry */
+                sr_timer_run(sr);
+                sr_epoch_leave(w->epoch);
+                sr_ring_publish(&w->out);
+                sr_log_flush();
+                if (n) {
+                        sr_ring_release(&w->in);
+                        w->packets += n;
+                        w->batches++;
+                        continue;
+                }
+                if (sr->pipe.stop) break;
+                sr_bell_wait(&w->bell, sr_pipe_work_more, w);
+        }
+        sr_ring_publish(&w->out);
+}
+
+/** a worker: route with our own sr_fwd until told to stop */
+static void* sr_pipe_work(void* arg)
+{
+        struct sr_worker* w = arg;
+        struct sr_instance* sr = w->sr;
+
+        sr_pipe_self = w;
+        sr_pipe_logger = w->id + 2;
+        /* set up here rather than in sr_pipe_run so its pages are touched by this thread */
+        sr_timer_init(&w->fwd->timers);
+        sr_arp_init(sr);
+        sr_cache_clear(&w->fwd->cache);
+        sr_buffer_clear(sr);
+        /* the startup arp requests sr_handle_hwinfo left to us */
+        if (w->id == 0) {
+                sr_epoch_enter(&sr->rt_epoch, w->epoch);
+                sr_arp_scan(sr);
+                sr_epoch_leave(w->epoch);
+        }
+        if (sr->pipe.poll) sr_pipe_serve(w);
+        else sr_pipe_take(w);
+        /* the counters are kept for sr_pipe_print_stats */
+        sr_arp_clear(sr);
+        free(w->fwd->buffer.packets);
+        w->fwd->buffer.packets = 0;
+        return 0;
+}
+
+static int sr_pipe_write_more(void* arg)
+{
+        struct sr_instance* sr = arg;
+        struct sr_pipe* p = &sr->pipe;
+        int i;
+
+        if (p->tx_stop || sr_ring_ready(&p->out)) return 1;
+        for (i = 0; i < p->workers; i++) {
+                if (sr_ring_ready(&p->worker[i].out)) return 1;
+        }
+        return 0;
+}
+
+/**
+ * write what has been queued and give the slots it came from back
+ * @return -1 once the connection has failed: everything after is dropped
+ */
+static int sr_pipe_write_out(struct sr_instance* sr, struct sr_ring** rings, int n, int failed)
+{
+        int i;
+
+        if (failed) {
+                sr->tx.frames = 0;
+                sr->tx.staged = 0;
+        } else if (sr->tx.frames && sr_tx_drain(&sr->tx, sr->sockfd) == -1) {
+                fprintf(stderr, "Error writing packet\n");
+                sr_event_stop(sr);
+                failed = 1;
+        }
+        for (i = 0; i < n; i++) sr_ring_release(rings[i]);
+        return failed ? -1 : 0;
+}
+
+/** the tx thread: up to a batch from each ring in turn per writev */
+static void* sr_pipe_write(void* arg)
+{
+        struct sr_instance* sr = arg;
+        struct sr_pipe* p = &sr->pipe;
+        struct sr_ring* rings[SR_PIPE_MAXWORKERS + 1];
+        struct sr_ring_slot* s;
+        int nrings, i, k, n, failed = 0;
+
+        for (i = 0; i < p->workers; i++) rings[i] = &p->worker[i].out;
+        rings[i] = &p->out;
+        nrings = i + 1;
+        for (;;) {
+                for (n = i = 0; i < nrings; i++) {
+                        for (k = 0; k < SR_PIPE_BATCH && (s = sr_ring_peek(rings[i])); k++) {
+                                if (sr_tx_full(&sr->tx, s->len, 0)) {
+                                        failed = sr_pipe_write_out(sr, rings, nrings, failed) == -1;
+                                }
+                                sr_tx_queue(&sr->tx, s->frame, s->len, s->iface, 0);
+                                sr_ring_pop(rings[i]);
+                        }
+                        n += k;
+                }
+                if (n) {
+                        failed = sr_pipe_write_out(sr, rings, nrings, failed) == -1;
+                        continue;
+                }
+                if (p->tx_stop) break;
+                sr_bell_wait(&p->tx_bell, sr_pipe_write_more, sr);
+        }
+        return 0;
+}
+
+static void* sr_pipe_read(void* arg)
+{
+        struct sr_instance* sr = arg;
+
+        sr_pipe_logger = 1;
+        sr->pipe.reader(sr);
+        return 0;
+}
+
+/**
+ * set up -W workers (SR_PIPE_WORKERS if not given) and their rings. from
+ * here on frames received go to the workers' rings and frames sent to the
+ * tx thread's, though nothing takes them until sr_pipe_run. workers with
+ * queues of their own (poll set) only get small in rings for arp replies
+ * @return 0 or -1 if there is no memory for them
+ */
+int sr_pipe_init(struct sr_instance* sr)
+{
+        struct sr_pipe* p;
+        struct sr_worker* w;
+        int i;
+
+        assert(sr);
+        p = &sr->pipe;
+        p->workers = p->want ? p->want : SR_PIPE_WORKERS;
+        if (p->workers < 1 || p->workers > SR_PIPE_MAXWORKERS) {
+                fprintf(stderr, "PIPE: %d workers: there can be 1 to %d\n", p->workers, SR_PIPE_MAXWORKERS);
+                p->workers = 0;
+                return -1;
+        }
+        pthread_mutex_init(&p->share, 0);
+        if (!(p->worker = calloc(p->workers, sizeof(struct sr_worker))) ||
+            (!p->poll && sr_ring_init(&p->out, SR_PIPE_SLOTS, &p->tx_bell) == -1)) {
+                perror("calloc(..):sr_pipe.c::sr_pipe_init");
+                sr_pipe_free(sr);
+                return -1;
+        }
+        for (i = 0; i < p->workers; i++) {
+                w = &p->worker[i];
+                w->id = i;
+                if (p->poll ? sr_ring_init(&w->in, SR_PIPE_SHARE_SLOTS, &w->bell) == -1 :
+                    sr_ring_init(&w->in, SR_PIPE_SLOTS, &w->bell) == -1 ||
+                    sr_ring_init(&w->out, SR_PIPE_SLOTS, &p->tx_bell) == -1) {
+                        perror("posix_memalign(..):sr_pipe.c::sr_pipe_init");
+                        p->workers = i + 1;
+                        sr_pipe_free(sr);
+                        return -1;
+                }
+        }
+        p->stop = p->tx_stop = 0;
+        return 0;
+}
+
+/**
+ * start the workers, each with a sr_fwd of its own, and unless they have
+ * queues of their own (reader is 0) the tx thread and the rx thread
+ * running reader. the interfaces must be known by now. the threads take
+ * no signals: they are all for the main thread
+ * @return 0 or -1 if anything couldn't be set up: nothing is left running
+ */
+int sr_pipe_run(struct sr_instance* sr, void (*reader)(struct sr_instance*))
+{
+        struct sr_pipe* p;
+        struct sr_worker* w;
+        sigset_t all, old;
+        int i, err = 0;
+
+        assert(sr);
+        p = &sr->pipe;
+        assert(reader || p->poll);
+        /* built now: after this only sr_rt_timeout rebuilds it */
+        if (sr->rt_engine == SR_RT_DIR && !sr->rt_dir) sr->rt_dir = sr_rt_dir_build(sr->routing_table);
+        for (i = 0; i < p->workers; i++) {
+                w = &p->worker[i];
+                w->sr = sr;
+                if (!(w->fwd = calloc(1, sizeof(struct sr_fwd)))) {
+                        perror("calloc(..):sr_pipe.c::sr_pipe_run");
+                        goto fail;
+                }
+                if (!(w->epoch = sr_epoch_register(&sr->rt_epoch))) {
+                        fprintf(stderr, "PIPE: more workers than epoch readers\n");
+                        goto fail;
+                }
+        }
+        p->reader = reader;
+
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &old);
+        for (i = 0; i < p->workers; i++) {
+                if ((err = pthread_create(&p->worker[i].thread, 0, sr_pipe_work, &p->worker[i]))) break;
+        }
+        if (!err && reader && !(err = pthread_create(&p->tx, 0, sr_pipe_write, sr))) {
+                err = pthread_create(&p->rx, 0, sr_pipe_read, sr);
+                if (err) {
+                        p->tx_stop = 1;
+                        sr_bell_ring(&p->tx_bell);
+                        pthread_join(p->tx, 0);
+                }
+        }
+        pthread_sigmask(SIG_SETMASK, &old, 0);
+        if (err) {
+                errno = err;
+                perror("pthread_create(..):sr_pipe.c::sr_pipe_run");
+                /* i workers were started: there is no tx to wait for */
+                p->stop = p->tx_stop = 1;
+                while (--i >= 0) {
+                        sr_bell_ring(&p->worker[i].bell);
+                        pthread_join(p->worker[i].thread, 0);
+                }
+                goto fail;
+        }
+        p->running = 1;
+        printf("PIPE: %d workers%s\n", p->workers, reader ? "" : ", each with a queue of its own");
+        return 0;
+
+fail:
+        for (i = 0; i < p->workers; i++) {
+                w = &p->worker[i];
+                sr_epoch_unregister(w->epoch);
+                w->epoch = 0;
+                free(w->fwd);
+                w->fwd = 0;
+        }
+        return -1;
+}
+
+/**
+ * stop the threads: rx first, then the workers once they have routed what
+ * they were given, then tx once it has written what they sent. the
+ * workers' sr_fwds are kept for sr_pipe_print_stats until sr_pipe_free
+ */
+void sr_pipe_close(struct sr_instance* sr)
+{
+        struct sr_pipe* p = &sr->pipe;
+        int i;
+
+        assert(sr);
+        if (p->running) {
+                p->stop = 1;
+                /* rx is blocked in recv: this wakes it with an end of file */
+                if (p->reader) {
+                        if (sr->sockfd != -1) shutdown(sr->sockfd, SHUT_RD);
+                        pthread_join(p->rx, 0);
+                }
+                for (i = 0; i < p->workers; i++) {
+                        sr_bell_ring(&p->worker[i].bell);
+                        pthread_join(p->worker[i].thread, 0);
+                        sr_epoch_unregister(p->worker[i].epoch);
+                        p->worker[i].epoch = 0;
+                }
+                if (p->reader) {
+                        sr_ring_publish(&p->out);
+                        p->tx_stop = 1;
+                        sr_bell_ring(&p->tx_bell);
+                        pthread_join(p->tx, 0);
+                }
+                p->running = 0;
+        }
+}
+
+/** once the threads are stopped: the rings, the workers and their sr_fwds */
+void sr_pipe_free(struct sr_instance* sr)
+{
+        struct sr_pipe* p = &sr->pipe;
+        int i;
+
+        assert(sr);
+        assert(!p->running);
+        for (i = 0; i < p->workers && p->worker; i++) {
+                sr_ring_free(&p->worker[i].in);
+                sr_ring_free(&p->worker[i].out);
+                free(p->worker[i].fwd);
+        }
+        sr_ring_free(&p->out);
+        free(p->worker);
+        p->worker = 0;
+        p->workers = 0;
+        pthread_mutex_destroy(&p->share);
+}
+
+void sr_pipe_print_stats(struct sr_instance* sr)
+{
+        struct sr_pipe* p = &sr->pipe;
+        struct sr_worker* w;
+        struct sr_cache* c;
+        uint64_t total;
+        int i;
+
+        for (i = 0; i < p->workers; i++) {
+                w = &p->worker[i];
+                printf("PIPE: worker %d: %lu packets in %lu batches, %lu sleeps, "
+                        "%lu waits for room in, %lu out\n",
+                        w->id, w->packets, w->batches, w->bell.sleeps, w->in.full, w->out.full);
+                if (!w->fwd) continue;
+                c = &w->fwd->cache;
+                total = c->hits + c->misses;
+                printf("PIPE: worker %d: %.1f%% cache hits, %llu flushes, buffer high water %d, "
+                        "%lu packets dropped\n",
+                        w->id, total ? 100.0 * c->hits / total : 0.0, (unsigned long long) c->flushes,
+                        w->fwd->buffer.highwater, w->fwd->buffer.dropped);
+        }
+        if (p->reader) {
+                printf("PIPE: tx %lu sleeps, main thread sent %lu, %lu frames too long\n",
+                        p->tx_bell.sleeps, (unsigned long) p->out.next, p->toolong);
+        } else {
+                printf("PIPE: %lu copies of arp replies the other workers had no room for\n", p->unshared);
+        }
+}
@@ -0,0 +1,133 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * pipelined forwarding over the VNS connection: -B pipe -W workers
+ *
+ * every other backend does everything on the one thread: read a batch,
+ * route it, write it out. here reading, routing and writing each get
+ * threads of their own, handing frames on through the rings of sr_ring.h:
+ *
+ *   rx thread   blocks reading the socket, frames the commands (sr_rx.h)
+ *               and copies each packet into the in ring of the worker its
+ *               flow hashes to, so a flow always takes the same worker and
+ *               keeps its order
+ *   workers     run sr_handlepacket on the frames where they are, in the
+ *               ring, and copy what they send into their out ring
+ *   tx thread   gathers the out rings (and one for the main thread) into
+ *               writevs on the socket (sr_tx.h)
+ *
+ * the main thread keeps the event loop for timers, signals and the control
+ * fifo (sr_event.h), so arp retries and buffer expiry carry on as before.
+ *
+ * nothing that changes while packets are handled is shared: each worker
+ * routes with forwarding state of its own, a struct sr_fwd (sr_router.h)
+ * with its own arp table, buffer, timer wheel and destination cache that
+ * sr_fwd() finds through sr_pipe_self. the rest of the router is shared:
+ * the interfaces, which don't change once the router is running, and the
+ * routing table, which changes without stopping them (live updates in
+ * sr_rt.c): a worker is in an epoch (sr_epoch.h) while it handles a
+ * batch. the flow hash is like a nic's rss hash: the addresses, protocol
+ * and, for tcp and udp packets that aren't fragments, the ports.
+ * fragments and everything else are hashed on the addresses alone.
+ *
+ * a worker learns a neighbour by asking for it itself. arp replies are
+ * handed to every worker, so one answer does for all that were waiting,
+ * and arp requests to the first. the first worker also sends the arp
+ * requests that go out at startup, so interfaces have to be known, from
+ * VNSHWINFO, before the threads are started: see sr_pipe_start in
+ * sr_vns_comm.c.
+ *
+ * with one worker per core and the rx and tx threads on cores of their
+ * own nothing in the forwarding path is shared between workers but the
+ * rings to and from them and the routes they only read.
+ *
+ * a backend that can give each worker a queue of its own, a multiqueue
+ * TAP (sr_tap.h), has no rx or tx thread: the workers read and write
+ * their queues themselves, through poll and wait, and the kernel spreads
+ * flows over the queues as rx would. their in rings are only for arp
+ * replies: one that comes in on a worker's queue is copied to the others
+ * (sr_pipe_share) as rx would have.
+ */
+#ifndef SR_PIPE_H
+#define SR_PIPE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "sr_ring.h"
+
+/** workers if -W isn't given */
+#define SR_PIPE_WORKERS 2
+#define SR_PIPE_MAXWORKERS 16
+/** slots per ring: a power of 2 */
+#define SR_PIPE_SLOTS 512
+/** frames a worker handles, or rx hands over, before publishing */
+#define SR_PIPE_BATCH 32
+/** slots in the in ring of a worker with a queue of its own */
+#define SR_PIPE_SHARE_SLOTS 64
+
+struct sr_instance;
+struct sr_fwd;
+struct sr_epoch_reader;
+
+struct sr_worker
+{
+        struct sr_instance* sr; /** the router */
+        struct sr_fwd* fwd;     /** what the worker routes with: see sr_fwd() */
+        int id;
+        pthread_t thread;
+        struct sr_bell bell;    /** rung by the rx thread */
+        struct sr_ring in;      /** from the rx thread */
+        struct sr_ring out;     /** to the tx thread */
+        struct sr_epoch_reader* epoch; /** in the routing table's epoch */
+        unsigned long packets;
+        unsigned long batches;
+};
+
+struct sr_pipe
+{
+        int workers;            /** 0 unless the backend is pipe */
+        int want;               /** -W */
+        struct sr_worker* worker;
+        struct sr_ring out;     /** sends from the main thread */
+        struct sr_bell tx_bell;
+        pthread_t rx, tx;
+        int running;            /** the threads are up */
+        void (*reader)(struct sr_instance* sr); /** what the rx thread runs, if there is one */
+        int (*poll)(struct sr_instance* sr);    /** a worker with a queue of its own: handle a burst from it */
+        void (*wait)(struct sr_instance* sr, int ms); /** and sleep until it has frames or ms have passed */
+        pthread_mutex_t share;  /** for workers copying arp replies into each other's in rings */
+        unsigned long unshared; /** copies a worker had no room for */
+        volatile int stop;      /** workers: finish what is in the rings and go */
+        volatile int tx_stop;   /** tx: the workers are gone, flush and go */
+        unsigned long toolong;  /** received frames that don't fit a slot */
+};
+
+/** set in the worker threads */
+extern __thread struct sr_worker* sr_pipe_self;
+
+/**
+ * the pcap queue and flight ring (sr_pcap.h, sr_flight.h) a thread logs
+ * packets to: 0 for the main thread, 1 for rx and 2 on for the workers
+ */
+extern __thread int sr_pipe_logger;
+
+/** threads that log packets, for sr_pcap_open and sr_flight_open */
+static inline int sr_pipe_loggers(int want)
+{
+        int workers = want ? want : SR_PIPE_WORKERS;
+
+        return workers >= 1 && workers <= SR_PIPE_MAXWORKERS ? workers + 2 : 1;
+}
+
+int sr_pipe_init(struct sr_instance* sr);
+int sr_pipe_run(struct sr_instance* sr, void (*reader)(struct sr_instance*));
+int sr_pipe_deliver(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface);
+void sr_pipe_share(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface);
+void sr_pipe_publish(struct sr_instance* sr);
+int sr_pipe_send(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface);
+int sr_pipe_flush(struct sr_instance* sr);
+void sr_pipe_close(struct sr_instance* sr);
+void sr_pipe_free(struct sr_instance* sr);
+void sr_pipe_print_stats(struct sr_instance* sr);
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * single producer single consumer ring of frame slots
+ *
+ * the threads of the pipelined backend (sr_pipe.h) hand frames to each
+ * other through these. a slot holds a whole frame and the name of its
+ * interface, so the producer builds the frame where the consumer will use
+ * it and nothing else is allocated or copied on the way.
+ *
+ * each side keeps its own index on a cache line of its own, works ahead on
+ * a private copy of it and only publishes (a release store) once per batch:
+ * claim/push on the producer side then sr_ring_publish, peek/pop on the
+ * consumer side then sr_ring_release. each side also remembers the last
+ * index it read of the other side's and only reads it again, which is
+ * what moves the cache line across, when that runs out.
+ *
+ * a consumer with nothing to do sleeps on its bell, which may be shared by
+ * several rings (the tx thread has one bell for all the rings feeding it).
+ * a producer only makes the syscall to wake it when it publishes to a bell
+ * that has someone asleep on it.
+ */
+#ifndef SR_RING_H
+#define SR_RING_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/** bytes per slot, header included */
+#define SR_RING_SLOT 2048
+/** the longest frame a slot holds */
+#define SR_RING_FRAME (SR_RING_SLOT - 64)
+/** longest a sleeper waits before looking again: a wake can be missed */
+#define SR_RING_NAPMS 10
+
+struct sr_ring_slot
+{
+        uint32_t len;
+        char iface[32];         /** as sr_IFACE_NAMELEN */
+        uint8_t frame[SR_RING_FRAME] __attribute__ ((aligned (64)));
+};
+
+/** what a consumer sleeps on */
+struct sr_bell
+{
+        int sleeping __attribute__ ((aligned (64))); /** futex word */
+        unsigned long sleeps;
+        unsigned long wakes;    /** syscalls made to wake it */
+};
+
+struct sr_ring
+{
+        struct sr_ring_slot* slots;
+        uint32_t size;          /** slots: a power of 2 */
+        struct sr_bell* bell;   /** the consumer's */
+        /* producer side */
+        uint32_t next __attribute__ ((aligned (64))); /** claimed but not published yet */
+        uint32_t tail_seen;     /** last tail read */
+        unsigned long full;     /** times a claim found no room */
+        /* consumer side */
+        uint32_t take __attribute__ ((aligned (64))); /** taken but not released yet */
+        uint32_t head_seen;     /** last head read */
+        /* shared */
+        uint32_t head __attribute__ ((aligned (64))); /** slots published */
+        uint32_t tail __attribute__ ((aligned (64))); /** slots released */
+};
+
+/** @return 0 or -1 (errno set) if there is no memory for size slots */
+static inline int sr_ring_init(struct sr_ring* r, uint32_t size, struct sr_bell* bell)
+{
+        void* slots;
+        int err;
+
+        memset(r, 0, sizeof(*r));
+        if ((err = posix_memalign(&slots, SR_RING_SLOT, (size_t) size * SR_RING_SLOT))) {
+                errno = err;
+                return -1;
+        }
+        r->slots = slots;
+        r->size = size;
+        r->bell = bell;
+        return 0;
+}
+
+static inline void sr_ring_free(struct sr_ring* r)
+{
+        free(r->slots);
+        r->slots = 0;
+}
+
+/** @return the slot to fill next or 0 if the ring is full */
+static inline struct sr_ring_slot* sr_ring_claim(struct sr_ring* r)
+{
+        if (r->next - r->tail_seen == r->size) {
+                r->tail_seen = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+                if (r->next - r->tail_seen == r->size) {
+                        r->full++;
+                        return 0;
+                }
+        }
+        return &r->slots[r->next & (r->size - 1)];
+}
+
+/** the claimed slot is filled in */
+static inline void sr_ring_push(struct sr_ring* r)
+{
+        r->next++;
+}
+
+/** slots pushed since the last publish */
+static inline uint32_t sr_ring_unpublished(const struct sr_ring* r)
+{
+        return r->next - r->head;
+}
+
+/** @return the next slot to use or 0 if there is none yet */
+static inline struct sr_ring_slot* sr_ring_peek(struct sr_ring* r)
+{
+        if (r->take == r->head_seen) {
+                r->head_seen = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+                if (r->take == r->head_seen) return 0;
+        }
+        return &r->slots[r->take & (r->size - 1)];
+}
+
+/** done with the peeked slot, but it isn't handed back until sr_ring_release */
+static inline void sr_ring_pop(struct sr_ring* r)
+{
+        r->take++;
+}
+
+/** hand back every slot popped so far */
+static inline void sr_ring_release(struct sr_ring* r)
+{
+        if (r->take != r->tail) __atomic_store_n(&r->tail, r->take, __ATOMIC_RELEASE);
+}
+
+/** wake the consumer if it is asleep */
+static inline void sr_bell_ring(struct sr_bell* b)
+{
+        if (__atomic_load_n(&b->sleeping, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(&b->sleeping, 0, __ATOMIC_SEQ_CST)) {
+                syscall(SYS_futex, &b->sleeping, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+                b->wakes++;
+        }
+}
+
+/** make everything pushed visible to the consumer and wake it */
+static inline void sr_ring_publish(struct sr_ring* r)
+{
+        if (r->next == r->head) return;
+        __atomic_store_n(&r->head, r->next, __ATOMIC_SEQ_CST);
+        sr_bell_ring(r->bell);
+}
+
+/**
+ * consumer: sleep until rung or SR_RING_NAPMS, unless more() says there is
+ * work after all. the flag is set before looking so a producer that
+ * publishes after the look sees it and wakes us.
+ */
+static inline void sr_bell_wait(struct sr_bell* b, int (*more)(void*), void* arg)
+{
+        struct timespec nap = { 0, SR_RING_NAPMS * 1000000L };
+
+        __atomic_store_n(&b->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!more(arg)) {
+                b->sleeps++;
+                syscall(SYS_futex, &b->sleeping, FUTEX_WAIT_PRIVATE, 1, &nap, 0, 0);
+        }
+        __atomic_store_n(&b->sleeping, 0, __ATOMIC_RELAXED);
+}
+
+/** consumer: @return 1 if something has been published that hasn't been taken */
+static inline int sr_ring_ready(struct sr_ring* r)
+{
+        return r->take != __atomic_load_n(&r->head, __ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -11,11 +11,11 @@
  *
  **********************************************************************/
 
+#define SR_LOG_MODULE SR_LOG_ROUTER
+
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
-#include <time.h>
-
 
 #include "sr_rt.h"
 #include "sr_router.h"
@@ -63,11 +63,11 @@ void sr_handlepacket(struct sr_instance* sr,
     struct sr_if*           ipif; /* used to test where traffic is going */
     struct sr_ethernet_hdr* e_hdr = 0;
     struct sr_arphdr*       a_hdr = 0;
+    struct sr_arp*          arp_entry;
     struct ip*              ip = 0;
     struct sr_ip_handle     ip_handler;
     uint16_t                checksum;
     int                     send_result;
-    time_t                  t;
 
     /* REQUIRES */
     assert(sr);
@@ -76,8 +76,7 @@ void sr_handlepacket(struct sr_instance* sr,
 
     e_hdr = (struct sr_ethernet_hdr*)packet;
 
-    time(&t);
-    Debug("ROUTER: %s",ctime(&t));
+    Trace("ROUTER: %u byte frame on %s\n", len, interface);
 /*    Debug("ROUTER: Ethernet destination MAC: "); DebugMAC(e_hdr->ether_dhost); */
 /*    Debug(" ethernet source MAC: "); DebugMAC(e_hdr->ether_shost); Debug("\n"); */
 
@@ -85,12 +84,11 @@ void sr_handlepacket(struct sr_instance* sr,
     switch (ntohs(e_hdr->ether_type)) 
     {
     case ETHERTYPE_IP:
-        Debug("ROUTER: IP packet ");
-        Debug("src %s ", inet_ntoa(ip->ip_src));
-        Debug("dst %s ", inet_ntoa(ip->ip_dst));
-        Debug("(src %lX dst %lX subnet %lX)", 
+        Trace("ROUTER: IP packet ");
+        Trace("src %s ", inet_ntoa(ip->ip_src));
+        Trace("dst %s ", inet_ntoa(ip->ip_dst));
+        Trace("(src %lX dst %lX subnet %lX)\n", 
             (unsigned long int) ip->ip_src.s_addr, (unsigned long int) ip->ip_dst.s_addr, (unsigned long int) sr->subnet);
-        Debug("\n");
         /* this doesn't work because they send packets for machines not in our subnet 
            with addresses that are valid for our subnet block */
         if (!(
@@ -98,13 +96,13 @@ void sr_handlepacket(struct sr_instance* sr,
               (ip->ip_src.s_addr & sr->subnet & sr->mask) == sr->subnet
              )
         ) { 
-            Debug("ROUTER: not for our subnet - aborting\n");
+            Trace("ROUTER: not for our subnet - aborting\n");
             return;
         } else {
-            Debug("ROUTER: for our subnet - processing\n");
+            Trace("ROUTER: for our subnet - processing\n");
         }
         if ((checksum = sr_ip_checksum((uint16_t*) ip, (ip->ip_hl*4)))) {
-            Debug("ROUTER: IP checksum failed (got %X) - aborting\n", checksum);
+            sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG, "ROUTER: IP checksum failed (got %X) - aborting\n", checksum);
             return;
         }
 
@@ -113,32 +111,33 @@ void sr_handlepacket(struct sr_instance* sr,
         ip_handler.pkt = (struct sr_ip_packet*) packet;
         ip_handler.raw = packet;
         ip_handler.raw_len = len;
+        /* the packet is in sr->rx with the next command right behind it,
+           or pipelined it has a ring slot to itself */
+        ip_handler.raw_size = sr_pipe_self ? SR_RING_FRAME : len;
         ip_handler.len = len;
         ip_handler.iface = iface;
 
         /* transmogrify the data we are given and send if we are successful */
         if (ip->ip_ttl <= 1) {
-            Debug("ROUTER: ttl expired!\n");
+            Trace("ROUTER: ttl expired!\n");
             if (!sr_icmp_unreachable(&ip_handler)) return;
 
         } else if (ip->ip_p == IPPROTO_ICMP) {
-            Debug("ROUTER: ICMP protocol\n");
+            Trace("ROUTER: ICMP protocol\n");
             if (!sr_icmp_handler(&ip_handler)) return;
 
         } else if ((ipif = sr_if_ip2iface(sr, ip->ip_dst.s_addr))) {
-            Debug("ROUTER: destination is interface %s\n", ipif->name);
+            Trace("ROUTER: destination is interface %s\n", ipif->name);
             if (!sr_icmp_unreachable(&ip_handler)) return;
 
         } else {
-            Debug("ROUTER: IP protocol %d\n", ip->ip_p);
+            Trace("ROUTER: IP protocol %d\n", ip->ip_p);
             if (!sr_ip_handler(&ip_handler)) return;
         }
 
-        /* handle any backlog */
-        sr_router_resend(sr);
-        /* then try and send packet */
+        /* buffered packets wait for their own arp reply: see sr_router_flush */
         send_result = sr_router_send(&ip_handler);
-        Debug("ROUTER: send result %d\n", send_result);
+        Trace("ROUTER: send result %d\n", send_result);
 
     break;
     case ETHERTYPE_ARP:
@@ -146,129 +145,166 @@ void sr_handlepacket(struct sr_instance* sr,
         switch (ntohs(a_hdr->ar_op)) 
         {
         case ARP_REQUEST: 
-            Debug("ROUTER: ARP request - sending ARP reply\n");
+            Trace("ROUTER: ARP request - sending ARP reply\n");
             sr_arp_request_response(sr,packet,len,iface);
         break;
         case ARP_REPLY:
-            Debug("ROUTER: ARP reply - update ARP table\n");
-            sr_arp_set(sr, a_hdr->ar_sip, a_hdr->ar_sha, iface);
-            /* handle any backlog */
-            sr_router_resend(sr); 
+            Trace("ROUTER: ARP reply - update ARP table\n");
+            /* release only the packets that were waiting on this neighbour */
+            if ((arp_entry = sr_arp_set(sr, a_hdr->ar_sip, a_hdr->ar_sha, iface))) {
+                sr_router_flush(sr, arp_entry);
+            } else {
+                sr_log_limit(SR_LOG_ROUTER, SR_LOG_WARN, "ROUTER: no memory for arp entry - ignoring reply\n");
+            }
         break;
         default:
-            Debug("ROUTER: ARP ERROR: don't know what %d is!\n", a_hdr->ar_op);
+            sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG, "ROUTER: ARP ERROR: don't know what %d is!\n", a_hdr->ar_op);
         }
     break;
     default:
-        Debug("ROUTER: ERROR: don't know what %d ethernet packet type is!\n", e_hdr->ether_type);
+        sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG, "ROUTER: ERROR: don't know what %d ethernet packet type is!\n",
+            e_hdr->ether_type);
     }
 
 }/* end sr_handlepacket */
 
-/**--------------------------------------------------------------------- 
- * Method: sr_router_send
- *
- * figure out where we are sending and do basic sanity check
- * this is where you'd buffer packets should you not be able to send them
- *---------------------------------------------------------------------*/
-int sr_router_send(struct sr_ip_handle* h) 
+/**
+ * put the gateway's ethernet header (its arp entry's template) on the
+ * packet and send it out of the route's interface
+ * @return 1: sent or not, the packet is done with
+ */
+static int sr_router_xmit(struct sr_ip_handle* h, struct sr_rt* sender, const uint8_t* eth_template)
 {
-        struct sr_arp*  arp_entry;
-        struct sr_rt*   sender;
         struct sr_ethernet_hdr* eth;
 
-        assert(h->sr);
-        assert(h->pkt->ip.ip_dst.s_addr);
+        Trace("ROUTER: attempting to send packet (size %d bytes) on interface %s\n", 
+                h->len, sender->interface);
+
+        /* set the mac addresses for the ethernet transmission from the arp entry's template */
+        eth = &h->pkt->eth;
+        memcpy(eth, eth_template, sizeof(struct sr_ethernet_hdr));
+        Trace("ROUTER: Source IP %s ", inet_ntoa(h->pkt->ip.ip_src));
+        Trace("Destination IP %s\n", inet_ntoa(h->pkt->ip.ip_dst));
+        if (sr_send_packet(h->sr, h->raw, h->len, sender->interface) == -1) {
+		sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG, "ROUTER: error sending packet - dropping\n"); /* - buffering\n"); */
+                /* sr_buffer_add(h);
+		return 0; */
+	}
+        return 1;
+}
+
+/**
+ * sr_router_send for a destination that isn't cached: look up the route
+ * and the gateway's arp entry, buffering the packet if it isn't resolved
+ */
+static int sr_router_resolve(struct sr_ip_handle* h, struct sr_cache* cache) 
+{
+        struct sr_arp*  arp_entry;
+        struct sr_rt*   sender;
 
         sender = sr_rt_find(h->sr, h->pkt->ip.ip_dst.s_addr );
+        if (!sender) {
+                sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG, "ROUTER: no route to %s - dropping\n",
+                        inet_ntoa(h->pkt->ip.ip_dst));
+                return 1; /* want buffer to delete packet */
+        }
         arp_entry = sr_arp_get(h->sr, sender->gw.s_addr);
+        if (!arp_entry) {
+                sr_log_limit(SR_LOG_ROUTER, SR_LOG_WARN, "ROUTER: no memory for arp entry - dropping\n");
+                return 1; /* want buffer to delete packet */
+        }
 
 	if (!arp_entry->ip) {
-                Debug("ROUTER: interface %s arp entry does not exist - buffering packet\n",
+                Trace("ROUTER: interface %s arp entry does not exist - buffering packet\n",
                         sender->interface);
-                sr_buffer_add(h);
+                if (!sr_buffer_add(h, arp_entry))
+                        sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG, "ROUTER: buffer full - packet dropped\n");
 		sr_arp_refresh(h->sr, sender->gw.s_addr, sender->interface);
                 return 0;
 
         } else if (arp_entry->tries >= ARP_MAX_TRIES) {
-                Debug("ROUTER: interface %s is disconnected (tries %d) - sending unreachable packet\n", 
+                sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG,
+                        "ROUTER: interface %s is disconnected (tries %d) - sending unreachable packet\n", 
                         sender->interface, arp_entry->tries);
 		/* reconfigure message to indicate host is unreachable */
                 if (!sr_icmp_unreachable(h)) return 1; /* want buffer to delete packet */
                 sender = sr_rt_find(h->sr, h->pkt->ip.ip_dst.s_addr );
+                if (!sender) return 1;
                 arp_entry = sr_arp_get(h->sr, sender->gw.s_addr);
+                if (!arp_entry) return 1;
                 if (arp_entry->tries >= ARP_MAX_TRIES) {
-                     Debug("ROUTER: interface %s is disconnected (tries %d) - aborting\n", 
+                     sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG,
+                            "ROUTER: interface %s is disconnected (tries %d) - aborting\n", 
                             sender->interface, arp_entry->tries);
 		     return 1; /* want buffer to delete packet */
                 }
 
         } else if (arp_entry->tries > 0) {
-                Debug("ROUTER: interface %s arp entry being refreshed (tries %d) buffering packet\n",
+                Trace("ROUTER: interface %s arp entry being refreshed (tries %d) buffering packet\n",
                         sender->interface, arp_entry->tries);
-                sr_buffer_add(h);
+                if (!sr_buffer_add(h, arp_entry))
+                        sr_log_limit(SR_LOG_ROUTER, SR_LOG_DEBUG, "ROUTER: buffer full - packet dropped\n");
                 return 0;
 
+        } else {
+                sr_cache_put(cache, h->pkt->ip.ip_dst.s_addr, sender, arp_entry);
         }
-        Debug("ROUTER: attempting to send packet (size %d bytes) on interface %s\n", 
-                h->len, sender->interface);
+        return sr_router_xmit(h, sender, arp_entry->eth);
+}
 
-        /* set the mac addresses for the ethernet transmission based on our routing and arp data */
-        eth = &h->pkt->eth;
-        memcpy(
-                eth->ether_shost,
-                arp_entry->iface->addr,
-                ETHER_ADDR_LEN
-        );
-        memcpy(
-                eth->ether_dhost,
-                arp_entry->mac,
-                ETHER_ADDR_LEN
-        );
-        Debug("ROUTER: Source IP %s (send mac ", inet_ntoa(h->pkt->ip.ip_src));
-        DebugMAC(eth->ether_shost); 
-        Debug(") Destination IP %s (recv mac ", inet_ntoa(h->pkt->ip.ip_dst));
-        DebugMAC(eth->ether_dhost);
-        Debug(")\n");
-        if (sr_send_packet(h->sr, h->raw, h->len, sender->interface) == -1) {
-		Debug("ROUTER: error sending packet - dropping\n"); /* - buffering\n"); */
-                /* sr_buffer_add(h);
-		return 0; */
-	}
-        return 1;
+/**--------------------------------------------------------------------- 
+ * Method: sr_router_send
+ *
+ * figure out where we are sending and do basic sanity check
+ * this is where you'd buffer packets should you not be able to send them
+ *---------------------------------------------------------------------*/
+int sr_router_send(struct sr_ip_handle* h) 
+{
+        struct sr_fwd* fwd = sr_fwd(h->sr);
+        struct sr_cache_entry* cached;
+        uint32_t routes;
+
+        assert(h->sr);
+        assert(h->pkt->ip.ip_dst.s_addr);
+
+        /* a pipe worker's cache is its own: catch up with live route changes */
+        routes = __atomic_load_n(&h->sr->rt_gen, __ATOMIC_ACQUIRE);
+        if (fwd->cache.routes != routes) {
+                sr_cache_flush(&fwd->cache);
+                fwd->cache.routes = routes;
+        }
+
+        /* destinations we have sent to since the last route or arp change */
+        if ((cached = sr_cache_find(&fwd->cache, h->pkt->ip.ip_dst.s_addr))) {
+                return sr_router_xmit(h, cached->route, cached->eth);
+        }
+        return sr_router_resolve(h, &fwd->cache);
 }
 
 /**
- * go through our queue and resend the packets 
- * delete anything too old or successfully sent
+ * an arp entry has been answered (or given up on): resend the packets 
+ * that were waiting on it and delete anything successfully sent
+ * packets that still can't go out are put back on a queue by sr_router_send
  */
-void sr_router_resend(struct sr_instance* sr) 
+void sr_router_flush(struct sr_instance* sr, struct sr_arp* arp) 
 {
-        struct sr_buffer* b;
         struct sr_buffer_item *item, *next;
         struct ip* ip;
-        time_t t;
 
         assert(sr);
-        b = &sr->buffer;
-
-        if (b->start) {
-                item = b->start;
-                while (item) {
-                        ip = &item->h.pkt->ip;
-                        next = item->next;
-                        Debug("ROUTER: attempting to resend packet (proto %d, from %s, ",
-                                ip->ip_p, inet_ntoa(ip->ip_src));
-                        Debug("to %s)\n", inet_ntoa(ip->ip_dst));
-                        if (time(&t) - item->created > PACKET_TOO_OLD) { 
-                                Debug("ROUTER: packet too old - deleting\n");
-                                sr_buffer_remove(sr,item);
-                        } else if (sr_router_send(&item->h)) {
-                                Debug("ROUTER: packet successfully sent - deleting\n"); 
-                                sr_buffer_remove(sr,item);
-                        }
-                        item = next;
+        if (!arp) return;
+
+        item = sr_buffer_take(arp);
+        while (item) {
+                ip = &item->h.pkt->ip;
+                next = item->qnext;
+                Trace("ROUTER: attempting to resend packet (proto %d, from %s, ",
+                        ip->ip_p, inet_ntoa(ip->ip_src));
+                Trace("to %s)\n", inet_ntoa(ip->ip_dst));
+                if (sr_router_send(&item->h)) {
+                        Trace("ROUTER: packet successfully sent - deleting\n"); 
+                        sr_buffer_remove(sr,item);
                 }
+                item = next;
         }
 }
-
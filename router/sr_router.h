@@ -17,23 +17,53 @@
 #include "sr_buffer.h"
 #include "sr_arp.h"
 #include "sr_ip.h"
-
-/* we dont like this debug , but what to do for varargs ? */
-#ifdef _DEBUG_
-#define Debug(x, args...) printf(x, ## args)
+#include "sr_cache.h"
+#include "sr_timer.h"
+#include "sr_rx.h"
+#include "sr_tx.h"
+#include "sr_event.h"
+#include "sr_io.h"
+#include "sr_packet.h"
+#include "sr_tap.h"
+#include "sr_xdp.h"
+#include "sr_uring.h"
+#include "sr_pcap.h"
+#include "sr_flight.h"
+#include "sr_control.h"
+#include "sr_pipe.h"
+#include "sr_epoch.h"
+#include "sr_log.h"
+
+/* debug and per packet trace logging for the file's SR_LOG_MODULE: compiled out without _DEBUG_ */
+#define Debug(x, args...) sr_log(SR_LOG_MODULE, SR_LOG_DEBUG, x, ## args)
+#define Trace(x, args...) sr_log(SR_LOG_MODULE, SR_LOG_TRACE, x, ## args)
 #define DebugMAC(x) \
-  do { int ivyl; for(ivyl=0; ivyl<5; ivyl++) printf("%02x:", \
-  (unsigned char)(x[ivyl])); printf("%02x",(unsigned char)(x[5])); } while (0)
-#else
-#define Debug(x, args...) do{}while(0)
-#define DebugMAC(x) do{}while(0)
-#endif
+  Debug("%02x:%02x:%02x:%02x:%02x:%02x", (unsigned char)(x)[0], (unsigned char)(x)[1], \
+  (unsigned char)(x)[2], (unsigned char)(x)[3], (unsigned char)(x)[4], (unsigned char)(x)[5])
 
 #define PACKET_DUMP_SIZE 1024
 
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_rt_node;
+struct sr_rt_dir;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fwd
+ *
+ * What routing a packet changes. The router has one and each pipe worker
+ * one of its own (see sr_pipe.h); sr_fwd() picks the one for this thread.
+ *
+ * -------------------------------------------------------------------------- */
+struct sr_fwd
+{
+    struct sr_buffer buffer; /** store packets that can't be sent right away */
+    struct sr_timer_wheel timers; /** arp refreshes and buffered packet expiry: see sr_timer.h */
+    struct sr_arp_table arp_table; /** our local LAN neighbourhood: see sr_arp_table.h */
+    struct sr_cache cache; /** destination -> route and arp entry: see sr_cache.h */
+    uint8_t spill[SR_RX_SPILL]; /** frames received own only their own bytes: replies that need more are built here */
+};
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -50,36 +80,68 @@ struct sr_instance
     char auth_key_fn[64]; /* auth key filename */
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
+    struct sr_rx rx; /** commands read from the server but not handled yet: see sr_rx.h */
+    struct sr_tx tx; /** packets waiting to go to the server: see sr_tx.h */
+    struct sr_uring uring; /** io_uring ring for the server socket when io is sr_uring_io: see sr_uring.h */
+    struct sr_event_loop events; /** what the main loop waits on: see sr_event.h */
+    const struct sr_io* io; /** where frames come from and go to: see sr_io.h */
+    struct sr_packet packet; /** AF_PACKET rings when io is sr_packet_io: see sr_packet.h */
+    struct sr_tap* tap; /** TAP devices, allocated by sr_tap_io's open: see sr_tap.h */
+    struct sr_xdp* xdp; /** AF_XDP sockets and umem, allocated by sr_xdp_io's open: see sr_xdp.h */
     struct sr_if* if_list; /* list of interfaces */
     struct sr_if* interfaces[LAN_SIZE]; /** find interfaces by last digit of name */
     struct sr_if* ip2iface[LAN_SIZE]; /** find interfaces by last octet of ip address */
     struct sr_rt* routing_table; /* routing table */
-    struct sr_buffer buffer; /** store packets that can't be sent right away */
-    time_t arp_lastrefresh; /** last time we ran sr_arp_check_refresh in sr_arp.c */
-    struct sr_arp arp_table[LAN_SIZE]; /** our local LAN neighbourhood: see sr_arp.h  */
+    struct sr_rt* rt_last; /** tail of routing_table so loading is not quadratic */
+    struct sr_rt_node* rt_trie; /** longest prefix match trie over routing_table: see sr_rt.c */
+    struct sr_rt_dir* rt_dir; /** DIR-24-8 table over routing_table, built on demand */
+    int rt_engine; /** which of the above sr_rt_find uses: SR_RT_TRIE etc in sr_rt.h */
+    uint32_t rt_gen; /** bumped by every live change to the routes */
+    struct sr_epoch rt_epoch; /** what live changes replaced, until the workers let go */
+    struct sr_timer rt_timer; /** reclaims and rebuilds rt_dir once changes settle */
+    uint64_t rt_changed; /** ms of the last live change */
+    unsigned long rt_changes; /** live changes so far */
+    struct sr_fwd fwd; /** buffer, timers, arp table and cache: use sr_fwd() */
     char subnetstr[32]; /** how we identify traffic from or to us: printable address */
     uint32_t subnet;  /** how we identify traffic from or to us: numerical base address for subnet */
     uint32_t mask; /** how we identify traffic from or to us: subnet mask */
-    FILE* logfile;
+    struct sr_pcap pcap; /** packets logged with -l: see sr_pcap.h */
+    struct sr_flight flight; /** recent packets kept with -F: see sr_flight.h */
+    struct sr_control control; /** commands read from the -C fifo: see sr_control.h */
+    struct sr_pipe pipe; /** threads and rings when io is sr_pipe_io: see sr_pipe.h */
 };
 
+/** the forwarding state this thread routes with: a pipe worker's own or the router's */
+static inline struct sr_fwd* sr_fwd(struct sr_instance* sr)
+{
+    return sr_pipe_self ? sr_pipe_self->fwd : &sr->fwd;
+}
+
 /* -- sr_arp.c -- */
 struct sr_arp* 
         sr_arp_set(struct sr_instance* sr, uint32_t ip, unsigned char* mac, struct sr_if* iface);
 struct sr_arp* sr_arp_get(struct sr_instance* sr, uint32_t ip);
+struct sr_arp* sr_arp_find(struct sr_instance* sr, uint32_t ip);
+void sr_arp_init(struct sr_instance* sr);
+void sr_arp_delete(struct sr_instance* sr, struct sr_arp* entry);
+void sr_arp_clear(struct sr_instance* sr);
 
 void sr_arp_scan(struct sr_instance* sr);
-void sr_arp_check_refresh(struct sr_instance* sr);
+void sr_arp_set_template(struct sr_arp* entry);
+void sr_arp_update_templates(struct sr_instance* sr);
+void sr_arp_timeout(struct sr_instance* sr, struct sr_timer* t);
 void sr_arp_refresh(struct sr_instance* sr, uint32_t ip, char* interface);
 void sr_arp_request_response(
         struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* iface);
 
 void sr_arp_print_table(struct sr_instance* sr);
-void sr_arp_print_entry(int i, struct sr_arp entry);
+void sr_arp_print_entry(struct sr_instance* sr, struct sr_arp* entry);
 
 /* -- sr_buffer.c -- */
 void sr_buffer_clear(struct sr_instance*);
-void sr_buffer_add(struct sr_ip_handle*);
+int sr_buffer_add(struct sr_ip_handle*, struct sr_arp*);
+struct sr_buffer_item* sr_buffer_take(struct sr_arp*);
+void sr_buffer_print_stats(struct sr_instance*);
 void sr_buffer_remove(struct sr_instance*,struct sr_buffer_item*);
 
 /* -- sr_ip.c -- */
@@ -88,12 +150,14 @@ int sr_icmp_unreachable(struct sr_ip_handle*);
 int sr_ip_handler(struct sr_ip_handle*);
 int sr_ip_passthru(struct sr_ip_handle*);
 uint16_t sr_ip_checksum(uint16_t const data[], uint16_t len_in_bytes);
+uint16_t sr_ip_checksum_adjust(uint16_t sum, uint16_t before, uint16_t after);
 
 /* -- sr_main.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_flush_packets(struct sr_instance* );
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len );
@@ -102,11 +166,13 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len );
 void sr_init(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
 int sr_router_send(struct sr_ip_handle*);
-void sr_router_resend(struct sr_instance*);
+void sr_router_flush(struct sr_instance*, struct sr_arp*);
+void sr_buffer_timeout(struct sr_instance*, struct sr_timer*);
 
 /* -- sr_if.c -- */
 /** newer functions that use arrays and quasi hashing to find things faster */
 uint8_t sr_if_name2idx(const char* name);
+int sr_if_name_check(const char* name);
 struct sr_if* sr_if_name2iface(struct sr_instance* sr, const char* name);
 struct sr_if* sr_if_ip2iface(struct sr_instance* sr, uint32_t ip);
 void sr_if_clear(struct sr_instance* sr);
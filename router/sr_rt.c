@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
 
 
 #include <sys/socket.h>
@@ -28,52 +29,280 @@
  * author Cal Woodruff <cwoodruf@sfu.ca>
  *
  * find the correct routing table entry for the ip address
- * this is painful as we have to scan the whole table every time
+ * by default lookups go through the trie compiled in sr_add_rt_entry so 
+ * the cost depends on the prefix length and not on the size of the table
+ * the DIR-24-8 engine costs one or two reads but is rebuilt after changes
+ * (see sr_rt_timeout) and the trie answers until it has been
  *
- * returns address of rt entry
+ * routes can change while pipe workers look them up, without a lock:
+ * see "live updates" below.
+ *
+ * returns address of rt entry or 0 if nothing matches
  *---------------------------------------------------------------------*/
 struct sr_rt* sr_rt_find(struct sr_instance* sr, uint32_t ip) 
 {
-        struct sr_rt* walker,* elsewhere,* bestmatch;
-        uint32_t prefix, bestprefix;
+        struct sr_rt_dir* dir;
 
         assert(sr);
         assert(ip);
 
-        walker = sr->routing_table;
-        assert(walker);
-
-        prefix = bestprefix = 0;
-
-        if (walker->dest.s_addr == 0) {
-                elsewhere = walker;
-        } else if (
-                (prefix = (walker->dest.s_addr & walker->mask.s_addr)) == 
-                        (ip & walker->mask.s_addr)
-        ) {
-                bestmatch = walker;
-                bestprefix = prefix;
-                if (walker->mask.s_addr == 0xFFFFFFFF) return walker;
-        }
-
-        while (walker->next) {
-                walker = walker->next;
-                if (walker->dest.s_addr == 0) {
-                        elsewhere = walker;
-                } else if (
-                        (prefix = (walker->dest.s_addr & walker->mask.s_addr)) == 
-                                (ip & walker->mask.s_addr)
-                ) {
-                        if (bestprefix == 0 || prefix > bestprefix) {
-                                bestprefix = prefix;
-                                bestmatch = walker;
-                                if (walker->mask.s_addr == 0xFFFFFFFF) return walker;
-                        }
+        switch (sr->rt_engine) {
+        case SR_RT_DIR:
+                if ((dir = __atomic_load_n(&sr->rt_dir, __ATOMIC_ACQUIRE))) {
+                        return sr_rt_dir_lookup(dir, ntohl(ip));
+                }
+                break;
+        case SR_RT_LIST:
+                return sr_rt_list_find(sr, ip);
+        }
+        return sr_rt_trie_lookup(__atomic_load_n(&sr->rt_trie, __ATOMIC_ACQUIRE), ntohl(ip));
+}
+/*--------------------------------------------------------------------- 
+ * Method: sr_rt_list_find
+ *
+ * the original linear scan of the routing table list
+ * kept as a reference for sr_rt_find: the longest mask wins and
+ * the first entry added wins between identical prefixes
+ *
+ * returns address of rt entry or 0 if nothing matches
+ *---------------------------------------------------------------------*/
+struct sr_rt* sr_rt_list_find(struct sr_instance* sr, uint32_t ip) 
+{
+        struct sr_rt* walker,* bestmatch;
+        uint32_t bestmask;
+
+        assert(sr);
+        assert(ip);
+
+        bestmatch = 0;
+        bestmask = 0;
+        walker = __atomic_load_n(&sr->routing_table, __ATOMIC_ACQUIRE);
+        for (; walker; walker = __atomic_load_n(&walker->next, __ATOMIC_ACQUIRE)) {
+                if ((ip & walker->mask.s_addr) != 
+                        (walker->dest.s_addr & walker->mask.s_addr)) continue;
+                /* contiguous masks compare by length once in host order */
+                if (!bestmatch || ntohl(walker->mask.s_addr) > bestmask) {
+                        bestmatch = walker;
+                        bestmask = ntohl(walker->mask.s_addr);
+                        if (bestmask == 0xFFFFFFFF) break;
                 }
         }
-        if (bestprefix == 0) return elsewhere;
         return bestmatch;
 }
+/**
+ * number of leading one bits in a (network byte order) netmask
+ */
+uint8_t sr_rt_masklen(struct in_addr mask) 
+{
+        uint32_t m = ntohl(mask.s_addr);
+        uint8_t len = 0;
+
+        while (m & 0x80000000) {
+                len++;
+                m <<= 1;
+        }
+        return len;
+}
+/** host byte order mask covering the first len bits */
+static inline uint32_t sr_rt_prefix_mask(uint8_t len) 
+{
+        return len ? 0xFFFFFFFF << (32 - len) : 0;
+}
+/** bit pos of key counting from the most significant bit */
+static inline int sr_rt_bit(uint32_t key, uint8_t pos) 
+{
+        return (key >> (31 - pos)) & 1;
+}
+static struct sr_rt_node* sr_rt_trie_node(uint32_t key, uint8_t len, struct sr_rt* route) 
+{
+        struct sr_rt_node* node = (struct sr_rt_node*)malloc(sizeof(struct sr_rt_node));
+
+        assert(node);
+        node->key = key & sr_rt_prefix_mask(len);
+        node->len = len;
+        node->route = route;
+        node->child[0] = node->child[1] = 0;
+        return node;
+}
+/**
+ * add a routing table entry to a path compressed trie
+ *
+ * nodes are only created where prefixes branch or end so the depth
+ * is bounded by the prefix length and the size by twice the number of
+ * routes
+ */
+void sr_rt_trie_insert(struct sr_rt_node** root, struct sr_rt* entry) 
+{
+        struct sr_rt_node** link,* n,* split;
+        uint32_t key, diff;
+        uint8_t len, common;
+
+        assert(root);
+        assert(entry);
+
+        len = sr_rt_masklen(entry->mask);
+        key = ntohl(entry->dest.s_addr) & sr_rt_prefix_mask(len);
+
+        link = root;
+        while ((n = *link)) {
+                diff = n->key ^ key;
+                common = diff ? __builtin_clz(diff) : 32;
+                if (common > n->len) common = n->len;
+                if (common > len) common = len;
+
+                if (common < n->len) {
+                        /* the new prefix leaves the compressed path part way along */
+                        split = sr_rt_trie_node(key, common, 0);
+                        split->child[ sr_rt_bit(n->key, common) ] = n;
+                        *link = split;
+                        if (common == len) {
+                                split->route = entry;
+                        } else {
+                                split->child[ sr_rt_bit(key, common) ] = 
+                                        sr_rt_trie_node(key, len, entry);
+                        }
+                        return;
+                }
+                if (n->len == len) {
+                        /* first entry added for a prefix wins, as in the list */
+                        if (!n->route) n->route = entry;
+                        return;
+                }
+                link = &n->child[ sr_rt_bit(key, n->len) ];
+        }
+        *link = sr_rt_trie_node(key, len, entry);
+}
+/**
+ * longest prefix match on a host byte order address
+ */
+struct sr_rt* sr_rt_trie_lookup(struct sr_rt_node* n, uint32_t ip) 
+{
+        struct sr_rt* best = 0;
+
+        while (n) {
+                if ((ip & sr_rt_prefix_mask(n->len)) != n->key) break;
+                if (n->route) best = n->route;
+                if (n->len == 32) break;
+                n = n->child[ sr_rt_bit(ip, n->len) ];
+        }
+        return best;
+}
+/**
+ * free a trie (the routes themselves belong to the routing table list)
+ */
+void sr_rt_trie_free(struct sr_rt_node* n) 
+{
+        if (!n) return;
+        sr_rt_trie_free(n->child[0]);
+        sr_rt_trie_free(n->child[1]);
+        free(n);
+}
+/** a route waiting to be painted into the DIR-24-8 tables */
+struct sr_rt_dir_paint 
+{
+        uint32_t key;
+        uint8_t len;
+        uint32_t order;
+        uint32_t idx;
+};
+/** shortest prefixes first; among equal prefixes the first added goes last */
+static int sr_rt_dir_cmp(const void* a, const void* b) 
+{
+        const struct sr_rt_dir_paint* x = a,* y = b;
+
+        if (x->len != y->len) return x->len < y->len ? -1 : 1;
+        return x->order > y->order ? -1 : x->order < y->order;
+}
+/**
+ * compile the routing table list into DIR-24-8 tables
+ *
+ * routes are painted shortest prefix first so longer prefixes simply
+ * overwrite the ranges they cover. a /25 or longer prefix gives its /24
+ * slot a second level block seeded with whatever covered the whole /24.
+ */
+struct sr_rt_dir* sr_rt_dir_build(struct sr_rt* routing_table) 
+{
+        struct sr_rt_dir* dir;
+        struct sr_rt_dir_paint* paint;
+        struct sr_rt* r;
+        struct timespec t0, t1;
+        uint32_t i, j, n, first, count, blocks, *block;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        dir = (struct sr_rt_dir*)calloc(1, sizeof(struct sr_rt_dir));
+        assert(dir);
+        for (n = 0, r = routing_table; r; r = r->next) n++;
+
+        dir->routes = (struct sr_rt**)malloc((n+1) * sizeof(struct sr_rt*));
+        paint = (struct sr_rt_dir_paint*)malloc((n+1) * sizeof(struct sr_rt_dir_paint));
+        dir->tbl24 = (uint32_t*)calloc(SR_RT_DIR_TBL24, sizeof(uint32_t));
+        assert(dir->routes && paint && dir->tbl24);
+
+        dir->routes[0] = 0;
+        blocks = 0;
+        for (i = 0, r = routing_table; r; r = r->next, i++) {
+                dir->routes[i+1] = r;
+                paint[i].len = sr_rt_masklen(r->mask);
+                paint[i].key = ntohl(r->dest.s_addr) & ntohl(r->mask.s_addr);
+                paint[i].order = i;
+                paint[i].idx = i+1;
+                if (paint[i].len > 24) blocks++;
+        }
+        dir->nroutes = n;
+        qsort(paint, n, sizeof(struct sr_rt_dir_paint), sr_rt_dir_cmp);
+
+        /* at most one block per long prefix, trimmed once we know */
+        dir->tbllong = (uint32_t*)malloc((blocks ? blocks : 1) * SR_RT_DIR_BLOCK * sizeof(uint32_t));
+        assert(dir->tbllong);
+
+        for (i = 0; i < n; i++) {
+                if (paint[i].len <= 24) {
+                        first = paint[i].key >> 8;
+                        count = 1 << (24 - paint[i].len);
+                        for (j = first; j < first + count; j++) dir->tbl24[j] = paint[i].idx;
+                        continue;
+                }
+                first = paint[i].key >> 8;
+                if (!(dir->tbl24[first] & SR_RT_DIR_LONG)) {
+                        block = dir->tbllong + dir->nlong * SR_RT_DIR_BLOCK;
+                        for (j = 0; j < SR_RT_DIR_BLOCK; j++) block[j] = dir->tbl24[first];
+                        dir->tbl24[first] = SR_RT_DIR_LONG | dir->nlong++;
+                }
+                block = dir->tbllong + (dir->tbl24[first] & ~SR_RT_DIR_LONG) * SR_RT_DIR_BLOCK;
+                first = paint[i].key & 0xFF;
+                count = 1 << (32 - paint[i].len);
+                for (j = first; j < first + count; j++) block[j] = paint[i].idx;
+        }
+        free(paint);
+
+        if (dir->nlong && dir->nlong < blocks) {
+                block = realloc(dir->tbllong, dir->nlong * SR_RT_DIR_BLOCK * sizeof(uint32_t));
+                if (block) dir->tbllong = block;
+        }
+        dir->bytes = sizeof(struct sr_rt_dir) + 
+                SR_RT_DIR_TBL24 * sizeof(uint32_t) + 
+                dir->nlong * SR_RT_DIR_BLOCK * sizeof(uint32_t) +
+                (n+1) * sizeof(struct sr_rt*);
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        dir->build_ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+        return dir;
+}
+void sr_rt_dir_free(struct sr_rt_dir* dir) 
+{
+        if (!dir) return;
+        free(dir->tbl24);
+        free(dir->tbllong);
+        free(dir->routes);
+        free(dir);
+}
+void sr_rt_dir_print(struct sr_rt_dir* dir) 
+{
+        assert(dir);
+        printf("RT: DIR-24-8 table: %u routes, %u long blocks, %.1f MB, built in %.1f ms\n",
+                dir->nroutes, dir->nlong, dir->bytes / (1024.0 * 1024.0), dir->build_ms);
+}
 /**
  * free routing table 
  */
@@ -81,6 +310,12 @@ void sr_rt_clear(struct sr_instance* sr) {
         struct sr_rt *r, *del;
 
         assert(sr);
+        /* and everything live changes retired: the readers have gone */
+        sr_epoch_close(&sr->rt_epoch);
+        sr_rt_trie_free(sr->rt_trie);
+        sr->rt_trie = 0;
+        sr_rt_dir_free(sr->rt_dir);
+        sr->rt_dir = 0;
         r = sr->routing_table;
         while (r) {
                 del = r;
@@ -88,13 +323,40 @@ void sr_rt_clear(struct sr_instance* sr) {
                 free(del);
         }
         sr->routing_table = 0;
+        sr->rt_last = 0;
+        sr_cache_flush(&sr_fwd(sr)->cache);
 }
 /*--------------------------------------------------------------------- 
- * Method:
+ * Method: sr_rt_entry
  *
+ * a new routing table entry, not linked into anything yet
  *---------------------------------------------------------------------*/
 
-int sr_load_rt(struct sr_instance* sr,const char* filename)
+static struct sr_rt* sr_rt_entry(struct in_addr dest, struct in_addr gw,
+        struct in_addr mask, const char* if_name)
+{
+    struct sr_rt* entry = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+
+    assert(entry);
+    entry->next = 0;
+    entry->prev = 0;
+    entry->dest = dest;
+    entry->gw   = gw;
+    entry->mask = mask;
+    entry->ifidx = sr_if_name2idx(if_name);
+    strncpy(entry->interface,if_name,sr_IFACE_NAMELEN);
+    return entry;
+} /* -- sr_rt_entry -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_rt_read
+ *
+ * append the routes in an rtable file to a list and trie: the router's
+ * for sr_load_rt, new ones for sr_rt_reload
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_read(const char* filename, struct sr_rt** list, 
+        struct sr_rt** last, struct sr_rt_node** trie)
 {
     FILE* fp;
     char  line[BUFSIZ];
@@ -105,6 +367,7 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
     struct in_addr dest_addr;
     struct in_addr gw_addr;
     struct in_addr mask_addr;
+    struct sr_rt* entry;
 
     /* -- REQUIRES -- */
     assert(filename);
@@ -118,12 +381,15 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
 
     while( fgets(line,BUFSIZ,fp) != 0)
     {
-        sscanf(line,"%s %s %s %s",dest,gw,mask,iface);
+        /* -- blank lines would add the last route again -- */
+        if(sscanf(line,"%31s %31s %31s %31s",dest,gw,mask,iface) != 4)
+        { continue; }
         if(inet_aton(dest,&dest_addr) == 0)
         { 
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     dest);
+            fclose(fp);
             return -1; 
         }
         if(inet_aton(gw,&gw_addr) == 0)
@@ -131,6 +397,7 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     gw);
+            fclose(fp);
             return -1; 
         }
         if(inet_aton(mask,&mask_addr) == 0)
@@ -138,10 +405,53 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
             fprintf(stderr,
                     "Error loading routing table, cannot convert %s to valid IP\n",
                     mask);
+            fclose(fp);
+            return -1; 
+        }
+        /* -- sr_rt_entry can only index a name that fits -- */
+        if(sr_if_name_check(iface) == -1)
+        { 
+            fprintf(stderr,
+                    "Error loading routing table, %s is not an interface name like eth0\n",
+                    iface);
+            fclose(fp);
             return -1; 
         }
-        sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
+        entry = sr_rt_entry(dest_addr,gw_addr,mask_addr,iface);
+        if(*list == 0)
+        { *list = entry; }
+        else
+        { (*last)->next = entry; entry->prev = *last; }
+        *last = entry;
+        sr_rt_trie_insert(trie, entry);
     } /* -- while -- */
+    fclose(fp);
+
+    return 0;
+} /* -- sr_rt_read -- */
+
+/*--------------------------------------------------------------------- 
+ * Method:
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_rt(struct sr_instance* sr,const char* filename)
+{
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if(sr_rt_read(filename, &sr->routing_table, &sr->rt_last, &sr->rt_trie) != 0)
+    { return -1; }
+    sr_rt_dir_free(sr->rt_dir);
+    sr->rt_dir = 0;
+    sr_cache_flush(&sr_fwd(sr)->cache);
+
+    /* -- build the flat table now rather than on the first packet -- */
+    if(sr->rt_engine == SR_RT_DIR)
+    {
+        sr->rt_dir = sr_rt_dir_build(sr->routing_table);
+        sr_rt_dir_print(sr->rt_dir);
+    }
 
     return 0; /* -- success -- */
 } /* -- sr_load_rt -- */
@@ -149,6 +459,8 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
 /*--------------------------------------------------------------------- 
  * Method:
  *
+ * add a route before the router is running: see sr_rt_add for adding
+ * one while packets are being forwarded
  *---------------------------------------------------------------------*/
 
 void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
@@ -160,37 +472,347 @@ void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
     assert(if_name);
     assert(sr);
 
-    /* -- empty list special case -- */
-    if(sr->routing_table == 0)
-    {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        sr->routing_table->ifidx = sr_if_name2idx(if_name);
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
-        return;
-    }
+    rt_walker = sr_rt_entry(dest,gw,mask,if_name);
 
-    /* -- find the end of the list -- */
-    rt_walker = sr->routing_table;
-    while(rt_walker->next)
-    {rt_walker = rt_walker->next; }
+    /* -- append to the list: rt_last saves walking it every time -- */
+    if(sr->routing_table == 0)
+    { sr->routing_table = rt_walker; }
+    else
+    { sr->rt_last->next = rt_walker; rt_walker->prev = sr->rt_last; }
+    sr->rt_last = rt_walker;
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+    sr_rt_trie_insert(&sr->rt_trie, rt_walker);
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    /* -- a stale DIR-24-8 table is dropped: sr_load_rt builds it -- */
+    sr_rt_dir_free(sr->rt_dir);
+    sr->rt_dir = 0;
+    sr_cache_flush(&sr_fwd(sr)->cache);
 
 } /* -- sr_add_entry -- */
 
+/*--------------------------------------------------------------------- 
+ * live updates
+ *
+ * author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * sr_rt_add, sr_rt_del and sr_rt_reload change the routes while pipe
+ * workers go on looking them up without a lock. nothing a reader can
+ * reach is changed in place:
+ *   - list entries are linked in or out with one store each
+ *   - the trie is copied on write: a change copies the nodes on the
+ *     path down to it, shares everything else with the old trie and
+ *     publishes the new root with one store
+ *   - the DIR-24-8 table is dropped and rebuilt once the routes settle
+ * what a change replaced is retired to sr->rt_epoch (sr_epoch.h) and
+ * freed once no worker can still be using it. destination caches follow
+ * sr->rt_gen so none of them hands out a route that has gone.
+ * only the main thread makes changes: see the route command in
+ * sr_control.c
+ *---------------------------------------------------------------------*/
+
+/** deepest a trie gets: a node per prefix length at most */
+#define SR_RT_DEPTH 33
+
+/** everything one change replaced: retired and freed as one */
+struct sr_rt_retired
+{
+        struct sr_rt_node* node[SR_RT_DEPTH]; /** copied on write */
+        int nodes;
+        struct sr_rt* route;            /** deleted */
+        struct sr_rt* list;             /** a whole list replaced by a reload */
+        struct sr_rt_node* trie;        /** and its trie */
+        struct sr_rt_dir* dir;          /** dropped until sr_rt_timeout */
+};
+
+static void sr_rt_retired_free(void* arg)
+{
+        struct sr_rt_retired* r = arg;
+        struct sr_rt* del;
+        int i;
+
+        for (i = 0; i < r->nodes; i++) free(r->node[i]);
+        free(r->route);
+        while ((del = r->list)) {
+                r->list = del->next;
+                free(del);
+        }
+        sr_rt_trie_free(r->trie);
+        sr_rt_dir_free(r->dir);
+        free(r);
+}
+
+/** a private copy of a node that is in use: the original is retired */
+static struct sr_rt_node* sr_rt_trie_copy(struct sr_rt_node* n, struct sr_rt_retired* r)
+{
+        struct sr_rt_node* c = sr_rt_trie_node(n->key, n->len, n->route);
+
+        c->child[0] = n->child[0];
+        c->child[1] = n->child[1];
+        assert(r->nodes < SR_RT_DEPTH);
+        r->node[r->nodes++] = n;
+        return c;
+}
+
+/**
+ * sr_rt_trie_insert copying on write
+ * @return the root of the new trie: n itself if nothing changed
+ */
+static struct sr_rt_node* sr_rt_trie_put(struct sr_rt_node* n, uint32_t key, uint8_t len,
+        struct sr_rt* entry, struct sr_rt_retired* r)
+{
+        struct sr_rt_node* c,* split,* child;
+        uint32_t diff;
+        uint8_t common;
+        int b;
+
+        if (!n) return sr_rt_trie_node(key, len, entry);
+        diff = n->key ^ key;
+        common = diff ? __builtin_clz(diff) : 32;
+        if (common > n->len) common = n->len;
+        if (common > len) common = len;
+
+        if (common < n->len) {
+                /* a new node above n: n itself doesn't change */
+                split = sr_rt_trie_node(key, common, 0);
+                split->child[ sr_rt_bit(n->key, common) ] = n;
+                if (common == len) {
+                        split->route = entry;
+                } else {
+                        split->child[ sr_rt_bit(key, common) ] = sr_rt_trie_node(key, len, entry);
+                }
+                return split;
+        }
+        if (n->len == len) {
+                /* first entry added for a prefix wins, as in the list */
+                if (n->route) return n;
+                c = sr_rt_trie_copy(n, r);
+                c->route = entry;
+                return c;
+        }
+        b = sr_rt_bit(key, n->len);
+        child = sr_rt_trie_put(n->child[b], key, len, entry, r);
+        if (child == n->child[b]) return n;
+        c = sr_rt_trie_copy(n, r);
+        c->child[b] = child;
+        return c;
+}
+
+/**
+ * take entry out of the trie copying on write. next, if not 0, is the
+ * following list entry for the same prefix, which takes its place
+ * @return the root of the new trie: n itself if nothing changed
+ */
+static struct sr_rt_node* sr_rt_trie_remove(struct sr_rt_node* n, uint32_t key, uint8_t len,
+        struct sr_rt* entry, struct sr_rt* next, struct sr_rt_retired* r)
+{
+        struct sr_rt_node* c,* child;
+        int b;
+
+        if (!n || n->len > len || (key & sr_rt_prefix_mask(n->len)) != n->key) return n;
+        if (n->len == len) {
+                if (n->route != entry) return n;
+                c = sr_rt_trie_copy(n, r);
+                c->route = next;
+        } else {
+                b = sr_rt_bit(key, n->len);
+                child = sr_rt_trie_remove(n->child[b], key, len, entry, next, r);
+                if (child == n->child[b]) return n;
+                c = sr_rt_trie_copy(n, r);
+                c->child[b] = child;
+        }
+        /* a node that neither ends a prefix nor branches is left out */
+        if (!c->route && !(c->child[0] && c->child[1])) {
+                child = c->child[0] ? c->child[0] : c->child[1];
+                free(c);
+                return child;
+        }
+        return c;
+}
+
+/**
+ * make a change visible: the new list entries are already linked in.
+ * publish the new trie, drop the DIR-24-8 table, move the caches on and
+ * retire what the change replaced
+ */
+static void sr_rt_publish(struct sr_instance* sr, struct sr_rt_node* trie, struct sr_rt_retired* r)
+{
+        __atomic_store_n(&sr->rt_trie, trie, __ATOMIC_RELEASE);
+        r->dir = sr->rt_dir;
+        __atomic_store_n(&sr->rt_dir, 0, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&sr->rt_gen, 1, __ATOMIC_RELEASE);
+        sr_cache_flush(&sr_fwd(sr)->cache);
+
+        /* nothing is freed early if there is no memory to remember it: it leaks */
+        sr_epoch_retire(&sr->rt_epoch, r, sr_rt_retired_free);
+        sr_epoch_reclaim(&sr->rt_epoch);
+        sr->rt_changes++;
+        sr->rt_changed = sr_timer_clock(&sr_fwd(sr)->timers);
+        if (!sr_timer_pending(&sr->rt_timer)) {
+                sr_timer_add(&sr_fwd(sr)->timers, &sr->rt_timer, sr_rt_timeout, sr->rt_changed + SR_RT_SETTLE_MS);
+        }
+}
+
+/**
+ * @return 0 if the interface is known, or can't be checked yet but has a
+ * name sr_rt_entry can index
+ */
+static int sr_rt_check_iface(struct sr_instance* sr, const char* if_name)
+{
+        if (sr_if_name_check(if_name) == -1) {
+                fprintf(stderr, "RT: %s is not an interface name like eth0\n", if_name);
+                return -1;
+        }
+        if (!sr->if_list || sr_if_name2iface(sr, if_name)) return 0;
+        fprintf(stderr, "RT: there is no interface %s\n", if_name);
+        return -1;
+}
+
+/**
+ * add a route while the router is running
+ * @return 0 or -1 if the interface is unknown or there is no memory
+ */
+int sr_rt_add(struct sr_instance* sr, struct in_addr dest, struct in_addr gw,
+        struct in_addr mask, const char* if_name)
+{
+        struct sr_rt_retired* r;
+        struct sr_rt_node* trie;
+        struct sr_rt* entry;
+        uint8_t len;
+
+        assert(sr);
+        assert(if_name);
+        if (sr_rt_check_iface(sr, if_name) == -1) return -1;
+        if (!(r = (struct sr_rt_retired*)calloc(1, sizeof(struct sr_rt_retired)))) {
+                perror("calloc(..):sr_rt.c::sr_rt_add");
+                return -1;
+        }
+        entry = sr_rt_entry(dest, gw, mask, if_name);
+        len = sr_rt_masklen(mask);
+        trie = sr_rt_trie_put(sr->rt_trie, ntohl(dest.s_addr) & sr_rt_prefix_mask(len), len, entry, r);
+
+        entry->prev = sr->rt_last;
+        if (sr->routing_table) __atomic_store_n(&sr->rt_last->next, entry, __ATOMIC_RELEASE);
+        else __atomic_store_n(&sr->routing_table, entry, __ATOMIC_RELEASE);
+        sr->rt_last = entry;
+        sr_rt_publish(sr, trie, r);
+        return 0;
+}
+
+/** @return the route added first for exactly key/len or 0 */
+static struct sr_rt* sr_rt_trie_exact(struct sr_rt_node* n, uint32_t key, uint8_t len)
+{
+        while (n && n->len <= len && (key & sr_rt_prefix_mask(n->len)) == n->key) {
+                if (n->len == len) return n->route;
+                n = n->child[ sr_rt_bit(key, n->len) ];
+        }
+        return 0;
+}
+
+/** the list entry matches dest/mask */
+static int sr_rt_is(struct sr_rt* e, struct in_addr dest, struct in_addr mask)
+{
+        return e->mask.s_addr == mask.s_addr && !((e->dest.s_addr ^ dest.s_addr) & mask.s_addr);
+}
+
+/**
+ * delete the first route for dest/mask while the router is running
+ * @return 0 or -1 if there is no such route or no memory
+ */
+int sr_rt_del(struct sr_instance* sr, struct in_addr dest, struct in_addr mask)
+{
+        struct sr_rt_retired* r;
+        struct sr_rt_node* trie;
+        struct sr_rt *entry,* next;
+        uint32_t key;
+        uint8_t len;
+
+        assert(sr);
+        /* the trie has the first for a prefix without walking the list */
+        len = sr_rt_masklen(mask);
+        key = ntohl(dest.s_addr) & sr_rt_prefix_mask(len);
+        if (!(entry = sr_rt_trie_exact(sr->rt_trie, key, len))) return -1;
+        if (!(r = (struct sr_rt_retired*)calloc(1, sizeof(struct sr_rt_retired)))) {
+                perror("calloc(..):sr_rt.c::sr_rt_del");
+                return -1;
+        }
+        for (next = entry->next; next && !sr_rt_is(next, dest, mask); next = next->next);
+        trie = sr_rt_trie_remove(sr->rt_trie, key, len, entry, next, r);
+
+        /* a reader on entry carries on along entry->next, which stays put */
+        if (entry->prev) __atomic_store_n(&entry->prev->next, entry->next, __ATOMIC_RELEASE);
+        else __atomic_store_n(&sr->routing_table, entry->next, __ATOMIC_RELEASE);
+        if (entry->next) entry->next->prev = entry->prev;
+        if (sr->rt_last == entry) sr->rt_last = entry->prev;
+        r->route = entry;
+        sr_rt_publish(sr, trie, r);
+        return 0;
+}
+
+/**
+ * replace every route with those in an rtable file while the router is
+ * running. the new table is built off to the side and swapped in whole
+ * @return 0 or -1 if the file can't be read or names an unknown interface
+ */
+int sr_rt_reload(struct sr_instance* sr, const char* filename)
+{
+        struct sr_rt_retired* r = 0;
+        struct sr_rt *list = 0,* last = 0,* e;
+        struct sr_rt_node* trie = 0;
+        int bad = 0;
+
+        assert(sr);
+        if (sr_rt_read(filename, &list, &last, &trie) == 0) {
+                for (e = list; e && !bad; e = e->next) bad = sr_rt_check_iface(sr, e->interface);
+                if (!bad && !(r = (struct sr_rt_retired*)calloc(1, sizeof(struct sr_rt_retired)))) {
+                        perror("calloc(..):sr_rt.c::sr_rt_reload");
+                }
+        }
+        if (!r) {
+                while ((e = list)) {
+                        list = e->next;
+                        free(e);
+                }
+                sr_rt_trie_free(trie);
+                return -1;
+        }
+        r->list = sr->routing_table;
+        r->trie = sr->rt_trie;
+        __atomic_store_n(&sr->routing_table, list, __ATOMIC_RELEASE);
+        sr->rt_last = last;
+        sr_rt_publish(sr, trie, r);
+        return 0;
+}
+
+/**
+ * timer callback: free what the workers have let go of and, once the
+ * routes have been left alone for SR_RT_SETTLE_MS, rebuild the DIR-24-8
+ * table the last change dropped
+ */
+void sr_rt_timeout(struct sr_instance* sr, struct sr_timer* t)
+{
+        struct sr_rt_dir* dir;
+        uint64_t now = sr_timer_now(&sr_fwd(sr)->timers);
+
+        sr_epoch_reclaim(&sr->rt_epoch);
+        if (now - sr->rt_changed < SR_RT_SETTLE_MS) {
+                sr_timer_add(&sr_fwd(sr)->timers, t, sr_rt_timeout, sr->rt_changed + SR_RT_SETTLE_MS);
+                return;
+        }
+        if (sr->rt_engine == SR_RT_DIR && !sr->rt_dir && sr->routing_table) {
+                dir = sr_rt_dir_build(sr->routing_table);
+                __atomic_store_n(&sr->rt_dir, dir, __ATOMIC_RELEASE);
+                sr_rt_dir_print(dir);
+        }
+        /* a worker is still in the batch it was in: look again next tick */
+        if (sr->rt_epoch.pending) sr_timer_add(&sr_fwd(sr)->timers, t, sr_rt_timeout, now + SR_TIMER_TICK_MS);
+}
+
+void sr_rt_print_stats(struct sr_instance* sr)
+{
+        printf("RT: %lu live changes\n", sr->rt_changes);
+        sr_epoch_print_stats(&sr->rt_epoch);
+}
+
 /*--------------------------------------------------------------------- 
  * Method:
  *
@@ -34,17 +34,96 @@ struct sr_rt
     uint8_t ifidx;
     char   interface[sr_IFACE_NAMELEN];
     struct sr_rt* next;
+    struct sr_rt* prev;           /* for sr_rt_del: lookups only follow next */
 };
 
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_node
+ *
+ * Node in the path compressed (radix) trie compiled from the routing table.
+ * Keys are kept in host byte order so bits can be tested directly; a node
+ * only carries a route if one was added for exactly that prefix.
+ *
+ * -------------------------------------------------------------------------- */
+struct sr_rt_node
+{
+    uint32_t key;                 /* prefix bits, host byte order */
+    uint8_t  len;                 /* number of significant bits in key */
+    struct sr_rt* route;          /* entry for this exact prefix or 0 */
+    struct sr_rt_node* child[2];  /* indexed by bit len of the address */
+};
+
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_dir
+ *
+ * DIR-24-8 flat lookup table for full size routing tables. The first level
+ * is indexed by the top 24 bits of the address; prefixes longer than /24
+ * get a 256 entry second level block. Entries hold an index into routes
+ * (0 means no route) or a block number tagged with SR_RT_DIR_LONG.
+ *
+ * -------------------------------------------------------------------------- */
+#define SR_RT_DIR_TBL24 (1 << 24)
+#define SR_RT_DIR_BLOCK 256
+#define SR_RT_DIR_LONG  0x80000000
+
+struct sr_rt_dir
+{
+    uint32_t* tbl24;          /* SR_RT_DIR_TBL24 first level entries */
+    uint32_t* tbllong;        /* nlong second level blocks */
+    uint32_t  nlong;
+    struct sr_rt** routes;    /* entry index -> route, routes[0] is 0 */
+    uint32_t  nroutes;
+    size_t    bytes;          /* memory held by the tables */
+    double    build_ms;       /* how long the last build took */
+};
+
+/** lookup engines for sr_rt_find: see the -L option in sr_main.c */
+#define SR_RT_TRIE 0
+#define SR_RT_DIR  1
+#define SR_RT_LIST 2
 
 struct sr_rt* sr_rt_find(struct sr_instance*,uint32_t);
+struct sr_rt* sr_rt_list_find(struct sr_instance*,uint32_t);
 void sr_rt_clear(struct sr_instance* sr);
 
+uint8_t sr_rt_masklen(struct in_addr mask);
+void sr_rt_trie_insert(struct sr_rt_node** root, struct sr_rt* entry);
+struct sr_rt* sr_rt_trie_lookup(struct sr_rt_node* root, uint32_t ip);
+void sr_rt_trie_free(struct sr_rt_node* node);
+
+struct sr_rt_dir* sr_rt_dir_build(struct sr_rt* routing_table);
+void sr_rt_dir_free(struct sr_rt_dir* dir);
+void sr_rt_dir_print(struct sr_rt_dir* dir);
+
+/** one or two memory reads whatever the table size */
+static inline struct sr_rt* sr_rt_dir_lookup(struct sr_rt_dir* dir, uint32_t ip)
+{
+    uint32_t e = dir->tbl24[ip >> 8];
+
+    if (e & SR_RT_DIR_LONG)
+    { e = dir->tbllong[ ((e & ~SR_RT_DIR_LONG) << 8) | (ip & 0xFF) ]; }
+    return dir->routes[e];
+}
+
+/** how long routes must be left alone before the DIR-24-8 table is rebuilt */
+#define SR_RT_SETTLE_MS 1000
+
+struct sr_timer;
+
 int sr_load_rt(struct sr_instance*,const char*);
 void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr,char*);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 
+/* -- changes while the router is running: see "live updates" in sr_rt.c -- */
+int sr_rt_add(struct sr_instance* sr, struct in_addr dest, struct in_addr gw,
+        struct in_addr mask, const char* if_name);
+int sr_rt_del(struct sr_instance* sr, struct in_addr dest, struct in_addr mask);
+int sr_rt_reload(struct sr_instance* sr, const char* filename);
+void sr_rt_timeout(struct sr_instance* sr, struct sr_timer* t);
+void sr_rt_print_stats(struct sr_instance* sr);
+
 
 #endif  /* --  sr_RT_H -- */
@@ -0,0 +1,179 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * batched receive buffer for the VNS connection: see sr_rx.h
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "sr_rx.h"
+
+void sr_rx_init(struct sr_rx* rx)
+{
+        assert(rx);
+        rx->head = rx->tail = 0;
+        rx->reads = rx->commands = rx->moves = 0;
+        rx->bytes = 0;
+}
+
+/** make room after tail for a whole command */
+static void sr_rx_make_room(struct sr_rx* rx)
+{
+        size_t left;
+
+        if (rx->head == rx->tail) {
+                rx->head = rx->tail = 0;
+        } else if (SR_RX_SIZE - rx->tail < VNSCMDSIZE) {
+                /* only part of one command is left: move it to the front */
+                left = rx->tail - rx->head;
+                memmove(rx->buf, rx->buf + rx->head, left);
+                rx->head = 0;
+                rx->tail = left;
+                rx->moves++;
+        }
+}
+
+/**
+ * one recv into the free space after tail, blocking if there is nothing
+ * @return bytes read, 0 if the server hung up or -1 on error
+ */
+int sr_rx_fill(struct sr_rx* rx, int fd)
+{
+        ssize_t ret;
+
+        assert(rx);
+
+        sr_rx_make_room(rx);
+        do {
+                ret = recv(fd, rx->buf + rx->tail, SR_RX_SIZE - rx->tail, 0);
+        } while (ret == -1 && errno == EINTR); /* be mindful of signals */
+
+        if (ret <= 0) return (int) ret;
+        rx->tail += ret;
+        rx->reads++;
+        rx->bytes += ret;
+        return (int) ret;
+}
+
+/**
+ * parse the command at cmd if all avail bytes of it are there
+ * the length field stays in network order, the command type is switched
+ * to host order in place the way the handlers expect
+ * @param len set to the command's length, or -1 if the length is bad
+ * @return the command or 0 if it has not all arrived yet
+ */
+static uint8_t* sr_rx_parse(uint8_t* cmd, size_t avail, int* len)
+{
+        uint32_t n, type;
+
+        *len = 0;
+        if (avail < sizeof(c_base)) return 0;
+        memcpy(&n, cmd, sizeof(n));
+        n = ntohl(n);
+        if (n > VNSCMDSIZE || n < sizeof(c_base)) {
+                fprintf(stderr,"Error: bad command length %u\n", n);
+                *len = -1;
+                return 0;
+        }
+        if (avail < n) return 0;
+
+        memcpy(&type, cmd + sizeof(uint32_t), sizeof(type));
+        type = ntohl(type);
+        memcpy(cmd + sizeof(uint32_t), &type, sizeof(type));
+        *len = n;
+        return cmd;
+}
+
+/**
+ * parse the next complete command out of the buffer
+ * @param len set to the command's length, or -1 if the length is bad
+ * @return the command or 0 if it has not all arrived yet
+ */
+uint8_t* sr_rx_next(struct sr_rx* rx, int* len)
+{
+        uint8_t* cmd;
+
+        assert(rx);
+        assert(len);
+
+        if (!(cmd = sr_rx_parse(rx->buf + rx->head, rx->tail - rx->head, len))) return 0;
+        rx->head += *len;
+        rx->commands++;
+        return cmd;
+}
+
+/**
+ * copy bytes of a command split across chunks received elsewhere (see
+ * sr_uring.h) into the buffer: only as many as the partial command needs
+ * @return bytes taken from data
+ */
+static size_t sr_rx_append(struct sr_rx* rx, const uint8_t* data, size_t left)
+{
+        size_t have, want = sizeof(uint32_t);
+        uint32_t n;
+
+        sr_rx_make_room(rx);
+        have = rx->tail - rx->head;
+        if (have >= want) {
+                memcpy(&n, rx->buf + rx->head, sizeof(n));
+                want = ntohl(n);
+                /* a bad length is left for sr_rx_next to report */
+                if (want > VNSCMDSIZE || want < sizeof(c_base)) return 0;
+        }
+        want -= have;
+        if (want > left) want = left;
+        memcpy(rx->buf + rx->tail, data, want);
+        rx->tail += want;
+        return want;
+}
+
+/**
+ * parse the next command out of a chunk of the stream that was received
+ * into some other buffer. whole commands are handed out where they are,
+ * one that is cut off by the end of a chunk is put back together here and
+ * handed out from rx->buf once the next chunk completes it.
+ * @param data, left the part of the chunk not parsed yet: moved past the command
+ * @param len set to the command's length, or -1 if the length is bad
+ * @return the command or 0 when the chunk is used up
+ */
+uint8_t* sr_rx_next_from(struct sr_rx* rx, uint8_t** data, size_t* left, int* len)
+{
+        uint8_t* cmd;
+        size_t took;
+
+        assert(rx);
+        assert(data);
+        assert(left);
+        assert(len);
+
+        *len = 0;
+        if (!sr_rx_pending(rx)) {
+                if ((cmd = sr_rx_parse(*data, *left, len))) {
+                        *data += *len;
+                        *left -= *len;
+                        rx->commands++;
+                        return cmd;
+                }
+                if (*len < 0) return 0;
+        }
+        while (*left) {
+                took = sr_rx_append(rx, *data, *left);
+                *data += took;
+                *left -= took;
+                if ((cmd = sr_rx_next(rx, len)) || *len < 0) return cmd;
+                if (!took) break;
+        }
+        return 0;
+}
+
+void sr_rx_print_stats(struct sr_rx* rx)
+{
+        assert(rx);
+        printf("RX: %lu commands in %lu reads (%.1f per read), %llu bytes, %lu partial commands moved\n",
+                rx->commands, rx->reads,
+                rx->reads ? (double) rx->commands / rx->reads : 0.0,
+                rx->bytes, rx->moves);
+}
@@ -0,0 +1,61 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * receive buffer for the connection to the VNS server
+ *
+ * rather than two or more syscalls per command (one for the length and
+ * then the body) the socket is read in big chunks and every complete
+ * command in the chunk is parsed out where it sits. commands are handed
+ * out as pointers into the buffer so packets reach sr_handlepacket without
+ * being copied.
+ *
+ * data lives between head (first byte not parsed yet) and tail (end of
+ * what has been received). when there is no longer room after tail for a
+ * whole command the unparsed bytes, never more than one partial command,
+ * are moved back to the start of the buffer. a command returned by
+ * sr_rx_next stays put until the next sr_rx_fill.
+ *
+ * when the stream arrives in someone else's buffers instead (io_uring's
+ * provided buffers, see sr_uring.h) sr_rx_next_from parses each chunk
+ * where it is and only the commands cut in two by the end of a chunk are
+ * copied here to be put back together.
+ */
+#ifndef SR_RX_H
+#define SR_RX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "vnscommand.h"
+
+/** size of the receive buffer: room for a batch of the largest commands */
+#ifndef SR_RX_SIZE
+#define SR_RX_SIZE (16 * VNSCMDSIZE)
+#endif
+
+/** room for any reply the ip code builds from a smaller frame: an icmp error is 74 bytes (see struct sr_fwd) */
+#define SR_RX_SPILL 128
+
+struct sr_rx
+{
+        uint8_t buf[SR_RX_SIZE];
+        size_t head;            /** next byte to parse */
+        size_t tail;            /** end of the data received so far */
+        unsigned long reads;    /** recv calls that returned data */
+        unsigned long commands; /** complete commands parsed */
+        unsigned long long bytes;
+        unsigned long moves;    /** times a partial command was moved to the front */
+};
+
+/** @return bytes received but not parsed yet */
+static inline size_t sr_rx_pending(const struct sr_rx* rx)
+{
+        return rx->tail - rx->head;
+}
+
+void sr_rx_init(struct sr_rx* rx);
+int sr_rx_fill(struct sr_rx* rx, int fd);
+uint8_t* sr_rx_next(struct sr_rx* rx, int* len);
+uint8_t* sr_rx_next_from(struct sr_rx* rx, uint8_t** data, size_t* left, int* len);
+void sr_rx_print_stats(struct sr_rx* rx);
+
+#endif
@@ -0,0 +1,368 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * TAP backend: see sr_tap.h
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_tun.h>
+#include "sr_router.h"
+#include "sr_io.h"
+#include "sr_tap.h"
+
+#define SR_TAP_DEV "/dev/net/tun"
+
+/** attach one more queue to the device: @return its file descriptor or -1 */
+static int sr_tap_attach(const char* name, int multi)
+{
+        struct ifreq ifr;
+        int fd;
+
+        if ((fd = open(SR_TAP_DEV, O_RDWR | O_NONBLOCK | O_CLOEXEC)) == -1) {
+                perror("open(" SR_TAP_DEV "):sr_tap.c::sr_tap_attach");
+                return -1;
+        }
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+        ifr.ifr_flags = IFF_TAP | IFF_NO_PI | (multi ? IFF_MULTI_QUEUE : 0);
+        if (ioctl(fd, TUNSETIFF, &ifr) == -1) {
+                if (!multi) perror("ioctl(TUNSETIFF):sr_tap.c::sr_tap_attach");
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+/**
+ * open the device called name with a queue for each of queues workers,
+ * or just the one if there are none or the kernel won't have more
+ * @return 0 or -1
+ */
+static int sr_tap_device(struct sr_tap_if* t, const char* name, int queues)
+{
+        strncpy(t->name, name, sr_IFACE_NAMELEN - 1);
+        t->nqueues = 0;
+        while (t->nqueues < queues && (t->fds[t->nqueues] = sr_tap_attach(name, 1)) != -1) t->nqueues++;
+        if ((t->multi = t->nqueues > 0)) return 0;
+
+        /* no multiqueue support, or the device already exists without it */
+        if (queues) fprintf(stderr, "TAP: %s can't be multiqueue: it gets one queue\n", name);
+        if ((t->fds[0] = sr_tap_attach(name, 0)) == -1) return -1;
+        t->nqueues = 1;
+        return 0;
+}
+
+/**
+ * the queues every device has: what workers there can be, or none if a
+ * device isn't multiqueue. queues past that are closed so the kernel
+ * doesn't send flows to them
+ */
+static void sr_tap_queues(struct sr_tap* tap, int want)
+{
+        struct sr_tap_if* t;
+        int i, n = want;
+
+        for (i = 0; i < tap->nifs; i++) {
+                t = &tap->ifs[i];
+                if (!t->multi) n = 0;
+                else if (t->nqueues < n) n = t->nqueues;
+        }
+        tap->nqueues = n ? n : 1;
+        for (i = 0; i < tap->nifs; i++) {
+                t = &tap->ifs[i];
+                while (t->nqueues > tap->nqueues) close(t->fds[--t->nqueues]);
+        }
+        tap->nq = n ? n + 1 : 1;
+}
+
+/**
+ * create (or attach to) a TAP device for each name=address in ifnames
+ * the router's hardware address on each is 02:00 followed by its ip address
+ */
+static int sr_tap_open(struct sr_instance* sr, const char* ifnames)
+{
+        struct sr_tap* tap;
+        struct in_addr ip;
+        unsigned char mac[ETHER_ADDR_LEN];
+        char *list, *name, *addr, *save;
+        int i;
+
+        assert(sr);
+        if (!ifnames) {
+                fprintf(stderr, "TAP: give each interface an address: -i eth0=10.0.1.1,eth1=10.0.2.1\n");
+                return -1;
+        }
+        if (sr->pipe.want < 0 || sr->pipe.want > SR_TAP_QUEUES) {
+                fprintf(stderr, "TAP: %d workers: there can be 1 to %d\n", sr->pipe.want, SR_TAP_QUEUES);
+                return -1;
+        }
+        /* only a TAP router has one */
+        if (!sr->tap && !(sr->tap = calloc(1, sizeof(*sr->tap)))) {
+                perror("calloc(..):sr_tap.c::sr_tap_open");
+                return -1;
+        }
+        tap = sr->tap;
+        if (!(list = strdup(ifnames))) return -1;
+        for (name = strtok_r(list, ",", &save); name; name = strtok_r(0, ",", &save)) {
+                if (!(addr = strchr(name, '=')) || !inet_aton(addr + 1, &ip)) {
+                        fprintf(stderr, "TAP: %s should look like eth0=10.0.1.1\n", name);
+                        free(list);
+                        return -1;
+                }
+                *addr = '\0';
+                if (tap->nifs == SR_TAP_MAXIF) {
+                        fprintf(stderr, "TAP: skipping %s: only %d interfaces are supported\n",
+                                name, SR_TAP_MAXIF);
+                        continue;
+                }
+                mac[0] = 0x02;
+                mac[1] = 0x00;
+                memcpy(mac + 2, &ip.s_addr, 4);
+                if (sr_io_add_interface(sr, name, mac, ip.s_addr) == -1) continue;
+
+                if (sr_tap_device(&tap->ifs[tap->nifs], name, sr->pipe.want) == -1) {
+                        free(list);
+                        return -1;
+                }
+                tap->nifs++;
+        }
+        free(list);
+
+        if (tap->nifs == 0) {
+                fprintf(stderr, "TAP: no usable interfaces\n");
+                return -1;
+        }
+        sr_tap_queues(tap, sr->pipe.want);
+        if (!(tap->q = calloc(tap->nq, sizeof(struct sr_tap_queue)))) {
+                perror("calloc(..):sr_tap.c::sr_tap_open");
+                return -1;
+        }
+        for (i = 0; i < tap->nq; i++) {
+                tap->q[i].queue = i ? i - 1 : 0;
+                tap->q[i].epfd = -1;
+        }
+        sr_arp_update_templates(sr);
+        printf("TAP: Router interfaces:\n");
+        sr_print_if_list(sr);
+        return 0;
+}
+
+/** the queue state of the thread we are on */
+static inline struct sr_tap_queue* sr_tap_self(struct sr_instance* sr)
+{
+        return &sr->tap->q[sr_pipe_self ? sr_pipe_self->id + 1 : 0];
+}
+
+/** read and handle a burst of frames from q's queue of device dev: @return frames */
+static int sr_tap_read(struct sr_instance* sr, struct sr_tap_queue* q, int dev)
+{
+        struct sr_tap_if* t = &sr->tap->ifs[dev];
+        ssize_t len;
+        int burst, n = 0;
+
+        for (burst = 0; burst < SR_TAP_BURST; burst++) {
+                len = read(t->fds[q->queue], q->rx, SR_TAP_FRAME);
+                if (len == -1) {
+                        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                                perror("read(..):sr_tap.c::sr_tap_read");
+                        break;
+                }
+                if (len < sizeof(struct sr_ethernet_hdr)) continue;
+                n++;
+                sr_log_packet(sr, q->rx, len);
+                /* an arp reply may be for another worker: see sr_pipe.h */
+                if (sr_pipe_self) sr_pipe_share(sr, q->rx, len, t->name);
+                sr_handlepacket(sr, q->rx, len, t->name);
+        }
+        if (burst) q->rx_reads[dev]++;
+        q->rx_frames[dev] += n;
+        return n;
+}
+
+/** event loop callback: the main thread's one queue of a device */
+static void sr_tap_event(struct sr_instance* sr, int fd, uint32_t events, void* arg)
+{
+        struct sr_tap_if* t = arg;
+
+        sr_timer_clock(&sr_fwd(sr)->timers);
+        sr_tap_read(sr, &sr->tap->q[0], t - sr->tap->ifs);
+}
+
+/** pipe worker: a burst from each of its queues */
+static int sr_tap_poll(struct sr_instance* sr)
+{
+        struct sr_tap_queue* q = sr_tap_self(sr);
+        int i, n = 0;
+
+        for (i = 0; i < sr->tap->nifs; i++) n += sr_tap_read(sr, q, i);
+        return n;
+}
+
+/** pipe worker: sleep until one of its queues has frames */
+static void sr_tap_wait(struct sr_instance* sr, int ms)
+{
+        struct epoll_event ev[SR_TAP_MAXIF];
+
+        epoll_wait(sr_tap_self(sr)->epfd, ev, SR_TAP_MAXIF, ms);
+}
+
+/** write out this thread's transmit queue, each frame on its own queue of the device */
+static int sr_tap_flush(struct sr_instance* sr)
+{
+        struct sr_tap_queue* q = sr_tap_self(sr);
+        struct sr_tap_frame* f;
+        int i;
+
+        for (i = 0; i < q->txq; i++) {
+                f = &q->tx[i];
+                if (write(sr->tap->ifs[f->dev].fds[q->queue], f->data, f->len) != f->len) q->tx_dropped[f->dev]++;
+                else q->tx_frames[f->dev]++;
+        }
+        if (q->txq) q->flushes++;
+        q->txq = 0;
+        return 0;
+}
+
+/** copy a frame to this thread's transmit queue, flushing first if it is full */
+static int sr_tap_send(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface)
+{
+        struct sr_tap_queue* q = sr_tap_self(sr);
+        struct sr_tap_frame* f;
+        int i;
+
+        if (len > SR_TAP_FRAME) {
+                fprintf(stderr, "TAP: frame is too long (%u bytes)\n", len);
+                return -1;
+        }
+        if (q->txq == SR_TAP_TXQ) sr_tap_flush(sr);
+
+        f = &q->tx[q->txq];
+        for (i = 0; i < sr->tap->nifs; i++) {
+                if (strcmp(sr->tap->ifs[i].name, iface) == 0) break;
+        }
+        if (i == sr->tap->nifs) {
+                fprintf(stderr, "TAP: no device for interface %s\n", iface);
+                return -1;
+        }
+        f->dev = i;
+        f->len = len;
+        memcpy(f->data, frame, len);
+        q->txq++;
+        return 0;
+}
+
+/** a pipe worker for each queue: they read their own, see sr_pipe.h */
+static int sr_tap_start_workers(struct sr_instance* sr)
+{
+        struct sr_tap* tap = sr->tap;
+        struct sr_tap_queue* q;
+        struct epoll_event ev;
+        int i, k;
+
+        for (k = 1; k < tap->nq; k++) {
+                q = &tap->q[k];
+                if ((q->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+                        perror("epoll_create1(..):sr_tap.c::sr_tap_start_workers");
+                        return -1;
+                }
+                for (i = 0; i < tap->nifs; i++) {
+                        memset(&ev, 0, sizeof(ev));
+                        ev.events = EPOLLIN;
+                        ev.data.u32 = i;
+                        if (epoll_ctl(q->epfd, EPOLL_CTL_ADD, tap->ifs[i].fds[q->queue], &ev) == -1) {
+                                perror("epoll_ctl(..):sr_tap.c::sr_tap_start_workers");
+                                return -1;
+                        }
+                }
+        }
+        sr->pipe.want = tap->nqueues;
+        sr->pipe.poll = sr_tap_poll;
+        sr->pipe.wait = sr_tap_wait;
+        if (sr_pipe_init(sr) == -1) return -1;
+        printf("TAP: %d queues on each device\n", tap->nqueues);
+        /* the first worker sends the arp requests */
+        return sr_pipe_run(sr, 0);
+}
+
+static int sr_tap_start(struct sr_instance* sr)
+{
+        struct sr_tap_if* t;
+        int i;
+
+        if (sr->tap->nq > 1) return sr_tap_start_workers(sr);
+        for (i = 0; i < sr->tap->nifs; i++) {
+                t = &sr->tap->ifs[i];
+                if (sr_event_add(sr, t->fds[0], EPOLLIN, sr_tap_event, t) == -1) return -1;
+        }
+        printf("TAP: Sending arp broadcasts on each interface\n");
+        sr_arp_scan(sr);
+        return sr_tap_flush(sr);
+}
+
+static void sr_tap_close(struct sr_instance* sr)
+{
+        struct sr_tap* tap = sr->tap;
+        int i, k;
+
+        if (!tap) return;
+        /* the workers write to the queues: they go first */
+        sr_pipe_close(sr);
+        if (sr->pipe.workers) sr_pipe_free(sr);
+        for (i = 0; i < tap->nifs; i++) {
+                for (k = 0; k < tap->ifs[i].nqueues; k++) close(tap->ifs[i].fds[k]);
+        }
+        for (k = 0; k < tap->nq && tap->q; k++) {
+                if (tap->q[k].epfd != -1) close(tap->q[k].epfd);
+        }
+        free(tap->q);
+        free(tap);
+        sr->tap = 0;
+}
+
+static void sr_tap_print_stats(struct sr_instance* sr)
+{
+        struct sr_tap* tap = sr->tap;
+        struct sr_tap_queue* q;
+        unsigned long rx_frames, rx_reads, tx_frames, tx_dropped, flushes = 0;
+        int i, k;
+
+        if (!tap || !tap->q) return;
+        for (i = 0; i < tap->nifs; i++) {
+                rx_frames = rx_reads = tx_frames = tx_dropped = 0;
+                for (k = 0; k < tap->nq; k++) {
+                        q = &tap->q[k];
+                        rx_frames += q->rx_frames[i];
+                        rx_reads += q->rx_reads[i];
+                        tx_frames += q->tx_frames[i];
+                        tx_dropped += q->tx_dropped[i];
+                }
+                printf("TAP: %s %d queue%s, rx %lu frames in %lu bursts (%.1f per burst); "
+                        "tx %lu frames, %lu dropped\n",
+                        tap->ifs[i].name, tap->nqueues, tap->nqueues == 1 ? "" : "s",
+                        rx_frames, rx_reads, rx_reads ? (double) rx_frames / rx_reads : 0.0,
+                        tx_frames, tx_dropped);
+        }
+        for (k = 0; k < tap->nq; k++) flushes += tap->q[k].flushes;
+        printf("TAP: %lu transmit flushes\n", flushes);
+        if (sr->pipe.workers) sr_pipe_print_stats(sr);
+}
+
+const struct sr_io sr_tap_io = {
+        "tap",
+        sr_tap_open,
+        sr_tap_start,
+        sr_tap_send,
+        sr_tap_flush,
+        sr_tap_close,
+        sr_tap_print_stats
+};
@@ -0,0 +1,85 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * TAP backend (see sr_io.h)
+ *
+ * each router interface is a TAP device of the same name. the router is
+ * the "wire" end: frames the kernel sends out of the TAP are read from its
+ * file descriptor and frames the router sends are written to it, so the
+ * kernel side behaves like a host plugged into that router port. this
+ * makes it possible to run ping and traceroute through sr on one machine
+ * with no VNS server (see sr_netns.sh).
+ *
+ * the kernel knows nothing about the router's own addresses so they are
+ * given on the command line: -B tap -i eth0=10.0.1.1,eth1=10.0.2.1. the
+ * hardware address of each port is made up from its ip address.
+ *
+ * with -W workers devices are opened with IFF_MULTI_QUEUE and a file
+ * descriptor, a queue, is attached to each for every pipe worker
+ * (sr_pipe.h). the kernel spreads flows over the queues and each worker
+ * reads and writes its own, so as many cores serve the devices. if the
+ * kernel won't have IFF_MULTI_QUEUE, or a device already exists without
+ * it, each device gets one queue read by the event loop as without -W.
+ *
+ * reads are done in bursts of up to SR_TAP_BURST frames per queue per
+ * wakeup. a TAP takes one frame per write so frames to send are copied to
+ * the transmit queue of the thread sending them and written back to back
+ * at the end of its batch.
+ */
+#ifndef SR_TAP_H
+#define SR_TAP_H
+
+#include <stdint.h>
+#include "sr_if.h"
+
+#define SR_TAP_MAXIF 8
+/** queues per device: one for each pipe worker, as SR_PIPE_MAXWORKERS */
+#define SR_TAP_QUEUES 16
+/** frames read from one queue per wakeup */
+#define SR_TAP_BURST 32
+/** largest frame: an ethernet frame with room to spare for a bigger mtu */
+#define SR_TAP_FRAME 2048
+/** frames waiting to be written */
+#define SR_TAP_TXQ 256
+
+struct sr_tap_if
+{
+        char name[sr_IFACE_NAMELEN];
+        int fds[SR_TAP_QUEUES];         /** a file descriptor per queue */
+        int nqueues;
+        int multi;                      /** opened with IFF_MULTI_QUEUE */
+};
+
+struct sr_tap_frame
+{
+        int dev;                        /** index into ifs */
+        unsigned int len;
+        uint8_t data[SR_TAP_FRAME];
+};
+
+/** what one thread reads and writes with: the main thread's or a worker's */
+struct sr_tap_queue
+{
+        int queue;                      /** which of each device's fds it uses */
+        int epfd;                       /** a worker waits on its fds here */
+        uint8_t rx[SR_TAP_FRAME];       /** frame being handled */
+        struct sr_tap_frame tx[SR_TAP_TXQ];
+        int txq;                        /** frames in tx */
+        unsigned long flushes;
+        /* per device */
+        unsigned long rx_frames[SR_TAP_MAXIF];
+        unsigned long rx_reads[SR_TAP_MAXIF]; /** wakeups that found at least one frame */
+        unsigned long tx_frames[SR_TAP_MAXIF];
+        unsigned long tx_dropped[SR_TAP_MAXIF]; /** write failed, eg the device is down */
+};
+
+struct sr_tap
+{
+        struct sr_tap_if ifs[SR_TAP_MAXIF];
+        int nifs;
+        int nqueues;                    /** on every device */
+        struct sr_tap_queue* q;         /** [0] the main thread's, [1 + id] pipe worker id's */
+        int nq;
+};
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * hierarchical timer wheel: see sr_timer.h
+ */
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include "sr_router.h"
+#include "sr_timer.h"
+
+/**
+ * the pipe worker this thread is, see sr_pipe.h. it lives here with
+ * sr_timer_run, which finds its wheel through sr_fwd(), so whatever links
+ * the timers without sr_pipe.c (the route benchmarks) has it as well
+ */
+__thread struct sr_worker* sr_pipe_self;
+
+/**
+ * refresh the cached clock
+ * @return milliseconds on the monotonic clock
+ */
+uint64_t sr_timer_clock(struct sr_timer_wheel* w)
+{
+        struct timespec ts;
+
+        assert(w);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        w->now = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+        return w->now;
+}
+
+/**
+ * empty the wheel and start it at the current time
+ */
+void sr_timer_init(struct sr_timer_wheel* w)
+{
+        assert(w);
+        memset(w, 0, sizeof(struct sr_timer_wheel));
+        w->tick = sr_timer_clock(w) / SR_TIMER_TICK_MS;
+}
+
+/**
+ * put a timer into the slot matching how far away it is. one due on the
+ * current tick goes in the level 0 slot sr_timer_run is about to run
+ */
+static void sr_timer_link(struct sr_timer_wheel* w, struct sr_timer* t)
+{
+        struct sr_timer** slot;
+        uint64_t delta;
+        int level;
+
+        assert(t->expires >= w->tick);
+        delta = t->expires - w->tick;
+
+        for (level = 0; level < SR_TIMER_LEVELS - 1; level++) {
+                if (delta < (uint64_t) 1 << (SR_TIMER_BITS * (level + 1))) break;
+        }
+        if (level == SR_TIMER_LEVELS - 1 &&
+            delta >= (uint64_t) 1 << (SR_TIMER_BITS * SR_TIMER_LEVELS)) {
+                /* further out than the wheel reaches: park it at the far end */
+                t->expires = w->tick + ((uint64_t) 1 << (SR_TIMER_BITS * SR_TIMER_LEVELS)) - 1;
+        }
+
+        slot = &w->slots[level][ (t->expires >> (SR_TIMER_BITS * level)) & SR_TIMER_MASK ];
+        t->next = *slot;
+        if (t->next) t->next->pprev = &t->next;
+        t->pprev = slot;
+        *slot = t;
+}
+
+static void sr_timer_unlink(struct sr_timer* t)
+{
+        *t->pprev = t->next;
+        if (t->next) t->next->pprev = t->pprev;
+        t->next = 0;
+        t->pprev = 0;
+}
+
+/**
+ * schedule a timer to call fn at expires_ms on the monotonic clock
+ * a timer that is already scheduled is moved
+ */
+void sr_timer_add(struct sr_timer_wheel* w, struct sr_timer* t, sr_timer_fn fn, uint64_t expires_ms)
+{
+        assert(w);
+        assert(t);
+        assert(fn);
+
+        if (sr_timer_pending(t)) sr_timer_unlink(t);
+        else w->pending++;
+        t->fn = fn;
+        t->expires = expires_ms / SR_TIMER_TICK_MS;
+        /* not in the past, nor on a tick that may be being run now */
+        if (t->expires <= w->tick) t->expires = w->tick + 1;
+        sr_timer_link(w, t);
+}
+
+void sr_timer_cancel(struct sr_timer_wheel* w, struct sr_timer* t)
+{
+        assert(w);
+        assert(t);
+
+        if (!sr_timer_pending(t)) return;
+        sr_timer_unlink(t);
+        w->pending--;
+}
+
+/** move the timers in a slot of a higher level down to where they belong now */
+static void sr_timer_cascade(struct sr_timer_wheel* w, int level)
+{
+        struct sr_timer** slot,* t;
+
+        slot = &w->slots[level][ (w->tick >> (SR_TIMER_BITS * level)) & SR_TIMER_MASK ];
+        while ((t = *slot)) {
+                sr_timer_unlink(t);
+                sr_timer_link(w, t);
+        }
+}
+
+/**
+ * catch the wheel up with the clock and run everything that is due
+ * called once per pass of the main loop
+ */
+void sr_timer_run(struct sr_instance* sr)
+{
+        struct sr_timer_wheel* w;
+        struct sr_timer** slot,* t;
+        uint64_t target;
+        int level;
+
+        assert(sr);
+        w = &sr_fwd(sr)->timers;
+        target = sr_timer_clock(w) / SR_TIMER_TICK_MS;
+
+        while (w->tick < target) {
+                if (!w->pending) {
+                        /* nothing to do: skip straight to now */
+                        w->tick = target;
+                        break;
+                }
+                w->tick++;
+                for (level = 1; level < SR_TIMER_LEVELS; level++) {
+                        if ((w->tick >> (SR_TIMER_BITS * (level - 1))) & SR_TIMER_MASK) break;
+                        sr_timer_cascade(w, level);
+                }
+                slot = &w->slots[0][ w->tick & SR_TIMER_MASK ];
+                while ((t = *slot)) {
+                        sr_timer_unlink(t);
+                        w->pending--;
+                        w->fired++;
+                        /* the callback is free to reschedule or free t */
+                        t->fn(sr, t);
+                }
+        }
+}
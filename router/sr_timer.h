@@ -0,0 +1,74 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * hierarchical timer wheel
+ *
+ * things that need to happen later (arp refreshes, dropping buffered
+ * packets) embed a struct sr_timer and schedule it on the router's wheel.
+ * time is counted in ticks of SR_TIMER_TICK_MS from a monotonic clock that
+ * is read once per pass of the main loop and cached in the wheel.
+ *
+ * the wheel has SR_TIMER_LEVELS levels of SR_TIMER_SLOTS slots each: level
+ * 0 holds timers due in the next SR_TIMER_SLOTS ticks, each higher level
+ * covers SR_TIMER_SLOTS times as long and is cascaded down a level as its
+ * slots come due. adding and cancelling are O(1) and the work done per
+ * tick depends on the number of timers expiring, not the number pending.
+ */
+#ifndef SR_TIMER_H
+#define SR_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** milliseconds per tick */
+#define SR_TIMER_TICK_MS 100
+#define SR_TIMER_BITS 6
+#define SR_TIMER_SLOTS (1 << SR_TIMER_BITS)
+#define SR_TIMER_MASK (SR_TIMER_SLOTS - 1)
+/** 4 levels of 64 slots at 100ms cover about 19 days */
+#define SR_TIMER_LEVELS 4
+
+struct sr_instance;
+struct sr_timer;
+
+typedef void (*sr_timer_fn)(struct sr_instance*, struct sr_timer*);
+
+struct sr_timer
+{
+        struct sr_timer* next;
+        struct sr_timer** pprev; /** 0 when the timer is not scheduled */
+        uint64_t expires;        /** tick the timer is due on */
+        sr_timer_fn fn;          /** called once when the timer expires */
+};
+
+struct sr_timer_wheel
+{
+        struct sr_timer* slots[SR_TIMER_LEVELS][SR_TIMER_SLOTS];
+        uint64_t tick;           /** last tick that has been run */
+        uint64_t now;            /** cached monotonic clock in ms */
+        unsigned long pending;   /** timers scheduled */
+        unsigned long fired;     /** timers run so far */
+};
+
+/** get the structure a timer is embedded in */
+#define sr_timer_entry(t, type, member) \
+        ((type*)((char*)(t) - offsetof(type, member)))
+
+static inline int sr_timer_pending(struct sr_timer* t)
+{
+        return t->pprev != 0;
+}
+
+/** the cached clock: only changes when sr_timer_clock is called */
+static inline uint64_t sr_timer_now(struct sr_timer_wheel* w)
+{
+        return w->now;
+}
+
+void sr_timer_init(struct sr_timer_wheel* w);
+uint64_t sr_timer_clock(struct sr_timer_wheel* w);
+void sr_timer_add(struct sr_timer_wheel* w, struct sr_timer* t, sr_timer_fn fn, uint64_t expires_ms);
+void sr_timer_cancel(struct sr_timer_wheel* w, struct sr_timer* t);
+void sr_timer_run(struct sr_instance* sr);
+
+#endif
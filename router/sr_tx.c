@@ -0,0 +1,236 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * batched writev transmit queue for the VNS connection: see sr_tx.h
+ */
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "sr_tx.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+void sr_tx_init(struct sr_tx* tx)
+{
+        assert(tx);
+        tx->frames = 0;
+        tx->staged = 0;
+        tx->sent = tx->copied = tx->writes = tx->partial = 0;
+        tx->backlog = 0;
+        tx->head = tx->tail = 0;
+        tx->held = tx->dropped = 0;
+}
+
+/**
+ * add a frame to the queue: the caller makes sure it is not full
+ * @param copy non zero if frame may change before the next flush
+ */
+void sr_tx_queue(struct sr_tx* tx, const uint8_t* frame, unsigned int len, const char* iface, int copy)
+{
+        c_packet_header* hdr;
+        struct iovec* iov;
+
+        assert(tx);
+        assert(frame);
+        assert(!sr_tx_full(tx, len, copy));
+
+        hdr = &tx->hdr[tx->frames];
+        hdr->mLen = htonl(len + sizeof(c_packet_header));
+        hdr->mType = htonl(VNSPACKET);
+        strncpy(hdr->mInterfaceName, iface, sizeof(hdr->mInterfaceName));
+
+        if (copy) {
+                memcpy(tx->stage + tx->staged, frame, len);
+                frame = tx->stage + tx->staged;
+                tx->staged += len;
+                tx->copied++;
+        }
+
+        iov = &tx->iov[2 * tx->frames];
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = sizeof(c_packet_header);
+        iov[1].iov_base = (void*) frame;
+        iov[1].iov_len = len;
+        tx->frames++;
+}
+
+/** wait for room in the socket if it is non blocking */
+static int sr_tx_wait(int fd)
+{
+        struct pollfd p;
+
+        p.fd = fd;
+        p.events = POLLOUT;
+        while (poll(&p, 1, -1) == -1) {
+                if (errno != EINTR) return -1;
+        }
+        return 0;
+}
+
+/**
+ * write what is in the backlog
+ * @return 0 once it is all written or the socket is full, -1 on error
+ */
+static int sr_tx_write_backlog(struct sr_tx* tx, int fd, int wait)
+{
+        ssize_t w;
+
+        while (sr_tx_backlog(tx)) {
+                w = write(fd, tx->backlog + tx->head, sr_tx_backlog(tx));
+                if (w == -1) {
+                        if (errno == EINTR) continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                if (!wait) return 0;
+                                if (sr_tx_wait(fd) == 0) continue;
+                        }
+                        perror("write(..):sr_tx.c::sr_tx_write_backlog");
+                        return -1;
+                }
+                tx->writes++;
+                if (w < sr_tx_backlog(tx)) tx->partial++;
+                tx->head += w;
+        }
+        tx->head = tx->tail = 0;
+        return 0;
+}
+
+/**
+ * copy the queue from iov on, the first frame maybe part written, into the
+ * backlog: that one always fits, the frames after it while there is room
+ * @return 0 or -1 if there is no memory for the backlog
+ */
+static int sr_tx_hold(struct sr_tx* tx, struct iovec* iov, int niov)
+{
+        int i = iov - tx->iov, end = i + niov, n;
+        size_t len;
+
+        if (!tx->backlog && !(tx->backlog = malloc(SR_TX_BACKLOG))) {
+                perror("malloc(..):sr_tx.c::sr_tx_hold");
+                return -1;
+        }
+        if (tx->head) {
+                memmove(tx->backlog, tx->backlog + tx->head, sr_tx_backlog(tx));
+                tx->tail -= tx->head;
+                tx->head = 0;
+        }
+        while (i < end) {
+                /* a frame's header and frame iovecs, or what is left of the frame */
+                n = i % 2 == 0 ? 2 : 1;
+                len = tx->iov[i].iov_len + (n == 2 ? tx->iov[i + 1].iov_len : 0);
+                if (tx->tail + len > SR_TX_BACKLOG) {
+                        tx->dropped += (end - i + 1) / 2;
+                        break;
+                }
+                memcpy(tx->backlog + tx->tail, tx->iov[i].iov_base, tx->iov[i].iov_len);
+                tx->tail += tx->iov[i].iov_len;
+                if (n == 2) {
+                        memcpy(tx->backlog + tx->tail, tx->iov[i + 1].iov_base, tx->iov[i + 1].iov_len);
+                        tx->tail += tx->iov[i + 1].iov_len;
+                }
+                i += n;
+        }
+        tx->held++;
+        return 0;
+}
+
+/** the backlog, then everything queued: with wait set until it is all written */
+static int sr_tx_write(struct sr_tx* tx, int fd, int wait)
+{
+        struct iovec* iov = tx->iov;
+        int niov = 2 * tx->frames, n, i, ret = 0;
+        unsigned long dropped = tx->dropped;
+        size_t offered;
+        ssize_t w;
+
+        assert(tx);
+        if (sr_tx_backlog(tx) && sr_tx_write_backlog(tx, fd, wait) == -1) {
+                ret = -1;
+                niov = 0;
+        }
+        /* still no room: the queue goes behind what is waiting */
+        if (niov && sr_tx_backlog(tx)) {
+                ret = sr_tx_hold(tx, iov, niov);
+                niov = 0;
+        }
+        while (niov) {
+                n = niov < IOV_MAX ? niov : IOV_MAX;
+                w = writev(fd, iov, n);
+                if (w == -1) {
+                        if (errno == EINTR) continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                                if (!wait) {
+                                        ret = sr_tx_hold(tx, iov, niov);
+                                        break;
+                                }
+                                if (sr_tx_wait(fd) == 0) continue;
+                        }
+                        perror("writev(..):sr_tx.c::sr_tx_flush");
+                        ret = -1;
+                        break;
+                }
+                tx->writes++;
+                for (offered = 0, i = 0; i < n; i++) offered += iov[i].iov_len;
+                if (w < offered) tx->partial++;
+
+                /* drop what was written, then trim the iovec that was cut short */
+                while (niov && w >= (ssize_t) iov->iov_len) {
+                        w -= iov->iov_len;
+                        iov++;
+                        niov--;
+                }
+                if (w) {
+                        iov->iov_base = (uint8_t*) iov->iov_base + w;
+                        iov->iov_len -= w;
+                }
+        }
+        if (ret == 0) tx->sent += tx->frames - (tx->dropped - dropped);
+        else tx->head = tx->tail = 0;
+        tx->frames = 0;
+        tx->staged = 0;
+        return ret;
+}
+
+/**
+ * write what the socket has room for and keep the rest in the backlog
+ * (see sr_tx.h): the caller waits for room while sr_tx_backlog is non zero
+ * @return 0 on success, -1 if the connection failed (the queue is emptied)
+ */
+int sr_tx_flush(struct sr_tx* tx, int fd)
+{
+        return sr_tx_write(tx, fd, 0);
+}
+
+/**
+ * write everything, waiting for room in the socket for as long as it takes
+ * @return 0 on success, -1 if the connection failed (the queue is emptied)
+ */
+int sr_tx_drain(struct sr_tx* tx, int fd)
+{
+        return sr_tx_write(tx, fd, 1);
+}
+
+void sr_tx_close(struct sr_tx* tx)
+{
+        assert(tx);
+        free(tx->backlog);
+        tx->backlog = 0;
+        tx->head = tx->tail = 0;
+}
+
+void sr_tx_print_stats(struct sr_tx* tx)
+{
+        assert(tx);
+        printf("TX: %lu frames in %lu writes (%.1f per write), %lu copied, %lu short writes, "
+               "%lu flushes left a backlog, %lu frames dropped for want of room\n",
+                tx->sent, tx->writes,
+                tx->writes ? (double) tx->sent / tx->writes : 0.0,
+                tx->copied, tx->partial, tx->held, tx->dropped);
+}
@@ -0,0 +1,83 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * transmit queue for the connection to the VNS server
+ *
+ * sr_send_packet used to copy each frame behind a VNSPACKET header on the
+ * stack and write it on its own. now frames are queued while a batch of
+ * commands (or a round of timers) is handled and the whole queue goes out
+ * in one writev: each frame is a header iovec followed by an iovec
+ * pointing at the frame itself.
+ *
+ * a frame can only be pointed at if it will not change before the flush.
+ * frames sitting in the receive buffer (sr_rx.h) qualify since that is not
+ * touched until the next recv, which always comes after a flush. anything
+ * else (arp requests built on the stack, buffered packets whose slot may
+ * be reused, the spill frame) is copied into the staging area.
+ *
+ * the socket is non blocking and sr_tx_flush never waits for it: one
+ * router must not hold up the others sharing its thread (sr_multi.h).
+ * what the socket has no room for, from the middle of a frame on, is
+ * copied into the backlog, since the frames pointed at won't stay put, and
+ * goes out first on the next flush. the caller watches for room (EPOLLOUT)
+ * while sr_tx_backlog says there is some and reads no more meanwhile, so
+ * the server slows us down as a blocking write used to. frames queued in
+ * the meantime join the backlog while it has room and are dropped after
+ * that, like a full link. the backlog is only allocated the first time a
+ * socket is full. sr_tx_drain waits instead, for threads of their own.
+ */
+#ifndef SR_TX_H
+#define SR_TX_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include "vnscommand.h"
+
+/** frames queued before sr_send_packet forces a flush */
+#ifndef SR_TX_FRAMES
+#define SR_TX_FRAMES 128
+#endif
+
+/** bytes for frames that have to be copied */
+#define SR_TX_STAGE (8 * VNSCMDSIZE)
+/** bytes kept for a socket with no room: more than a queue of full size ethernet frames */
+#define SR_TX_BACKLOG (256 << 10)
+
+struct sr_tx
+{
+        c_packet_header hdr[SR_TX_FRAMES];
+        struct iovec iov[2 * SR_TX_FRAMES];
+        int frames;             /** frames queued */
+        size_t staged;          /** bytes of stage in use */
+        uint8_t stage[SR_TX_STAGE];
+        unsigned long sent;     /** frames written or in the backlog */
+        unsigned long copied;   /** frames that went through stage */
+        unsigned long writes;   /** writev calls */
+        unsigned long partial;  /** writev calls that took less than offered */
+        uint8_t* backlog;       /** SR_TX_BACKLOG bytes once a socket has been full */
+        size_t head;            /** next byte of backlog to write */
+        size_t tail;            /** end of the bytes waiting in backlog */
+        unsigned long held;     /** flushes that left bytes in backlog */
+        unsigned long dropped;  /** frames there was no room for in backlog */
+};
+
+/** @return 1 if there is no room for another frame of len bytes */
+static inline int sr_tx_full(const struct sr_tx* tx, unsigned int len, int copy)
+{
+        return tx->frames == SR_TX_FRAMES || (copy && tx->staged + len > SR_TX_STAGE);
+}
+
+/** @return bytes waiting for room in the socket */
+static inline size_t sr_tx_backlog(const struct sr_tx* tx)
+{
+        return tx->tail - tx->head;
+}
+
+void sr_tx_init(struct sr_tx* tx);
+void sr_tx_queue(struct sr_tx* tx, const uint8_t* frame, unsigned int len, const char* iface, int copy);
+int sr_tx_flush(struct sr_tx* tx, int fd);
+int sr_tx_drain(struct sr_tx* tx, int fd);
+void sr_tx_close(struct sr_tx* tx);
+void sr_tx_print_stats(struct sr_tx* tx);
+
+#endif
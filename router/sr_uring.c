@@ -0,0 +1,369 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * io_uring transport for the VNS connection: see sr_uring.h
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "sr_uring.h"
+
+/** what a completion is for */
+enum { SR_URING_RECV = 1, SR_URING_SEND, SR_URING_WAKE };
+
+#define SR_URING_BGID 0
+
+static int sr_uring_setup(unsigned int entries, struct io_uring_params* p)
+{
+        return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sr_uring_register(int fd, unsigned int op, void* arg, unsigned int nargs)
+{
+        return syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+/** @return a cleared submission entry or 0 if the queue is full */
+static struct io_uring_sqe* sr_uring_sqe(struct sr_uring* u)
+{
+        struct io_uring_sqe* sqe;
+
+        if (u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) return 0;
+        sqe = &u->sqes[u->sqe_tail & *u->sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        u->sqe_tail++;
+        return sqe;
+}
+
+/**
+ * submit what has been filled in and wait for at least wait completions
+ * @return 0 or -1 if the ring failed
+ */
+static int sr_uring_enter(struct sr_uring* u, unsigned int wait)
+{
+        unsigned int submit;
+        int ret;
+
+        __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+        do {
+                submit = u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+                u->enters++;
+                ret = syscall(__NR_io_uring_enter, u->fd, submit, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+        } while (ret == -1 && errno == EINTR);
+        if (ret == -1) {
+                perror("io_uring_enter(..):sr_uring.c::sr_uring_enter");
+                return -1;
+        }
+        return 0;
+}
+
+/** give buffer bid to the kernel to receive into */
+static void sr_uring_give(struct sr_uring* u, uint16_t bid)
+{
+        struct io_uring_buf* b = &u->br->bufs[u->br_tail & (SR_URING_BUFS - 1)];
+
+        b->addr = (uintptr_t)(u->bufs + (size_t) bid * SR_URING_BUFSIZE);
+        b->len = SR_URING_BUFSIZE;
+        b->bid = bid;
+        u->br_tail++;
+}
+
+/** hand back every buffer whose chunk has been handled */
+static void sr_uring_give_back(struct sr_uring* u)
+{
+        int i;
+
+        if (!u->nused) return;
+        for (i = 0; i < u->nused; i++) sr_uring_give(u, u->used[i]);
+        u->nused = 0;
+        __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/** @return buffers the kernel has to receive into */
+static inline int sr_uring_free(struct sr_uring* u)
+{
+        return SR_URING_BUFS - u->nready - u->nused - (u->current != -1);
+}
+
+/** post the multishot recv: it keeps going until an error or the buffers run out */
+static int sr_uring_arm(struct sr_uring* u)
+{
+        struct io_uring_sqe* sqe;
+
+        if (u->armed || u->closed || u->error) return 0;
+        if (!(sqe = sr_uring_sqe(u))) return -1;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = u->sock;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = SR_URING_BGID;
+        sqe->user_data = SR_URING_RECV;
+        u->armed = 1;
+        u->rearms++;
+        return 0;
+}
+
+/**
+ * take every completion the kernel has posted: received chunks are queued
+ * for sr_uring_recv, finished sends are counted in done
+ * @param err set to the first failed send's -errno
+ */
+static void sr_uring_reap(struct sr_uring* u, unsigned int* done, int* err)
+{
+        unsigned int head = *u->cq_head, tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        struct io_uring_cqe* cqe;
+        struct sr_uring_chunk* c;
+
+        for (; head != tail; head++) {
+                cqe = &u->cqes[head & *u->cq_mask];
+                if (cqe->user_data == SR_URING_SEND) {
+                        (*done)++;
+                        if (cqe->res < 0 && !*err) *err = cqe->res;
+                } else if (cqe->user_data == SR_URING_RECV) {
+                        if (cqe->flags & IORING_CQE_F_BUFFER) {
+                                c = &u->ready[(u->rhead + u->nready++) % SR_URING_BUFS];
+                                c->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                                c->len = cqe->res;
+                                u->chunks++;
+                                u->bytes += cqe->res;
+                        } else if (cqe->res == 0) {
+                                u->closed = 1;
+                        } else if (cqe->res == -ENOBUFS) {
+                                u->nobufs++;
+                        } else if (cqe->res < 0) {
+                                u->error = -cqe->res;
+                        }
+                        if (!(cqe->flags & IORING_CQE_F_MORE)) u->armed = 0;
+                }
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * set up a ring and receive buffers for sock and start receiving
+ * @return 0 or -1 (with errno set) if io_uring can't be used
+ */
+int sr_uring_init(struct sr_uring* u, int sock)
+{
+        struct io_uring_params p;
+        struct io_uring_buf_reg reg;
+        unsigned int* array;
+        int i, err;
+
+        assert(u);
+        memset(u, 0, sizeof(struct sr_uring));
+        u->sock = sock;
+        u->current = -1;
+
+        memset(&p, 0, sizeof(p));
+        if ((u->fd = sr_uring_setup(SR_URING_ENTRIES, &p)) == -1) return -1;
+
+        u->sq_maplen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+        u->cq_maplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                if (u->cq_maplen > u->sq_maplen) u->sq_maplen = u->cq_maplen;
+                u->cq_maplen = 0;
+        }
+        u->sq_map = mmap(0, u->sq_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                u->fd, IORING_OFF_SQ_RING);
+        if (u->sq_map == MAP_FAILED) goto fail;
+        if (u->cq_maplen) {
+                u->cq_map = mmap(0, u->cq_maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        u->fd, IORING_OFF_CQ_RING);
+                if (u->cq_map == MAP_FAILED) goto fail;
+        } else {
+                u->cq_map = u->sq_map;
+        }
+        u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+        u->sqes = mmap(0, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                u->fd, IORING_OFF_SQES);
+        if (u->sqes == MAP_FAILED) goto fail;
+
+        u->sq_head = (unsigned int*)((uint8_t*) u->sq_map + p.sq_off.head);
+        u->sq_tail = (unsigned int*)((uint8_t*) u->sq_map + p.sq_off.tail);
+        u->sq_mask = (unsigned int*)((uint8_t*) u->sq_map + p.sq_off.ring_mask);
+        u->sq_entries = p.sq_entries;
+        u->sqe_tail = *u->sq_tail;
+        /* entry i of the queue is always sqes[i] */
+        array = (unsigned int*)((uint8_t*) u->sq_map + p.sq_off.array);
+        for (i = 0; i < p.sq_entries; i++) array[i] = i;
+        u->cq_head = (unsigned int*)((uint8_t*) u->cq_map + p.cq_off.head);
+        u->cq_tail = (unsigned int*)((uint8_t*) u->cq_map + p.cq_off.tail);
+        u->cq_mask = (unsigned int*)((uint8_t*) u->cq_map + p.cq_off.ring_mask);
+        u->cqes = (struct io_uring_cqe*)((uint8_t*) u->cq_map + p.cq_off.cqes);
+
+        /* the buffer ring has to be page aligned: mmap takes care of that */
+        u->br = mmap(0, SR_URING_BUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        u->bufs = mmap(0, (size_t) SR_URING_BUFS * SR_URING_BUFSIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (u->br == MAP_FAILED || u->bufs == MAP_FAILED) goto fail;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uintptr_t) u->br;
+        reg.ring_entries = SR_URING_BUFS;
+        reg.bgid = SR_URING_BGID;
+        if (sr_uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) goto fail;
+        for (i = 0; i < SR_URING_BUFS; i++) sr_uring_give(u, i);
+        __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+
+        if (sr_uring_arm(u) == -1 || sr_uring_enter(u, 0) == -1) goto fail;
+        return 0;
+
+fail:
+        err = errno;
+        if (u->br == MAP_FAILED) u->br = 0;
+        if (u->bufs == MAP_FAILED) u->bufs = 0;
+        if (u->sqes == MAP_FAILED) u->sqes = 0;
+        if (u->cq_map == MAP_FAILED) u->cq_map = 0;
+        if (u->sq_map == MAP_FAILED) u->sq_map = 0;
+        sr_uring_close(u);
+        errno = err;
+        return -1;
+}
+
+/**
+ * the next chunk of the stream, with no syscall: the previous one must
+ * have been passed to sr_uring_done
+ * @return 1 with data and len set, 0 if nothing has arrived, -1 if the
+ *         server hung up (errno 0) or the recv failed
+ */
+int sr_uring_recv(struct sr_uring* u, uint8_t** data, size_t* len)
+{
+        struct sr_uring_chunk* c;
+        unsigned int done = 0;
+        int err = 0;
+
+        assert(u);
+        assert(u->current == -1);
+        if (!u->nready) sr_uring_reap(u, &done, &err);
+        if (!u->nready) {
+                if (!u->closed && !u->error) return 0;
+                errno = u->error;
+                return -1;
+        }
+        c = &u->ready[u->rhead];
+        u->rhead = (u->rhead + 1) % SR_URING_BUFS;
+        u->nready--;
+        u->current = c->bid;
+        *data = u->bufs + (size_t) c->bid * SR_URING_BUFSIZE;
+        *len = c->len;
+        return 1;
+}
+
+/** every command in the chunk from sr_uring_recv has been handled */
+void sr_uring_done(struct sr_uring* u)
+{
+        assert(u);
+        if (u->current == -1) return;
+        u->used[u->nused++] = u->current;
+        u->current = -1;
+}
+
+/**
+ * send everything queued in tx with linked sendmsgs and wait for them,
+ * re-arming the recv in the same io_uring_enter if it had stopped
+ * @return 0 on success, -1 if the connection failed (the queue is emptied)
+ */
+int sr_uring_flush(struct sr_uring* u, struct sr_tx* tx)
+{
+        struct io_uring_sqe* sqe;
+        struct msghdr* msg;
+        unsigned int n = tx->frames, nsends, niov, done = 0, i;
+        int err = 0;
+
+        assert(u);
+        assert(tx);
+        /* each sendmsg takes as many frames as one writev could, linked so they stay in order */
+        for (i = 0, niov = 2 * n; niov; i++) {
+                sqe = sr_uring_sqe(u);
+                assert(sqe);
+                msg = &u->msg[i];
+                memset(msg, 0, sizeof(*msg));
+                msg->msg_iov = &tx->iov[2 * n - niov];
+                msg->msg_iovlen = niov < SR_URING_IOV ? niov : SR_URING_IOV;
+                niov -= msg->msg_iovlen;
+                sqe->opcode = IORING_OP_SENDMSG;
+                sqe->fd = u->sock;
+                sqe->addr = (uintptr_t) msg;
+                sqe->len = 1;
+                /* a short send is finished by the kernel rather than breaking the chain */
+                sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+                if (niov) sqe->flags = IOSQE_IO_LINK;
+                sqe->user_data = SR_URING_SEND;
+        }
+        nsends = i;
+        /* with nothing to send the buffers can go back before re-arming */
+        if (!n) sr_uring_give_back(u);
+        if (!u->armed && sr_uring_free(u)) sr_uring_arm(u);
+
+        if (u->sqe_tail != *u->sq_tail) {
+                if (sr_uring_enter(u, nsends) == -1) return -1;
+                sr_uring_reap(u, &done, &err);
+                while (done < nsends) {
+                        if (sr_uring_enter(u, nsends - done) == -1) return -1;
+                        sr_uring_reap(u, &done, &err);
+                }
+        }
+        if (n) {
+                u->sends += nsends;
+                tx->writes++;
+                if (!err) tx->sent += n;
+                tx->frames = 0;
+                tx->staged = 0;
+                sr_uring_give_back(u);
+                /*
+                 * the recv ran out of buffers but they are back now: if chunks
+                 * are waiting the caller comes back and it is re-armed with the
+                 * next round's sends, otherwise nothing would wake us
+                 */
+                if (!u->armed && !u->nready && sr_uring_arm(u) == 0 && sr_uring_enter(u, 0) == -1) return -1;
+        }
+        if (err) {
+                errno = -err;
+                perror("sendmsg(..):sr_uring.c::sr_uring_flush");
+                return -1;
+        }
+        return 0;
+}
+
+/** post a no-op so the ring's fd wakes the event loop again (chunks are still waiting) */
+int sr_uring_wake(struct sr_uring* u)
+{
+        struct io_uring_sqe* sqe;
+
+        assert(u);
+        if (!u->armed && sr_uring_free(u)) sr_uring_arm(u);
+        if (!(sqe = sr_uring_sqe(u))) return 0;
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = SR_URING_WAKE;
+        return sr_uring_enter(u, 0);
+}
+
+void sr_uring_close(struct sr_uring* u)
+{
+        assert(u);
+        if (u->fd > 0) close(u->fd);
+        if (u->sqes) munmap(u->sqes, u->sqes_len);
+        if (u->cq_map && u->cq_map != u->sq_map) munmap(u->cq_map, u->cq_maplen);
+        if (u->sq_map) munmap(u->sq_map, u->sq_maplen);
+        if (u->br) munmap(u->br, SR_URING_BUFS * sizeof(struct io_uring_buf));
+        if (u->bufs) munmap(u->bufs, (size_t) SR_URING_BUFS * SR_URING_BUFSIZE);
+        u->fd = -1;
+        u->sqes = 0;
+        u->sq_map = u->cq_map = 0;
+        u->br = 0;
+        u->bufs = 0;
+}
+
+void sr_uring_print_stats(struct sr_uring* u)
+{
+        assert(u);
+        printf("URING: %lu chunks, %llu bytes, %lu sends in %lu io_uring_enters; "
+                "recv posted %lu times (%lu out of buffers)\n",
+                u->chunks, u->bytes, u->sends, u->enters, u->rearms, u->nobufs);
+}
@@ -0,0 +1,126 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * io_uring transport for the connection to the VNS server
+ *
+ * with epoll (sr_event.h) every wakeup costs an epoll_wait, a recv per
+ * chunk plus one that says EAGAIN, and a writev per batch. here the
+ * socket is read by one multishot recv that stays posted: the kernel
+ * picks a buffer from a ring of SR_URING_BUFS buffers we provide
+ * (IORING_REGISTER_PBUF_RING) each time data arrives and posts a
+ * completion saying which, so receiving needs no syscalls at all. the
+ * ring's fd goes in the epoll set to wake the event loop.
+ *
+ * sends take the header and frame iovecs sr_tx.h queues: one
+ * IORING_OP_SENDMSG carries as many frames as a writev could, and if a
+ * queue ever needs more than one they are linked with IOSQE_IO_LINK so
+ * they go out in order. (a sendmsg per frame was tried: on a stream
+ * socket each becomes its own skb and wakes the reader, which made it
+ * ten times slower than writev.)
+ * sr_uring_flush submits them, re-arms the recv if it stopped, and waits
+ * for the sends to complete in a single io_uring_enter, so one syscall per
+ * loop iteration covers both directions. waiting keeps the lifetime rules
+ * of sr_tx.h: once the flush returns nothing points at the frames.
+ *
+ * a receive buffer is only handed back to the kernel at the flush after
+ * the chunk in it has been handled, since frames queued to send may point
+ * into it. the ring is driven directly through the syscalls and the
+ * shared memory they set up so there is nothing to link against, and
+ * sr_uring_init failing (old kernel, io_uring switched off) just means the
+ * caller should use the epoll path instead.
+ */
+#ifndef SR_URING_H
+#define SR_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include "sr_tx.h"
+
+/** submission queue entries */
+#define SR_URING_ENTRIES 64
+/** iovecs per sendmsg, as UIO_MAXIOV */
+#define SR_URING_IOV 1024
+/** sendmsgs it takes to send a full sr_tx queue */
+#define SR_URING_SENDS ((2 * SR_TX_FRAMES + SR_URING_IOV - 1) / SR_URING_IOV)
+/** provided receive buffers: a power of 2 */
+#define SR_URING_BUFS 64
+#define SR_URING_BUFSIZE 16384
+
+/** a chunk of the stream received into buffer bid */
+struct sr_uring_chunk
+{
+        uint16_t bid;
+        uint32_t len;
+};
+
+struct sr_uring
+{
+        int fd;                 /** the ring, -1 if not set up */
+        int sock;               /** the server socket */
+
+        unsigned int* sq_head;
+        unsigned int* sq_tail;
+        unsigned int* sq_mask;
+        unsigned int sq_entries;
+        unsigned int sqe_tail;  /** entries up to here are filled in but maybe not submitted */
+        struct io_uring_sqe* sqes;
+        unsigned int* cq_head;
+        unsigned int* cq_tail;
+        unsigned int* cq_mask;
+        struct io_uring_cqe* cqes;
+        void* sq_map;
+        size_t sq_maplen;
+        void* cq_map;
+        size_t cq_maplen;
+        size_t sqes_len;
+
+        struct io_uring_buf_ring* br;   /** where we give buffers to the kernel */
+        uint16_t br_tail;
+        uint8_t* bufs;
+        int armed;              /** the multishot recv is posted */
+        int closed;             /** the server hung up */
+        int error;              /** errno of a failed recv */
+
+        struct sr_uring_chunk ready[SR_URING_BUFS];     /** received and not handled yet */
+        int rhead;
+        int nready;
+        int current;            /** buffer of the chunk being handled, -1 if none */
+        uint16_t used[SR_URING_BUFS];   /** handled: given back at the next flush */
+        int nused;
+        struct msghdr msg[SR_URING_SENDS];
+
+        unsigned long enters;   /** io_uring_enter calls */
+        unsigned long chunks;   /** recv completions with data */
+        unsigned long long bytes;
+        unsigned long sends;    /** sendmsg requests */
+        unsigned long rearms;   /** times the multishot recv was posted */
+        unsigned long nobufs;   /** times it stopped for want of buffers */
+};
+
+/** @return 1 if the len bytes at p are in a receive buffer */
+static inline int sr_uring_owns(const struct sr_uring* u, const uint8_t* p, unsigned int len)
+{
+        return u->bufs && p >= u->bufs && p + len <= u->bufs + (size_t) SR_URING_BUFS * SR_URING_BUFSIZE;
+}
+
+/**
+ * @return non-zero if sr_uring_recv has something to say without a
+ * completion coming: chunks waiting, or a hang up or error that a flush
+ * reaped, which leaves nothing to wake the event loop for
+ */
+static inline int sr_uring_ready(const struct sr_uring* u)
+{
+        return u->nready || u->closed || u->error;
+}
+
+int sr_uring_init(struct sr_uring* u, int sock);
+int sr_uring_recv(struct sr_uring* u, uint8_t** data, size_t* len);
+void sr_uring_done(struct sr_uring* u);
+int sr_uring_flush(struct sr_uring* u, struct sr_tx* tx);
+int sr_uring_wake(struct sr_uring* u);
+void sr_uring_close(struct sr_uring* u);
+void sr_uring_print_stats(struct sr_uring* u);
+
+#endif
@@ -23,6 +23,8 @@
  *
  *---------------------------------------------------------------------------*/
 
+#define SR_LOG_MODULE SR_LOG_VNS
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -30,6 +32,7 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -40,6 +43,7 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_io.h"
 
 #include "sha1.h"
 
@@ -49,6 +53,8 @@ static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   unsigned int len,
                                   char* interface  /* lent */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
+static int sr_handle_command(struct sr_instance* sr, uint8_t* buf, int len, int expected_cmd);
+static int sr_vns_flush(struct sr_instance* sr);
 
 /*-----------------------------------------------------------------------------
  * Method: sr_connect_to_server()
@@ -201,6 +207,8 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWETHER:
                 Debug("VNSCOMM: Hardware Address: "); DebugMAC(hwinfo->mHWInfo[i].value); Debug("\n"); 
                 sr_set_ether_addr(sr,(unsigned char*)hwinfo->mHWInfo[i].value);
+                /* -- frames to known neighbours must use the new address -- */
+                sr_arp_update_templates(sr);
                 break;
             default:
                 printf (" %d \n",ntohl(hwinfo->mHWInfo[i].mKey));
@@ -212,7 +220,9 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
 
     /** see sr_arp.c - cal */
     printf("VNSCOMM: Sending arp broadcasts on each interface\n");
-    sr_arp_scan(sr);
+    /* -- pipelined the first worker sends them, see sr_pipe.h -- */
+    if ( ! sr->pipe.workers )
+    { sr_arp_scan(sr); }
     /** end sr_arp.c code */
 
     return num_entries;
@@ -323,82 +333,157 @@ int sr_read_from_server(struct sr_instance* sr /* borrowed */)
 
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
 {
-    int command, len;
-    unsigned char buf[VNSCMDSIZE + MPADDING];
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    uint8_t* cmd;
+    int len, ret, handled;
 
     /* REQUIRES */
     assert(sr);
 
     /*---------------------------------------------------------------------------
-      Read a command from the server
+      Read commands from the server: a recv brings in as much as is waiting
+      and every complete command in it is handled straight from sr->rx
       -------------------------------------------------------------------------*/
 
-    bytes_read = 0;
-
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
+    for (;;)
     {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
+        /* one clock read per batch: everything handled below shares it */
+        sr_timer_clock(&sr_fwd(sr)->timers);
+        handled = 0;
+        while ((cmd = sr_rx_next(&sr->rx, &len)))
+        {
+            ret = sr_handle_command(sr, cmd, len, expected_cmd);
+            /* during the handshake leave anything after this command for later */
+            if (ret != 1 || expected_cmd)
             {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
+                sr_vns_flush(sr);
+                return ret;
             }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
+            handled++;
+        }
+        if (len < 0)
+        {
+            close(sr->sockfd);
+            return -1;
+        }
+        /* end of the batch: send what it produced before blocking again */
+        if (sr_vns_flush(sr) == -1) return -1;
+        if (handled) return 1;
+
+        if ((ret = sr_rx_fill(&sr->rx, sr->sockfd)) <= 0)
+        {
+            if (ret == 0) fprintf(stderr,"Error: server closed the connection\n");
+            else perror("recv(..):sr_client.c::sr_read_from_server");
+            return -1;
+        }
     }
+}/* -- sr_read_from_server -- */
 
-    len = ntohl(len);
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_event(..)
+ * Scope: local
+ *
+ * Event loop callback for the server socket. Reads whatever has arrived, up
+ * to SR_EVENT_BURST recvs, and handles every complete command. The packets
+ * each batch produced are flushed before the next recv since they may
+ * still point into the receive buffer. When the server doesn't take them
+ * all the socket is watched for room instead (see sr_tx.h) and nothing
+ * more is read until the backlog has gone.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_vns_event(struct sr_instance* sr, int fd, uint32_t events, void* arg)
+{
+    uint8_t* cmd;
+    int len, ret, burst;
 
-    if ( len > VNSCMDSIZE || len < 0 )
+    /* -- room for the backlog: reading again is for the next wakeup -- */
+    if (events & EPOLLOUT)
     {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
+        if (sr_vns_flush(sr) == -1) sr_event_stop(sr);
+        return;
     }
-/*
-    if((buf = malloc(len + MPADDING)) == 0)
+
+    for (burst = 0; burst < SR_EVENT_BURST; burst++)
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
+        if ((ret = sr_rx_fill(&sr->rx, fd)) <= 0)
+        {
+            if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            { return; } /* drained */
+            if (ret == 0) fprintf(stderr,"Error: server closed the connection\n");
+            else perror("recv(..):sr_client.c::sr_vns_event");
+            sr_event_stop(sr);
+            return;
+        }
+
+        sr_timer_clock(&sr_fwd(sr)->timers);
+        while ((cmd = sr_rx_next(&sr->rx, &len)))
+        {
+            if (sr_handle_command(sr, cmd, len, 0) != 1)
+            {
+                sr_event_stop(sr);
+                return;
+            }
+        }
+        if (len < 0 || sr_vns_flush(sr) == -1)
+        {
+            sr_event_stop(sr);
+            return;
+        }
+        if (sr_tx_backlog(&sr->tx))
+        { return; } /* wait for the server */
     }
-*/
+}/* -- sr_vns_event -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_start(..)
+ * Scope: local
+ *
+ * Once the session is negotiated switch the server socket to non blocking
+ * and hand it to the event loop. Any commands that came in with the
+ * handshake are handled first.
+ *
+ *---------------------------------------------------------------------------*/
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+static int sr_vns_start(struct sr_instance* sr /* borrowed */)
+{
+    uint8_t* cmd;
+    int len;
 
-    bytes_read = 0;
+    /* REQUIRES */
+    assert(sr);
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
+    if (fcntl(sr->sockfd, F_SETFL, fcntl(sr->sockfd, F_GETFL) | O_NONBLOCK) == -1)
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
+        perror("fcntl(..):sr_client.c::sr_vns_start");
+        return -1;
+    }
+
+    sr_timer_clock(&sr_fwd(sr)->timers);
+    while ((cmd = sr_rx_next(&sr->rx, &len)))
+    {
+        if (sr_handle_command(sr, cmd, len, 0) != 1) return -1;
     }
+    /* -- registered first: a flush the socket has no room for watches it for room -- */
+    if (len < 0 || sr_event_add(sr, sr->sockfd, EPOLLIN, sr_vns_event, 0) == -1) return -1;
 
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+    return sr_vns_flush(sr);
+}/* -- sr_vns_start -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_command(..)
+ * Scope: local
+ *
+ * Act on one complete command of len bytes from the server. buf points into
+ * sr->rx and the command type has already been put in host byte order.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_handle_command(struct sr_instance* sr, uint8_t* buf, int len, int expected_cmd)
+{
+    int command, ret;
+    c_packet_ethernet_header* sr_pkt = 0;
+
+    command = ((c_base*)buf)->mType;
 
     /* make sure the command is what we expected if we were expecting something */
     if(expected_cmd && command!=expected_cmd) {
@@ -428,6 +513,18 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             sr_log_packet(sr, buf + sizeof(c_packet_header),
                     ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
 
+            /* -- pipelined: one of the workers routes it, see sr_pipe.h -- */
+            if ( sr->pipe.workers )
+            {
+                if ( sr_pipe_deliver(sr,
+                        (buf+sizeof(c_packet_header)),
+                        len - sizeof(c_packet_ethernet_header) +
+                        sizeof(struct sr_ethernet_hdr),
+                        (char*)(buf + sizeof(c_base))) == -1 )
+                { ret = -1; }
+                break;
+            }
+
             /* -- pass to router, student's code should take over here -- */
             sr_handlepacket(sr,
                     (buf+sizeof(c_packet_header)),
@@ -491,12 +588,8 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             break;
 
     }/* -- switch -- */
-/*
-    if(buf)
-    { free(buf); }
-*/
     return ret;
-}/* -- sr_read_from_server -- */
+}/* -- sr_handle_command -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_ether_addrs_match_interface(..)
@@ -550,8 +643,8 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
  * Method: sr_send_packet(..)
  * Scope: Global
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * Send a packet (ethernet header included!) of length 'len' out of the
+ * named interface through whichever backend is in use (see sr_io.h).
  *
  *---------------------------------------------------------------------------*/
 
@@ -560,9 +653,6 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header sr_pkt[VNSCMDSIZE + sizeof(c_packet_header) + MPADDING];
-    unsigned int total_len =  len + (sizeof(c_packet_header));
-
     /* REQUIRES */
     assert(sr);
     assert(buf);
@@ -575,44 +665,402 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
-    /* Create packet */
-/*
-    sr_pkt = (c_packet_header *)malloc(total_len + MPADDING);
-    assert(sr_pkt);
-*/
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
-
     /* -- log packet -- */
     sr_log_packet(sr,buf,len);
 
     if ( ! sr_ether_addrs_match_interface( sr, buf, iface) )
     {
         fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-/*
-        free ( sr_pkt );
-*/
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len )
+    return sr->io->send(sr, buf, len, iface);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flush_packets(..)
+ * Scope: Global
+ *
+ * Write out every packet queued by sr_send_packet. Called at the end of each
+ * batch of received packets and after timers have run.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flush_packets(struct sr_instance* sr /* borrowed */)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    return sr->io->flush(sr);
+} /* -- sr_flush_packets -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_send(..)
+ * Scope: local
+ *
+ * Queue a packet for the server behind a VNSPACKET header.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_send(struct sr_instance* sr /* borrowed */,
+                       uint8_t* buf /* borrowed */ ,
+                       unsigned int len,
+                       const char* iface /* borrowed */)
+{
+    int copy;
+
+    if ( len > VNSCMDSIZE - sizeof(c_packet_header) )
+    {
+        fprintf(stderr , "** Error: packet is too long (%u bytes)\n", len);
+        return -1;
+    }
+
+    /* frames in the receive buffer stay put until after the next flush */
+    copy = !(buf >= sr->rx.buf && buf + len <= sr->rx.buf + SR_RX_SIZE);
+
+    if ( sr_tx_full(&sr->tx, len, copy) && sr_vns_flush(sr) == -1 )
     {
         fprintf(stderr, "Error writing packet\n");
-/*
-        free(sr_pkt);
-*/
         return -1;
     }
+    sr_tx_queue(&sr->tx, buf, len, iface, copy);
 
-/*
-    free(sr_pkt);
-*/
+    return 0;
+} /* -- sr_vns_send -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_flush(..)
+ * Scope: local
+ *
+ * Write the transmit queue to the server, the backlog first. Once the
+ * event loop has the socket it is watched for room rather than commands
+ * for as long as there is a backlog.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_flush(struct sr_instance* sr /* borrowed */)
+{
+    int waiting = sr_tx_backlog(&sr->tx) != 0;
+
+    if ( sr->tx.frames == 0 && !waiting )
+    { return 0; }
+
+    if ( sr_tx_flush(&sr->tx, sr->sockfd) == -1 )
+    { return -1; }
+
+    if ( waiting != (sr_tx_backlog(&sr->tx) != 0) )
+    { return sr_event_mod(sr, sr->sockfd, waiting ? EPOLLIN : EPOLLOUT); }
 
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_vns_flush -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_close(..)
+ * Scope: local
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_vns_close(struct sr_instance* sr /* borrowed */)
+{
+    if ( sr->sockfd != -1 )
+    { close(sr->sockfd); }
+    sr->sockfd = -1;
+    sr_tx_close(&sr->tx);
+} /* -- sr_vns_close -- */
+
+static void sr_vns_print_stats(struct sr_instance* sr /* borrowed */)
+{
+    sr_rx_print_stats(&sr->rx);
+    sr_tx_print_stats(&sr->tx);
+} /* -- sr_vns_print_stats -- */
+
+/* -- the VNS server is the default backend: see sr_io.h -- */
+const struct sr_io sr_vns_io =
+{
+    "vns",
+    0, /* interfaces come from the server in VNSHWINFO */
+    sr_vns_start,
+    sr_vns_send,
+    sr_vns_flush,
+    sr_vns_close,
+    sr_vns_print_stats
+};
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_handle(..)
+ * Scope: local
+ *
+ * Handle every command in up to SR_EVENT_BURST chunks the io_uring recv has
+ * brought in (see sr_uring.h). Commands are parsed where they landed.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_handle(struct sr_instance* sr)
+{
+    uint8_t* cmd, * data;
+    size_t left;
+    int len, ret, burst;
+
+    for (burst = 0; burst < SR_EVENT_BURST; burst++)
+    {
+        if ((ret = sr_uring_recv(&sr->uring, &data, &left)) <= 0)
+        {
+            if (ret == 0) return 0; /* drained */
+            if (errno == 0) fprintf(stderr,"Error: server closed the connection\n");
+            else perror("recv(..):sr_client.c::sr_uring_handle");
+            return -1;
+        }
+        sr->rx.reads++;
+        sr->rx.bytes += left;
+
+        sr_timer_clock(&sr_fwd(sr)->timers);
+        while ((cmd = sr_rx_next_from(&sr->rx, &data, &left, &len)))
+        {
+            if (sr_handle_command(sr, cmd, len, 0) != 1) return -1;
+        }
+        sr_uring_done(&sr->uring);
+        if (len < 0) return -1;
+    }
+    return 0;
+}/* -- sr_uring_handle -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_event(..)
+ * Scope: local
+ *
+ * Event loop callback for the ring: completions have been posted.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_uring_event(struct sr_instance* sr, int fd, uint32_t events, void* arg)
+{
+    if (sr_uring_handle(sr) == -1)
+    { sr_event_stop(sr); }
+}/* -- sr_uring_event -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_flush_packets(..)
+ * Scope: local
+ *
+ * End of a loop iteration: one io_uring_enter sends the queue and picks up
+ * whatever arrived meanwhile, which is handled straight away and its
+ * replies sent with the next enter. After SR_EVENT_BURST rounds the
+ * event loop gets a turn so timers still run under load.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_flush_packets(struct sr_instance* sr /* borrowed */)
+{
+    int round;
+
+    for (round = 0; round < SR_EVENT_BURST; round++)
+    {
+        if (sr_uring_flush(&sr->uring, &sr->tx) == -1) return -1;
+        if (!sr_uring_ready(&sr->uring)) return 0;
+        if (sr_uring_handle(sr) == -1) return -1;
+    }
+    return sr_uring_wake(&sr->uring);
+}/* -- sr_uring_flush_packets -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_send(..)
+ * Scope: local
+ *
+ * Queue a packet for the server. Frames still in a receive buffer are
+ * sent from there, anything else is copied.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_send(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len,
+                         const char* iface /* borrowed */)
+{
+    int copy;
+
+    if ( len > VNSCMDSIZE - sizeof(c_packet_header) )
+    {
+        fprintf(stderr , "** Error: packet is too long (%u bytes)\n", len);
+        return -1;
+    }
+
+    copy = !sr_uring_owns(&sr->uring, buf, len);
+
+    /* not sr_uring_flush_packets: we may be in the middle of a chunk */
+    if ( sr_tx_full(&sr->tx, len, copy) && sr_uring_flush(&sr->uring, &sr->tx) == -1 )
+    {
+        fprintf(stderr, "Error writing packet\n");
+        return -1;
+    }
+    sr_tx_queue(&sr->tx, buf, len, iface, copy);
+
+    return 0;
+} /* -- sr_uring_send -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_start(..)
+ * Scope: local
+ *
+ * Like sr_vns_start but the server socket is read and written through
+ * io_uring from here on. If the kernel won't give us a ring the plain
+ * vns backend takes over.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_start(struct sr_instance* sr /* borrowed */)
+{
+    uint8_t* cmd;
+    int len;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (sr_uring_init(&sr->uring, sr->sockfd) == -1)
+    {
+        fprintf(stderr, "URING: io_uring is not available (%s), using epoll\n", strerror(errno));
+        sr->io = &sr_vns_io;
+        return sr->io->start(sr);
+    }
+
+    /* anything that came in with the handshake is in sr->rx: sends copy it */
+    sr_timer_clock(&sr_fwd(sr)->timers);
+    while ((cmd = sr_rx_next(&sr->rx, &len)))
+    {
+        if (sr_handle_command(sr, cmd, len, 0) != 1) return -1;
+    }
+    if (len < 0 || sr_uring_flush(&sr->uring, &sr->tx) == -1) return -1;
+
+    return sr_event_add(sr, sr->uring.fd, EPOLLIN, sr_uring_event, 0);
+}/* -- sr_uring_start -- */
+
+static void sr_uring_stop(struct sr_instance* sr /* borrowed */)
+{
+    sr_uring_close(&sr->uring);
+    sr_vns_close(sr);
+} /* -- sr_uring_stop -- */
+
+static void sr_uring_stats(struct sr_instance* sr /* borrowed */)
+{
+    sr_uring_print_stats(&sr->uring);
+    sr_vns_print_stats(sr);
+} /* -- sr_uring_stats -- */
+
+/* -- the VNS server over io_uring: see sr_uring.h -- */
+const struct sr_io sr_uring_io =
+{
+    "uring",
+    0,
+    sr_uring_start,
+    sr_uring_send,
+    sr_uring_flush_packets,
+    sr_uring_stop,
+    sr_uring_stats
+};
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pipe_reader(..)
+ * Scope: local
+ *
+ * The rx thread of the pipe backend (see sr_pipe.h): block reading the
+ * server socket and hand every packet that comes in to a worker. Anything
+ * that came in with the handshake is handled first. When the server goes
+ * away, or sr_pipe_close shuts the socket, the event loop is stopped.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pipe_reader(struct sr_instance* sr /* borrowed */)
+{
+    uint8_t* cmd;
+    int len, ret;
+
+    for (;;)
+    {
+        while ((cmd = sr_rx_next(&sr->rx, &len)))
+        {
+            if (sr_handle_command(sr, cmd, len, 0) != 1)
+            {
+                len = -1;
+                break;
+            }
+        }
+        sr_pipe_publish(sr);
+        if (len < 0) break;
+
+        if ((ret = sr_rx_fill(&sr->rx, sr->sockfd)) <= 0)
+        {
+            if (sr->pipe.stop) break;
+            if (ret == 0) fprintf(stderr,"Error: server closed the connection\n");
+            else perror("recv(..):sr_client.c::sr_pipe_reader");
+            break;
+        }
+    }
+    sr_event_stop(sr);
+}/* -- sr_pipe_reader -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pipe_start(..)
+ * Scope: local
+ *
+ * Start the pipe's threads. The workers route with the router's
+ * interfaces so they have to be known first: read and handle commands here
+ * until VNSHWINFO has come. The socket stays blocking: the rx thread has
+ * nothing else to do but wait in recv.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_pipe_start(struct sr_instance* sr /* borrowed */)
+{
+    uint8_t* cmd;
+    int len, ret;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (sr_pipe_init(sr) == -1) return -1;
+
+    sr_timer_clock(&sr_fwd(sr)->timers);
+    while (!sr->if_list)
+    {
+        if ((cmd = sr_rx_next(&sr->rx, &len)))
+        {
+            if (sr_handle_command(sr, cmd, len, 0) != 1) return -1;
+            continue;
+        }
+        if (len < 0) return -1;
+        if ((ret = sr_rx_fill(&sr->rx, sr->sockfd)) <= 0)
+        {
+            if (ret == 0) fprintf(stderr,"Error: server closed the connection\n");
+            else perror("recv(..):sr_client.c::sr_pipe_start");
+            return -1;
+        }
+    }
+    return sr_pipe_run(sr, sr_pipe_reader);
+}/* -- sr_pipe_start -- */
+
+static void sr_pipe_stop(struct sr_instance* sr /* borrowed */)
+{
+    sr_pipe_close(sr);
+    sr_pipe_free(sr);
+    sr_vns_close(sr);
+} /* -- sr_pipe_stop -- */
+
+static void sr_pipe_stats(struct sr_instance* sr /* borrowed */)
+{
+    sr_pipe_print_stats(sr);
+    sr_vns_print_stats(sr);
+} /* -- sr_pipe_stats -- */
+
+/* -- the VNS server with threads for reading, routing and writing: see sr_pipe.h -- */
+const struct sr_io sr_pipe_io =
+{
+    "pipe",
+    0,
+    sr_pipe_start,
+    sr_pipe_send,
+    sr_pipe_flush,
+    sr_pipe_stop,
+    sr_pipe_stats
+};
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -622,23 +1070,24 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
 
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
-    struct pcap_pkthdr h;
-    int size;
+    const struct timeval* ts;
 
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    if(sr->pcap.fd < 0 && !sr->flight.rings)
     {return; }
 
-    size = min(PACKET_DUMP_SIZE, len);
+    /* -- pipelined, packets come from several threads: each reads the clock -- */
+    ts = sr->events.stamped && !sr->pipe.workers ? &sr->events.now : 0;
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+    /* -- queued for the writer thread on this thread's queue, see sr_pcap.h -- */
+    if(sr->pcap.fd >= 0)
+    { sr_pcap_log(&sr->pcap, sr_pipe_logger, buf, len, ts); }
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* -- kept in memory until something asks for it, see sr_flight.h -- */
+    if(sr->flight.rings)
+    { sr_flight_log(&sr->flight, sr_pipe_logger, buf, len, ts); }
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -0,0 +1,1388 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * a stand-in for the VNS server so sr can be tested and timed on one machine
+ *
+ * it listens for sr the way the real server does and speaks the same
+ * protocol (vnscommand.h): the salted sha1 login, VNSOPEN or
+ * VNS_OPEN_TEMPLATE (answered with VNS_RTABLE), VNSHWINFO describing the
+ * router's interfaces and then VNSPACKET frames both ways. on the far side
+ * of each interface are emulated hosts that answer ARP and pings.
+ *
+ * once the router is up the hosts can send it traffic for a while at a
+ * target rate: numbered udp datagrams from one host to another (-f, with
+ * as many flows between the two as ports are given, each from a source
+ * port of its own), pings
+ * (-P) or the frames of a pcap file such as one sr wrote with -l (-x).
+ * generated packets carry the time they were sent, so what comes back out
+ * of the router gives its forwarding rate, loss, reordering and latency
+ * over the VNS connection. for pings the latency is the round trip.
+ * traffic starts EMU_SETTLE seconds after VNSHWINFO so the router has had
+ * its answers to the arp requests it sends at startup.
+ *
+ * the topology is read from a file with one item per line:
+ *      iface <name> <ip> <mask> <mac>          an interface of the router
+ *      host <iface> <ip> [mac]                 a host on the link to iface
+ *      route <dest> <gateway> <mask> <iface>   a line of the router's rtable
+ * with no route lines every host gets a host route. without a file it
+ * serves the topology the rtable in this directory was written for.
+ *
+ * everything after the options is a command to start once the emulator is
+ * listening, normally sr itself, so a run needs no sleeps or second shell.
+ *
+ * with -n it takes that many connections, for sr hosting as many routers
+ * (sr -m), and serves each in a process of its own with the same topology
+ * and traffic. each session reports in a line and the totals follow.
+ *
+ * usage: sr_vns_emu [-p port] [-t topology] [-w rtable] [-k auth_key]
+ *                   [-f src,dst[,ports]]... [-R pps] [-d seconds] [-z bytes]
+ *                   [-P] [-x pcap file] [-n sessions] [-o log] [command ...]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "sr_protocol.h"
+#include "vnscommand.h"
+#include "sr_ip.h"
+#include "sr_rx.h"
+#include "sr_cksum.h"
+#include "sr_dumper.h"
+#include "sha1.h"
+
+#define EMU_PORT 3250           /** as DEFAULT_PORT in sr_main.c */
+#define EMU_IFACES 16
+#define EMU_HOSTS 256
+#define EMU_ROUTES 256
+#define EMU_FLOWS 256
+/** flows listed one by one in the summary: more are added up */
+#define EMU_FLOWS_SHOWN 16
+#define EMU_NAMELEN 16          /** as mInterfaceName */
+#define EMU_UDP_PORT 9000       /** as sr_bench_udp */
+#define EMU_MAGIC 0x564e5345    /** "VNSE" */
+#define EMU_AUTH_KEY_LEN 64     /** as AUTH_KEY_LEN in sr_vns_comm.c */
+#define EMU_SALT_LEN 8
+/** bytes of commands waiting to go to the router */
+#define EMU_OUT (4 << 20)
+/** most packets generated per loop */
+#define EMU_BURST 256
+/** most generated packets in flight: the rest wait so queueing here doesn't count as latency */
+#define EMU_WINDOW 1024
+/** most bytes of generated packets waiting to be written */
+#define EMU_BACKLOG (256 << 10)
+/** latency histogram: one bucket per microsecond up to 100 ms, then one for the rest */
+#define EMU_HIST 100000
+#define EMU_SETTLE 0.5
+/** how long to wait for stragglers after the traffic stops */
+#define EMU_DRAIN 1.0
+#define EMU_MAXFRAME 1514
+#define EMU_SESSIONS 256        /** as SR_MULTI_ROUTERS */
+
+/** what a generated packet carries after its udp or icmp header */
+struct emu_stamp
+{
+        uint32_t magic;
+        uint32_t flow;
+        uint64_t seq;
+        uint64_t ns;            /** CLOCK_MONOTONIC when it was sent */
+} __attribute__ ((packed)) ;
+
+struct emu_iface
+{
+        char name[EMU_NAMELEN];
+        uint32_t ip;
+        uint32_t mask;
+        uint8_t mac[ETHER_ADDR_LEN];
+};
+
+struct emu_host
+{
+        int iface;
+        uint32_t ip;
+        uint8_t mac[ETHER_ADDR_LEN];
+        unsigned long arps;     /** arp requests answered */
+        unsigned long pings;    /** echo requests answered */
+        unsigned long frames;   /** frames addressed to it */
+};
+
+struct emu_route
+{
+        uint32_t dest, gw, mask;
+        char iface[EMU_NAMELEN];
+};
+
+struct emu_flow
+{
+        int src, dst;           /** hosts */
+        uint16_t port;          /** udp source port */
+        uint64_t sent;
+        uint64_t recv;
+        uint64_t next;          /** the sequence number expected next */
+        uint64_t reordered;
+};
+
+/** what a session saw, sent up to the parent with -n */
+struct emu_result
+{
+        uint64_t sent, recv, reordered;
+        unsigned long delivered;        /** frames for the hosts */
+        double seconds;
+        unsigned int p99;
+        int ret;
+};
+
+/** a frame of the pcap file to replay */
+struct emu_replay
+{
+        uint8_t* frame;
+        uint32_t len;
+        int iface;
+};
+
+struct emu
+{
+        struct emu_iface iface[EMU_IFACES];
+        int nifaces;
+        struct emu_host host[EMU_HOSTS];
+        int nhosts;
+        struct emu_route route[EMU_ROUTES];
+        int nroutes;
+        struct emu_flow flow[EMU_FLOWS];
+        int nflows;
+
+        const char* auth_key_fn;
+        double rate;            /** packets per second, 0 for as fast as the router takes them */
+        double seconds;         /** of traffic: 0 for none */
+        int size;               /** udp payload bytes */
+        int ping;
+
+        struct emu_replay* replay;
+        int nreplay;
+        uint8_t* pcap;
+
+        int session;            /** from 1 when serving one of -n sessions */
+        double ran;             /** seconds of the run reported */
+        int sock;
+        struct sr_rx rx;
+        uint8_t out[EMU_OUT];
+        size_t ohead, otail;
+
+        uint64_t generated;     /** packets made by the generator */
+        unsigned long frames;   /** frames from the router */
+        unsigned long arps;
+        unsigned long pings;
+        unsigned long icmp_errors;
+        unsigned long badsum;
+        unsigned long stray;    /** frames for no host we know */
+        unsigned long other;    /** frames for a host that it just takes */
+        unsigned long full;     /** frames not sent because the output buffer was full */
+        unsigned long long bytes;       /** of frames for our hosts */
+        uint32_t hist[EMU_HIST + 1];
+        uint64_t lat_n, lat_min, lat_max;
+        double lat_sum;
+};
+
+static struct emu emu;
+static volatile sig_atomic_t emu_stop;
+
+static uint64_t emu_ns(void)
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void emu_sigint(int sig)
+{
+        emu_stop = 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* topology */
+
+static int emu_mac(const char* s, uint8_t* mac)
+{
+        unsigned int m[ETHER_ADDR_LEN];
+        int i;
+
+        if (sscanf(s, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6)
+                return -1;
+        for (i = 0; i < ETHER_ADDR_LEN; i++) mac[i] = (uint8_t) m[i];
+        return 0;
+}
+
+static int emu_ip(const char* s, uint32_t* ip)
+{
+        struct in_addr a;
+
+        if (!inet_aton(s, &a)) return -1;
+        *ip = a.s_addr;
+        return 0;
+}
+
+static int emu_iface_by_name(struct emu* e, const char* name)
+{
+        int i;
+
+        for (i = 0; i < e->nifaces; i++)
+                if (!strcmp(e->iface[i].name, name)) return i;
+        return -1;
+}
+
+static int emu_host_by_ip(struct emu* e, uint32_t ip)
+{
+        int i;
+
+        for (i = 0; i < e->nhosts; i++)
+                if (e->host[i].ip == ip) return i;
+        return -1;
+}
+
+static int emu_host_by_mac(struct emu* e, int iface, const uint8_t* mac)
+{
+        int i;
+
+        for (i = 0; i < e->nhosts; i++)
+                if (e->host[i].iface == iface && !memcmp(e->host[i].mac, mac, ETHER_ADDR_LEN))
+                        return i;
+        return -1;
+}
+
+static int emu_add_iface(struct emu* e, const char* name, const char* ip, const char* mask, const char* mac)
+{
+        struct emu_iface* f;
+
+        if (e->nifaces == EMU_IFACES || strlen(name) >= EMU_NAMELEN) return -1;
+        f = &e->iface[e->nifaces];
+        strcpy(f->name, name);
+        if (emu_ip(ip, &f->ip) || emu_ip(mask, &f->mask) || emu_mac(mac, f->mac)) return -1;
+        e->nifaces++;
+        return 0;
+}
+
+static int emu_add_host(struct emu* e, const char* iface, const char* ip, const char* mac)
+{
+        struct emu_host* h;
+
+        if (e->nhosts == EMU_HOSTS) return -1;
+        h = &e->host[e->nhosts];
+        memset(h, 0, sizeof(*h));
+        if ((h->iface = emu_iface_by_name(e, iface)) < 0 || emu_ip(ip, &h->ip)) return -1;
+        if (mac) {
+                if (emu_mac(mac, h->mac)) return -1;
+        }
+        else {
+                /* locally administered, numbered by host */
+                h->mac[0] = 0x02;
+                h->mac[4] = (uint8_t) (e->nhosts >> 8);
+                h->mac[5] = (uint8_t) e->nhosts;
+        }
+        e->nhosts++;
+        return 0;
+}
+
+static int emu_add_route(struct emu* e, const char* dest, const char* gw, const char* mask, const char* iface)
+{
+        struct emu_route* r;
+
+        if (e->nroutes == EMU_ROUTES || strlen(iface) >= EMU_NAMELEN) return -1;
+        r = &e->route[e->nroutes];
+        if (emu_ip(dest, &r->dest) || emu_ip(gw, &r->gw) || emu_ip(mask, &r->mask)) return -1;
+        strcpy(r->iface, iface);
+        e->nroutes++;
+        return 0;
+}
+
+/** the topology of fake.py and ./rtable */
+static void emu_default_topology(struct emu* e)
+{
+        emu_add_iface(e, "eth0", "172.24.74.11", "255.255.255.0", "00:01:02:03:04:00");
+        emu_add_iface(e, "eth1", "171.67.245.100", "255.255.255.254", "00:01:02:03:04:01");
+        emu_add_iface(e, "eth2", "171.67.245.102", "255.255.255.254", "00:01:02:03:04:02");
+        emu_add_host(e, "eth0", "172.24.74.17", 0);
+        emu_add_host(e, "eth1", "171.67.245.101", 0);
+        emu_add_host(e, "eth2", "171.67.245.103", 0);
+        emu_add_route(e, "0.0.0.0", "172.24.74.17", "0.0.0.0", "eth0");
+        emu_add_route(e, "171.67.245.101", "171.67.245.101", "255.255.255.255", "eth1");
+        emu_add_route(e, "171.67.245.103", "171.67.245.103", "255.255.255.255", "eth2");
+}
+
+static int emu_load_topology(struct emu* e, const char* fn)
+{
+        char line[256], w[5][64];
+        FILE* fp;
+        int n, lineno = 0, ret = 0;
+
+        if (!(fp = fopen(fn, "r"))) {
+                perror("fopen(..):sr_vns_emu.c::emu_load_topology");
+                return -1;
+        }
+        while (!ret && fgets(line, sizeof(line), fp)) {
+                lineno++;
+                if (line[0] == '#') continue;
+                n = sscanf(line, "%63s %63s %63s %63s %63s", w[0], w[1], w[2], w[3], w[4]);
+                if (n <= 0) continue;
+                if (!strcmp(w[0], "iface") && n == 5)
+                        ret = emu_add_iface(e, w[1], w[2], w[3], w[4]);
+                else if (!strcmp(w[0], "host") && (n == 3 || n == 4))
+                        ret = emu_add_host(e, w[1], w[2], n == 4 ? w[3] : 0);
+                else if (!strcmp(w[0], "route") && n == 5)
+                        ret = emu_add_route(e, w[1], w[2], w[3], w[4]);
+                else
+                        ret = -1;
+                if (ret) fprintf(stderr, "EMU: %s:%d: bad line: %s", fn, lineno, line);
+        }
+        fclose(fp);
+        if (ret) return -1;
+
+        if (!e->nroutes) {
+                for (n = 0; n < e->nhosts; n++) {
+                        struct emu_route* r = &e->route[e->nroutes++];
+                        r->dest = r->gw = e->host[n].ip;
+                        r->mask = 0xffffffff;
+                        strcpy(r->iface, e->iface[e->host[n].iface].name);
+                }
+        }
+        return 0;
+}
+
+/** the rtable as sr_load_rt reads it */
+static int emu_rtable(struct emu* e, char* buf, size_t size)
+{
+        char dest[16], gw[16], mask[16];
+        struct in_addr a;
+        size_t len = 0;
+        int i, n;
+
+        for (i = 0; i < e->nroutes; i++) {
+                a.s_addr = e->route[i].dest; strcpy(dest, inet_ntoa(a));
+                a.s_addr = e->route[i].gw; strcpy(gw, inet_ntoa(a));
+                a.s_addr = e->route[i].mask; strcpy(mask, inet_ntoa(a));
+                n = snprintf(buf + len, size - len, "%-18s %-18s %-18s %s\n", dest, gw, mask, e->route[i].iface);
+                if (n < 0 || (size_t) n >= size - len) return -1;
+                len += n;
+        }
+        return (int) len;
+}
+
+static int emu_write_rtable(struct emu* e, const char* fn)
+{
+        char buf[VNSCMDSIZE];
+        FILE* fp;
+        int len;
+
+        if ((len = emu_rtable(e, buf, sizeof(buf))) < 0) return -1;
+        if (!(fp = fopen(fn, "w"))) {
+                perror("fopen(..):sr_vns_emu.c::emu_write_rtable");
+                return -1;
+        }
+        fwrite(buf, len, 1, fp);
+        fclose(fp);
+        return 0;
+}
+
+/** src,dst[,ports]: one flow per source port from EMU_UDP_PORT up */
+static int emu_add_flow(struct emu* e, const char* arg)
+{
+        char src[64], dst[64];
+        const char* comma = strchr(arg, ',');
+        const char* ports;
+        uint32_t ip;
+        struct emu_flow* f;
+        int i, n = 1;
+
+        if (!comma || comma - arg >= (int) sizeof(src)) return -1;
+        memcpy(src, arg, comma - arg);
+        src[comma - arg] = 0;
+        ports = strchr(comma + 1, ',');
+        if (!ports) ports = comma + 1 + strlen(comma + 1);
+        else if ((n = atoi(ports + 1)) < 1) return -1;
+        if (ports - comma - 1 >= (int) sizeof(dst) || e->nflows + n > EMU_FLOWS) return -1;
+        memcpy(dst, comma + 1, ports - comma - 1);
+        dst[ports - comma - 1] = 0;
+        for (i = 0; i < n; i++) {
+                f = &e->flow[e->nflows + i];
+                memset(f, 0, sizeof(*f));
+                if (emu_ip(src, &ip) || (f->src = emu_host_by_ip(e, ip)) < 0) return -1;
+                if (emu_ip(dst, &ip) || (f->dst = emu_host_by_ip(e, ip)) < 0) return -1;
+                f->port = EMU_UDP_PORT + i;
+        }
+        e->nflows += n;
+        return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* pcap replay */
+
+/**
+ * read the frames the hosts sent in a pcap file: frames from one of the
+ * router's own addresses are left out. each goes in on the interface of
+ * the host with its source ip, or the first one, addressed to the router.
+ */
+static int emu_load_pcap(struct emu* e, const char* fn)
+{
+        struct pcap_file_header fh;
+        struct pcap_sf_pkthdr ph;
+        struct sr_ethernet_hdr* eth;
+        struct ip* ip;
+        FILE* fp;
+        long size;
+        uint8_t* p;
+        int i, h;
+
+        if (!(fp = fopen(fn, "r"))) {
+                perror("fopen(..):sr_vns_emu.c::emu_load_pcap");
+                return -1;
+        }
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        rewind(fp);
+        if (fread(&fh, sizeof(fh), 1, fp) != 1 || fh.magic != TCPDUMP_MAGIC || fh.linktype != LINKTYPE_ETHERNET) {
+                fprintf(stderr, "EMU: %s is not an ethernet pcap file\n", fn);
+                fclose(fp);
+                return -1;
+        }
+        e->pcap = p = malloc(size);
+        e->replay = malloc(sizeof(struct emu_replay) * (size / sizeof(ph) + 1));
+        if (!e->pcap || !e->replay) {
+                perror("malloc(..):sr_vns_emu.c::emu_load_pcap");
+                fclose(fp);
+                return -1;
+        }
+        while (fread(&ph, sizeof(ph), 1, fp) == 1) {
+                if (ph.caplen > EMU_MAXFRAME || fread(p, ph.caplen, 1, fp) != 1) break;
+                if (ph.caplen < sizeof(*eth) + sizeof(*ip)) continue;
+                eth = (struct sr_ethernet_hdr*) p;
+                for (i = 0; i < e->nifaces; i++)
+                        if (!memcmp(eth->ether_shost, e->iface[i].mac, ETHER_ADDR_LEN)) break;
+                if (i < e->nifaces) continue;
+
+                e->replay[e->nreplay].frame = p;
+                e->replay[e->nreplay].len = ph.caplen;
+                e->replay[e->nreplay].iface = 0;
+                if (ntohs(eth->ether_type) == ETHERTYPE_IP) {
+                        ip = (struct ip*) (p + sizeof(*eth));
+                        if ((h = emu_host_by_ip(e, ip->ip_src.s_addr)) >= 0) {
+                                e->replay[e->nreplay].iface = e->host[h].iface;
+                                memcpy(eth->ether_shost, e->host[h].mac, ETHER_ADDR_LEN);
+                        }
+                }
+                memcpy(eth->ether_dhost, e->iface[e->replay[e->nreplay].iface].mac, ETHER_ADDR_LEN);
+                e->nreplay++;
+                p += ph.caplen;
+        }
+        fclose(fp);
+        printf("EMU: %d frames to replay from %s\n", e->nreplay, fn);
+        return e->nreplay ? 0 : -1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* the connection */
+
+static int emu_send_all(int fd, const void* buf, size_t len)
+{
+        const uint8_t* p = buf;
+        ssize_t n;
+
+        while (len) {
+                n = send(fd, p, len, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                        perror("send(..):sr_vns_emu.c::emu_send_all");
+                        return -1;
+                }
+                p += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/** @return the next command from the router, blocking: 0 if it is not of type (when type is not 0) */
+static uint8_t* emu_expect(struct emu* e, uint32_t type, int* len)
+{
+        uint8_t* cmd;
+        int n;
+
+        while (!(cmd = sr_rx_next(&e->rx, len))) {
+                if (*len < 0) return 0;
+                if ((n = sr_rx_fill(&e->rx, e->sock)) <= 0) {
+                        if (n < 0) perror("recv(..):sr_vns_emu.c::emu_expect");
+                        else fprintf(stderr, "EMU: the router hung up\n");
+                        return 0;
+                }
+        }
+        if (type && ((c_base*) cmd)->mType != type) {
+                fprintf(stderr, "EMU: expected command %u, got %u\n", type, ((c_base*) cmd)->mType);
+                return 0;
+        }
+        return cmd;
+}
+
+/** salted sha1 login as in sr_handle_auth_request: without a key file any login passes */
+static int emu_login(struct emu* e)
+{
+        uint8_t buf[sizeof(c_auth_request) + EMU_SALT_LEN];
+        c_auth_request* req = (c_auth_request*) buf;
+        c_auth_reply* reply;
+        char status[sizeof(c_auth_status) + 64];
+        c_auth_status* st = (c_auth_status*) status;
+        char key[EMU_AUTH_KEY_LEN + 1], user[IDSIZE];
+        uint32_t ulen, digest[5];
+        SHA1Context sha1;
+        FILE* fp;
+        int i, len, ok = 1;
+        const char* msg = "welcome";
+
+        req->mLen = htonl(sizeof(buf));
+        req->mType = htonl(VNS_AUTH_REQUEST);
+        for (i = 0; i < EMU_SALT_LEN; i++) req->salt[i] = (uint8_t) random();
+        if (emu_send_all(e->sock, buf, sizeof(buf))) return -1;
+
+        if (!(reply = (c_auth_reply*) emu_expect(e, VNS_AUTH_REPLY, &len))) return -1;
+        ulen = ntohl(reply->usernameLen);
+        if (ulen >= IDSIZE || sizeof(*reply) + ulen + sizeof(digest) > (size_t) len) {
+                fprintf(stderr, "EMU: bad auth reply\n");
+                return -1;
+        }
+        memcpy(user, reply->username, ulen);
+        user[ulen] = 0;
+
+        if (e->auth_key_fn) {
+                /* the router hashes all EMU_AUTH_KEY_LEN bytes: shorter keys won't match */
+                memset(key, 0, sizeof(key));
+                if (!(fp = fopen(e->auth_key_fn, "r"))) {
+                        perror("fopen(..):sr_vns_emu.c::emu_login");
+                        return -1;
+                }
+                if (!fgets(key, sizeof(key), fp)) key[0] = 0;
+                fclose(fp);
+                SHA1Reset(&sha1);
+                SHA1Input(&sha1, req->salt, EMU_SALT_LEN);
+                SHA1Input(&sha1, (unsigned char*) key, EMU_AUTH_KEY_LEN);
+                SHA1Result(&sha1);
+                for (i = 0; i < 5; i++) digest[i] = htonl(sha1.Message_Digest[i]);
+                if (memcmp(digest, reply->username + ulen, sizeof(digest))) {
+                        ok = 0;
+                        msg = "bad auth key";
+                }
+        }
+        printf("EMU: login from %s %s\n", user, ok ? "accepted" : "refused");
+
+        len = sizeof(*st) + strlen(msg) + 1;
+        st->mLen = htonl(len);
+        st->mType = htonl(VNS_AUTH_STATUS);
+        st->auth_ok = (uint8_t) ok;
+        strcpy(st->msg, msg);
+        if (emu_send_all(e->sock, status, len)) return -1;
+        return ok ? 0 : -1;
+}
+
+static c_hw_entry* emu_hw_entry(c_hw_entry* ent, uint32_t key, const void* value, size_t len)
+{
+        memset(ent, 0, sizeof(*ent));
+        ent->mKey = htonl(key);
+        memcpy(ent->value, value, len);
+        return ent + 1;
+}
+
+/** answer VNSOPEN or VNS_OPEN_TEMPLATE: the rtable for a template, then the interfaces */
+static int emu_open(struct emu* e)
+{
+        static uint8_t buf[VNSCMDSIZE];
+        c_rtable* rt = (c_rtable*) buf;
+        c_hwinfo* hw = (c_hwinfo*) buf;
+        c_hw_entry* ent;
+        uint32_t type, speed = htonl(100), subnet;
+        uint8_t* cmd;
+        int i, len;
+
+        if (!(cmd = emu_expect(e, 0, &len))) return -1;
+        type = ((c_base*) cmd)->mType;
+        if (type == VNS_OPEN_TEMPLATE) {
+                printf("EMU: template %.30s opened\n", ((c_open_template*) cmd)->templateName);
+                /* sr_main.c reads the rtable back from rtable.vrhost */
+                memset(rt->mVirtualHostID, 0, IDSIZE);
+                strcpy(rt->mVirtualHostID, "vrhost");
+                if ((len = emu_rtable(e, rt->rtable, sizeof(buf) - sizeof(*rt))) < 0) return -1;
+                len += sizeof(*rt);
+                rt->mLen = htonl(len);
+                rt->mType = htonl(VNS_RTABLE);
+                if (emu_send_all(e->sock, buf, len)) return -1;
+        }
+        else if (type == VNSOPEN) {
+                printf("EMU: topology %u opened for %.32s\n", ntohs(((c_open*) cmd)->topoID),
+                       ((c_open*) cmd)->mVirtualHostID);
+        }
+        else {
+                fprintf(stderr, "EMU: expected VNSOPEN, got %u\n", type);
+                return -1;
+        }
+
+        ent = hw->mHWInfo;
+        for (i = 0; i < e->nifaces; i++) {
+                subnet = e->iface[i].ip & e->iface[i].mask;
+                ent = emu_hw_entry(ent, HWINTERFACE, e->iface[i].name, strlen(e->iface[i].name));
+                ent = emu_hw_entry(ent, HWSPEED, &speed, sizeof(speed));
+                ent = emu_hw_entry(ent, HWSUBNET, &subnet, sizeof(subnet));
+                ent = emu_hw_entry(ent, HWMASK, &e->iface[i].mask, sizeof(uint32_t));
+                ent = emu_hw_entry(ent, HWETHIP, &e->iface[i].ip, sizeof(uint32_t));
+                ent = emu_hw_entry(ent, HWETHER, e->iface[i].mac, ETHER_ADDR_LEN);
+        }
+        len = (uint8_t*) ent - buf;
+        hw->mLen = htonl(len);
+        hw->mType = htonl(VNSHWINFO);
+        return emu_send_all(e->sock, buf, len);
+}
+
+/*---------------------------------------------------------------------------*/
+/* frames both ways */
+
+/** @return where to put a frame of len bytes sent in on iface or 0 if there is no room yet */
+static uint8_t* emu_queue(struct emu* e, int iface, int len)
+{
+        c_packet_header* hdr;
+        size_t need = sizeof(*hdr) + len;
+
+        if (EMU_OUT - e->otail < need && e->ohead) {
+                memmove(e->out, e->out + e->ohead, e->otail - e->ohead);
+                e->otail -= e->ohead;
+                e->ohead = 0;
+        }
+        if (EMU_OUT - e->otail < need) return 0;
+        hdr = (c_packet_header*) (e->out + e->otail);
+        hdr->mLen = htonl(need);
+        hdr->mType = htonl(VNSPACKET);
+        memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+        memcpy(hdr->mInterfaceName, e->iface[iface].name, strlen(e->iface[iface].name));
+        e->otail += need;
+        return (uint8_t*) (hdr + 1);
+}
+
+/** @return -1 if the connection failed */
+static int emu_write(struct emu* e)
+{
+        ssize_t n;
+
+        while (e->ohead < e->otail) {
+                n = send(e->sock, e->out + e->ohead, e->otail - e->ohead, MSG_NOSIGNAL);
+                if (n < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                        perror("send(..):sr_vns_emu.c::emu_write");
+                        return -1;
+                }
+                e->ohead += n;
+        }
+        e->ohead = e->otail = 0;
+        return 0;
+}
+
+static void emu_ip_header(struct ip* ip, uint32_t src, uint32_t dst, uint8_t proto, int len, uint16_t id)
+{
+        ip->ip_v = 4;
+        ip->ip_hl = 5;
+        ip->ip_tos = 0;
+        ip->ip_len = htons(len);
+        ip->ip_id = htons(id);
+        ip->ip_off = 0;
+        ip->ip_ttl = 64;
+        ip->ip_p = proto;
+        ip->ip_sum = 0;
+        ip->ip_src.s_addr = src;
+        ip->ip_dst.s_addr = dst;
+        ip->ip_sum = (uint16_t) ~sr_cksum_sum(ip, sizeof(*ip));
+}
+
+/** a host answers an arp request for its address */
+static void emu_arp(struct emu* e, int iface, uint8_t* frame, int len)
+{
+        struct sr_ethernet_hdr* eth = (struct sr_ethernet_hdr*) frame;
+        struct sr_arphdr* arp = (struct sr_arphdr*) (eth + 1);
+        struct sr_ethernet_hdr* reth;
+        struct sr_arphdr* rarp;
+        struct emu_host* h;
+        uint8_t* p;
+        int i;
+
+        e->arps++;
+        if (len < (int) (sizeof(*eth) + sizeof(*arp)) || ntohs(arp->ar_op) != ARP_REQUEST) return;
+        if ((i = emu_host_by_ip(e, arp->ar_tip)) < 0 || e->host[i].iface != iface) return;
+        h = &e->host[i];
+        if (!(p = emu_queue(e, iface, sizeof(*reth) + sizeof(*rarp)))) {
+                e->full++;
+                return;
+        }
+        reth = (struct sr_ethernet_hdr*) p;
+        rarp = (struct sr_arphdr*) (reth + 1);
+        memcpy(reth->ether_dhost, eth->ether_shost, ETHER_ADDR_LEN);
+        memcpy(reth->ether_shost, h->mac, ETHER_ADDR_LEN);
+        reth->ether_type = htons(ETHERTYPE_ARP);
+        *rarp = *arp;
+        rarp->ar_op = htons(ARP_REPLY);
+        memcpy(rarp->ar_sha, h->mac, ETHER_ADDR_LEN);
+        rarp->ar_sip = h->ip;
+        memcpy(rarp->ar_tha, arp->ar_sha, ETHER_ADDR_LEN);
+        rarp->ar_tip = arp->ar_sip;
+        h->arps++;
+}
+
+/** a host answers a ping for its address with the same data */
+static void emu_pong(struct emu* e, struct emu_host* h, struct sr_ip_packet* pkt, int len)
+{
+        struct sr_ip_packet* r;
+        int iplen = ntohs(pkt->ip.ip_len);
+
+        if (iplen > len - (int) sizeof(pkt->eth)) return;
+        if (!(r = (struct sr_ip_packet*) emu_queue(e, h->iface, sizeof(pkt->eth) + iplen))) {
+                e->full++;
+                return;
+        }
+        memcpy(r, pkt, sizeof(pkt->eth) + iplen);
+        memcpy(r->eth.ether_dhost, pkt->eth.ether_shost, ETHER_ADDR_LEN);
+        memcpy(r->eth.ether_shost, h->mac, ETHER_ADDR_LEN);
+        emu_ip_header(&r->ip, h->ip, pkt->ip.ip_src.s_addr, IPPROTO_ICMP, iplen, ntohs(pkt->ip.ip_id));
+        r->d.icmp.type = ICMP_ECHO_REPLY;
+        r->d.icmp.checksum = 0;
+        r->d.icmp.checksum = (uint16_t) ~sr_cksum_sum(&r->d.icmp, iplen - sizeof(r->ip));
+        h->pings++;
+}
+
+/** count a generated packet that made it and when */
+static int emu_measure(struct emu* e, const uint8_t* data, int len)
+{
+        struct emu_stamp st;
+        struct emu_flow* f;
+        uint64_t lat;
+
+        /* replayed packets may carry old stamps */
+        if (e->nreplay || len < (int) sizeof(st)) return 0;
+        memcpy(&st, data, sizeof(st));
+        if (st.magic != EMU_MAGIC || st.flow >= (uint32_t) e->nflows) return 0;
+        f = &e->flow[st.flow];
+        f->recv++;
+        if (st.seq < f->next) f->reordered++;
+        else f->next = st.seq + 1;
+
+        lat = emu_ns() - st.ns;
+        e->hist[lat / 1000 < EMU_HIST ? lat / 1000 : EMU_HIST]++;
+        if (!e->lat_n || lat < e->lat_min) e->lat_min = lat;
+        if (lat > e->lat_max) e->lat_max = lat;
+        e->lat_sum += lat;
+        e->lat_n++;
+        return 1;
+}
+
+/** a frame from the router on iface: hand it to the host it is for */
+static void emu_frame(struct emu* e, int iface, uint8_t* frame, int len)
+{
+        struct sr_ip_packet* pkt = (struct sr_ip_packet*) frame;
+        struct emu_host* h;
+        int i, hl, left;
+
+        e->frames++;
+        if (iface < 0 || len < (int) sizeof(pkt->eth)) {
+                e->stray++;
+                return;
+        }
+        if (ntohs(pkt->eth.ether_type) == ETHERTYPE_ARP) {
+                emu_arp(e, iface, frame, len);
+                return;
+        }
+        if ((i = emu_host_by_mac(e, iface, pkt->eth.ether_dhost)) < 0) {
+                e->stray++;
+                return;
+        }
+        h = &e->host[i];
+        h->frames++;
+        e->bytes += len;
+        if (ntohs(pkt->eth.ether_type) != ETHERTYPE_IP || len < (int) (sizeof(pkt->eth) + sizeof(pkt->ip))) {
+                e->other++;
+                return;
+        }
+        hl = pkt->ip.ip_hl * 4;
+        if (sr_cksum_sum(&pkt->ip, hl) != 0xffff) e->badsum++;
+        left = len - sizeof(pkt->eth) - hl;
+        if (left < 8 || hl != sizeof(pkt->ip)) {
+                e->other++;
+                return;
+        }
+
+        if (pkt->ip.ip_p == IPPROTO_ICMP) {
+                switch (pkt->d.icmp.type) {
+                case ICMP_ECHO_REQUEST:
+                        if (pkt->ip.ip_dst.s_addr == h->ip) emu_pong(e, h, pkt, len);
+                        else e->other++;
+                        return;
+                case ICMP_ECHO_REPLY:
+                        e->pings++;
+                        if (!emu_measure(e, pkt->d.icmp.data, left - 8)) e->other++;
+                        return;
+                default:
+                        e->icmp_errors++;
+                        return;
+                }
+        }
+        if (pkt->ip.ip_p == IPPROTO_UDP && pkt->d.udp.dest_port == htons(EMU_UDP_PORT)
+            && emu_measure(e, pkt->d.udp.data, left - 8))
+                return;
+        e->other++;
+}
+
+/*---------------------------------------------------------------------------*/
+/* traffic */
+
+/** queue the next packet: from the pcap file or the next flow in turn */
+static int emu_generate_one(struct emu* e)
+{
+        struct sr_ip_packet* pkt;
+        struct emu_replay* r;
+        struct emu_flow* f;
+        struct emu_host *src, *dst;
+        struct emu_stamp st;
+        uint8_t* p;
+        int flow, iplen = sizeof(struct ip) + 8 + e->size;
+
+        if (e->nreplay) {
+                r = &e->replay[e->generated % e->nreplay];
+                if (!(p = emu_queue(e, r->iface, r->len))) return -1;
+                memcpy(p, r->frame, r->len);
+                return 0;
+        }
+
+        flow = e->generated % e->nflows;
+        f = &e->flow[flow];
+        src = &e->host[f->src];
+        dst = &e->host[f->dst];
+        if (!(pkt = (struct sr_ip_packet*) emu_queue(e, src->iface, sizeof(pkt->eth) + iplen))) return -1;
+        memcpy(pkt->eth.ether_dhost, e->iface[src->iface].mac, ETHER_ADDR_LEN);
+        memcpy(pkt->eth.ether_shost, src->mac, ETHER_ADDR_LEN);
+        pkt->eth.ether_type = htons(ETHERTYPE_IP);
+
+        st.magic = EMU_MAGIC;
+        st.flow = flow;
+        st.seq = f->sent;
+        if (e->ping) {
+                emu_ip_header(&pkt->ip, src->ip, dst->ip, IPPROTO_ICMP, iplen, (uint16_t) f->sent);
+                pkt->d.icmp.type = ICMP_ECHO_REQUEST;
+                pkt->d.icmp.code = 0;
+                pkt->d.icmp.checksum = 0;
+                pkt->d.icmp.fields.ping.id = htons(flow);
+                pkt->d.icmp.fields.ping.sequence = htons((uint16_t) f->sent);
+                memset(pkt->d.icmp.data, 0, e->size);
+                st.ns = emu_ns();
+                memcpy(pkt->d.icmp.data, &st, sizeof(st));
+                pkt->d.icmp.checksum = (uint16_t) ~sr_cksum_sum(&pkt->d.icmp, 8 + e->size);
+        }
+        else {
+                emu_ip_header(&pkt->ip, src->ip, dst->ip, IPPROTO_UDP, iplen, (uint16_t) f->sent);
+                pkt->d.udp.src_port = htons(f->port);
+                pkt->d.udp.dest_port = htons(EMU_UDP_PORT);
+                pkt->d.udp.len = htons(8 + e->size);
+                pkt->d.udp.checksum = 0; /* optional for ipv4 */
+                memset(pkt->d.udp.data, 0, e->size);
+                st.ns = emu_ns();
+                memcpy(pkt->d.udp.data, &st, sizeof(st));
+        }
+        f->sent++;
+        return 0;
+}
+
+static uint64_t emu_received(struct emu* e)
+{
+        uint64_t n = 0;
+        int i;
+
+        for (i = 0; i < e->nflows; i++) n += e->flow[i].recv;
+        return n;
+}
+
+static unsigned long emu_delivered(struct emu* e)
+{
+        unsigned long n = 0;
+        int i;
+
+        for (i = 0; i < e->nhosts; i++) n += e->host[i].frames;
+        return n;
+}
+
+/** @return 1 if the generator should wait for the router to catch up */
+static int emu_backlogged(struct emu* e)
+{
+        if (e->otail - e->ohead >= EMU_BACKLOG) return 1;
+        return !e->nreplay && e->generated - emu_received(e) >= EMU_WINDOW;
+}
+
+/** keep up with the target rate, EMU_BURST packets at a time at most */
+static void emu_generate(struct emu* e, double elapsed)
+{
+        uint64_t due = EMU_BURST;
+
+        if (e->rate > 0) {
+                due = (uint64_t) (elapsed * e->rate) + 1;
+                due = due > e->generated ? due - e->generated : 0;
+                if (due > EMU_BURST) due = EMU_BURST;
+        }
+        while (due-- && !emu_backlogged(e) && !emu_generate_one(e)) e->generated++;
+}
+
+/**
+ * @return the latency in microseconds that a fraction q of packets beat,
+ * EMU_HIST if that is past the histogram
+ */
+static unsigned int emu_percentile(struct emu* e, double q)
+{
+        uint64_t n = 0, want = (uint64_t) (q * e->lat_n);
+        unsigned int i;
+
+        for (i = 0; i < EMU_HIST; i++)
+                if ((n += e->hist[i]) > want) break;
+        return i;
+}
+
+/** a percentile to print: one past the histogram is only known to be at least that */
+static const char* emu_us(unsigned int us, char* buf, size_t size)
+{
+        snprintf(buf, size, us >= EMU_HIST ? ">=%u" : "%u", us);
+        return buf;
+}
+
+static void emu_result(struct emu* e, struct emu_result* r)
+{
+        int i;
+
+        memset(r, 0, sizeof(*r));
+        for (i = 0; i < e->nflows && !e->nreplay; i++) {
+                r->sent += e->flow[i].sent;
+                r->recv += e->flow[i].recv;
+                r->reordered += e->flow[i].reordered;
+        }
+        r->delivered = emu_delivered(e);
+        if (e->nreplay) {
+                r->sent = e->generated;
+                r->recv = r->delivered;
+        }
+        r->seconds = e->ran;
+        r->p99 = e->lat_n ? emu_percentile(e, 0.99) : 0;
+}
+
+static void emu_report(struct emu* e, double seconds)
+{
+        char src[16], dst[16], p50[16], p90[16], p99[16];
+        struct in_addr a;
+        struct emu_result r;
+        uint64_t sent = 0, recv = 0, reordered = 0, lost;
+        int i;
+
+        e->ran = seconds;
+        if (e->session) {
+                /* the totals are what matter with many */
+                emu_result(e, &r);
+                printf("EMU: session %d: %llu sent, %llu back, %llu lost, %llu out of order, "
+                       "forwarded %.0f pps, p99 %s us\n", e->session, (unsigned long long) r.sent,
+                       (unsigned long long) r.recv, (unsigned long long) (r.sent > r.recv ? r.sent - r.recv : 0),
+                       (unsigned long long) r.reordered, r.seconds > 0 ? r.recv / r.seconds : 0,
+                       emu_us(r.p99, p99, sizeof(p99)));
+                return;
+        }
+        if (e->generated) {
+                for (i = 0; i < e->nflows && !e->nreplay; i++) {
+                        struct emu_flow* f = &e->flow[i];
+                        sent += f->sent;
+                        recv += f->recv;
+                        reordered += f->reordered;
+                        if (e->nflows > EMU_FLOWS_SHOWN) continue;
+                        a.s_addr = e->host[f->src].ip; strcpy(src, inet_ntoa(a));
+                        a.s_addr = e->host[f->dst].ip; strcpy(dst, inet_ntoa(a));
+                        lost = f->sent > f->recv ? f->sent - f->recv : 0;
+                        printf("EMU: %s %s:%u -> %s: %llu sent, %llu back, %llu lost, %llu out of order\n",
+                               e->ping ? "ping" : "udp", src, f->port, dst, (unsigned long long) f->sent,
+                               (unsigned long long) f->recv, (unsigned long long) lost,
+                               (unsigned long long) f->reordered);
+                }
+                if (e->nflows > EMU_FLOWS_SHOWN && !e->nreplay) {
+                        printf("EMU: %d %s flows: %llu sent, %llu back, %llu lost, %llu out of order\n",
+                               e->nflows, e->ping ? "ping" : "udp", (unsigned long long) sent,
+                               (unsigned long long) recv, (unsigned long long) (sent > recv ? sent - recv : 0),
+                               (unsigned long long) reordered);
+                }
+                if (e->nreplay) {
+                        /* replies and all: no way to tell which frame came from which */
+                        sent = e->generated;
+                        recv = emu_delivered(e);
+                }
+                printf("EMU: %llu packets in %.2f s: offered %.0f pps, forwarded %.0f pps (%.1f Mbit/s)\n",
+                       (unsigned long long) sent, seconds, sent / seconds, recv / seconds,
+                       e->bytes * 8 / seconds / 1e6);
+        }
+        if (e->lat_n)
+                printf("EMU: %s us: min %.1f avg %.1f p50 %s p90 %s p99 %s max %.1f\n",
+                       e->ping ? "round trip" : "latency", e->lat_min / 1e3, e->lat_sum / e->lat_n / 1e3,
+                       emu_us(emu_percentile(e, 0.5), p50, sizeof(p50)),
+                       emu_us(emu_percentile(e, 0.9), p90, sizeof(p90)),
+                       emu_us(emu_percentile(e, 0.99), p99, sizeof(p99)), e->lat_max / 1e3);
+        printf("EMU: %lu frames from the router: %lu arp, %lu echo replies, %lu icmp errors, "
+               "%lu other, %lu for no host, %lu bad ip checksums, %lu replies dropped\n",
+               e->frames, e->arps, e->pings, e->icmp_errors, e->other, e->stray, e->badsum, e->full);
+        for (i = 0; i < e->nhosts; i++) {
+                a.s_addr = e->host[i].ip;
+                printf("EMU: host %-15s on %s: %lu frames, answered %lu arp requests and %lu pings\n",
+                       inet_ntoa(a), e->iface[e->host[i].iface].name, e->host[i].frames,
+                       e->host[i].arps, e->host[i].pings);
+        }
+}
+
+/** frames from the router and traffic to it until the run is over or the router hangs up */
+static int emu_serve(struct emu* e)
+{
+        struct pollfd pfd;
+        uint64_t start, now;
+        double elapsed, next_report = 1;
+        uint8_t* cmd;
+        c_packet_header* ph;
+        char name[EMU_NAMELEN + 1];
+        int i, n, len, timeout, ret = 0;
+
+        fcntl(e->sock, F_SETFL, fcntl(e->sock, F_GETFL) | O_NONBLOCK);
+        start = emu_ns() + (uint64_t) (EMU_SETTLE * 1e9);
+        pfd.fd = e->sock;
+
+        while (!emu_stop) {
+                now = emu_ns();
+                elapsed = ((double) now - (double) start) / 1e9;
+                timeout = 1000;
+                if (e->seconds > 0 && elapsed < 0) {
+                        timeout = (int) (-elapsed * 1000) + 1;
+                }
+                else if (e->seconds > 0 && elapsed < e->seconds) {
+                        emu_generate(e, elapsed);
+                        if (elapsed >= next_report) {
+                                if (!e->session)
+                                        printf("EMU: %.0f s: %llu sent, %lu frames for the hosts\n", next_report,
+                                               (unsigned long long) e->generated, emu_delivered(e));
+                                next_report += 1;
+                        }
+                        timeout = 0;
+                        if (emu_backlogged(e))
+                                timeout = 10; /* the router wakes us before then */
+                        else if (e->rate > 0)
+                                timeout = (int) ((e->generated / e->rate - elapsed) * 1000);
+                        if (timeout < 0) timeout = 0;
+                }
+                else if (e->seconds > 0) {
+                        if (elapsed >= e->seconds + EMU_DRAIN) break;
+                        if (!e->nreplay && emu_received(e) >= e->generated) break;
+                        timeout = 10;
+                }
+                if (emu_write(e)) {
+                        ret = -1;
+                        break;
+                }
+
+                pfd.events = POLLIN | (e->ohead < e->otail ? POLLOUT : 0);
+                if (poll(&pfd, 1, timeout) < 0) {
+                        if (errno == EINTR) continue;
+                        perror("poll(..):sr_vns_emu.c::emu_serve");
+                        ret = -1;
+                        break;
+                }
+                if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+                n = sr_rx_fill(&e->rx, e->sock);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                        if (n < 0) perror("recv(..):sr_vns_emu.c::emu_serve");
+                        fprintf(stderr, "EMU: the router hung up\n");
+                        if (e->seconds > 0) ret = -1;
+                        break;
+                }
+                while ((cmd = sr_rx_next(&e->rx, &len))) {
+                        if (((c_base*) cmd)->mType == VNSCLOSE) {
+                                fprintf(stderr, "EMU: the router closed the session\n");
+                                emu_stop = 1;
+                                break;
+                        }
+                        if (((c_base*) cmd)->mType != VNSPACKET || len < (int) sizeof(*ph)) continue;
+                        ph = (c_packet_header*) cmd;
+                        memcpy(name, ph->mInterfaceName, EMU_NAMELEN);
+                        name[EMU_NAMELEN] = 0;
+                        i = emu_iface_by_name(e, name);
+                        emu_frame(e, i, cmd + sizeof(*ph), len - sizeof(*ph));
+                }
+                if (len < 0) {
+                        ret = -1;
+                        break;
+                }
+        }
+        now = emu_ns();
+        elapsed = ((double) now - (double) start) / 1e9;
+        emu_report(e, e->seconds > 0 && elapsed > e->seconds ? e->seconds : elapsed);
+        return ret;
+}
+
+/*---------------------------------------------------------------------------*/
+
+/**
+ * -n: a session per connection, each in a process of its own, then the
+ * totals. delivered gets the frames the hosts had between them
+ * @return 0 or -1 if a session failed or packets were lost
+ */
+static int emu_sessions(struct emu* e, int lfd, int sessions, unsigned long* delivered)
+{
+        struct emu_result r, all;
+        pid_t kid[EMU_SESSIONS];
+        char p99[16];
+        double pps = 0;
+        int fds[2], i, n = 0, status, ret = 0, one = 1;
+
+        if (pipe(fds)) {
+                perror("pipe(..):sr_vns_emu.c::emu_sessions");
+                return -1;
+        }
+        for (i = 0; i < sessions && !emu_stop; i++) {
+                if ((e->sock = accept(lfd, 0, 0)) < 0) {
+                        perror("accept(..):sr_vns_emu.c::emu_sessions");
+                        ret = -1;
+                        break;
+                }
+                setsockopt(e->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                if ((kid[n] = fork()) < 0) {
+                        perror("fork(..):sr_vns_emu.c::emu_sessions");
+                        close(e->sock);
+                        ret = -1;
+                        break;
+                }
+                if (!kid[n]) {
+                        close(lfd);
+                        close(fds[0]);
+                        e->session = i + 1;
+                        status = emu_login(e) || emu_open(e) || emu_serve(e);
+                        emu_result(e, &r);
+                        r.ret = status;
+                        if (write(fds[1], &r, sizeof(r)) != sizeof(r)) status = 1;
+                        fflush(stdout);
+                        _exit(status ? 1 : 0);
+                }
+                n++;
+                close(e->sock);
+        }
+        close(fds[1]);
+
+        memset(&all, 0, sizeof(all));
+        for (i = 0; i < n; i++) {
+                /* an end of file: a session died without a word */
+                if (read(fds[0], &r, sizeof(r)) != sizeof(r)) {
+                        ret = -1;
+                        break;
+                }
+                all.sent += r.sent;
+                all.recv += r.recv;
+                all.reordered += r.reordered;
+                all.delivered += r.delivered;
+                if (r.p99 > all.p99) all.p99 = r.p99;
+                if (r.seconds > 0) pps += r.recv / r.seconds;
+                if (r.ret) ret = -1;
+        }
+        close(fds[0]);
+        for (i = 0; i < n; i++) {
+                if (waitpid(kid[i], &status, 0) != kid[i] || !WIFEXITED(status) || WEXITSTATUS(status)) ret = -1;
+        }
+        printf("EMU: %d sessions: %llu sent, %llu back, %llu lost, %llu out of order\n", n,
+               (unsigned long long) all.sent, (unsigned long long) all.recv,
+               (unsigned long long) (all.sent > all.recv ? all.sent - all.recv : 0),
+               (unsigned long long) all.reordered);
+        printf("EMU: %d sessions forwarded %.0f pps in all, worst p99 %s us\n", n, pps,
+               emu_us(all.p99, p99, sizeof(p99)));
+        *delivered = all.delivered;
+        if (!e->nreplay && all.recv < all.sent) ret = -1;
+        return ret;
+}
+
+static int emu_listen(unsigned int port)
+{
+        struct sockaddr_in addr;
+        int fd, one = 1;
+
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+                perror("socket(..):sr_vns_emu.c::emu_listen");
+                return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) || listen(fd, EMU_SESSIONS)) {
+                perror("bind(..):sr_vns_emu.c::emu_listen");
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+/** start the router under test with its output going to log */
+static pid_t emu_spawn(char** argv, const char* log)
+{
+        pid_t pid;
+        int fd;
+
+        if ((pid = fork()) < 0) {
+                perror("fork(..):sr_vns_emu.c::emu_spawn");
+                return -1;
+        }
+        if (pid) return pid;
+        if (log) {
+                if ((fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+                        perror("open(..):sr_vns_emu.c::emu_spawn");
+                        _exit(127);
+                }
+                dup2(fd, 1);
+                dup2(fd, 2);
+                close(fd);
+        }
+        execvp(argv[0], argv);
+        perror("execvp(..):sr_vns_emu.c::emu_spawn");
+        _exit(127);
+}
+
+/** give the router a moment to notice we hung up and leave: ru gets the cpu it used */
+static int emu_reap(pid_t pid, struct rusage* ru)
+{
+        int i, status = 0;
+
+        for (i = 0; i < 20; i++) {
+                if (wait4(pid, &status, WNOHANG, ru) == pid) return status;
+                usleep(100000);
+        }
+        kill(pid, SIGTERM);
+        wait4(pid, &status, 0, ru);
+        return status;
+}
+
+static void emu_usage(const char* argv0)
+{
+        printf("usage: %s [-p port] [-t topology] [-w rtable] [-k auth_key]\n", argv0);
+        printf("       [-f src,dst[,ports]]... [-R pps] [-d seconds] [-z bytes] [-P]\n");
+        printf("       [-x pcap file] [-n sessions] [-o log] [command ...]\n");
+}
+
+int main(int argc, char** argv)
+{
+        struct emu* e = &emu;
+        const char *topology = 0, *rtable = 0, *pcap = 0, *log = 0;
+        char* flows[EMU_FLOWS];
+        unsigned int port = EMU_PORT;
+        int c, i, lfd, nflows = 0, sessions = 0, ret;
+        unsigned long delivered = 0;
+        pid_t pid = 0;
+        struct rusage ru;
+        double cpu;
+
+        e->rate = 10000;
+        e->size = 64;
+        while ((c = getopt(argc, argv, "+hp:t:w:k:f:R:d:z:Px:n:o:")) != EOF) {
+                switch (c) {
+                case 'p': port = atoi(optarg); break;
+                case 't': topology = optarg; break;
+                case 'w': rtable = optarg; break;
+                case 'k': e->auth_key_fn = optarg; break;
+                case 'f':
+                        if (nflows == EMU_FLOWS) {
+                                fprintf(stderr, "EMU: at most %d flows\n", EMU_FLOWS);
+                                return 1;
+                        }
+                        flows[nflows++] = optarg;
+                        break;
+                case 'R': e->rate = atof(optarg); break;
+                case 'd': e->seconds = atof(optarg); break;
+                case 'z': e->size = atoi(optarg); break;
+                case 'P': e->ping = 1; break;
+                case 'x': pcap = optarg; break;
+                case 'n': sessions = atoi(optarg); break;
+                case 'o': log = optarg; break;
+                default:
+                        emu_usage(argv[0]);
+                        return c == 'h' ? 0 : 1;
+                }
+        }
+        if (sessions < 0 || sessions > EMU_SESSIONS) {
+                fprintf(stderr, "EMU: at most %d sessions\n", EMU_SESSIONS);
+                return 1;
+        }
+        if (e->size < (int) sizeof(struct emu_stamp)) e->size = sizeof(struct emu_stamp);
+        if (e->size > EMU_MAXFRAME - 42) e->size = EMU_MAXFRAME - 42;
+
+        if (topology) {
+                if (emu_load_topology(e, topology)) return 1;
+        }
+        else emu_default_topology(e);
+        if (!e->nifaces || !e->nhosts) {
+                fprintf(stderr, "EMU: the topology needs interfaces and hosts\n");
+                return 1;
+        }
+        for (i = 0; i < nflows; i++) {
+                if (emu_add_flow(e, flows[i])) {
+                        fprintf(stderr, "EMU: bad flow %s: give two host addresses as src,dst "
+                                "and a number of ports, %d flows in all\n", flows[i], EMU_FLOWS);
+                        return 1;
+                }
+        }
+        if (!e->nflows) {
+                e->flow[0].src = 0;
+                e->flow[0].dst = e->nhosts - 1;
+                e->flow[0].port = EMU_UDP_PORT;
+                e->nflows = 1;
+        }
+        if (pcap && emu_load_pcap(e, pcap)) return 1;
+        if (rtable && emu_write_rtable(e, rtable)) return 1;
+
+        signal(SIGINT, emu_sigint);
+        signal(SIGPIPE, SIG_IGN);
+        srandom(time(0) ^ getpid());
+        sr_rx_init(&e->rx);
+        if ((lfd = emu_listen(port)) < 0) return 1;
+        printf("EMU: %d interfaces, %d hosts, %d routes: listening on port %u\n",
+               e->nifaces, e->nhosts, e->nroutes, port);
+        if (optind < argc && (pid = emu_spawn(argv + optind, log)) < 0) return 1;
+
+        if (sessions) {
+                ret = emu_sessions(e, lfd, sessions, &delivered);
+                close(lfd);
+        } else {
+                if ((e->sock = accept(lfd, 0, 0)) < 0) {
+                        perror("accept(..):sr_vns_emu.c::main");
+                        return 1;
+                }
+                close(lfd);
+                c = 1;
+                setsockopt(e->sock, IPPROTO_TCP, TCP_NODELAY, &c, sizeof(c));
+
+                ret = emu_login(e) || emu_open(e) || emu_serve(e);
+                close(e->sock);
+                delivered = emu_delivered(e);
+        }
+        if (pid > 0) {
+                c = emu_reap(pid, &ru);
+                cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+                printf("EMU: %s exited with status %d, %.3f s of cpu", argv[optind],
+                       WIFEXITED(c) ? WEXITSTATUS(c) : -1, cpu);
+                /* at a rate sr keeps up with this is what tells two builds apart */
+                if (delivered) printf(", %.3f us per frame delivered", cpu * 1e6 / delivered);
+                printf("\n");
+        }
+        /* stamped packets that never came back fail the run */
+        if (!ret && e->generated && !e->nreplay && emu_received(e) < e->generated) ret = 1;
+        return ret ? 1 : 0;
+}
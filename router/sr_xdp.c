@@ -0,0 +1,527 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * AF_XDP backend with a shared UMEM: see sr_xdp.h
+ */
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include "sr_router.h"
+#include "sr_io.h"
+#include "sr_xdp.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define SR_XDP_MASK (SR_XDP_RING - 1)
+#define SR_XDP_UMEM ((size_t) SR_XDP_FRAMES * SR_XDP_FRAME)
+
+/* -- rings: we produce on fill and tx and consume from rx and completion -- */
+
+static inline uint32_t sr_xdp_room(struct sr_xdp_ring* r)
+{
+        return SR_XDP_RING - (r->cached - __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE));
+}
+
+static inline uint32_t sr_xdp_ready(struct sr_xdp_ring* r)
+{
+        return __atomic_load_n(r->producer, __ATOMIC_ACQUIRE) - r->cached;
+}
+
+static inline void sr_xdp_produced(struct sr_xdp_ring* r)
+{
+        __atomic_store_n(r->producer, r->cached, __ATOMIC_RELEASE);
+}
+
+static inline void sr_xdp_consumed(struct sr_xdp_ring* r)
+{
+        __atomic_store_n(r->consumer, r->cached, __ATOMIC_RELEASE);
+}
+
+/** @return the umem frame p points into or -1 if it isn't in the umem */
+static inline int sr_xdp_frame(struct sr_xdp* x, const uint8_t* p)
+{
+        if (!x->umem || p < x->umem || p >= x->umem + SR_XDP_UMEM) return -1;
+        return (p - x->umem) / SR_XDP_FRAME;
+}
+
+static inline void sr_xdp_put(struct sr_xdp* x, uint32_t f)
+{
+        x->owner[f] = SR_XDP_FREE;
+        x->free[x->nfree++] = f;
+}
+
+static struct sr_xdp_if* sr_xdp_find(struct sr_instance* sr, const char* name)
+{
+        int i;
+
+        for (i = 0; i < sr->xdp->nifs; i++) {
+                if (strcmp(sr->xdp->ifs[i].name, name) == 0) return &sr->xdp->ifs[i];
+        }
+        return 0;
+}
+
+/** give each interface's fill ring free frames to receive into */
+static void sr_xdp_refill(struct sr_xdp* x)
+{
+        struct sr_xdp_if* xi;
+        uint32_t n, f;
+        int i;
+
+        for (i = 0; i < x->nifs; i++) {
+                xi = &x->ifs[i];
+                n = SR_XDP_FILL - xi->filled;
+                if (n > sr_xdp_room(&xi->fill)) n = sr_xdp_room(&xi->fill);
+                if (n > x->nfree) n = x->nfree;
+                if (!n) continue;
+                xi->filled += n;
+                while (n--) {
+                        f = x->free[--x->nfree];
+                        x->owner[f] = SR_XDP_FILLED;
+                        ((uint64_t*) xi->fill.desc)[xi->fill.cached++ & SR_XDP_MASK] = (uint64_t) f * SR_XDP_FRAME;
+                }
+                sr_xdp_produced(&xi->fill);
+        }
+}
+
+/** take back frames the kernel has finished sending */
+static void sr_xdp_reap(struct sr_xdp* x)
+{
+        struct sr_xdp_if* xi;
+        uint32_t n;
+        int i;
+
+        for (i = 0; i < x->nifs; i++) {
+                xi = &x->ifs[i];
+                if (!(n = sr_xdp_ready(&xi->comp))) continue;
+                while (n--) {
+                        sr_xdp_put(x, ((uint64_t*) xi->comp.desc)[xi->comp.cached++ & SR_XDP_MASK] / SR_XDP_FRAME);
+                }
+                sr_xdp_consumed(&xi->comp);
+        }
+}
+
+/* -- the xdp program: raw bpf syscalls so we need nothing beyond the kernel headers -- */
+
+static int sr_xdp_bpf(int cmd, union bpf_attr* attr)
+{
+        return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * load the program that sends queue 0 of xi to its socket and attach it,
+ * in driver mode if possible. in C it would be:
+ *
+ *   return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ */
+static int sr_xdp_program(struct sr_xdp_if* xi)
+{
+        static char log[4096];
+        struct bpf_insn prog[] = {
+                /* r2 = ctx->rx_queue_index */
+                { BPF_LDX | BPF_MEM | BPF_W, 2, 1, offsetof(struct xdp_md, rx_queue_index), 0 },
+                /* r1 = the xskmap: a 64 bit immediate takes two instructions */
+                { BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, 0 },
+                { 0, 0, 0, 0, 0 },
+                /* r3 = what happens to queues without a socket */
+                { BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS },
+                { BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+                { BPF_JMP | BPF_EXIT, 0, 0, 0, 0 },
+        };
+        union bpf_attr attr;
+        int key = 0;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.map_type = BPF_MAP_TYPE_XSKMAP;
+        attr.key_size = sizeof(int);
+        attr.value_size = sizeof(int);
+        attr.max_entries = 1;
+        if ((xi->map_fd = sr_xdp_bpf(BPF_MAP_CREATE, &attr)) == -1) {
+                perror("bpf(BPF_MAP_CREATE):sr_xdp.c::sr_xdp_program");
+                return -1;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.map_fd = xi->map_fd;
+        attr.key = (uintptr_t) &key;
+        attr.value = (uintptr_t) &xi->fd;
+        if (sr_xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1) {
+                perror("bpf(BPF_MAP_UPDATE_ELEM):sr_xdp.c::sr_xdp_program");
+                return -1;
+        }
+
+        prog[1].imm = xi->map_fd;
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = (uintptr_t) prog;
+        attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+        attr.license = (uintptr_t) "GPL";
+        attr.log_buf = (uintptr_t) log;
+        attr.log_size = sizeof(log);
+        attr.log_level = 1;
+        if ((xi->prog_fd = sr_xdp_bpf(BPF_PROG_LOAD, &attr)) == -1) {
+                perror("bpf(BPF_PROG_LOAD):sr_xdp.c::sr_xdp_program");
+                fprintf(stderr, "%s\n", log);
+                return -1;
+        }
+
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = xi->prog_fd;
+        attr.link_create.target_ifindex = xi->ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+        xi->native = 1;
+        if ((xi->link_fd = sr_xdp_bpf(BPF_LINK_CREATE, &attr)) == -1) {
+                attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+                xi->native = 0;
+                if ((xi->link_fd = sr_xdp_bpf(BPF_LINK_CREATE, &attr)) == -1) {
+                        perror("bpf(BPF_LINK_CREATE):sr_xdp.c::sr_xdp_program");
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/* -- sockets -- */
+
+static int sr_xdp_map_ring(int fd, struct sr_xdp_ring* r, struct xdp_ring_offset* off,
+        size_t descsize, off_t pgoff)
+{
+        r->maplen = off->desc + SR_XDP_RING * descsize;
+        r->map = mmap(0, r->maplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+        if (r->map == MAP_FAILED) {
+                perror("mmap(..):sr_xdp.c::sr_xdp_map_ring");
+                r->map = 0;
+                return -1;
+        }
+        r->producer = (uint32_t*)((uint8_t*) r->map + off->producer);
+        r->consumer = (uint32_t*)((uint8_t*) r->map + off->consumer);
+        r->desc = (uint8_t*) r->map + off->desc;
+        return 0;
+}
+
+/**
+ * open xi's socket and its rings: the first interface registers the umem
+ * and the rest share it
+ */
+static int sr_xdp_socket(struct sr_instance* sr, struct sr_xdp_if* xi)
+{
+        struct sr_xdp* x = sr->xdp;
+        struct xdp_umem_reg reg;
+        struct xdp_mmap_offsets off;
+        struct sockaddr_xdp sxdp;
+        socklen_t optlen = sizeof(off);
+        int n = SR_XDP_RING, first = xi == &x->ifs[0];
+
+        if ((xi->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0)) == -1) {
+                perror("socket(AF_XDP):sr_xdp.c::sr_xdp_socket");
+                return -1;
+        }
+        if (first) {
+                memset(&reg, 0, sizeof(reg));
+                reg.addr = (uintptr_t) x->umem;
+                reg.len = SR_XDP_UMEM;
+                reg.chunk_size = SR_XDP_FRAME;
+                if (setsockopt(xi->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) == -1) {
+                        perror("setsockopt(XDP_UMEM_REG):sr_xdp.c::sr_xdp_socket");
+                        return -1;
+                }
+        }
+        /* sockets sharing a umem across devices each need their own fill and completion rings */
+        if (setsockopt(xi->fd, SOL_XDP, XDP_UMEM_FILL_RING, &n, sizeof(n)) == -1 ||
+            setsockopt(xi->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &n, sizeof(n)) == -1 ||
+            setsockopt(xi->fd, SOL_XDP, XDP_RX_RING, &n, sizeof(n)) == -1 ||
+            setsockopt(xi->fd, SOL_XDP, XDP_TX_RING, &n, sizeof(n)) == -1) {
+                perror("setsockopt(XDP_*_RING):sr_xdp.c::sr_xdp_socket");
+                return -1;
+        }
+        if (getsockopt(xi->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1) {
+                perror("getsockopt(XDP_MMAP_OFFSETS):sr_xdp.c::sr_xdp_socket");
+                return -1;
+        }
+        if (sr_xdp_map_ring(xi->fd, &xi->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) == -1 ||
+            sr_xdp_map_ring(xi->fd, &xi->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) == -1 ||
+            sr_xdp_map_ring(xi->fd, &xi->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) == -1 ||
+            sr_xdp_map_ring(xi->fd, &xi->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) == -1)
+                return -1;
+        xi->rx.cached = *xi->rx.consumer;
+        xi->comp.cached = *xi->comp.consumer;
+        xi->tx.cached = *xi->tx.producer;
+        xi->fill.cached = *xi->fill.producer;
+
+        memset(&sxdp, 0, sizeof(sxdp));
+        sxdp.sxdp_family = AF_XDP;
+        sxdp.sxdp_ifindex = xi->ifindex;
+        sxdp.sxdp_queue_id = 0;
+        if (!first) {
+                sxdp.sxdp_flags = XDP_SHARED_UMEM;
+                sxdp.sxdp_shared_umem_fd = x->ifs[0].fd;
+        } else {
+                sxdp.sxdp_flags = XDP_ZEROCOPY;
+                if (bind(xi->fd, (struct sockaddr*) &sxdp, sizeof(sxdp)) == 0) return 0;
+                /* the driver can't do zero copy (veth can't): the kernel copies for us */
+                sxdp.sxdp_flags = XDP_COPY;
+        }
+        if (bind(xi->fd, (struct sockaddr*) &sxdp, sizeof(sxdp)) == -1) {
+                perror("bind(..):sr_xdp.c::sr_xdp_socket");
+                return -1;
+        }
+        return 0;
+}
+
+/** sr_io_discover found an interface: open a socket on it and redirect its traffic there */
+static int sr_xdp_found(struct sr_instance* sr, const char* name, int ifindex)
+{
+        struct sr_xdp_if* xi = &sr->xdp->ifs[sr->xdp->nifs++];
+
+        strncpy(xi->name, name, sr_IFACE_NAMELEN - 1);
+        xi->ifindex = ifindex;
+        xi->fd = xi->map_fd = xi->prog_fd = xi->link_fd = -1;
+        if (sr_xdp_socket(sr, xi) == -1) return -1;
+        /* frames to receive into have to be there before traffic is redirected */
+        sr_xdp_refill(sr->xdp);
+        return sr_xdp_program(xi);
+}
+
+static int sr_xdp_open(struct sr_instance* sr, const char* ifnames)
+{
+        struct sr_xdp* x;
+        int f;
+
+        assert(sr);
+        if (!sr->xdp && !(sr->xdp = calloc(1, sizeof(*sr->xdp)))) {
+                perror("calloc(..):sr_xdp.c::sr_xdp_open");
+                return -1;
+        }
+        x = sr->xdp;
+        x->umem = mmap(0, SR_XDP_UMEM, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (x->umem == MAP_FAILED) {
+                perror("mmap(..):sr_xdp.c::sr_xdp_open");
+                x->umem = 0;
+                return -1;
+        }
+        x->nfree = 0;
+        for (f = SR_XDP_FRAMES - 1; f >= 0; f--) sr_xdp_put(x, f);
+
+        return sr_io_discover(sr, ifnames, SR_XDP_MAXIF, sr_xdp_found) == -1 ? -1 : 0;
+}
+
+/** event loop callback: handle a batch of received frames where they are */
+static void sr_xdp_event(struct sr_instance* sr, int fd, uint32_t events, void* arg)
+{
+        struct sr_xdp_if* xi = arg;
+        struct sr_xdp* x = sr->xdp;
+        struct xdp_desc* d;
+        uint32_t n, f;
+
+        sr_timer_clock(&sr_fwd(sr)->timers);
+        if (!(n = sr_xdp_ready(&xi->rx))) return;
+        if (n > SR_XDP_BATCH) n = SR_XDP_BATCH;
+        xi->rx_batches++;
+        xi->filled -= n;
+        while (n--) {
+                d = &((struct xdp_desc*) xi->rx.desc)[xi->rx.cached++ & SR_XDP_MASK];
+                f = d->addr / SR_XDP_FRAME;
+                x->owner[f] = SR_XDP_ROUTER;
+                if (d->len >= sizeof(struct sr_ethernet_hdr)) {
+                        xi->rx_frames++;
+                        sr_log_packet(sr, x->umem + d->addr, d->len);
+                        sr_handlepacket(sr, x->umem + d->addr, d->len, xi->name);
+                }
+                /* not sent and not buffered */
+                if (x->owner[f] == SR_XDP_ROUTER) sr_xdp_put(x, f);
+        }
+        sr_xdp_consumed(&xi->rx);
+        sr_xdp_refill(x);
+}
+
+/**
+ * tell the kernel about new tx descriptors: in copy mode each sendto only
+ * sends a few dozen of them so keep going until the ring is empty
+ */
+static void sr_xdp_kick(struct sr_xdp_if* xi)
+{
+        int tries = SR_XDP_RING;
+
+        sr_xdp_produced(&xi->tx);
+        xi->tx_ready = 0;
+        while (__atomic_load_n(xi->tx.consumer, __ATOMIC_ACQUIRE) != xi->tx.cached && tries--) {
+                xi->tx_kicks++;
+                if (sendto(xi->fd, 0, 0, MSG_DONTWAIT, 0, 0) == -1 &&
+                    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS && errno != EINTR) {
+                        perror("sendto(..):sr_xdp.c::sr_xdp_kick");
+                        return;
+                }
+        }
+}
+
+/**
+ * post a frame to iface's tx ring: frames already in the umem go as they
+ * are, anything else is copied into a free frame
+ */
+static int sr_xdp_send(struct sr_instance* sr, uint8_t* frame, unsigned int len, const char* iface)
+{
+        struct sr_xdp* x = sr->xdp;
+        struct sr_xdp_if* xi = sr_xdp_find(sr, iface);
+        struct xdp_desc* d;
+        uint64_t addr;
+        int f;
+
+        if (!xi) {
+                fprintf(stderr, "XDP: no socket for interface %s\n", iface);
+                return -1;
+        }
+        if (len > SR_XDP_FRAME) {
+                fprintf(stderr, "XDP: frame is too long (%u bytes)\n", len);
+                return -1;
+        }
+        if (!sr_xdp_room(&xi->tx)) sr_xdp_kick(xi);
+        if (!sr_xdp_room(&xi->tx)) {
+                xi->tx_dropped++;
+                return 0;
+        }
+
+        f = sr_xdp_frame(x, frame);
+        if (f != -1 && (x->owner[f] == SR_XDP_ROUTER || x->owner[f] == SR_XDP_HELD) &&
+            (frame - x->umem) % SR_XDP_FRAME + len <= SR_XDP_FRAME) {
+                addr = frame - x->umem;
+        } else {
+                if (!x->nfree) sr_xdp_reap(x);
+                if (!x->nfree) {
+                        xi->tx_dropped++;
+                        return 0;
+                }
+                f = x->free[--x->nfree];
+                addr = (uint64_t) f * SR_XDP_FRAME;
+                memcpy(x->umem + addr, frame, len);
+                xi->tx_copied++;
+        }
+        x->owner[f] = SR_XDP_TX;
+
+        d = &((struct xdp_desc*) xi->tx.desc)[xi->tx.cached++ & SR_XDP_MASK];
+        d->addr = addr;
+        d->len = len;
+        d->options = 0;
+        xi->tx_ready++;
+        xi->tx_frames++;
+        return 0;
+}
+
+static int sr_xdp_flush(struct sr_instance* sr)
+{
+        struct sr_xdp* x = sr->xdp;
+        int i;
+
+        for (i = 0; i < x->nifs; i++) {
+                if (x->ifs[i].tx_ready) sr_xdp_kick(&x->ifs[i]);
+        }
+        sr_xdp_reap(x);
+        sr_xdp_refill(x);
+        return 0;
+}
+
+/** sr_buffer wants to keep a frame until arp is answered: frames in the umem can stay put */
+static int sr_xdp_hold(struct sr_instance* sr, uint8_t* frame)
+{
+        int f = sr_xdp_frame(sr->xdp, frame);
+
+        if (f == -1 || sr->xdp->owner[f] != SR_XDP_ROUTER) return 0;
+        sr->xdp->owner[f] = SR_XDP_HELD;
+        sr->xdp->held++;
+        return 1;
+}
+
+/** sr_buffer is done with a frame: if it was sent it is the tx ring's now */
+static void sr_xdp_release(struct sr_instance* sr, uint8_t* frame)
+{
+        int f = sr_xdp_frame(sr->xdp, frame);
+
+        if (f != -1 && sr->xdp->owner[f] == SR_XDP_HELD) sr_xdp_put(sr->xdp, f);
+}
+
+static int sr_xdp_start(struct sr_instance* sr)
+{
+        int i;
+
+        for (i = 0; i < sr->xdp->nifs; i++) {
+                if (sr_event_add(sr, sr->xdp->ifs[i].fd, EPOLLIN, sr_xdp_event, &sr->xdp->ifs[i]) == -1)
+                        return -1;
+        }
+        printf("XDP: Sending arp broadcasts on each interface\n");
+        sr_arp_scan(sr);
+        return sr_xdp_flush(sr);
+}
+
+static void sr_xdp_unmap(struct sr_xdp_ring* r)
+{
+        if (r->map) munmap(r->map, r->maplen);
+        r->map = 0;
+}
+
+static void sr_xdp_close(struct sr_instance* sr)
+{
+        struct sr_xdp_if* xi;
+        int i;
+
+        if (!sr->xdp) return;
+        for (i = 0; i < sr->xdp->nifs; i++) {
+                xi = &sr->xdp->ifs[i];
+                /* closing the link detaches the program */
+                if (xi->link_fd != -1) close(xi->link_fd);
+                if (xi->prog_fd != -1) close(xi->prog_fd);
+                if (xi->map_fd != -1) close(xi->map_fd);
+                sr_xdp_unmap(&xi->rx);
+                sr_xdp_unmap(&xi->tx);
+                sr_xdp_unmap(&xi->fill);
+                sr_xdp_unmap(&xi->comp);
+                if (xi->fd != -1) close(xi->fd);
+                xi->fd = xi->map_fd = xi->prog_fd = xi->link_fd = -1;
+        }
+        if (sr->xdp->umem) munmap(sr->xdp->umem, SR_XDP_UMEM);
+        free(sr->xdp);
+        sr->xdp = 0;
+}
+
+static void sr_xdp_print_stats(struct sr_instance* sr)
+{
+        struct sr_xdp_if* xi;
+        int i;
+
+        if (!sr->xdp) return;
+        for (i = 0; i < sr->xdp->nifs; i++) {
+                xi = &sr->xdp->ifs[i];
+                printf("XDP: %s (%s mode) rx %lu frames in %lu batches (%.1f per batch); "
+                        "tx %lu frames (%lu copied) in %lu kicks, %lu dropped\n",
+                        xi->name, xi->native ? "driver" : "generic",
+                        xi->rx_frames, xi->rx_batches,
+                        xi->rx_batches ? (double) xi->rx_frames / xi->rx_batches : 0.0,
+                        xi->tx_frames, xi->tx_copied, xi->tx_kicks, xi->tx_dropped);
+        }
+        printf("XDP: %d of %d umem frames free, %lu held for arp\n",
+                sr->xdp->nfree, SR_XDP_FRAMES, sr->xdp->held);
+}
+
+const struct sr_io sr_xdp_io = {
+        "xdp",
+        sr_xdp_open,
+        sr_xdp_start,
+        sr_xdp_send,
+        sr_xdp_flush,
+        sr_xdp_close,
+        sr_xdp_print_stats,
+        sr_xdp_hold,
+        sr_xdp_release
+};
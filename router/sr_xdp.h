@@ -0,0 +1,97 @@
+/**
+ * @author Cal Woodruff <cwoodruf@sfu.ca>
+ *
+ * AF_XDP backend (see sr_io.h)
+ *
+ * every packet the router handles lives in one UMEM: SR_XDP_FRAMES fixed
+ * size frames registered with the kernel and shared by an AF_XDP socket
+ * on each interface (XDP_SHARED_UMEM). a tiny XDP program on each
+ * interface, written out by hand in sr_xdp.c so there is no libbpf to
+ * depend on, redirects queue 0 to that interface's socket.
+ *
+ * since every socket can see every frame nothing needs copying on the
+ * way through: a frame received on eth0 is rewritten in place by
+ * sr_ip_passthru and sr_router_send and its address is posted to eth1's
+ * transmit ring. packets waiting on arp keep their frame too (see the
+ * hold and release hooks in sr_io.h) instead of being copied into
+ * sr_buffer. only frames built somewhere else, like arp requests or icmp
+ * errors made in the spill frame, are copied into a free frame to be sent.
+ *
+ * the backend tracks who owns each frame:
+ *
+ *   free     on the free stack
+ *   fill     on an interface's fill ring waiting for a packet
+ *   router   being handled by sr_handlepacket
+ *   held     kept by sr_buffer until arp is answered
+ *   tx       on a transmit ring until it shows up on a completion ring
+ *
+ * the program is attached in native (driver) mode if the driver has it
+ * (veth does on recent kernels) and generic (skb) mode otherwise. sockets
+ * bind zero copy when the driver allows and fall back to the kernel
+ * copying into the umem, so "never copied" is from the router's point of
+ * view on drivers like veth. only queue 0 is redirected so a nic with more queues should be
+ * set to one (ethtool -L <if> combined 1).
+ */
+#ifndef SR_XDP_H
+#define SR_XDP_H
+
+#include <stdint.h>
+#include <linux/if_xdp.h>
+#include "sr_if.h"
+
+#define SR_XDP_MAXIF 4
+/** frames in the umem and the size of each */
+#define SR_XDP_FRAMES 8192
+#define SR_XDP_FRAME 2048
+/** entries in each ring: a power of 2 */
+#define SR_XDP_RING 2048
+/** most frames an interface has on its fill ring at once */
+#define SR_XDP_FILL 1024
+/** rx descriptors handled per wakeup */
+#define SR_XDP_BATCH 256
+
+enum sr_xdp_owner { SR_XDP_FREE, SR_XDP_FILLED, SR_XDP_ROUTER, SR_XDP_HELD, SR_XDP_TX };
+
+/** one side of a ring shared with the kernel */
+struct sr_xdp_ring
+{
+        uint32_t* producer;
+        uint32_t* consumer;
+        void* desc;             /** struct xdp_desc for rx and tx, uint64_t addresses otherwise */
+        void* map;
+        size_t maplen;
+        uint32_t cached;        /** our copy of the index we move */
+};
+
+struct sr_xdp_if
+{
+        char name[sr_IFACE_NAMELEN];
+        int ifindex;
+        int fd;
+        int map_fd;             /** xskmap with our socket as queue 0 */
+        int prog_fd;
+        int link_fd;            /** attaches prog_fd: closing it detaches the program */
+        int native;             /** 1 if attached in driver mode */
+        struct sr_xdp_ring rx, tx, fill, comp;
+        unsigned int filled;    /** frames on the fill ring */
+        unsigned int tx_ready;  /** posted since the last kick */
+        unsigned long rx_frames;
+        unsigned long rx_batches;
+        unsigned long tx_frames;
+        unsigned long tx_copied;        /** frames that were not in the umem already */
+        unsigned long tx_kicks;
+        unsigned long tx_dropped;       /** tx ring or free frames ran out */
+};
+
+struct sr_xdp
+{
+        uint8_t* umem;
+        uint8_t owner[SR_XDP_FRAMES];   /** enum sr_xdp_owner */
+        uint32_t free[SR_XDP_FRAMES];   /** stack of free frame numbers */
+        int nfree;
+        unsigned long held;             /** frames kept by sr_buffer over the run */
+        struct sr_xdp_if ifs[SR_XDP_MAXIF];
+        int nifs;
+};
+
+#endif